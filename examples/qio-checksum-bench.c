@@ -0,0 +1,114 @@
+/* Microbenchmark for the fused byte reversal and checksum */
+
+/* Compares byte reversing a whole buffer and then checksumming it
+   (two passes over memory) with the single pass
+   DML_checksum_byterevn_block, in both directions, for several
+   per-site datum sizes.  The buffer should be much larger than the
+   last level cache to see the memory bandwidth saved.
+
+   Usage ...
+
+   qio-checksum-bench [buffer_megabytes [repetitions]]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <qio.h>
+
+#define NSIZES 5
+
+static double elapsed(clock_t start){
+  return (double)(clock() - start)/(double)CLOCKS_PER_SEC;
+}
+
+/* The two pass version the fused kernel replaces */
+static void two_pass(DML_Checksum *checksum, char *buf, size_t nsites,
+		     size_t size, int word_size, int direction){
+  if(direction == DML_FROM_FILE)
+    DML_checksum_accum_block(checksum, 0, buf, nsites, size);
+  if(! DML_big_endian())
+    DML_byterevn(buf, nsites*size, word_size);
+  if(direction == DML_TO_FILE)
+    DML_checksum_accum_block(checksum, 0, buf, nsites, size);
+}
+
+int main(int argc, char *argv[]){
+  /* Su3 vector, su3 matrix, gauge field, Dirac propagator, and a big
+     site in double precision */
+  size_t sizes[NSIZES] = { 48, 144, 576, 2304, 36864 };
+  const char *dirname[2] = { "write", "read" };
+  double megabytes = 256.;
+  int reps = 4;
+  char *buf, *ref;
+  size_t i, nbytes, nsites, size;
+  int r, dir, status = 0;
+  DML_Checksum c1, c2;
+  clock_t start;
+  double t1, t2;
+
+  if(argc > 1) megabytes = atof(argv[1]);
+  if(argc > 2) reps = atoi(argv[2]);
+
+  nbytes = (size_t)(megabytes*1048576.);
+  nbytes -= nbytes % sizes[NSIZES-1];
+  buf = (char *)malloc(nbytes);
+  ref = (char *)malloc(nbytes);
+  if(buf == NULL || ref == NULL){
+    printf("%s: Can't malloc %lu byte buffers\n",argv[0],
+	   (unsigned long)nbytes);
+    return 1;
+  }
+  srand(1234);
+  for(i = 0; i < nbytes; i++) ref[i] = (char)(rand() & 0xff);
+
+  printf("byte reversal %s, crc32 %s, %.0f MB buffer\n",
+	 DML_byterevn_engine_name(DML_byterevn_engine()),
+	 DML_crc32_engine_name(DML_crc32_engine()), nbytes/1048576.);
+  printf("%5s %8s %12s %12s %8s\n","", "bytes","two pass","fused",
+	 "speedup");
+  printf("%5s %8s %12s %12s\n","", "","(MB/s)","(MB/s)");
+
+  for(dir = DML_TO_FILE; dir <= DML_FROM_FILE; dir++)
+    for(i = 0; i < NSIZES; i++){
+      size = sizes[i];
+      nsites = nbytes/size;
+
+      /* Both must give the same bytes and checksum.  Reversal is its
+	 own inverse, so undoing it restores the starting data. */
+      memcpy(buf, ref, nbytes);
+      DML_checksum_init(&c1);
+      two_pass(&c1, buf, nsites, size, 8, dir);
+      memcpy(ref, buf, nbytes);
+      DML_byterevn(buf, nbytes, 8);
+      DML_checksum_init(&c2);
+      DML_checksum_byterevn_block(&c2, 0, buf, buf, nsites, size, 8, dir);
+      if(c1.suma != c2.suma || c1.sumb != c2.sumb ||
+	 memcmp(buf, ref, nbytes) != 0){
+	printf("%s: %s size %lu: fused result differs\n",argv[0],
+	       dirname[dir],(unsigned long)size);
+	status = 1;
+	continue;
+      }
+
+      start = clock();
+      for(r = 0; r < reps; r++)
+	two_pass(&c1, buf, nsites, size, 8, dir);
+      t1 = elapsed(start);
+
+      start = clock();
+      for(r = 0; r < reps; r++)
+	DML_checksum_byterevn_block(&c2, 0, buf, buf, nsites, size, 8, dir);
+      t2 = elapsed(start);
+
+      printf("%5s %8lu %12.0f %12.0f %7.2fx\n", dirname[dir],
+	     (unsigned long)size, reps*nbytes/1048576./t1,
+	     reps*nbytes/1048576./t2, t2 > 0 ? t1/t2 : 0.);
+    }
+
+  free(buf);
+  free(ref);
+  return status;
+}
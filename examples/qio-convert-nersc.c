@@ -721,6 +721,7 @@ QIO_Writer *open_scidac_output(char *filename, int volfmt,
   else
     oflag.ildgLFN = NULL;
   oflag.mode = QIO_TRUNC;
+  QIO_set_oflag_backend(&oflag, QIO_BACKEND_DEFAULT);
 
   /* Open the file for writing */
 #ifdef QIO_TRELEASE
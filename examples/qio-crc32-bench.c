@@ -0,0 +1,102 @@
+/* Microbenchmark for the DML_crc32 engines */
+
+/* Checks that every available engine reproduces the original
+   byte-at-a-time crc32 and reports the throughput of each for a range
+   of per-site datum sizes.
+
+   Usage ...
+
+   qio-crc32-bench [total_megabytes]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <qio.h>
+
+#define NSIZES 7
+#define MAXSIZE 262144
+#define MAXCHECK 300
+/* Room for the longest check at the largest misalignment */
+#define BUFBYTES (MAXSIZE + MAXCHECK + 16)
+
+static double elapsed(clock_t start){
+  return (double)(clock() - start)/(double)CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[]){
+  size_t sizes[NSIZES] = { 8, 72, 144, 576, 1152, 4608, MAXSIZE };
+  int engines[] = { DML_CRC32_BYTEWISE, DML_CRC32_SLICE8,
+		    DML_CRC32_SLICE16, DML_CRC32_HW };
+  int nengines = sizeof(engines)/sizeof(engines[0]);
+  double megabytes = 256.;
+  unsigned char *buf;
+  size_t i, len, reps, r;
+  int e, k, status = 0;
+  uint32_t ref, crc;
+  clock_t start;
+  double t, tref;
+
+  if(argc > 1) megabytes = atof(argv[1]);
+
+  buf = (unsigned char *)malloc(BUFBYTES);
+  if(buf == NULL){
+    printf("%s: Can't malloc buffer\n",argv[0]);
+    return 1;
+  }
+  srand(1234);
+  for(i = 0; i < BUFBYTES; i++) buf[i] = (unsigned char)(rand() & 0xff);
+
+  /* Correctness: all lengths and misalignments up to 300 bytes, plus
+     the benchmark sizes */
+  for(e = 0; e < nengines; e++){
+    if(DML_crc32_select(engines[e]) < 0)continue;
+    for(len = 0; len <= MAXCHECK + MAXSIZE; len += (len < MAXCHECK ? 1 : MAXSIZE))
+      for(k = 0; k < 16; k++){
+	ref = DML_crc32_bytewise(0x12345678, buf + k, len);
+	crc = DML_crc32(0x12345678, buf + k, len);
+	if(crc != ref){
+	  printf("%s: engine %s len %lu offset %d gives %08x, expected %08x\n",
+		 argv[0], DML_crc32_engine_name(engines[e]),
+		 (unsigned long)len, k, crc, ref);
+	  status = 1;
+	}
+      }
+  }
+  if(status != 0)return status;
+
+  printf("%8s","bytes");
+  for(e = 0; e < nengines; e++)
+    printf(" %14s",DML_crc32_engine_name(engines[e]));
+  printf("   (MB/s, speedup)\n");
+
+  for(i = 0; i < NSIZES; i++){
+    len = sizes[i];
+    reps = (size_t)(megabytes*1048576./len) + 1;
+    printf("%8lu",(unsigned long)len);
+    tref = 0;
+    for(e = 0; e < nengines; e++){
+      if(DML_crc32_select(engines[e]) < 0){
+	printf(" %14s","n/a");
+	continue;
+      }
+      crc = 0;
+      start = clock();
+      for(r = 0; r < reps; r++)
+	crc ^= DML_crc32(0, buf + (r & 7), len);
+      t = elapsed(start);
+      if(e == 0)tref = t;
+      printf(" %7.0f %5.1fx", reps*len/1048576./t, t > 0 ? tref/t : 0.);
+      /* Keep the loop from being optimized away */
+      if(crc == 0x5a5a5a5a)printf("*");
+    }
+    printf("\n");
+  }
+
+  DML_crc32_select(DML_CRC32_AUTO);
+  printf("Default engine: %s\n",DML_crc32_engine_name(DML_crc32_engine()));
+
+  free(buf);
+  return status;
+}
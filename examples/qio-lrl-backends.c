@@ -0,0 +1,229 @@
+/* Check of the LRL backends against c-lime */
+
+/* LRL writes and parses the LIME framing itself, so a file should be
+   the same byte for byte whichever backend wrote it, and c-lime
+   should read it.  A few records with odd lengths are written with
+   each backend that writes (stdio, posix, direct and memory).  Each
+   file is compared with the one stdio wrote, read back through LRL
+   with a different backend and then parsed with c-lime's LimeReader.
+   The memory file is first copied to disk through the backend.
+
+   Usage ...
+
+   qio-lrl-backends [filename]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <qio.h>
+
+#define NRECORDS 3
+#define MAXBYTES 20000
+
+static uint64_t rec_bytes[NRECORDS] = { 1, 12345, 8 };
+static char *rec_type[NRECORDS] = { "scidac-private-file-xml",
+				    "scidac-binary-data",
+				    "scidac-checksum" };
+
+static char datum(int r, uint64_t i){
+  return (char)(i*7 + 13*r);
+}
+
+/* Write the records.  Returns 0 on success. */
+static int write_lrl(const char *filename, const LRL_Backend *backend){
+  LRL_FileWriter *fw;
+  LRL_RecordWriter *rw;
+  char buf[MAXBYTES];
+  uint64_t i, n;
+  int r;
+
+  fw = LRL_open_write_file_backend(filename, LRL_TRUNC, backend);
+  if(fw == NULL)return 1;
+  for(r = 0; r < NRECORDS; r++){
+    n = rec_bytes[r];
+    for(i = 0; i < n; i++)buf[i] = datum(r, i);
+    rw = LRL_open_write_record(fw, r == 0, r == NRECORDS-1, n, rec_type[r]);
+    if(rw == NULL){
+      LRL_close_write_file(fw);
+      return 1;
+    }
+    /* The second half first, to write through a seek */
+    if(LRL_seek_write_record(rw, (off_t)(n/2)) != LRL_SUCCESS ||
+       LRL_write_bytes(rw, buf + n/2, n - n/2) != n - n/2 ||
+       LRL_seek_write_record(rw, 0) != LRL_SUCCESS ||
+       LRL_write_bytes(rw, buf, n/2) != n/2 ||
+       LRL_close_write_record(rw) != LRL_SUCCESS){
+      LRL_close_write_file(fw);
+      return 1;
+    }
+  }
+  return LRL_close_write_file(fw) != LRL_SUCCESS;
+}
+
+/* Read all bytes of a file through a backend.  Returns the number
+   read and sets *buf, or returns 0. */
+static uint64_t slurp(const char *filename, const LRL_Backend *backend,
+		      char **buf){
+  void *h;
+  uint64_t size;
+
+  h = backend->open(filename, LRL_READ);
+  if(h == NULL)return 0;
+  size = backend->size(h);
+  *buf = (char *)malloc(size);
+  if(*buf == NULL || backend->read_at(h, *buf, size, 0) != size){
+    free(*buf);
+    size = 0;
+  }
+  backend->close(h);
+  return size;
+}
+
+/* Read the records through LRL.  Returns the number of errors. */
+static int check_lrl(const char *filename, const LRL_Backend *backend){
+  LRL_FileReader *fr;
+  LRL_RecordReader *rr;
+  char buf[MAXBYTES];
+  uint64_t i, size;
+  LIME_type type;
+  int r, status, errors = 0;
+
+  fr = LRL_open_read_file_backend(filename, backend);
+  if(fr == NULL)return 1;
+  for(r = 0; r < NRECORDS; r++){
+    rr = LRL_open_read_record(fr, &size, &type, &status);
+    if(rr == NULL){
+      LRL_close_read_file(fr);
+      return errors + 1;
+    }
+    if(size != rec_bytes[r] || strcmp(type, rec_type[r]) != 0 ||
+       LRL_read_bytes(rr, buf, size) != size)
+      errors++;
+    else
+      for(i = 0; i < size; i++)
+	if(buf[i] != datum(r, i)){
+	  errors++;
+	  break;
+	}
+    LRL_close_read_record(rr);
+  }
+  rr = LRL_open_read_record(fr, &size, &type, &status);
+  if(rr != NULL || status != LRL_EOF)errors++;
+  LRL_close_read_file(fr);
+  return errors;
+}
+
+/* Parse the records with c-lime.  Returns the number of errors. */
+static int check_lime(const char *filename){
+  FILE *fp;
+  LimeReader *reader;
+  char buf[MAXBYTES];
+  n_uint64_t i, nbytes;
+  int r, errors = 0;
+
+  fp = fopen(filename, "r");
+  if(fp == NULL)return 1;
+  reader = limeCreateReader(fp);
+  if(reader == NULL){
+    fclose(fp);
+    return 1;
+  }
+  for(r = 0; r < NRECORDS; r++){
+    if(limeReaderNextRecord(reader) != LIME_SUCCESS){
+      errors++;
+      break;
+    }
+    nbytes = limeReaderBytes(reader);
+    if(nbytes != rec_bytes[r] ||
+       strcmp(limeReaderType(reader), rec_type[r]) != 0 ||
+       limeReaderMBFlag(reader) != (r == 0) ||
+       limeReaderMEFlag(reader) != (r == NRECORDS-1) ||
+       limeReaderReadData(buf, &nbytes, reader) != LIME_SUCCESS ||
+       nbytes != rec_bytes[r]){
+      errors++;
+      continue;
+    }
+    for(i = 0; i < nbytes; i++)
+      if(buf[i] != datum(r, i)){
+	errors++;
+	break;
+      }
+  }
+  if(errors == 0 && limeReaderNextRecord(reader) != LIME_EOF)errors++;
+  limeDestroyReader(reader);
+  fclose(fp);
+  return errors;
+}
+
+int main(int argc, char *argv[]){
+  /* Each writer with the reader that checks it */
+  const LRL_Backend *writers[] = { &LRL_stdio_backend, &LRL_posix_backend,
+				   &LRL_direct_backend, &LRL_memory_backend };
+  const LRL_Backend *readers[] = { &LRL_posix_backend, &LRL_mmap_backend,
+				   &LRL_stdio_backend, &LRL_posix_backend };
+  int nwriters = sizeof(writers)/sizeof(writers[0]);
+  const char *filename = "qio-lrl-backends.lime";
+  char *ref = NULL, *bytes;
+  uint64_t nref = 0, nbytes;
+  FILE *fp;
+  int w, errors, status = 0;
+
+  if(argc > 1) filename = argv[1];
+
+  for(w = 0; w < nwriters; w++){
+    errors = 0;
+    if(write_lrl(filename, writers[w]) != 0){
+      printf("%s: %s backend can't write %s\n",argv[0],
+	     writers[w]->name,filename);
+      status = 1;
+      continue;
+    }
+
+    /* The direct backend doesn't read, so files on disk go through
+       stdio */
+    nbytes = slurp(filename, writers[w]->on_disk ? &LRL_stdio_backend :
+		   writers[w], &bytes);
+    if(nbytes == 0){
+      printf("%s: can't read back %s\n",argv[0],filename);
+      status = 1;
+      continue;
+    }
+    if(w == 0){
+      ref = bytes;
+      nref = nbytes;
+    }
+    else if(nbytes != nref || memcmp(bytes, ref, nbytes) != 0){
+      printf("%s: %s file differs from stdio file\n",argv[0],
+	     writers[w]->name);
+      errors++;
+    }
+
+    /* Put the memory file on disk for the other readers */
+    if(!writers[w]->on_disk){
+      LRL_memory_remove(filename);
+      fp = fopen(filename, "w");
+      if(fp == NULL || fwrite(bytes, 1, nbytes, fp) != nbytes)errors++;
+      if(fp != NULL)fclose(fp);
+    }
+    if(bytes != ref)free(bytes);
+
+    if(check_lrl(filename, readers[w]) != 0){
+      printf("%s: %s file misread by the %s backend\n",argv[0],
+	     writers[w]->name,readers[w]->name);
+      errors++;
+    }
+    if(check_lime(filename) != 0){
+      printf("%s: %s file misread by c-lime\n",argv[0],writers[w]->name);
+      errors++;
+    }
+
+    printf("%-8s %s\n",writers[w]->name,errors ? "FAILED" : "OK");
+    if(errors)status = 1;
+  }
+
+  remove(filename);
+  free(ref);
+  return status;
+}
@@ -0,0 +1,149 @@
+/* Microbenchmark for the DML_grid_route engines */
+
+/* Every node in turn routes a message to node 0, the pattern used to
+   gather a lattice onto an I/O node.  Checks that each engine delivers
+   the message intact and reports the throughput of each for a range of
+   message sizes.  Runs on any QMP, including QMP over MPI, once a
+   logical mesh is declared.
+
+   Usage ...
+
+   qio-route-bench [max_bytes [nx ny ...]]
+
+   The mesh dimensions must multiply to the number of nodes.  By default
+   the nodes are factored into a 4D mesh.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <qmp.h>
+#include <qio.h>
+
+#define MAXDIM 8
+
+/* Split the nodes into a 4D mesh, largest factors first */
+static int default_mesh(int dims[], int numnodes){
+  int nd = 4, i, k, p;
+
+  for(i = 0; i < nd; i++) dims[i] = 1;
+  for(p = numnodes; p > 1; p--){
+    for(k = 2; k*k <= p && p % k != 0; k++);
+    if(k*k <= p)continue;	/* not prime */
+    while(numnodes % p == 0){
+      for(k = 0, i = 1; i < nd; i++) if(dims[i] < dims[k]) k = i;
+      dims[k] *= p;
+      numnodes /= p;
+    }
+  }
+  return nd;
+}
+
+static void fill(char *buf, size_t len, int node){
+  size_t i;
+  for(i = 0; i < len; i++) buf[i] = (char)((node*31 + i) & 0xff);
+}
+
+int main(int argc, char *argv[]){
+  int engines[] = { DML_ROUTE_HOPS, DML_ROUTE_PATH,
+		    DML_ROUTE_PIPELINE, DML_ROUTE_QMP };
+  int nengines = sizeof(engines)/sizeof(engines[0]);
+  int dims[MAXDIM], nd, i, e, src, r, reps;
+  int numnodes, this_node, status = 0;
+  size_t maxbytes = 4194304, len;
+  char *buf, *ref;
+  double t, tref;
+  QMP_thread_level_t prv;
+
+  if(QMP_init_msg_passing(&argc, &argv, QMP_THREAD_SINGLE, &prv)
+     != QMP_SUCCESS){
+    fprintf(stderr,"%s: QMP_init failed\n",argv[0]);
+    return 1;
+  }
+  numnodes = QMP_get_number_of_nodes();
+  this_node = QMP_get_node_number();
+
+  if(argc > 1) maxbytes = (size_t)atol(argv[1]);
+  if(argc > 2){
+    nd = argc - 2;
+    if(nd > MAXDIM) nd = MAXDIM;
+    for(i = 0; i < nd; i++) dims[i] = atoi(argv[i+2]);
+  }
+  else
+    nd = default_mesh(dims, numnodes);
+
+  if(QMP_declare_logical_topology(dims, nd) != QMP_SUCCESS){
+    if(this_node == 0)
+      printf("%s: Can't declare a mesh of %d nodes\n",argv[0],numnodes);
+    QMP_finalize_msg_passing();
+    return 1;
+  }
+
+  buf = (char *)malloc(maxbytes);
+  ref = (char *)malloc(maxbytes);
+  if(buf == NULL || ref == NULL){
+    printf("%s: Can't malloc buffers\n",argv[0]);
+    QMP_abort(1);
+  }
+
+  if(this_node == 0){
+    printf("%d nodes as",numnodes);
+    for(i = 0; i < nd; i++) printf(" %s%d", i ? "x " : "", dims[i]);
+    printf("\n%10s","bytes");
+    for(e = 0; e < nengines; e++)
+      printf(" %14s",DML_grid_route_engine_name(engines[e]));
+    printf("   (MB/s into node 0, speedup)\n");
+  }
+
+  for(len = 8; len <= maxbytes; len *= 8){
+    reps = (int)(16777216/(len*numnodes)) + 1;
+    if(this_node == 0) printf("%10lu",(unsigned long)len);
+    tref = 0;
+    for(e = 0; e < nengines; e++){
+      if(DML_grid_route_select(engines[e]) < 0){
+	if(this_node == 0) printf(" %14s","n/a");
+	continue;
+      }
+
+      /* Correctness */
+      for(src = 1; src < numnodes; src++){
+	fill(buf, len, this_node);
+	DML_grid_route(buf, len, src, 0);
+	if(this_node == 0){
+	  fill(ref, len, src);
+	  if(memcmp(buf, ref, len) != 0){
+	    printf("\n%s: engine %s garbles %lu bytes from node %d\n",
+		   argv[0], DML_grid_route_engine_name(engines[e]),
+		   (unsigned long)len, src);
+	    status = 1;
+	  }
+	}
+      }
+
+      QMP_barrier();
+      t = QMP_time();
+      for(r = 0; r < reps; r++)
+	for(src = 1; src < numnodes; src++)
+	  DML_grid_route(buf, len, src, 0);
+      QMP_barrier();
+      t = QMP_time() - t;
+      if(tref == 0) tref = t;
+      if(this_node == 0)
+	printf(" %7.0f %5.1fx",
+	       (double)reps*(numnodes-1)*len/1048576./t, t > 0 ? tref/t : 0.);
+    }
+    if(this_node == 0) printf("\n");
+  }
+
+  DML_grid_route_select(DML_ROUTE_AUTO);
+  if(this_node == 0)
+    printf("Default engine: %s\n",
+	   DML_grid_route_engine_name(DML_grid_route_engine()));
+
+  DML_grid_route_free();
+  free(buf);
+  free(ref);
+  QMP_finalize_msg_passing();
+  return status;
+}
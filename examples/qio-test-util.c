@@ -133,6 +133,30 @@ void vget_M(char *s1, size_t index, int count, void *s2)
     }
 }
 
+/* Block versions: move nsites consecutive sites starting at "first" */
+void vput_M_block(char *s1, size_t first, size_t nsites, int count, void *s2)
+{
+  suN_matrix **field = (suN_matrix **)s2;
+  suN_matrix *src = (suN_matrix *)s1;
+  size_t j;
+  int i;
+
+  for (j=0; j<nsites; j++)
+    for (i=0; i<count; i++, src++)
+      field[i][first + j] = *src;
+}
+
+void vget_M_block(char *s1, size_t first, size_t nsites, int count, void *s2)
+{
+  suN_matrix **field = (suN_matrix **)s2;
+  suN_matrix *dest = (suN_matrix *)s1;
+  size_t j;
+  int i;
+
+  for (j=0; j<nsites; j++)
+    for (i=0; i<count; i++, dest++)
+      *dest = field[i][first + j];
+}
 
 /* Internal factory function for array of real field data */
 void vput_R(char *buf, size_t index, int count, void *qfin)
@@ -10,6 +10,7 @@
 
 #include <qio.h>
 #include <stdio.h>
+#include <stdlib.h>
 #define MAIN
 #include "qio-test.h"
 
@@ -31,6 +32,7 @@ QIO_Writer *open_test_output(char *filename, int volfmt,
   oflag.ildgLFN = QIO_string_create();
   QIO_string_set(oflag.ildgLFN,"TestLFN");
   oflag.mode = QIO_TRUNC;
+  QIO_set_oflag_backend(&oflag, QIO_BACKEND_DEFAULT);
 
   QIO_verbose(QIO_VERB_DEBUG);
 
@@ -55,6 +57,9 @@ int write_real_field(QIO_Writer *outfile, int count,
   QIO_String *xml_record_out;
   char xml_write_field[] = "Dummy user record XML for real field";
   int status;
+  int i, sites_on_node = num_sites(this_node);
+  size_t index;
+  float *field_contig;
   QIO_RecordInfo *rec_info;
 
   /* Create the record info for the field */
@@ -65,10 +70,24 @@ int write_real_field(QIO_Writer *outfile, int count,
   xml_record_out = QIO_string_create();
   QIO_string_set(xml_record_out,xml_write_field);
 
+  /* Copy the field to one array in storage order, count values per
+     site, to exercise the contiguous writer */
+  field_contig = (float *)malloc(sizeof(float)*count*sites_on_node);
+  if(field_contig == NULL){
+    printf("%s(%d): Can't malloc field_contig\n",myname,this_node);
+    return 1;
+  }
+  for(index = 0; index < (size_t)sites_on_node; index++)
+    for(i = 0; i < count; i++)
+      field_contig[count*index + i] = field_out[i][index];
+
   /* Write the record for the field */
-  status = QIO_write(outfile, rec_info, xml_record_out, vget_R, 
-		     count*sizeof(float), sizeof(float), field_out);
-  printf("%s(%d): QIO_write returns status %d\n",myname,this_node,status);
+  status = QIO_write_contiguous(outfile, rec_info, xml_record_out,
+				field_contig, count*sizeof(float),
+				sizeof(float));
+  printf("%s(%d): QIO_write_contiguous returns status %d\n",
+	 myname,this_node,status);
+  free(field_contig);
   if(status != QIO_SUCCESS)return 1;
 
   QIO_destroy_record_info(rec_info);
@@ -120,10 +139,10 @@ int write_su3_field(QIO_Writer *outfile, int count,
   xml_record_out = QIO_string_create();
   QIO_string_set(xml_record_out,xml_write_field);
 
-  /* Write the record for the field */
-  status = QIO_write(outfile, rec_info, xml_record_out, vget_M, 
-		     count*sizeof(suN_matrix), sizeof(float), field_out);
-  printf("%s(%d): QIO_write returns status %d\n",myname,this_node,status);
+  /* Write the record for the field a run of sites at a time */
+  status = QIO_write_block(outfile, rec_info, xml_record_out, vget_M_block, 
+			   count*sizeof(suN_matrix), sizeof(float), field_out);
+  printf("%s(%d): QIO_write_block returns status %d\n",myname,this_node,status);
   if(status != QIO_SUCCESS)return 1;
 
   QIO_destroy_record_info(rec_info);
@@ -165,6 +184,7 @@ QIO_Reader *open_test_input(char *filename, int volfmt, int serpar,
 
   iflag.serpar = serpar;
   iflag.volfmt = volfmt;
+  QIO_set_iflag_backend(&iflag, QIO_BACKEND_DEFAULT);
 
   /* Create the file XML */
   xml_file_in = QIO_string_create();
@@ -249,9 +269,9 @@ int read_su3_field(QIO_Reader *infile, int count,
   /* Create the record XML */
   xml_record_in = QIO_string_create();
 
-  /* Read the field record */
-  status = QIO_read(infile, &rec_info, xml_record_in, 
-		    vput_M, sizeof(suN_matrix)*count, sizeof(float), field_in);
+  /* Read the field record a run of sites at a time */
+  status = QIO_read_block(infile, &rec_info, xml_record_in, vput_M_block,
+			  sizeof(suN_matrix)*count, sizeof(float), field_in);
   printf("%s(%d): QIO_read_record_data returns status %d\n",
 	 myname,this_node,status);
   if(status != QIO_SUCCESS)return 1;
@@ -37,6 +37,10 @@ void vput_R(char *buf, size_t index, int count, void *qfin);
 void vget_R(char *buf, size_t index, int count, void *qfin);
 void vput_M(char *buf, size_t index, int count, void *qfin);
 void vget_M(char *buf, size_t index, int count, void *qfin);
+void vput_M_block(char *buf, size_t first, size_t nsites, int count,
+		  void *qfin);
+void vget_M_block(char *buf, size_t first, size_t nsites, int count,
+		  void *qfin);
 void vput_r(char *buf, size_t index, int count, void *qfin);
 void vget_r(char *buf, size_t index, int count, void *qfin);
 
@@ -24,6 +24,10 @@
 #define DML_SERIAL     0
 #define DML_PARALLEL   1
 
+/* Direction of data passing through a byte reordering step */
+#define DML_TO_FILE    0
+#define DML_FROM_FILE  1
+
 /* Limits size of read and write buffers (bytes) 2^18 for now */
 #ifndef QIO_DML_BUF_BYTES
 #define DML_BUF_BYTES  262144
@@ -37,6 +41,55 @@
 //#define DML_TBUF_BYTES 65536
 #define DML_TBUF_BYTES (DML_BUF_BYTES/4)
 
+/* Limits size of the run table kept with a sitelist (bytes) */
+#define DML_RUN_TABLE_BYTES (64*DML_BUF_BYTES)
+
+/* Default limit on the total size of the cached site maps (bytes).
+   Can be changed with DML_set_site_map_bytes. */
+#ifndef QIO_DML_SITE_MAP_BYTES
+#define DML_SITE_MAP_BYTES 67108864
+#else
+#define DML_SITE_MAP_BYTES QIO_DML_SITE_MAP_BYTES
+#endif
+
+/* Default number of I/O node output buffers being filled or written.
+   More than one needs write-behind support.  Can be changed with
+   DML_set_write_behind_depth. */
+#ifndef QIO_DML_WRITE_BEHIND_DEPTH
+#define DML_WRITE_BEHIND_DEPTH 2
+#else
+#define DML_WRITE_BEHIND_DEPTH QIO_DML_WRITE_BEHIND_DEPTH
+#endif
+
+/* Default number of I/O node input buffers being read or used.  More
+   than one needs read-ahead support.  Can be changed with
+   DML_set_read_ahead_depth. */
+#ifndef QIO_DML_READ_AHEAD_DEPTH
+#define DML_READ_AHEAD_DEPTH 2
+#else
+#define DML_READ_AHEAD_DEPTH QIO_DML_READ_AHEAD_DEPTH
+#endif
+
+/* Default number of threads sharing the I/O of a file that holds only
+   this node's sites.  More than one needs I/O thread support and get
+   and put functions that allow it, so it is 1 unless configured.  Can
+   be changed with DML_set_io_threads. */
+#ifndef QIO_DML_IO_THREADS
+#define DML_IO_THREADS 1
+#else
+#define DML_IO_THREADS QIO_DML_IO_THREADS
+#endif
+
+/* Default number of messages an I/O node keeps receives posted for
+   while collecting output, and the number of messages any node keeps
+   in flight while sending output or distributing input.  Can be
+   changed with DML_set_send_credits. */
+#ifndef QIO_DML_SEND_CREDITS
+#define DML_SEND_CREDITS 8
+#else
+#define DML_SEND_CREDITS QIO_DML_SEND_CREDITS
+#endif
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -53,6 +106,19 @@ typedef uint32_t DML_SiteRank32;
 typedef int64_t DML_SiteRank;
 
 typedef n_uint64_t DML_Index;
+
+/* Cached site distribution.  See DML_sitemap.c */
+typedef struct DML_SiteMap DML_SiteMap;
+
+/* Ring of I/O node output buffers.  See DML_writebehind.c */
+typedef struct DML_WriteBehind DML_WriteBehind;
+
+/* Ring of I/O node input buffers.  See DML_readahead.c */
+typedef struct DML_ReadAhead DML_ReadAhead;
+
+/* Message in flight.  See DML_parscalar.c */
+typedef struct DML_Request DML_Request;
+
 /* For collecting and passing layout information */
 /* See qio.h for QIO_Layout */
 typedef struct {
@@ -84,12 +150,44 @@ typedef struct {
   /* I/O partitions */
   int (*ionode)(int node);
   int master_io_node;
+  int number_aggregators;        /* Two-phase aggregators.  0 for none */
+  size_t stripe_bytes;           /* Aggregator domain alignment */
+
+  /* Cached site distribution, shared with other layouts */
+  DML_SiteMap *site_map;
+  uint64_t site_map_hits;        /* Lookups answered by the map */
+  uint64_t site_map_misses;      /* Lookups needing the callbacks */
 } DML_Layout;
 
+/* A run of sites consecutive in the site loop, in lexicographic rank,
+   and in storage order on one node */
+typedef struct {
+  DML_SiteRank start_rank;       /* Lexicographic rank of first site */
+  size_t length;                 /* Number of sites */
+  int node;                      /* Node holding the sites */
+  DML_Index start_index;         /* Storage index of first site */
+} DML_LexRun;
+
+/* Sites at consecutive positions of a sitelist with consecutive
+   lexicographic ranks */
+typedef struct {
+  DML_SiteRank start_rank;       /* Rank of first site */
+  size_t start_pos;              /* List position of first site */
+  size_t length;                 /* Number of sites */
+} DML_SiteInterval;
+
 typedef struct {
   /* Constant for the file */
-  DML_SiteRank *list;            /* List of sites assigned to file */
+  DML_SiteRank *list;            /* Flat list of sites assigned to file.
+				    Only kept when asked for with
+				    DML_sitelist_array or when the
+				    intervals don't save space */
   int use_list;
+  /* The list as intervals, in list order and in rank order */
+  DML_SiteInterval *intervals;
+  DML_SiteInterval *intervals_by_rank; /* Same as intervals if sorted */
+  size_t number_of_intervals;
+  size_t current_interval;       /* Interval used last */
   DML_SiteRank first, current_rank;
   size_t number_of_io_sites;
   int number_of_my_ionodes;
@@ -101,8 +199,68 @@ typedef struct {
   int use_subset;
   DML_SiteRank *subset_rank;     /* Rank order of sites in subset */
   size_t subset_io_sites;
+
+  /* Run table for the site loop, built on first use */
+  DML_LexRun *runs;
+  size_t number_of_runs;
+  int runs_state;                /* 0 not built, 1 built, -1 none */
+  size_t current_run;            /* Run holding current_index */
+  size_t run_first;              /* Loop position of its first site */
 } DML_SiteList;
 
+/* Block transfer callbacks move the data for nsites sites that are
+   consecutive in node storage order, starting at index first, between
+   the node's field and the contiguous buffer buf.  A DML_SiteCallback
+   adapts the per-site callbacks: pass DML_get_sites or DML_put_sites
+   as the block callback and the DML_SiteCallback as its argument. */
+typedef struct {
+  void (*get)(char *buf, size_t index, int count, void *arg);
+  void (*put)(char *buf, size_t index, int count, void *arg);
+  size_t size;              /* Bytes per site */
+  void *arg;                /* Argument for get or put */
+} DML_SiteCallback;
+
+void DML_get_sites(char *buf, size_t first, size_t nsites, int count,
+		   void *arg);
+void DML_put_sites(char *buf, size_t first, size_t nsites, int count,
+		   void *arg);
+
+/* A field held in node storage order in one array of size bytes per
+   site.  Pass DML_get_contiguous as the get callback and the
+   DML_Contiguous as its argument.  QIO recognizes the callback and
+   writes with DML_contiguous_out, which needs no staging buffers. */
+typedef struct {
+  const char *base;         /* Datum for node index 0 */
+  size_t size;              /* Bytes per site */
+} DML_Contiguous;
+
+void DML_get_contiguous(char *buf, size_t first, size_t nsites, int count,
+			void *arg);
+
+/* A pending run of sites that are consecutive both in node storage
+   order and in the buffer, to be moved with a single block call */
+typedef struct {
+  char *buf;
+  size_t first;
+  size_t nsites;
+} DML_SiteRun;
+
+void DML_run_flush(DML_SiteRun *run,
+	  void (*xfer)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
+	  int count, void *arg);
+void DML_run_add(DML_SiteRun *run, char *buf, size_t index, size_t size,
+	  void (*xfer)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
+	  int count, void *arg);
+
+/* A site of this node in a singlefile parallel record */
+typedef struct {
+  DML_SiteRank pos;              /* Position in the record */
+  DML_SiteRank rank;             /* Lexicographic rank in the lattice */
+  DML_Index index;               /* Storage index on this node */
+} DML_RecordSite;
+
 
 /* For saving the state of DML_partition_out */
 typedef struct {
@@ -177,11 +335,51 @@ int DML_read_sitelist(DML_SiteList *sites, LRL_FileReader *lrl_file_in,
 		      int volfmt, DML_Layout *layout,
 		      LIME_type *lime_type);
 int DML_compare_sitelists(DML_SiteRank *lista, DML_SiteRank *listb, size_t n);
+void DML_compress_sitelist(DML_SiteList *sites);
+DML_SiteRank DML_sitelist_rank(DML_SiteList *sites, size_t pos);
+int64_t DML_sitelist_position(DML_SiteList *sites, DML_SiteRank rank);
+void DML_sitelist_bounds(DML_SiteList *sites, DML_SiteRank *lo,
+			 DML_SiteRank *hi);
+int DML_compare_sitelist_part(DML_SiteList *sites, size_t pos,
+			      const DML_SiteRank *list, size_t n);
+DML_SiteRank *DML_sitelist_array(DML_SiteList *sites);
+int64_t DML_table_lookup(DML_SiteRank list[], size_t n, DML_SiteRank r);
 int DML_insert_subset_data(DML_Layout *layout, int recordtype,
 			   int *lower, int *upper, int n);
+DML_SiteRank DML_record_pos(const int coords[], DML_Layout *layout);
+void DML_record_coords(int coords[], DML_SiteRank pos, DML_Layout *layout);
+DML_RecordSite *DML_list_record_sites(DML_Layout *layout, size_t *nsites);
+int DML_prepare_site_map(DML_Layout *layout, DML_SiteRank lo,
+			 DML_SiteRank hi, size_t nsites);
+void DML_layout_site_owner(DML_Layout *layout, DML_SiteRank rank,
+			   int coords[], int *node, DML_Index *index);
+size_t DML_set_site_map_bytes(size_t bytes);
+void DML_free_site_map(DML_Layout *layout);
+void DML_free_site_maps(void);
+int DML_reuse_sitelist(DML_SiteList *sites, DML_Layout *layout,
+		       int volfmt, int serpar);
+void DML_keep_sitelist(DML_SiteList *sites, DML_Layout *layout,
+		       int volfmt, int serpar);
+int DML_build_run_table(DML_SiteList *sites, DML_Layout *layout);
+void DML_site_owner(DML_SiteList *sites, DML_Layout *layout,
+		    DML_SiteRank rank, int coords[], int *node,
+		    DML_Index *index);
 void DML_checksum_init(DML_Checksum *checksum);
 void DML_checksum_accum(DML_Checksum *checksum, DML_SiteRank rank, 
 			char *buf, size_t size);
+void DML_checksum_accum_block(DML_Checksum *checksum, DML_SiteRank first_rank,
+			      char *buf, size_t nsites, size_t size);
+void DML_checksum_accum_indexed(DML_Checksum *checksum,
+				const DML_SiteRank rank[],
+				char *buf, size_t nsites, size_t size);
+void DML_checksum_byterevn_block(DML_Checksum *checksum,
+				 DML_SiteRank first_rank, char *dst,
+				 const char *src, size_t nsites, size_t size,
+				 int word_size, int direction);
+void DML_checksum_byterevn_indexed(DML_Checksum *checksum,
+				   const DML_SiteRank rank[], char *dst,
+				   const char *src, size_t nsites, size_t size,
+				   int word_size, int direction);
 void DML_checksum_combine(DML_Checksum *checksum);
 void DML_checksum_peq(DML_Checksum *total, DML_Checksum *checksum);
 int DML_create_subset_rank(DML_SiteList *sites, DML_Layout *layout,
@@ -190,8 +388,11 @@ void DML_destroy_subset_rank(DML_SiteList *sites);
 void DML_global_xor(uint32_t *x);
 int DML_big_endian(void);
 void DML_byterevn(void *buf, size_t size, int word_size);
+void DML_byterevn32(uint32_t w[], size_t n);
+void DML_byterevn64(uint32_t w[], size_t n);
+void DML_copy_byterevn(void *dst, const void *src, size_t size, int word_size);
 size_t DML_max_buf_sites(size_t size, int factor);
-char *DML_allocate_buf(size_t size, size_t *max_buf_sites);
+char *DML_allocate_buf(size_t size, size_t *max_buf_sites, size_t align);
 int DML_write_buf_seek(LRL_RecordWriter *lrl_record_out, 
 		       DML_SiteRank seeksite, 
 		       char *lbuf, size_t buf_sites, size_t size,
@@ -201,6 +402,46 @@ int DML_write_buf_current(LRL_RecordWriter *lrl_record_out,
 			  char *lbuf, size_t buf_sites, size_t size,
 			  uint64_t *nbytes, char *myname, 
 			  int this_node);
+int DML_flush_outbuf(LRL_RecordWriter *lrl_record_out, int serpar,
+		     DML_SiteRank snd_coords, char *outbuf, size_t buf_sites,
+		     size_t size, uint64_t *nbytes, int this_node);
+int DML_set_write_behind_depth(int depth);
+DML_WriteBehind *DML_write_behind_open(LRL_RecordWriter *lrl_record_out,
+				       int serpar, size_t size,
+				       size_t *max_buf_sites, int this_node);
+char *DML_write_behind_buffer(DML_WriteBehind *wb);
+int DML_write_behind_submit(DML_WriteBehind *wb, char *buf,
+			    DML_SiteRank rank, size_t nsites);
+int DML_write_behind_close(DML_WriteBehind *wb, uint64_t *nbytes,
+			   double *dtdisk);
+int DML_read_buf(LRL_RecordReader *lrl_record_in, char *buf,
+		 DML_SiteRank firstrank, size_t size, int num, int doseek);
+int DML_set_read_ahead_depth(int depth);
+DML_ReadAhead *DML_read_ahead_open(LRL_RecordReader *lrl_record_in,
+				   size_t size, size_t *max_buf_sites,
+				   int this_node);
+int DML_read_ahead_get_depth(DML_ReadAhead *ra);
+int DML_read_ahead_submit(DML_ReadAhead *ra, DML_SiteRank firstrank,
+			  size_t nsites, int doseek);
+const char *DML_read_ahead_wait(DML_ReadAhead *ra, int *err);
+char *DML_read_ahead_buffer(DML_ReadAhead *ra);
+void DML_read_ahead_release(DML_ReadAhead *ra);
+void DML_read_ahead_close(DML_ReadAhead *ra, double *dtdisk);
+int DML_set_io_threads(int nthreads);
+int DML_local_io_threads(DML_Layout *layout, DML_SiteList *sites,
+			 int volfmt, size_t size, int concurrent);
+uint64_t DML_threaded_out(LRL_RecordWriter *lrl_record_out,
+	   void (*get)(char *buf, size_t first, size_t nsites,
+	         int count, void *arg),
+	   int count, size_t size, int word_size, void *arg,
+	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	   int nthreads, DML_Checksum *checksum);
+uint64_t DML_threaded_in(LRL_RecordReader *lrl_record_in,
+	  void (*put)(char *buf, size_t first, size_t nsites,
+	        int count, void *arg),
+	  int count, size_t size, int word_size, void *arg,
+	  DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	  int nthreads, DML_Checksum *checksum);
 size_t DML_seek_read_buf(LRL_RecordReader *lrl_record_in, 
 			 DML_SiteRank seeksite, size_t size,
 			 char *lbuf, size_t *buf_extract, size_t buf_sites, 
@@ -228,23 +469,47 @@ int DML_partition_allsitedata_out(DML_RecordWriter *dml_record_out,
 	   int count, size_t size, int word_size, void *arg, 
  	   DML_Layout *layout, DML_SiteList *sites);
 uint64_t DML_partition_close_out(DML_RecordWriter *dml_record_out);
+int DML_set_send_credits(int credits);
 uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out, 
-	   void (*get)(char *buf, size_t index, int count, void *arg),
+	   void (*get)(char *buf, size_t first, size_t nsites,
+	         int count, void *arg),
 	   int count, size_t size, int word_size, void *arg, 
 	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
 	   int serpar, DML_Checksum *checksum);
+uint64_t DML_contiguous_out(LRL_RecordWriter *lrl_record_out,
+	   int count, int word_size, DML_Contiguous *field,
+	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	   int serpar, DML_Checksum *checksum);
+uint64_t DML_collective_out(LRL_RecordWriter *lrl_record_out,
+	   void (*get)(char *buf, size_t first, size_t nsites,
+	         int count, void *arg),
+	   int count, size_t size, int word_size, void *arg,
+	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	   int serpar, DML_Checksum *checksum);
+int DML_set_aggregators(int naggr);
+size_t DML_set_stripe_bytes(size_t bytes);
+void DML_agree_aggregators(DML_Layout *layout);
+uint64_t DML_aggregate_out(LRL_RecordWriter *lrl_record_out,
+	   void (*get)(char *buf, size_t first, size_t nsites,
+	         int count, void *arg),
+	   int count, size_t size, int word_size, void *arg,
+	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	   int serpar, DML_Checksum *checksum);
 size_t DML_global_out(LRL_RecordWriter *lrl_record_out, 
-	   void (*get)(char *buf, size_t index, int count, void *arg),
+	   void (*get)(char *buf, size_t first, size_t nsites,
+	         int count, void *arg),
 	   int count, size_t size, int word_size, void *arg, 
            DML_Layout *layout, int volfmt, 
 	   DML_Checksum *checksum);
 uint64_t DML_multifile_out(LRL_RecordWriter *lrl_record_out, 
-	      void (*get)(char *buf, size_t index, int count, void *arg),
+	      void (*get)(char *buf, size_t first, size_t nsites,
+	            int count, void *arg),
 	      int count, size_t size, int word_size, void *arg, 
  	      DML_Layout *layout, DML_Checksum *checksum);
 uint64_t DML_multifile_in(LRL_RecordReader *lrl_record_in, 
 	     DML_SiteRank sitelist[],
-	     void (*put)(char *buf, size_t index, int count, void *arg),
+	     void (*put)(char *buf, size_t first, size_t nsites,
+	           int count, void *arg),
 	     int count, size_t size, int word_size, void *arg, 
 	     DML_Layout *layout, DML_Checksum *checksum);
 int DML_synchronize_out(LRL_RecordWriter *lrl_record_out, DML_Layout *layout);
@@ -263,12 +528,26 @@ int DML_partition_allsitedata_in(DML_RecordReader *dml_record_in,
 	  DML_Checksum *checksum);
 uint64_t DML_partition_close_in(DML_RecordReader *dml_record_in);
 uint64_t DML_partition_in(LRL_RecordReader *lrl_record_in, 
-	  void (*put)(char *buf, size_t index, int count, void *arg),
+	  void (*put)(char *buf, size_t first, size_t nsites,
+	        int count, void *arg),
 	  int count, size_t size, int word_size, void *arg, 
 	  DML_Layout *layout, DML_SiteList *sites, int volfmt,
 	  int serpar, DML_Checksum *checksum);
+uint64_t DML_aggregate_in(LRL_RecordReader *lrl_record_in,
+	  void (*put)(char *buf, size_t first, size_t nsites,
+	        int count, void *arg),
+	  int count, size_t size, int word_size, void *arg,
+	  DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	  int serpar, DML_Checksum *checksum);
+uint64_t DML_collective_in(LRL_RecordReader *lrl_record_in,
+	  void (*put)(char *buf, size_t first, size_t nsites,
+	        int count, void *arg),
+	  int count, size_t size, int word_size, void *arg,
+	  DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	  int serpar, DML_Checksum *checksum);
 size_t DML_global_in(LRL_RecordReader *lrl_record_in, 
-	  void (*put)(char *buf, size_t index, int count, void *arg),
+	  void (*put)(char *buf, size_t first, size_t nsites,
+	        int count, void *arg),
 	  int count, size_t size, int word_size, void *arg, 
           DML_Layout* layout, int volfmt, int broadcast_global,
 	  DML_Checksum *checksum);
@@ -278,7 +557,14 @@ void DML_sum_uint64_t(uint64_t *ipt);
 void DML_sum_int(int *ipt);
 int DML_send_bytes(char *buf, size_t size, int tonode);
 int DML_get_bytes(char *buf, size_t size, int fromnode);
+int DML_exchange_bytes(char *sendbuf, size_t sendsize, int tonode,
+		       char *recvbuf, size_t recvsize, int fromnode);
 int DML_clear_to_send(char *buf, size_t size, int my_io_node, int tonode);
+DML_Request *DML_isend_bytes(char *buf, size_t size, int tonode);
+DML_Request *DML_irecv_bytes(char *buf, size_t size, int fromnode);
+int DML_wait_bytes(DML_Request *req);
+int DML_wait_any(DML_Request *req[], int n);
+void DML_free_requests(void);
 void DML_sync(void);
 
 /* I/O layout */
@@ -290,7 +576,42 @@ typedef int (*DML_master_io_node_ext)(void *arg);
 int DML_io_node(const int node);
 int DML_master_io_node(void);
 
-uint32_t DML_crc32(uint32_t crc, const unsigned char *buf, uint32_t len);
+/* CRC32 engines.  All compute the same zlib crc32. */
+#define DML_CRC32_AUTO      0
+#define DML_CRC32_BYTEWISE  1
+#define DML_CRC32_SLICE8    2
+#define DML_CRC32_SLICE16   3
+#define DML_CRC32_HW        4
+
+uint32_t DML_crc32(uint32_t crc, const unsigned char *buf, size_t len);
+uint32_t DML_crc32_bytewise(uint32_t crc, const unsigned char *buf, size_t len);
+int DML_crc32_select(int engine);
+int DML_crc32_engine(void);
+const char *DML_crc32_engine_name(int engine);
+
+/* Byte reversal engines.  All give the same result. */
+#define DML_BYTEREVN_AUTO    0
+#define DML_BYTEREVN_SCALAR  1
+#define DML_BYTEREVN_SSSE3   2
+#define DML_BYTEREVN_AVX2    3
+#define DML_BYTEREVN_AVX512  4
+#define DML_BYTEREVN_NEON    5
+
+int DML_byterevn_select(int engine);
+int DML_byterevn_engine(void);
+const char *DML_byterevn_engine_name(int engine);
+
+/* Grid routing engines.  All nodes must use the same one. */
+#define DML_ROUTE_AUTO      0
+#define DML_ROUTE_QMP       1
+#define DML_ROUTE_HOPS      2
+#define DML_ROUTE_PATH      3
+#define DML_ROUTE_PIPELINE  4
+
+int DML_grid_route_select(int engine);
+int DML_grid_route_engine(void);
+const char *DML_grid_route_engine_name(int engine);
+void DML_grid_route_free(void);
 
 /* Hacks to be removed */
 int DML_grid_route(char *buf, size_t size, int fromnode, int tonode);
@@ -32,6 +32,8 @@ extern "C"
 #define LRL_TRUNC      1
 #define LRL_APPEND     2
 #define LRL_NOTRUNC    3
+/* and for reading, when opening a backend */
+#define LRL_READ       4
 
 #ifdef __cplusplus
 extern "C"
@@ -42,9 +44,84 @@ extern "C"
 #define MAX_LIME_TYPE_LEN 32
 typedef char* LIME_type;
 
+/* The LIME record header: magic number, version, MB/ME flags, payload
+   length and type, all big endian.  The payload is padded to a
+   multiple of 8 bytes. */
+#define LRL_LIME_MAGIC       0x456789abUL
+#define LRL_LIME_VERSION     1
+#define LRL_LIME_HDR_BYTES   144
+#define LRL_LIME_LEN_OFFSET  8
+#define LRL_LIME_TYPE_OFFSET 16
+#define LRL_LIME_TYPE_LEN    128
+#define LRL_LIME_MB_MASK     0x80
+#define LRL_LIME_ME_MASK     0x40
+
+/* An I/O backend moves bytes to and from a file at given offsets.
+   LRL writes and parses the LIME framing itself, so a file is the same
+   whichever backend wrote it and can be read with any other.  Entries
+   marked optional may be null. */
+typedef struct {
+  const char *name;
+  int on_disk;      /* Other processes can open the file by name */
+  int concurrent;   /* Threads can read_at or write_at different
+		       parts of the file at once */
+  /* Open for LRL_READ or one of the write modes.  Null if refused. */
+  void *(*open)(const char *filename, int mode);
+  /* Move up to nbytes at offset.  Return the number moved. */
+  uint64_t (*read_at)(void *h, char *buf, uint64_t nbytes,
+		      uint64_t offset);
+  uint64_t (*write_at)(void *h, const char *buf, uint64_t nbytes,
+		       uint64_t offset);
+  /* Optional.  Point to nbytes at offset without copying, or null.
+     Valid until the file is written or closed. */
+  const char *(*map_at)(void *h, uint64_t offset, uint64_t nbytes);
+  /* Optional.  Say nbytes at offset will be read soon. */
+  int (*advise)(void *h, uint64_t offset, uint64_t nbytes);
+  /* Bytes in the file */
+  uint64_t (*size)(void *h);
+  /* Optional.  Alignment write buffers should have for speed. */
+  size_t (*alignment)(void *h);
+  /* Finish what was written, so other handles see it */
+  int (*flush)(void *h);
+  int (*close)(void *h);
+} LRL_Backend;
+
+/* The backends LRL provides, LRL_posix.c, LRL_stdio.c, LRL_mmap.c
+   (reading only), LRL_direct.c (writing only) and LRL_memory.c */
+extern const LRL_Backend LRL_posix_backend;
+extern const LRL_Backend LRL_stdio_backend;
+extern const LRL_Backend LRL_mmap_backend;
+extern const LRL_Backend LRL_direct_backend;
+extern const LRL_Backend LRL_memory_backend;
+
+/* Codes for choosing a backend per file.  All but the default carry
+   a tag, so a value that was never set, as in a flag structure of a
+   program written before the codes existed, gives the default. */
+#define LRL_BACKEND_TAG      0x4c524c00
+#define LRL_BACKEND_DEFAULT  0
+#define LRL_BACKEND_STDIO    (LRL_BACKEND_TAG | 1)
+#define LRL_BACKEND_MMAP     (LRL_BACKEND_TAG | 2)
+#define LRL_BACKEND_DIRECT   (LRL_BACKEND_TAG | 3)
+#define LRL_BACKEND_MEMORY   (LRL_BACKEND_TAG | 4)
+#define LRL_BACKEND_POSIX    (LRL_BACKEND_TAG | 5)
+
+/* Where a reader or writer is in its file.  A copy is the state
+   passed between nodes, so it doesn't depend on the backend. */
+typedef struct {
+  uint64_t next;            /* Offset of the next record header */
+  uint64_t rec_start;       /* Offset of the current record payload */
+  uint64_t rec_ptr;         /* Position in the payload */
+  uint64_t bytes_total;     /* Bytes in the payload */
+  int mb_flag;              /* Message begin flag of the record */
+  int me_flag;              /* Message end flag of the record */
+  char type[LRL_LIME_TYPE_LEN+1];
+} LRL_RecordState;
+
 typedef struct {
-  FILE *file;
-  LimeWriter *dg;
+  const LRL_Backend *backend;
+  void *handle;
+  char *filename;
+  LRL_RecordState rs;
 } LRL_FileWriter;
 
 typedef struct {
@@ -52,18 +129,36 @@ typedef struct {
 } LRL_RecordWriter;
 
 typedef struct {
-  FILE *file;
-  LimeReader *dr;
+  const LRL_Backend *backend;
+  void *handle;
+  char *filename;
+  uint64_t length;          /* Bytes in the file when opened */
+  LRL_RecordState rs;
 } LRL_FileReader;
 
 typedef struct {
   LRL_FileReader *fr;
 } LRL_RecordReader;
 
+const LRL_Backend *LRL_get_backend(int code);
+const LRL_Backend *LRL_find_backend(const char *name);
+const LRL_Backend *LRL_set_read_backend(const LRL_Backend *backend);
+const LRL_Backend *LRL_set_write_backend(const LRL_Backend *backend);
+int LRL_set_read_mapped(int flag);
 LRL_FileReader *LRL_open_read_file(const char *filename);
+LRL_FileReader *LRL_open_read_file_mapped(const char *filename);
+LRL_FileReader *LRL_open_read_file_backend(const char *filename,
+					   const LRL_Backend *backend);
 int LRL_set_reader_pointer(LRL_FileReader *, off_t offset);
 off_t LRL_get_reader_pointer(LRL_FileReader *fr);
+int LRL_set_write_direct(int flag);
 LRL_FileWriter *LRL_open_write_file(const char *filename, int mode);
+LRL_FileWriter *LRL_open_write_file_direct(const char *filename, int mode);
+LRL_FileWriter *LRL_open_write_file_backend(const char *filename, int mode,
+					    const LRL_Backend *backend);
+size_t LRL_write_alignment(LRL_RecordWriter *rw);
+int LRL_write_concurrent(LRL_RecordWriter *rw);
+int LRL_read_concurrent(LRL_RecordReader *rr);
 LRL_RecordReader *LRL_open_read_record(LRL_FileReader *fr, uint64_t *rec_size, 
 				       LIME_type *lime_type, int *status);
 LRL_RecordReader *LRL_open_read_target_record(LRL_FileReader *fr,
@@ -88,8 +183,18 @@ uint64_t LRL_write_bytes(LRL_RecordWriter *rr, char *buf,
 		       uint64_t nbytes);
 uint64_t LRL_read_bytes(LRL_RecordReader *rr, char *buf, 
 		      uint64_t nbytes);
+uint64_t LRL_write_bytes_at(LRL_RecordWriter *rw, off_t offset,
+			    char *buf, uint64_t nbytes);
+uint64_t LRL_read_bytes_at(LRL_RecordReader *rr, off_t offset,
+			   char *buf, uint64_t nbytes);
+const char *LRL_read_bytes_mapped(LRL_RecordReader *rr, uint64_t *nbytes);
+int LRL_advise_read(LRL_RecordReader *rr, uint64_t nbytes);
 int LRL_seek_write_record(LRL_RecordWriter *rr, off_t offset);
 int LRL_seek_read_record(LRL_RecordReader *rr, off_t offset);
+int LRL_get_writer_location(LRL_RecordWriter *rw, const char **filename,
+			    off_t *offset);
+int LRL_get_reader_location(LRL_RecordReader *rr, const char **filename,
+			    off_t *offset);
 void LRL_destroy_reader_state_copy(void *state_ptr);
 void LRL_destroy_writer_state_copy(void *state_ptr);
 int LRL_next_record(LRL_RecordReader *rr);
@@ -99,6 +204,9 @@ int LRL_close_write_record(LRL_RecordWriter *rr);
 int LRL_close_read_file(LRL_FileReader *fr);
 int LRL_close_write_file(LRL_FileWriter *fr);
 
+/* LRL_memory.c */
+int LRL_memory_remove(const char *filename);
+
 #ifdef __cplusplus
 }
 #endif
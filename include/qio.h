@@ -43,6 +43,18 @@ extern "C"
 #define QIO_TRUNC      LRL_TRUNC
 #define QIO_APPEND     LRL_APPEND
 
+/* I/O backend for a file, set in QIO_Iflag and QIO_Oflag with
+   QIO_set_iflag_backend and QIO_set_oflag_backend.  The default is
+   the one named by the QIO_BACKEND environment variable ("posix",
+   "stdio", "mmap", "direct" or "memory"), or else posix.  The codes
+   carry a tag, and any other value gives the default. */
+#define QIO_BACKEND_DEFAULT LRL_BACKEND_DEFAULT
+#define QIO_BACKEND_POSIX   LRL_BACKEND_POSIX
+#define QIO_BACKEND_STDIO   LRL_BACKEND_STDIO
+#define QIO_BACKEND_MMAP    LRL_BACKEND_MMAP
+#define QIO_BACKEND_DIRECT  LRL_BACKEND_DIRECT
+#define QIO_BACKEND_MEMORY  LRL_BACKEND_MEMORY
+
 /* Return codes */
 
 #define QIO_SUCCESS               (  0)
@@ -150,9 +162,12 @@ typedef struct {
   DML_RecordReader *dml_record_in;
 } QIO_Reader;
 
+/* The backend members were added after version 2.4.2, which changes
+   the size of the flag structures.  Programs must be recompiled. */
 typedef struct {
   int serpar;
   int volfmt;
+  int backend;           /* Set with QIO_set_iflag_backend */
 } QIO_Iflag;
 
 typedef struct {
@@ -160,6 +175,7 @@ typedef struct {
   int mode;
   int ildgstyle;
   QIO_String *ildgLFN;
+  int backend;           /* Set with QIO_set_oflag_backend */
 } QIO_Oflag;
 
 /* Support for host file conversion */
@@ -202,6 +218,51 @@ int QIO_verbosity(void);
 #define QIO_VERB_HIGH   4
 #define QIO_VERB_DEBUG  5
 
+/* Cached site distribution.  A file's site map is released when it is
+   closed.  Sitelists are shared by files opened with the same layout,
+   checked against the layout functions before each use, and kept
+   until QIO_free_site_maps. */
+size_t QIO_set_site_map_bytes(size_t bytes);
+void QIO_free_site_maps(void);
+
+/* Number of output buffers an I/O node fills while earlier ones are
+   written (needs --enable-dml-write-behind) */
+int QIO_set_write_behind_depth(int depth);
+
+/* Number of input buffers an I/O node reads ahead into while using
+   earlier ones (needs --enable-dml-read-ahead) */
+int QIO_set_read_ahead_depth(int depth);
+
+/* Number of messages an I/O node receives ahead from the nodes it
+   writes for (needs --enable-dml-output-buffering) */
+int QIO_set_send_credits(int credits);
+
+/* Number of threads sharing the I/O of a multifile or of the file of
+   a one-node partition, 1 by default.  The get and put functions and
+   the layout functions must then allow calls from several threads at
+   once for different sites (needs --enable-dml-io-threads) */
+int QIO_set_io_threads(int nthreads);
+
+/* Number of two-phase aggregators for singlefile parallel records,
+   0 for the I/O node partitions, and the file system stripe size
+   their ranges are aligned to, 0 for none.  A file takes the master
+   I/O node's values when it is opened. */
+int QIO_set_aggregators(int naggr);
+size_t QIO_set_stripe_bytes(size_t bytes);
+
+/* Choose the backend of files opened with the flag.  An unknown code
+   sets the default and returns QIO_BAD_ARG. */
+int QIO_set_iflag_backend(QIO_Iflag *iflag, int backend);
+int QIO_set_oflag_backend(QIO_Oflag *oflag, int backend);
+
+/* Read files through a memory map when possible.
+   Must be set the same on all nodes. */
+int QIO_set_read_mapped(int flag);
+
+/* Write files with O_DIRECT, bypassing the page cache, when the file
+   system allows it */
+int QIO_set_write_direct(int flag);
+
 /* HostAPI */
 int QIO_single_to_part( const char filename[], QIO_Filesystem *fs,
 			QIO_Layout *layout, int volfmt);
@@ -250,6 +311,26 @@ int QIO_read_record_info(QIO_Reader *in, QIO_RecordInfo *record_info,
 int QIO_read_record_data(QIO_Reader *in, 
 		 void (*put)(char *buf, size_t index, int count, void *arg),
 		 size_t datum_size, int word_size, void *arg);
+
+/* Variants taking block callbacks, which move nsites sites that are
+   consecutive in node storage order, starting at index first */
+int QIO_write_block(QIO_Writer *out, QIO_RecordInfo *record_info,
+	      QIO_String *xml_record, 
+	      void (*get_block)(char *buf, size_t first, size_t nsites,
+				int count, void *arg),
+	      size_t datum_size, int word_size, void *arg);
+int QIO_write_contiguous(QIO_Writer *out, QIO_RecordInfo *record_info,
+	      QIO_String *xml_record, const void *base,
+	      size_t datum_size, int word_size);
+int QIO_read_block(QIO_Reader *in, QIO_RecordInfo *record_info,
+	     QIO_String *xml_record, 
+	     void (*put_block)(char *buf, size_t first, size_t nsites,
+			       int count, void *arg),
+	     size_t datum_size, int word_size, void *arg);
+int QIO_read_record_data_block(QIO_Reader *in, 
+		 void (*put_block)(char *buf, size_t first, size_t nsites,
+				   int count, void *arg),
+		 size_t datum_size, int word_size, void *arg);
 int QIO_next_record(QIO_Reader *in);
 
 LRL_RecordWriter *QIO_open_write_field(QIO_Writer *out, 
@@ -279,6 +360,7 @@ double QIO_time(void);
 void QIO_wait(double sec);
 void QIO_suppress_global_broadcast(QIO_Reader *qio_in);
 QIO_Layout *QIO_check_layout_ext(QIO_Layout *layout);
+QIO_Layout *QIO_user_layout(QIO_Layout *layout);
 void QIO_free_layout_ext(DML_Layout *layout);
 QIO_Reader *QIO_open_read_master(const char *filename, QIO_Layout *layout,
 				 QIO_Iflag *iflag, int (*io_node)(int),
@@ -287,6 +369,8 @@ int QIO_open_read_nonmaster(QIO_Reader *qio_in, const char *filename,
 			    QIO_Iflag *iflag);
 int QIO_read_check_sitelist(QIO_Reader *qio_in);
 int QIO_read_user_file_xml(QIO_String *xml_file, QIO_Reader *qio_in);
+int QIO_broadcast_packed(DML_Layout *layout, void *header, size_t hsize,
+			 QIO_String *str[], int nstr);
 QIO_Writer *QIO_generic_open_write(const char *filename, 
 				   int volfmt, QIO_Layout *layout, 
 				   QIO_Oflag *oflag, 
@@ -304,6 +388,11 @@ int QIO_generic_read_record_data(QIO_Reader *in,
 	     void (*put)(char *buf, size_t index, int count, void *arg),
 	     size_t datum_size, int word_size, void *arg,
  	     DML_Checksum *checksum, uint64_t *nbytes);
+int QIO_generic_read_record_data_block(QIO_Reader *in, 
+	     void (*put_block)(char *buf, size_t first, size_t nsites,
+			       int count, void *arg),
+	     size_t datum_size, int word_size, void *arg,
+ 	     DML_Checksum *checksum, uint64_t *nbytes);
 QIO_ChecksumInfo *QIO_read_checksum(QIO_Reader *in);
 int QIO_compare_checksum(int this_node,
 	 QIO_ChecksumInfo *checksum_info_expect, DML_Checksum *checksum);
@@ -314,6 +403,13 @@ int QIO_generic_write(QIO_Writer *out, QIO_RecordInfo *record_info,
 	      size_t datum_size, int word_size, void *arg,
 	      DML_Checksum *checksum, uint64_t *nbytes,
 	      int *msg_begin, int *msg_end);
+int QIO_generic_write_block(QIO_Writer *out, QIO_RecordInfo *record_info, 
+	      QIO_String *xml_record, 
+	      void (*get_block)(char *buf, size_t first, size_t nsites,
+				int count, void *arg),
+	      size_t datum_size, int word_size, void *arg,
+	      DML_Checksum *checksum, uint64_t *nbytes,
+	      int *msg_begin, int *msg_end);
 int QIO_write_record_info(QIO_Writer *out, QIO_RecordInfo *record_info, 
               size_t datum_size, int word_size,
 	      QIO_String *xml_record, 
@@ -323,6 +419,13 @@ int QIO_write_record_data(QIO_Writer *out, QIO_RecordInfo *record_info,
 	      size_t datum_size, int word_size, void *arg,
 	      DML_Checksum *checksum, uint64_t *nbytes,
 	      int *msg_begin, int *msg_end);
+int QIO_write_record_data_block(QIO_Writer *out,
+	      QIO_RecordInfo *record_info, 
+	      void (*get_block)(char *buf, size_t first, size_t nsites,
+				int count, void *arg),
+	      size_t datum_size, int word_size, void *arg,
+	      DML_Checksum *checksum, uint64_t *nbytes,
+	      int *msg_begin, int *msg_end);
 int QIO_write_checksum(QIO_Writer *out, DML_Checksum *checksum);
 
 char *QIO_filename_edit(const char *filename, int volfmt, int this_node);
@@ -366,6 +469,31 @@ int QIO_write_field(QIO_Writer *out, int msg_begin, int msg_end,
 	    int count, size_t datum_size, int word_size, void *arg, 
 	    DML_Checksum *checksum, uint64_t *nbytes,
 	    const LIME_type lime_type);
+/* Variants taking block callbacks */
+int QIO_read_field_block(QIO_Reader *in, 
+	   void (*put)(char *buf, size_t first, size_t nsites, int count,
+	         void *arg),
+	   int count, size_t datum_size, int word_size, void *arg, 
+	   DML_Checksum *checksum, uint64_t* nbytes,
+	   LIME_type *lime_type);
+int QIO_read_field_data_block(QIO_Reader *in,
+	   LRL_RecordReader *lrl_record_in,
+	   void (*put)(char *buf, size_t first, size_t nsites, int count,
+	         void *arg),
+	   int count, size_t datum_size, int word_size, void *arg, 
+ 	   DML_Checksum *checksum, uint64_t* nbytes);
+int QIO_write_field_data_block(QIO_Writer *out,
+	    LRL_RecordWriter *lrl_record_out,
+	    void (*get)(char *buf, size_t first, size_t nsites, int count,
+	          void *arg),
+	    int count, size_t datum_size, int word_size, void *arg, 
+	    DML_Checksum *checksum, uint64_t *nbytes);
+int QIO_write_field_block(QIO_Writer *out, int msg_begin, int msg_end,
+	    void (*get)(char *buf, size_t first, size_t nsites, int count,
+	          void *arg),
+	    int count, size_t datum_size, int word_size, void *arg, 
+	    DML_Checksum *checksum, uint64_t *nbytes,
+	    const LIME_type lime_type);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,304 @@
+/* DML_byterevn.c */
+/* Byte reversal between host order and the big-endian file order.
+   The kernels work on byte pointers, so the data need not be word
+   aligned, and they may run in place (dst == src). */
+
+#include <qio_config.h>
+#include <dml.h>
+#include <qio_stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef void (*byterevn_kernel_t)(char *dst, const char *src, size_t nbytes,
+				  int word_size);
+
+/*------------------------------------------------------------------*/
+/* Portable kernels */
+
+static uint32_t DML_bswap32(uint32_t x)
+{
+#if defined(__GNUC__)
+  return __builtin_bswap32(x);
+#else
+  return (x >> 24 & 0x000000ff) | (x >> 8 & 0x0000ff00) |
+    (x << 8 & 0x00ff0000) | (x << 24 & 0xff000000);
+#endif
+}
+
+/* Swap nbytes/word_size words.  The 64-bit case exchanges and swaps
+   the two halves in the same pass. */
+static void byterevn_scalar(char *dst, const char *src, size_t nbytes,
+			    int word_size)
+{
+  uint32_t a, b;
+  size_t j;
+
+  if(word_size == 4){
+    for(j = 0; j + 4 <= nbytes; j += 4){
+      memcpy(&a, src + j, 4);
+      a = DML_bswap32(a);
+      memcpy(dst + j, &a, 4);
+    }
+  }
+  else if(word_size == 8){
+    for(j = 0; j + 8 <= nbytes; j += 8){
+      memcpy(&a, src + j, 4);
+      memcpy(&b, src + j + 4, 4);
+      a = DML_bswap32(a);
+      b = DML_bswap32(b);
+      memcpy(dst + j, &b, 4);
+      memcpy(dst + j + 4, &a, 4);
+    }
+  }
+}
+
+/*------------------------------------------------------------------*/
+/* Shuffle kernels.  Each vector is loaded before it is stored, so
+   in-place operation is safe.  The remainder goes to the portable
+   kernel.  The wide kernels finish their own 16-byte blocks and
+   clear the upper register halves rather than call the SSE kernel,
+   because mixing VEX and legacy SSE code costs a state transition on
+   each call. */
+
+#if !defined(QIO_DISABLE_SIMD_BYTEREVN) && defined(__GNUC__) && \
+    defined(__x86_64__) && !defined(__NVCOMPILER)
+#define DML_BYTEREVN_HAVE_X86
+#include <immintrin.h>
+
+#define BYTEREVN_MASK128(w) ((w) == 4 ?					\
+  _mm_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12) :		\
+  _mm_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8))
+
+#define BYTEREVN_TAIL128(dst,src,j,nbytes,mask)				\
+  for(; j + 16 <= nbytes; j += 16)					\
+    _mm_storeu_si128((__m128i *)(dst + j),				\
+      _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + j)), mask))
+
+__attribute__((target("ssse3")))
+static void byterevn_ssse3(char *dst, const char *src, size_t nbytes,
+			   int word_size)
+{
+  const __m128i mask = BYTEREVN_MASK128(word_size);
+  __m128i v0, v1;
+  size_t j = 0;
+
+  for(; j + 32 <= nbytes; j += 32){
+    v0 = _mm_loadu_si128((const __m128i *)(src + j));
+    v1 = _mm_loadu_si128((const __m128i *)(src + j + 16));
+    _mm_storeu_si128((__m128i *)(dst + j), _mm_shuffle_epi8(v0, mask));
+    _mm_storeu_si128((__m128i *)(dst + j + 16), _mm_shuffle_epi8(v1, mask));
+  }
+  BYTEREVN_TAIL128(dst, src, j, nbytes, mask);
+  byterevn_scalar(dst + j, src + j, nbytes - j, word_size);
+}
+
+__attribute__((target("avx2")))
+static void byterevn_avx2(char *dst, const char *src, size_t nbytes,
+			  int word_size)
+{
+  /* vpshufb shuffles within each 128-bit lane */
+  const __m128i mask128 = BYTEREVN_MASK128(word_size);
+  const __m256i mask = _mm256_broadcastsi128_si256(mask128);
+  __m256i v0, v1;
+  size_t j = 0;
+
+  for(; j + 64 <= nbytes; j += 64){
+    v0 = _mm256_loadu_si256((const __m256i *)(src + j));
+    v1 = _mm256_loadu_si256((const __m256i *)(src + j + 32));
+    _mm256_storeu_si256((__m256i *)(dst + j), _mm256_shuffle_epi8(v0, mask));
+    _mm256_storeu_si256((__m256i *)(dst + j + 32),
+			_mm256_shuffle_epi8(v1, mask));
+  }
+  for(; j + 32 <= nbytes; j += 32){
+    v0 = _mm256_loadu_si256((const __m256i *)(src + j));
+    _mm256_storeu_si256((__m256i *)(dst + j), _mm256_shuffle_epi8(v0, mask));
+  }
+  BYTEREVN_TAIL128(dst, src, j, nbytes, mask128);
+  _mm256_zeroupper();
+  byterevn_scalar(dst + j, src + j, nbytes - j, word_size);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void byterevn_avx512(char *dst, const char *src, size_t nbytes,
+			    int word_size)
+{
+  const __m128i mask128 = BYTEREVN_MASK128(word_size);
+  const __m512i mask = _mm512_broadcast_i32x4(mask128);
+  __m512i v0, v1;
+  size_t j = 0;
+
+  for(; j + 128 <= nbytes; j += 128){
+    v0 = _mm512_loadu_si512((const void *)(src + j));
+    v1 = _mm512_loadu_si512((const void *)(src + j + 64));
+    _mm512_storeu_si512((void *)(dst + j), _mm512_shuffle_epi8(v0, mask));
+    _mm512_storeu_si512((void *)(dst + j + 64), _mm512_shuffle_epi8(v1, mask));
+  }
+  for(; j + 64 <= nbytes; j += 64){
+    v0 = _mm512_loadu_si512((const void *)(src + j));
+    _mm512_storeu_si512((void *)(dst + j), _mm512_shuffle_epi8(v0, mask));
+  }
+  BYTEREVN_TAIL128(dst, src, j, nbytes, mask128);
+  _mm256_zeroupper();
+  byterevn_scalar(dst + j, src + j, nbytes - j, word_size);
+}
+
+#elif !defined(QIO_DISABLE_SIMD_BYTEREVN) && defined(__ARM_NEON) && \
+    defined(__aarch64__)
+#define DML_BYTEREVN_HAVE_NEON
+#include <arm_neon.h>
+
+/* Advanced SIMD is part of the base aarch64 instruction set */
+static void byterevn_neon(char *dst, const char *src, size_t nbytes,
+			  int word_size)
+{
+  uint8x16_t v0, v1;
+  size_t j = 0;
+
+  if(word_size == 4){
+    for(; j + 32 <= nbytes; j += 32){
+      v0 = vld1q_u8((const uint8_t *)(src + j));
+      v1 = vld1q_u8((const uint8_t *)(src + j + 16));
+      vst1q_u8((uint8_t *)(dst + j), vrev32q_u8(v0));
+      vst1q_u8((uint8_t *)(dst + j + 16), vrev32q_u8(v1));
+    }
+  }
+  else if(word_size == 8){
+    for(; j + 32 <= nbytes; j += 32){
+      v0 = vld1q_u8((const uint8_t *)(src + j));
+      v1 = vld1q_u8((const uint8_t *)(src + j + 16));
+      vst1q_u8((uint8_t *)(dst + j), vrev64q_u8(v0));
+      vst1q_u8((uint8_t *)(dst + j + 16), vrev64q_u8(v1));
+    }
+  }
+  byterevn_scalar(dst + j, src + j, nbytes - j, word_size);
+}
+
+#endif
+
+/*------------------------------------------------------------------*/
+/* Kernel selection.  DML_BYTEREVN_AUTO picks the widest shuffle the
+   CPU supports. */
+
+static byterevn_kernel_t byterevn_kernel = NULL;
+static int byterevn_engine_id = DML_BYTEREVN_AUTO;
+
+int DML_byterevn_select(int engine)
+{
+#ifdef DML_BYTEREVN_HAVE_X86
+  __builtin_cpu_init();
+  if(engine == DML_BYTEREVN_AUTO){
+    if(__builtin_cpu_supports("avx512bw"))engine = DML_BYTEREVN_AVX512;
+    else if(__builtin_cpu_supports("avx2"))engine = DML_BYTEREVN_AVX2;
+    else if(__builtin_cpu_supports("ssse3"))engine = DML_BYTEREVN_SSSE3;
+    else engine = DML_BYTEREVN_SCALAR;
+  }
+#elif defined(DML_BYTEREVN_HAVE_NEON)
+  if(engine == DML_BYTEREVN_AUTO)engine = DML_BYTEREVN_NEON;
+#else
+  if(engine == DML_BYTEREVN_AUTO)engine = DML_BYTEREVN_SCALAR;
+#endif
+
+  switch(engine){
+  case DML_BYTEREVN_SCALAR:
+    byterevn_kernel = byterevn_scalar;
+    break;
+#ifdef DML_BYTEREVN_HAVE_X86
+  case DML_BYTEREVN_SSSE3:
+    if(!__builtin_cpu_supports("ssse3"))return -1;
+    byterevn_kernel = byterevn_ssse3;
+    break;
+  case DML_BYTEREVN_AVX2:
+    if(!__builtin_cpu_supports("avx2"))return -1;
+    byterevn_kernel = byterevn_avx2;
+    break;
+  case DML_BYTEREVN_AVX512:
+    if(!__builtin_cpu_supports("avx512bw"))return -1;
+    byterevn_kernel = byterevn_avx512;
+    break;
+#endif
+#ifdef DML_BYTEREVN_HAVE_NEON
+  case DML_BYTEREVN_NEON:
+    byterevn_kernel = byterevn_neon;
+    break;
+#endif
+  default:
+    return -1;
+  }
+  byterevn_engine_id = engine;
+  return engine;
+}
+
+int DML_byterevn_engine(void)
+{
+  if(byterevn_kernel == NULL)DML_byterevn_select(DML_BYTEREVN_AUTO);
+  return byterevn_engine_id;
+}
+
+const char *DML_byterevn_engine_name(int engine)
+{
+  switch(engine){
+  case DML_BYTEREVN_AUTO:   return "auto";
+  case DML_BYTEREVN_SCALAR: return "scalar";
+  case DML_BYTEREVN_SSSE3:  return "ssse3";
+  case DML_BYTEREVN_AVX2:   return "avx2";
+  case DML_BYTEREVN_AVX512: return "avx512";
+  case DML_BYTEREVN_NEON:   return "neon";
+  default:                  return "unknown";
+  }
+}
+
+/*------------------------------------------------------------------*/
+/* Do byte reversal on n contiguous 32-bit words */
+void DML_byterevn32(uint32_t w[], size_t n)
+{
+  if(byterevn_kernel == NULL)DML_byterevn_select(DML_BYTEREVN_AUTO);
+  byterevn_kernel((char *)w, (const char *)w, 4*n, 4);
+}
+
+/* Do byte reversal on n contiguous 64-bit words */
+void DML_byterevn64(uint32_t w[], size_t n)
+{
+  if(byterevn_kernel == NULL)DML_byterevn_select(DML_BYTEREVN_AUTO);
+  byterevn_kernel((char *)w, (const char *)w, 8*n, 8);
+}
+
+/* Do byte reversal on size bytes of contiguous words,
+   each word consisting of word_size bytes
+   word_size = 1, 4 or 8 are the only choices. */
+
+void DML_byterevn(void *buf, size_t size, int word_size)
+{
+  if(word_size == 1) {
+    /* NOP */
+  }
+  else if(word_size == 4 || word_size == 8) {
+    if(byterevn_kernel == NULL)DML_byterevn_select(DML_BYTEREVN_AUTO);
+    byterevn_kernel((char *)buf, (const char *)buf,
+		    size - size % word_size, word_size);
+  }
+  else{
+    printf("DML_byterevn: illegal word_size %d\n",word_size);
+  }
+}
+
+/* Copy size bytes from src to dst reversing the bytes in each word
+   on the way.  Does in one pass what memcpy followed by DML_byterevn
+   does in two.  The buffers must not overlap unless dst == src. */
+
+void DML_copy_byterevn(void *dst, const void *src, size_t size, int word_size)
+{
+  size_t nbytes;
+
+  if(word_size != 4 && word_size != 8){
+    if(word_size != 1)
+      printf("DML_copy_byterevn: illegal word_size %d\n",word_size);
+    if(dst != src)memcpy(dst, src, size);
+    return;
+  }
+
+  if(byterevn_kernel == NULL)DML_byterevn_select(DML_BYTEREVN_AUTO);
+  nbytes = size - size % word_size;
+  byterevn_kernel((char *)dst, (const char *)src, nbytes, word_size);
+  if(nbytes < size && dst != src)
+    memcpy((char *)dst + nbytes, (const char *)src + nbytes, size - nbytes);
+}
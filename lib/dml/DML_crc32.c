@@ -40,6 +40,7 @@
 
 #include <qio_stdint.h>
 #include <stdlib.h>
+#include <dml.h>
 typedef uint32_t uLong;            /* At least 32 bits */
 typedef unsigned char Byte;
 typedef Byte Bytef;
@@ -180,14 +181,13 @@ static uLongf *get_crc_table()
 #define DO8(buf)  DO4(buf); DO4(buf);
 
 /* ========================================================================= */
-uint32_t DML_crc32(uint32_t crc, const unsigned char *buf, size_t len)
+/* The original byte-at-a-time routine.  Kept as the reference engine
+   and as the fallback for the others.  Operates on the pre-inverted
+   crc register. */
+
+local uint32_t crc32_bytewise(uint32_t crc, const unsigned char *buf,
+			      size_t len)
 {
-    if (buf == Z_NULL) return 0L;
-#ifdef DYNAMIC_CRC_TABLE
-    if (crc_table_empty)
-      make_crc_table();
-#endif
-    crc = crc ^ 0xffffffffL;
     while (len >= 8)
     {
       DO8(buf);
@@ -196,5 +196,353 @@ uint32_t DML_crc32(uint32_t crc, const unsigned char *buf, size_t len)
     if (len) do {
       DO1(buf);
     } while (--len);
+    return crc;
+}
+
+/* ========================================================================= */
+/* Slicing tables.  crc_slice[0] is crc_table and crc_slice[k][n] is the
+   crc of byte n followed by k zero bytes, so k+1 bytes can be folded
+   in with k+1 independent lookups.  Built once from crc_table. */
+
+#define DML_CRC32_SLICES 16
+local uint32_t crc_slice[DML_CRC32_SLICES][256];
+local int crc_slice_empty = 1;
+
+local void make_crc_slice_table(void)
+{
+  int n, k;
+  uint32_t c;
+
+#ifdef DYNAMIC_CRC_TABLE
+  if (crc_table_empty) make_crc_table();
+#endif
+  for (n = 0; n < 256; n++)
+    crc_slice[0][n] = crc_table[n];
+  for (n = 0; n < 256; n++)
+  {
+    c = crc_slice[0][n];
+    for (k = 1; k < DML_CRC32_SLICES; k++)
+    {
+      c = crc_table[c & 0xff] ^ (c >> 8);
+      crc_slice[k][n] = c;
+    }
+  }
+  crc_slice_empty = 0;
+}
+
+/* Assemble a little-endian word byte by byte so the slicing code gives
+   the same answer on either byte order */
+#define LE32(p) ((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | \
+                 ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+
+local uint32_t crc32_slice8(uint32_t crc, const unsigned char *buf,
+			    size_t len)
+{
+    const uint32_t (*t)[256] = (const uint32_t (*)[256])crc_slice;
+
+    while (len >= 8)
+    {
+      crc ^= LE32(buf);
+      crc = t[7][crc & 0xff] ^ t[6][(crc >> 8) & 0xff] ^
+	    t[5][(crc >> 16) & 0xff] ^ t[4][crc >> 24] ^
+	    t[3][buf[4]] ^ t[2][buf[5]] ^ t[1][buf[6]] ^ t[0][buf[7]];
+      buf += 8;
+      len -= 8;
+    }
+    return crc32_bytewise(crc, buf, len);
+}
+
+local uint32_t crc32_slice16(uint32_t crc, const unsigned char *buf,
+			     size_t len)
+{
+    const uint32_t (*t)[256] = (const uint32_t (*)[256])crc_slice;
+
+    while (len >= 16)
+    {
+      crc ^= LE32(buf);
+      crc = t[15][crc & 0xff] ^ t[14][(crc >> 8) & 0xff] ^
+	    t[13][(crc >> 16) & 0xff] ^ t[12][crc >> 24] ^
+	    t[11][buf[4]] ^ t[10][buf[5]] ^ t[9][buf[6]] ^ t[8][buf[7]] ^
+	    t[7][buf[8]] ^ t[6][buf[9]] ^ t[5][buf[10]] ^ t[4][buf[11]] ^
+	    t[3][buf[12]] ^ t[2][buf[13]] ^ t[1][buf[14]] ^ t[0][buf[15]];
+      buf += 16;
+      len -= 16;
+    }
+    return crc32_slice8(crc, buf, len);
+}
+
+/* ========================================================================= */
+/* Hardware engines.  Compiled with per-function target attributes so
+   the rest of the library keeps the default instruction set; they are
+   only called after the runtime CPU check passes.  Define
+   QIO_DISABLE_HW_CRC32 to leave them out. */
+
+#if !defined(QIO_DISABLE_HW_CRC32) && defined(__GNUC__) && \
+    defined(__x86_64__) && !defined(__NVCOMPILER)
+#define DML_CRC32_HAVE_PCLMUL
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+/* Carry-less multiply folding (Gopal et al., "Fast CRC Computation for
+   Generic Polynomials Using PCLMULQDQ Instruction", Intel 2009).  The
+   constants are the bit-reflected x^n mod P folding factors for the
+   0xedb88320 polynomial and the Barrett reduction pair.  Requires
+   len >= 64 and a multiple of 16. */
+
+__attribute__((target("sse2,pclmul")))
+local uint32_t crc32_pclmul_fold(uint32_t crc, const unsigned char *buf,
+				 size_t len)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000LL, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = k1k2;
+    buf += 64;
+    len -= 64;
+
+    /* Fold four lanes of 64 bytes in parallel */
+    while (len >= 64)
+    {
+      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+      x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+      x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+      x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+      x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+      x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+      x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+      x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+      y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+      y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+      y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+      y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+      x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+      x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+      x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+      x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+      buf += 64;
+      len -= 64;
+    }
+
+    /* Fold the four lanes into one */
+    x0 = k3k4;
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Remaining 16-byte blocks */
+    while (len >= 16)
+    {
+      x2 = _mm_loadu_si128((const __m128i *)buf);
+      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+      x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+      x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+      buf += 16;
+      len -= 16;
+    }
+
+    /* 128 -> 64 bits */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = k5k0;
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction to 32 bits */
+    x0 = poly;
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+local uint32_t crc32_hw(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    size_t chunk;
+
+    if (len >= 64)
+    {
+      chunk = len & ~(size_t)15;
+      crc = crc32_pclmul_fold(crc, buf, chunk);
+      buf += chunk;
+      len -= chunk;
+    }
+    return crc32_slice8(crc, buf, len);
+}
+
+local int crc32_hw_available(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+}
+
+#define DML_CRC32_HW_NAME "pclmul"
+
+#elif !defined(QIO_DISABLE_HW_CRC32) && defined(__GNUC__) && \
+    defined(__aarch64__) && defined(__linux__)
+#define DML_CRC32_HAVE_ARMV8
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+
+/* ARMv8 CRC32 instructions implement exactly the 0xedb88320 reflected
+   polynomial, so they can be fed the zlib register directly */
+
+__attribute__((target("+crc")))
+local uint32_t crc32_hw(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    uint64_t w;
+
+    while (len && ((uintptr_t)buf & 7))
+    {
+      crc = __crc32b(crc, *buf++);
+      len--;
+    }
+    while (len >= 32)
+    {
+      crc = __crc32d(crc, *(const uint64_t *)(buf + 0));
+      crc = __crc32d(crc, *(const uint64_t *)(buf + 8));
+      crc = __crc32d(crc, *(const uint64_t *)(buf + 16));
+      crc = __crc32d(crc, *(const uint64_t *)(buf + 24));
+      buf += 32;
+      len -= 32;
+    }
+    while (len >= 8)
+    {
+      w = *(const uint64_t *)buf;
+      crc = __crc32d(crc, w);
+      buf += 8;
+      len -= 8;
+    }
+    while (len--)
+      crc = __crc32b(crc, *buf++);
+    return crc;
+}
+
+local int crc32_hw_available(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#define DML_CRC32_HW_NAME "armv8-crc32"
+
+#endif
+
+/* ========================================================================= */
+/* Engine selection.  DML_CRC32_AUTO picks the hardware engine when the
+   CPU has one and slice-by-8 otherwise.  Every engine computes the same
+   crc, so the choice only affects speed. */
+
+typedef uint32_t (*crc32_engine_t)(uint32_t crc, const unsigned char *buf,
+				   size_t len);
+
+local crc32_engine_t crc32_engine = Z_NULL;
+local int crc32_engine_id = DML_CRC32_AUTO;
+
+int DML_crc32_select(int engine)
+{
+    if (crc_slice_empty)
+      make_crc_slice_table();
+
+    if (engine == DML_CRC32_AUTO)
+    {
+#if defined(DML_CRC32_HAVE_PCLMUL) || defined(DML_CRC32_HAVE_ARMV8)
+      engine = crc32_hw_available() ? DML_CRC32_HW : DML_CRC32_SLICE8;
+#else
+      engine = DML_CRC32_SLICE8;
+#endif
+    }
+
+    switch (engine)
+    {
+    case DML_CRC32_BYTEWISE:
+      crc32_engine = crc32_bytewise;
+      break;
+    case DML_CRC32_SLICE8:
+      crc32_engine = crc32_slice8;
+      break;
+    case DML_CRC32_SLICE16:
+      crc32_engine = crc32_slice16;
+      break;
+#if defined(DML_CRC32_HAVE_PCLMUL) || defined(DML_CRC32_HAVE_ARMV8)
+    case DML_CRC32_HW:
+      if (!crc32_hw_available())
+	return -1;
+      crc32_engine = crc32_hw;
+      break;
+#endif
+    default:
+      return -1;
+    }
+    crc32_engine_id = engine;
+    return engine;
+}
+
+int DML_crc32_engine(void)
+{
+    if (crc32_engine == Z_NULL) DML_crc32_select(DML_CRC32_AUTO);
+    return crc32_engine_id;
+}
+
+const char *DML_crc32_engine_name(int engine)
+{
+    switch (engine)
+    {
+    case DML_CRC32_AUTO:     return "auto";
+    case DML_CRC32_BYTEWISE: return "bytewise";
+    case DML_CRC32_SLICE8:   return "slice-by-8";
+    case DML_CRC32_SLICE16:  return "slice-by-16";
+#ifdef DML_CRC32_HW_NAME
+    case DML_CRC32_HW:       return DML_CRC32_HW_NAME;
+#else
+    case DML_CRC32_HW:       return "hardware";
+#endif
+    default:                 return "unknown";
+    }
+}
+
+/* ========================================================================= */
+uint32_t DML_crc32(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    if (buf == Z_NULL) return 0L;
+    if (crc32_engine == Z_NULL) DML_crc32_select(DML_CRC32_AUTO);
+    crc = crc ^ 0xffffffffL;
+    crc = crc32_engine(crc, buf, len);
+    return crc ^ 0xffffffffL;
+}
+
+/* The original byte-at-a-time crc, independent of the selected engine */
+uint32_t DML_crc32_bytewise(uint32_t crc, const unsigned char *buf,
+			    size_t len)
+{
+    if (buf == Z_NULL) return 0L;
+#ifdef DYNAMIC_CRC_TABLE
+    if (crc_table_empty)
+      make_crc_table();
+#endif
+    crc = crc ^ 0xffffffffL;
+    crc = crc32_bytewise(crc, buf, len);
     return crc ^ 0xffffffffL;
 }
@@ -0,0 +1,406 @@
+/* DML_iothreads.c */
+/* Threads sharing the I/O of a file that holds only this node's sites */
+
+/* A node writing or reading a multifile, or the file of a partition
+   of one node, exchanges no messages.  Its record is then cut into
+   consecutive byte ranges, one for each I/O thread.  Each thread
+   fetches or stores the sites of its range, reorders and checksums
+   them and writes or reads them with positioned LRL calls, using
+   buffers of its own.  The checksums of the ranges are combined at
+   the end.
+
+   The threads share the file handle, so this is done only when the
+   LRL backend allows positioned transfers from several threads at
+   once.  The get and put functions and the layout functions are then
+   called from several threads at once for different sites.  Without
+   thread support, or with one I/O thread, records take the usual
+   route. */
+
+#include <qio_config.h>
+#include <qio.h>
+#include <dml.h>
+#include <lrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef QIO_USE_DML_IO_THREADS
+#include <pthread.h>
+#endif
+
+typedef struct {
+  /* The same for every thread */
+  LRL_RecordWriter *lrl_record_out;
+  LRL_RecordReader *lrl_record_in;
+  void (*xfer)(char *buf, size_t first, size_t nsites, int count,
+	       void *arg);
+  int count;
+  size_t size;
+  int word_size;
+  void *arg;
+  DML_Layout *layout;
+  DML_SiteList *sites;       /* Null if the file is in storage order */
+
+  /* This thread's file positions and results */
+  size_t first;
+  size_t nsites;
+  DML_Checksum checksum;
+  uint64_t nbytes;
+  int status;                /* Nonzero after a failure */
+#ifdef QIO_USE_DML_IO_THREADS
+  pthread_t thread;
+  int started;
+#endif
+} DML_IOThread;
+
+#ifdef QIO_USE_DML_IO_THREADS
+static int DML_io_threads = DML_IO_THREADS;
+#else
+static int DML_io_threads = 1;
+#endif
+
+/* Set the number of threads sharing the I/O of a node's own file.
+   Returns the old value. */
+int DML_set_io_threads(int nthreads){
+  int old = DML_io_threads;
+  DML_io_threads = nthreads < 1 ? 1 : nthreads;
+  return old;
+}
+
+/* Number of threads to share a record of "size" bytes per site, or 1
+   if it takes the usual route: the file holds other nodes' sites, the
+   record is a subset, the backend can't be shared or there is too
+   little to share.  concurrent tells whether the backend can be
+   shared.  A null sitelist stands for all sites of the node in
+   storage order. */
+int DML_local_io_threads(DML_Layout *layout, DML_SiteList *sites,
+			 int volfmt, size_t size, int concurrent){
+#ifdef QIO_USE_DML_IO_THREADS
+  int this_node = layout->this_node;
+  size_t nsites = layout->sites_on_node, n;
+
+  if(DML_io_threads < 2 || !concurrent || size == 0)return 1;
+  if(sites != NULL){
+    if(sites->use_subset)return 1;
+    if(volfmt != DML_MULTIFILE &&
+       !((volfmt == DML_PARTFILE || volfmt == DML_PARTFILE_DIR) &&
+	 layout->ionode(this_node) == this_node &&
+	 sites->number_of_my_ionodes == 1))
+      return 1;
+    nsites = sites->number_of_io_sites;
+  }
+
+  /* Every thread gets at least a full buffer */
+  n = nsites*size/DML_BUF_BYTES;
+  if(n < 1)return 1;
+  if(n < (size_t)DML_io_threads)return (int)n;
+  return DML_io_threads;
+#else
+  (void)layout; (void)sites; (void)volfmt; (void)size; (void)concurrent;
+  return 1;
+#endif
+}
+
+/* Rank of the site at list position pos.  As DML_sitelist_rank, but
+   the interval used last is kept in *cur for this thread alone. */
+static DML_SiteRank DML_io_thread_rank(DML_SiteList *sites, size_t pos,
+				       size_t *cur){
+  DML_SiteInterval *iv = sites->intervals;
+  size_t lo = *cur, hi, mid, m = sites->number_of_intervals;
+
+  if(!sites->use_list)return sites->first + (DML_SiteRank)pos;
+  if(iv == NULL)return sites->list[pos];
+
+  if(pos < iv[lo].start_pos || pos >= iv[lo].start_pos + iv[lo].length){
+    if(lo + 1 < m && pos >= iv[lo+1].start_pos &&
+       pos < iv[lo+1].start_pos + iv[lo+1].length)
+      lo++;
+    else {
+      lo = 0; hi = m;
+      while(hi - lo > 1){
+	mid = (lo + hi)/2;
+	if(iv[mid].start_pos <= pos)lo = mid;
+	else hi = mid;
+      }
+    }
+    *cur = lo;
+  }
+  return iv[lo].start_rank + (DML_SiteRank)(pos - iv[lo].start_pos);
+}
+
+/* Lexicographic rank and storage index of the n sites at file
+   positions pos ... pos+n-1.  The layout is asked directly, since the
+   site map and run table keep a cursor. */
+static void DML_io_thread_locate(DML_IOThread *t, size_t pos, size_t n,
+				 DML_SiteRank ranks[], DML_Index index[],
+				 int coords[], size_t *cur){
+  DML_Layout *layout = t->layout;
+  size_t j;
+
+  for(j = 0; j < n; j++){
+    if(t->sites == NULL){
+      index[j] = pos + j;
+      layout->get_coords_ext(coords, layout->this_node, index[j],
+			     layout->arg);
+      ranks[j] = DML_lex_rank(coords, layout->latdim, layout->latsize);
+    }
+    else {
+      ranks[j] = DML_io_thread_rank(t->sites, pos + j, cur);
+      DML_lex_coords(coords, layout->latdim, layout->latsize, ranks[j]);
+      index[j] = layout->node_index_ext(coords, layout->arg);
+    }
+  }
+}
+
+/* Get or put the n sites of the buffer a storage run at a time */
+static void DML_io_thread_xfer(DML_IOThread *t, char *buf,
+			       const DML_Index index[], size_t n){
+  size_t i, m;
+
+  for(i = 0; i < n; i += m){
+    for(m = 1; i + m < n && index[i+m] == index[i] + m; m++);
+    t->xfer(buf + i*t->size, index[i], m, t->count, t->arg);
+  }
+}
+
+/* Write this thread's part of the record */
+static void *DML_io_thread_out(void *arg){
+  DML_IOThread *t = (DML_IOThread *)arg;
+  size_t size = t->size, end = t->first + t->nsites, cur = 0;
+  size_t pos, buf_sites, max_buf_sites;
+  DML_SiteRank *ranks;
+  DML_Index *index;
+  uint64_t wrote;
+  char *lbuf;
+  int *coords;
+
+  max_buf_sites = DML_max_buf_sites(size,1);
+  if(max_buf_sites < 1) max_buf_sites = 1;
+  lbuf = DML_allocate_buf(size, &max_buf_sites,
+			  LRL_write_alignment(t->lrl_record_out));
+  ranks = (DML_SiteRank *)malloc(max_buf_sites*sizeof(DML_SiteRank));
+  index = (DML_Index *)malloc(max_buf_sites*sizeof(DML_Index));
+  coords = DML_allocate_coords(t->layout->latdim, "DML_io_thread_out",
+			       t->layout->this_node);
+  DML_checksum_init(&t->checksum);
+  if(!lbuf || !ranks || !index || !coords){
+    t->status = 1;
+    free(lbuf); free(ranks); free(index); free(coords);
+    return NULL;
+  }
+
+  for(pos = t->first; pos < end; pos += buf_sites){
+    buf_sites = end - pos;
+    if(buf_sites > max_buf_sites) buf_sites = max_buf_sites;
+
+    DML_io_thread_locate(t, pos, buf_sites, ranks, index, coords, &cur);
+    DML_io_thread_xfer(t, lbuf, index, buf_sites);
+    DML_checksum_byterevn_indexed(&t->checksum, ranks, lbuf, lbuf,
+				  buf_sites, size, t->word_size, DML_TO_FILE);
+
+    wrote = LRL_write_bytes_at(t->lrl_record_out, (off_t)(pos*size),
+			       lbuf, buf_sites*size);
+    t->nbytes += wrote;
+    if(wrote != buf_sites*size){
+      t->status = 1;
+      break;
+    }
+  }
+
+  free(lbuf); free(ranks); free(index); free(coords);
+  return NULL;
+}
+
+/* Read this thread's part of the record */
+static void *DML_io_thread_in(void *arg){
+  DML_IOThread *t = (DML_IOThread *)arg;
+  size_t size = t->size, end = t->first + t->nsites, cur = 0;
+  size_t pos, buf_sites, max_buf_sites;
+  DML_SiteRank *ranks;
+  DML_Index *index;
+  uint64_t got;
+  char *lbuf;
+  int *coords;
+
+  max_buf_sites = DML_max_buf_sites(size,1);
+  if(max_buf_sites < 1) max_buf_sites = 1;
+  lbuf = DML_allocate_buf(size, &max_buf_sites, 0);
+  ranks = (DML_SiteRank *)malloc(max_buf_sites*sizeof(DML_SiteRank));
+  index = (DML_Index *)malloc(max_buf_sites*sizeof(DML_Index));
+  coords = DML_allocate_coords(t->layout->latdim, "DML_io_thread_in",
+			       t->layout->this_node);
+  DML_checksum_init(&t->checksum);
+  if(!lbuf || !ranks || !index || !coords){
+    t->status = 1;
+    free(lbuf); free(ranks); free(index); free(coords);
+    return NULL;
+  }
+
+  for(pos = t->first; pos < end; pos += buf_sites){
+    buf_sites = end - pos;
+    if(buf_sites > max_buf_sites) buf_sites = max_buf_sites;
+
+    got = LRL_read_bytes_at(t->lrl_record_in, (off_t)(pos*size),
+			    lbuf, buf_sites*size);
+    t->nbytes += got;
+    if(got != buf_sites*size){
+      t->status = 1;
+      break;
+    }
+
+    DML_io_thread_locate(t, pos, buf_sites, ranks, index, coords, &cur);
+    DML_checksum_byterevn_indexed(&t->checksum, ranks, lbuf, lbuf,
+				  buf_sites, size, t->word_size,
+				  DML_FROM_FILE);
+    DML_io_thread_xfer(t, lbuf, index, buf_sites);
+  }
+
+  free(lbuf); free(ranks); free(index); free(coords);
+  return NULL;
+}
+
+/* Give the threads equal shares of the record and run "work" on
+   them.  The calling thread takes the first share, and any share
+   whose thread could not be started after that.  The checksums are
+   combined into *checksum.  Returns the number of bytes moved, or 0
+   if any thread failed. */
+static uint64_t DML_io_threads_run(DML_IOThread *t, int nthreads,
+				   void *(*work)(void *),
+				   DML_Checksum *checksum){
+  size_t nsites = t[0].sites != NULL ? t[0].sites->number_of_io_sites :
+    t[0].layout->sites_on_node;
+  uint64_t nbytes = 0;
+  int k, status = 0;
+
+  for(k = 0; k < nthreads; k++){
+    t[k] = t[0];
+    t[k].first = nsites*k/nthreads;
+    t[k].nsites = nsites*(k+1)/nthreads - t[k].first;
+  }
+
+#ifdef QIO_USE_DML_IO_THREADS
+  /* The crc32 and byte reversal engines are chosen and their tables
+     built on first use, which is not safe from several threads at
+     once, so settle them here */
+  DML_crc32_engine();
+  DML_byterevn_engine();
+  for(k = 1; k < nthreads; k++)
+    t[k].started = pthread_create(&t[k].thread, NULL, work, t + k) == 0;
+#endif
+  work(t);
+  for(k = 1; k < nthreads; k++){
+#ifdef QIO_USE_DML_IO_THREADS
+    if(t[k].started){
+      pthread_join(t[k].thread, NULL);
+      continue;
+    }
+#endif
+    work(t + k);
+  }
+
+  DML_checksum_init(checksum);
+  for(k = 0; k < nthreads; k++){
+    DML_checksum_peq(checksum, &t[k].checksum);
+    nbytes += t[k].nbytes;
+    status |= t[k].status;
+  }
+  return status ? 0 : nbytes;
+}
+
+/* Set up the threads for a record.  A multifile is in storage order,
+   so its sitelist isn't needed. */
+static DML_IOThread *DML_io_threads_create(int nthreads,
+	   void (*xfer)(char *buf, size_t first, size_t nsites, int count,
+			void *arg),
+	   int count, size_t size, int word_size, void *arg,
+	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	   char *myname){
+  DML_IOThread *t;
+
+  t = (DML_IOThread *)calloc(nthreads, sizeof(DML_IOThread));
+  if(!t){
+    printf("%s(%d) can't malloc %d I/O threads\n",
+	   myname,layout->this_node,nthreads);
+    return NULL;
+  }
+  t->xfer = xfer;
+  t->count = count;
+  t->size = size;
+  t->word_size = word_size;
+  t->arg = arg;
+  t->layout = layout;
+  t->sites = volfmt == DML_MULTIFILE ? NULL : sites;
+  return t;
+}
+
+/*------------------------------------------------------------------*/
+/* Write a record of this node's sites alone with nthreads threads.
+   With a null sitelist the sites are written in storage order.
+
+   Returns the number of bytes written by this node */
+
+uint64_t DML_threaded_out(LRL_RecordWriter *lrl_record_out,
+	   void (*get)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
+	   int count, size_t size, int word_size, void *arg,
+	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	   int nthreads, DML_Checksum *checksum)
+{
+  double dtall;
+  uint64_t nbytes;
+  DML_IOThread *t;
+  char myname[] = "DML_threaded_out";
+
+  dtall = -QIO_time();
+  t = DML_io_threads_create(nthreads, get, count, size, word_size, arg,
+			    layout, sites, volfmt, myname);
+  if(!t)return 0;
+  t->lrl_record_out = lrl_record_out;
+
+  nbytes = DML_io_threads_run(t, nthreads, DML_io_thread_out, checksum);
+  if(nbytes == 0)
+    printf("%s(%d) write error\n",myname,layout->this_node);
+  free(t);
+  dtall += QIO_time();
+
+  if(QIO_verbosity()>=QIO_VERB_LOW && layout->this_node==layout->master_io_node)
+    printf("%s times: total %.2f  threads %d\n", myname, dtall, nthreads);
+
+  /* Number of bytes written by this node only */
+  return nbytes;
+}
+
+/*------------------------------------------------------------------*/
+/* Read a record of this node's sites alone with nthreads threads.
+   With a null sitelist the sites are read in storage order.
+
+   Returns the number of bytes read by this node */
+
+uint64_t DML_threaded_in(LRL_RecordReader *lrl_record_in,
+	  void (*put)(char *buf, size_t first, size_t nsites, int count,
+		      void *arg),
+	  int count, size_t size, int word_size, void *arg,
+	  DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	  int nthreads, DML_Checksum *checksum)
+{
+  double dtall;
+  uint64_t nbytes;
+  DML_IOThread *t;
+  char myname[] = "DML_threaded_in";
+
+  dtall = -QIO_time();
+  t = DML_io_threads_create(nthreads, put, count, size, word_size, arg,
+			    layout, sites, volfmt, myname);
+  if(!t)return 0;
+  t->lrl_record_in = lrl_record_in;
+
+  nbytes = DML_io_threads_run(t, nthreads, DML_io_thread_in, checksum);
+  if(nbytes == 0)
+    printf("%s(%d) read error\n",myname,layout->this_node);
+  free(t);
+  dtall += QIO_time();
+
+  if(QIO_verbosity()>=QIO_VERB_LOW && layout->this_node==layout->master_io_node)
+    printf("%s times: total %.2f  threads %d\n", myname, dtall, nthreads);
+
+  /* Number of bytes read by this node only */
+  return nbytes;
+}
@@ -0,0 +1,366 @@
+/* DML_mpiio.c */
+/* Collective MPI-IO for the payload of singlefile parallel records */
+
+/* The LIME headers and the XML records are written and read as usual
+   by the master I/O node.  Only the binary payload of a lattice field
+   record goes through MPI-IO.  Every node opens the file and sets a
+   view selecting the record positions of its own sites, so no data
+   passes through the I/O nodes.  The sites are then moved a buffer at
+   a time with MPI_File_write_at_all or MPI_File_read_at_all, which
+   lets the MPI library (e.g. ROMIO two-phase collective buffering)
+   combine the pieces from all nodes into large contiguous file
+   accesses.  If the file cannot be opened with MPI-IO on every node
+   the record is moved with DML_partition_out or DML_partition_in. */
+
+#include <qio_config.h>
+
+#ifdef QIO_USE_MPI_IO
+
+#include <qio.h>
+#include <dml.h>
+#include <lrl.h>
+#include <qmp.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  MPI_Comm comm;
+  MPI_File fh;
+  MPI_Datatype sitetype;     /* One site datum */
+  MPI_Datatype filetype;     /* Record positions of our sites */
+  size_t nsites;             /* Our sites in the record */
+  DML_SiteRank *rank;        /* Their ranks, in record order */
+  DML_Index *index;          /* Their storage indices, in record order */
+  char *buf;
+  size_t max_buf_sites;
+  int rounds;                /* Collective calls for the busiest node */
+} DML_Collective;
+
+/* List our sites in record order and describe their positions with
+   the file view.  Returns 0 for success. */
+static int DML_collective_plan(DML_Collective *c, size_t size,
+			       DML_Layout *layout){
+  DML_RecordSite *site;
+  int *blocklens;
+  MPI_Aint *displs;
+  int this_node = layout->this_node;
+  size_t i, n, nruns;
+  int status;
+  char myname[] = "DML_collective_plan";
+
+  /* The view must visit the file in increasing order */
+  site = DML_list_record_sites(layout, &n);
+  if(!site)return 1;
+
+  c->nsites = n;
+  c->rank = (DML_SiteRank *)malloc((n+1)*sizeof(DML_SiteRank));
+  c->index = (DML_Index *)malloc((n+1)*sizeof(DML_Index));
+  blocklens = (int *)malloc((n+1)*sizeof(int));
+  displs = (MPI_Aint *)malloc((n+1)*sizeof(MPI_Aint));
+  if(!c->rank || !c->index || !blocklens || !displs){
+    printf("%s(%d) can't malloc site lists\n",myname,this_node);
+    free(site); free(blocklens); free(displs);
+    return 1;
+  }
+
+  /* Sites consecutive in the record make one block of the view */
+  nruns = 0;
+  for(i = 0; i < n; i++){
+    c->rank[i] = site[i].rank;
+    c->index[i] = site[i].index;
+    if(nruns > 0 && site[i].pos == site[i-1].pos + 1 &&
+       blocklens[nruns-1] < 0x7fffffff)
+      blocklens[nruns-1]++;
+    else {
+      blocklens[nruns] = 1;
+      displs[nruns] = (MPI_Aint)(site[i].pos*size);
+      nruns++;
+    }
+  }
+  free(site);
+
+  status = MPI_Type_contiguous((int)size, MPI_BYTE, &c->sitetype);
+  if(status == MPI_SUCCESS)
+    status = MPI_Type_commit(&c->sitetype);
+  if(status == MPI_SUCCESS && nruns > 0){
+    status = MPI_Type_create_hindexed((int)nruns, blocklens, displs,
+				      c->sitetype, &c->filetype);
+    if(status == MPI_SUCCESS)
+      status = MPI_Type_commit(&c->filetype);
+  }
+  else c->filetype = c->sitetype;
+  free(blocklens);
+  free(displs);
+
+  if(status != MPI_SUCCESS){
+    printf("%s(%d) can't create the file view\n",myname,this_node);
+    return 1;
+  }
+  return 0;
+}
+
+static void DML_collective_free(DML_Collective *c){
+  if(c->filetype != MPI_DATATYPE_NULL && c->filetype != c->sitetype)
+    MPI_Type_free(&c->filetype);
+  if(c->sitetype != MPI_DATATYPE_NULL)
+    MPI_Type_free(&c->sitetype);
+  free(c->rank);
+  free(c->index);
+  free(c->buf);
+}
+
+/* Open the file on all nodes and set our view of the record payload.
+   Only the master I/O node knows the file name and the payload
+   offset.  Returns 0 if every node succeeds, and 1 otherwise. */
+static int DML_collective_open(DML_Collective *c, const char *filename,
+			       off_t offset, int amode, size_t size,
+			       DML_Layout *layout){
+  int this_node = layout->this_node;
+  int master_io_node = layout->master_io_node;
+  int64_t loc[2];
+  char *name = NULL;
+  void *commp;
+  int ok = 1, allok;
+  char myname[] = "DML_collective_open";
+
+  memset(c, 0, sizeof(DML_Collective));
+  c->fh = MPI_FILE_NULL;
+  c->sitetype = MPI_DATATYPE_NULL;
+  c->filetype = MPI_DATATYPE_NULL;
+
+  if(QMP_get_mpi_comm(QMP_comm_get_default(), &commp) != QMP_SUCCESS)
+    return 1;
+  c->comm = *(MPI_Comm *)commp;
+
+  /* Tell the other nodes where the payload is */
+  loc[0] = (int64_t)offset;
+  loc[1] = filename == NULL ? 0 : (int64_t)strlen(filename) + 1;
+  DML_broadcast_bytes((char *)loc, sizeof(loc), this_node, master_io_node);
+  if(loc[1] == 0)return 1;
+  name = (char *)malloc((size_t)loc[1]);
+  if(name == NULL)ok = 0;
+  else if(this_node == master_io_node)strcpy(name, filename);
+  DML_sum_int(&ok);
+  if(ok < layout->number_of_nodes){
+    free(name);
+    return 1;
+  }
+  ok = 1;
+  DML_broadcast_bytes(name, (size_t)loc[1], this_node, master_io_node);
+
+  if(MPI_File_open(c->comm, name, amode, MPI_INFO_NULL, &c->fh)
+     != MPI_SUCCESS){
+    c->fh = MPI_FILE_NULL;
+    ok = 0;
+  }
+  free(name);
+
+  /* Lay out our sites and allocate the buffer */
+  if(ok && DML_collective_plan(c, size, layout) != 0)ok = 0;
+  if(ok){
+    c->max_buf_sites = DML_max_buf_sites(size,1);
+    c->buf = DML_allocate_buf(size, &c->max_buf_sites, 0);
+    if(!c->buf){
+      printf("%s(%d) can't malloc buf\n",myname,this_node);
+      ok = 0;
+    }
+  }
+
+  /* Proceed only if all nodes can */
+  MPI_Allreduce(&ok, &allok, 1, MPI_INT, MPI_MIN, c->comm);
+  if(allok &&
+     MPI_File_set_view(c->fh, (MPI_Offset)loc[0], c->sitetype, c->filetype,
+		       "native", MPI_INFO_NULL) != MPI_SUCCESS){
+    printf("%s(%d) can't set the file view\n",myname,this_node);
+    allok = 0;
+  }
+  if(!allok){
+    if(c->fh != MPI_FILE_NULL)MPI_File_close(&c->fh);
+    DML_collective_free(c);
+    return 1;
+  }
+
+  /* Every node makes the same number of collective calls */
+  c->rounds = (int)((c->nsites + c->max_buf_sites - 1)/c->max_buf_sites);
+  MPI_Allreduce(MPI_IN_PLACE, &c->rounds, 1, MPI_INT, MPI_MAX, c->comm);
+
+  if(QIO_verbosity() >= QIO_VERB_DEBUG)
+    printf("%s(%d): %lu sites in %d rounds\n",myname,this_node,
+	   (unsigned long)c->nsites, c->rounds);
+  return 0;
+}
+
+/* Sites handled in round k */
+static size_t DML_collective_round(DML_Collective *c, int k,
+				   size_t *first){
+  *first = (size_t)k*c->max_buf_sites;
+  if(*first >= c->nsites){
+    *first = c->nsites;
+    return 0;
+  }
+  if(c->nsites - *first < c->max_buf_sites)return c->nsites - *first;
+  return c->max_buf_sites;
+}
+
+/*------------------------------------------------------------------*/
+/* Each node writes its own sites of a singlefile parallel record with
+   collective MPI-IO.  The master I/O node has written the record
+   header.  Returns the checksum and number of bytes written by this
+   node only. */
+
+uint64_t DML_collective_out(LRL_RecordWriter *lrl_record_out,
+	   void (*get)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
+	   int count, size_t size, int word_size, void *arg,
+	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	   int serpar, DML_Checksum *checksum)
+{
+  DML_Collective c;
+  DML_SiteRun run;
+  MPI_Status mpistat;
+  const char *filename = NULL;
+  off_t offset = 0;
+  size_t first, n, i;
+  int this_node = layout->this_node;
+  int k, err = 0;
+  double dtall, dtproc = 0, dtdisk = 0, t;
+  uint64_t nbytes = 0;
+  char myname[] = "DML_collective_out";
+
+  dtall = QIO_time();
+
+  if(this_node == layout->master_io_node &&
+     LRL_get_writer_location(lrl_record_out, &filename, &offset)
+     != LRL_SUCCESS)
+    filename = NULL;
+
+  if(DML_collective_open(&c, filename, offset, MPI_MODE_WRONLY, size,
+			 layout) != 0){
+    if(QIO_verbosity() >= QIO_VERB_DEBUG)
+      printf("%s(%d): falling back to DML_partition_out\n",
+	     myname,this_node);
+    return DML_partition_out(lrl_record_out, get, count, size, word_size,
+			     arg, layout, sites, volfmt, serpar, checksum);
+  }
+
+  DML_checksum_init(checksum);
+
+  run.nsites = 0;
+  for(k = 0; k < c.rounds; k++){
+    n = DML_collective_round(&c, k, &first);
+
+    /* Fetch the sites in record order, reorder and checksum them */
+    t = QIO_time();
+    for(i = 0; i < n; i++)
+      DML_run_add(&run, c.buf + i*size, c.index[first+i], size,
+		  get, count, arg);
+    DML_run_flush(&run, get, count, arg);
+    DML_checksum_byterevn_indexed(checksum, c.rank + first, c.buf, c.buf,
+				  n, size, word_size, DML_TO_FILE);
+    dtproc += QIO_time() - t;
+
+    t = QIO_time();
+    if(MPI_File_write_at_all(c.fh, (MPI_Offset)first, c.buf, (int)n,
+			     c.sitetype, &mpistat) != MPI_SUCCESS){
+      if(!err)printf("%s(%d) write error\n",myname,this_node);
+      err = 1;
+    }
+    else nbytes += (uint64_t)n*size;
+    dtdisk += QIO_time() - t;
+  }
+
+  if(MPI_File_close(&c.fh) != MPI_SUCCESS)err = 1;
+  DML_collective_free(&c);
+  dtall = QIO_time() - dtall;
+
+  if(QIO_verbosity() >= QIO_VERB_LOW && this_node == layout->master_io_node)
+    printf("%s times: process %.2f  disk %.2f  total %.2f\n",
+	   myname, dtproc, dtdisk, dtall);
+
+  /* Number of bytes written by this node only */
+  return err ? 0 : nbytes;
+}
+
+/*------------------------------------------------------------------*/
+/* Each node reads its own sites of a singlefile parallel record with
+   collective MPI-IO.  The master I/O node has read the record header.
+   Returns the checksum and number of bytes read by this node only. */
+
+uint64_t DML_collective_in(LRL_RecordReader *lrl_record_in,
+	  void (*put)(char *buf, size_t first, size_t nsites, int count,
+		      void *arg),
+	  int count, size_t size, int word_size, void *arg,
+	  DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	  int serpar, DML_Checksum *checksum)
+{
+  DML_Collective c;
+  DML_SiteRun run;
+  MPI_Status mpistat;
+  const char *filename = NULL;
+  off_t offset = 0;
+  size_t first, n, i;
+  int this_node = layout->this_node;
+  int k, err = 0;
+  double dtall, dtproc = 0, dtdisk = 0, t;
+  uint64_t nbytes = 0;
+  char myname[] = "DML_collective_in";
+
+  dtall = QIO_time();
+
+  if(this_node == layout->master_io_node &&
+     LRL_get_reader_location(lrl_record_in, &filename, &offset)
+     != LRL_SUCCESS)
+    filename = NULL;
+
+  if(DML_collective_open(&c, filename, offset, MPI_MODE_RDONLY, size,
+			 layout) != 0){
+    if(QIO_verbosity() >= QIO_VERB_DEBUG)
+      printf("%s(%d): falling back to DML_partition_in\n",
+	     myname,this_node);
+    return DML_partition_in(lrl_record_in, put, count, size, word_size,
+			    arg, layout, sites, volfmt, serpar, checksum);
+  }
+
+  DML_checksum_init(checksum);
+
+  run.nsites = 0;
+  for(k = 0; k < c.rounds; k++){
+    n = DML_collective_round(&c, k, &first);
+
+    t = QIO_time();
+    if(MPI_File_read_at_all(c.fh, (MPI_Offset)first, c.buf, (int)n,
+			    c.sitetype, &mpistat) != MPI_SUCCESS){
+      if(!err)printf("%s(%d) read error\n",myname,this_node);
+      err = 1;
+    }
+    dtdisk += QIO_time() - t;
+    /* After a failure we only keep up with the collective calls */
+    if(err)continue;
+    nbytes += (uint64_t)n*size;
+
+    /* Checksum and reorder the sites and store them */
+    t = QIO_time();
+    DML_checksum_byterevn_indexed(checksum, c.rank + first, c.buf, c.buf,
+				  n, size, word_size, DML_FROM_FILE);
+    for(i = 0; i < n; i++)
+      DML_run_add(&run, c.buf + i*size, c.index[first+i], size,
+		  put, count, arg);
+    DML_run_flush(&run, put, count, arg);
+    dtproc += QIO_time() - t;
+  }
+
+  if(MPI_File_close(&c.fh) != MPI_SUCCESS)err = 1;
+  DML_collective_free(&c);
+  dtall = QIO_time() - dtall;
+
+  if(QIO_verbosity() >= QIO_VERB_LOW && this_node == layout->master_io_node)
+    printf("%s times: process %.2f  disk %.2f  total %.2f\n",
+	   myname, dtproc, dtdisk, dtall);
+
+  /* Number of bytes read by this node only */
+  return err ? 0 : nbytes;
+}
+
+#endif /* QIO_USE_MPI_IO */
@@ -54,17 +54,224 @@ int DML_get_bytes(char *buf, size_t size, int fromnode){
 }
 
 
+/* Send to one node while receiving from another.  Either size may be
+   zero.  Pairs of nodes calling this for each other can't deadlock. */
+int DML_exchange_bytes(char *sendbuf, size_t sendsize, int tonode,
+		       char *recvbuf, size_t recvsize, int fromnode){
+  QMP_msgmem_t mm[2];
+  QMP_msghandle_t mh[2];
+  int i, n = 0;
+
+  if(recvsize > 0){
+    mm[n] = QMP_declare_msgmem(recvbuf, recvsize);
+    mh[n] = QMP_declare_receive_from(mm[n], fromnode, 0);
+    QMP_start(mh[n]);
+    n++;
+  }
+  if(sendsize > 0){
+    mm[n] = QMP_declare_msgmem(sendbuf, sendsize);
+    mh[n] = QMP_declare_send_to(mm[n], tonode, 0);
+    QMP_start(mh[n]);
+    n++;
+  }
+  for(i = 0; i < n; i++){
+    QMP_wait(mh[i]);
+    QMP_free_msghandle(mh[i]);
+    QMP_free_msgmem(mm[i]);
+  }
+  return 0;
+}
+
+/* Nonblocking messages.  DML_wait_bytes or DML_wait_any completes the
+   request and returns it to a pool.  Pooled requests keep their QMP
+   handles, so a message repeating the buffer, size, peer and
+   direction of a finished one is started again without declaring
+   anything.  DML_free_requests releases the pool and must be called
+   before the buffers are freed. */
+#define DML_REQUEST_POOL 64
+
+struct DML_Request {
+  QMP_msgmem_t mm;
+  QMP_msghandle_t mh;
+  char *buf;
+  size_t size;
+  int node;
+  int send;
+};
+
+static DML_Request *DML_request_pool[DML_REQUEST_POOL];
+static int DML_requests_pooled = 0;
+
+static void DML_release_request(DML_Request *req){
+  QMP_free_msghandle(req->mh);
+  QMP_free_msgmem(req->mm);
+  free(req);
+}
+
+static DML_Request *DML_start_bytes(char *buf, size_t size, int node,
+				    int send){
+  DML_Request *req = NULL;
+  int i;
+
+  /* Prefer a pooled request for the same message, else the oldest */
+  for(i = DML_requests_pooled - 1; i >= 0; i--){
+    req = DML_request_pool[i];
+    if(req->buf == buf && req->size == size && req->node == node &&
+       req->send == send)break;
+  }
+  if(i < 0 && DML_requests_pooled > 0)i = 0;
+
+  if(i >= 0){
+    req = DML_request_pool[i];
+    DML_request_pool[i] = DML_request_pool[--DML_requests_pooled];
+    if(req->buf == buf && req->size == size && req->node == node &&
+       req->send == send){
+      QMP_start(req->mh);
+      return req;
+    }
+    QMP_free_msghandle(req->mh);
+    QMP_free_msgmem(req->mm);
+  }
+  else {
+    req = (DML_Request *)malloc(sizeof(DML_Request));
+    if(!req)return NULL;
+  }
+
+  req->buf = buf;
+  req->size = size;
+  req->node = node;
+  req->send = send;
+  req->mm = QMP_declare_msgmem(buf, size);
+  if(send)
+    req->mh = QMP_declare_send_to(req->mm, node, 0);
+  else
+    req->mh = QMP_declare_receive_from(req->mm, node, 0);
+  QMP_start(req->mh);
+  return req;
+}
+
+DML_Request *DML_isend_bytes(char *buf, size_t size, int tonode){
+  return DML_start_bytes(buf, size, tonode, 1);
+}
+
+DML_Request *DML_irecv_bytes(char *buf, size_t size, int fromnode){
+  return DML_start_bytes(buf, size, fromnode, 0);
+}
+
+int DML_wait_bytes(DML_Request *req){
+  QMP_wait(req->mh);
+  if(DML_requests_pooled < DML_REQUEST_POOL)
+    DML_request_pool[DML_requests_pooled++] = req;
+  else
+    DML_release_request(req);
+  return 0;
+}
+
+/* Wait for any of the n requests.  Completes it, sets its entry to
+   NULL and returns its position, or -1 if all entries are NULL. */
+int DML_wait_any(DML_Request *req[], int n){
+  int i, pending;
+
+  for(;;){
+    pending = 0;
+    for(i = 0; i < n; i++){
+      if(!req[i])continue;
+      pending = 1;
+      if(QMP_is_complete(req[i]->mh)){
+	DML_wait_bytes(req[i]);
+	req[i] = NULL;
+	return i;
+      }
+    }
+    if(!pending)return -1;
+  }
+}
+
+void DML_free_requests(void){
+  while(DML_requests_pooled > 0)
+    DML_release_request(DML_request_pool[--DML_requests_pooled]);
+}
+
+/* Broadcast from any node.  QMP broadcasts from node 0 only, so other
+   roots use a binomial tree of point-to-point messages rooted at
+   from_node.  Large messages go down the tree in pieces, so a node
+   forwards one piece while it receives the next. */
+#define DML_BCAST_CHUNK_BYTES DML_TBUF_BYTES
+#define DML_BCAST_MAX_CHILDREN 32
+
 void DML_broadcast_bytes(char *buf, size_t size, int this_node, int from_node)
 {
-  /* QMP broadcasts from node 0 only!  So move the data there first */
-  if(from_node != 0){
-    if(this_node == from_node)
-      DML_send_bytes(buf, size, 0);
-    if(this_node == 0)
-      DML_get_bytes(buf, size, from_node);
+  int number_of_nodes, rel, parent = -1, nchildren = 0, i;
+  int children[DML_BCAST_MAX_CHILDREN];
+  DML_Request *recv, *sends[2][DML_BCAST_MAX_CHILDREN];
+  size_t nchunks, c, off, len, mask;
+
+  if(from_node == 0){
+    QMP_broadcast(buf, size);
+    return;
+  }
+  number_of_nodes = QMP_get_number_of_nodes();
+  if(number_of_nodes < 2 || size == 0)return;
+
+  /* Position in the tree relative to the root.  A node gets the data
+     from the node that differs in its lowest set bit and passes it on
+     to the nodes that differ in a lower bit. */
+  rel = (this_node - from_node + number_of_nodes) % number_of_nodes;
+  for(mask = 1; mask < (size_t)number_of_nodes; mask <<= 1)
+    if(rel & mask){
+      parent = ((rel - (int)mask) + from_node) % number_of_nodes;
+      break;
+    }
+  for(mask >>= 1; mask > 0; mask >>= 1)
+    if(rel + mask < (size_t)number_of_nodes)
+      children[nchildren++] = (int)((rel + mask + from_node) %
+				    number_of_nodes);
+
+  nchunks = (size + DML_BCAST_CHUNK_BYTES - 1)/DML_BCAST_CHUNK_BYTES;
+  for(i = 0; i < nchildren; i++)
+    sends[0][i] = sends[1][i] = NULL;
+
+  recv = NULL;
+  if(parent >= 0){
+    len = size < DML_BCAST_CHUNK_BYTES ? size : DML_BCAST_CHUNK_BYTES;
+    recv = DML_irecv_bytes(buf, len, parent);
+    if(!recv)DML_get_bytes(buf, len, parent);
+  }
+
+  for(c = 0; c < nchunks; c++){
+    off = c*DML_BCAST_CHUNK_BYTES;
+    len = size - off < DML_BCAST_CHUNK_BYTES ? size - off :
+      DML_BCAST_CHUNK_BYTES;
+
+    /* Finish this piece and ask for the next */
+    if(parent >= 0){
+      if(recv)DML_wait_bytes(recv);
+      recv = NULL;
+      if(c + 1 < nchunks){
+	size_t noff = off + len;
+	size_t nlen = size - noff < DML_BCAST_CHUNK_BYTES ? size - noff :
+	  DML_BCAST_CHUNK_BYTES;
+	recv = DML_irecv_bytes(buf + noff, nlen, parent);
+	if(!recv)DML_get_bytes(buf + noff, nlen, parent);
+      }
+    }
+
+    /* Pass it on, keeping at most two pieces in flight */
+    for(i = 0; i < nchildren; i++){
+      if(sends[c%2][i])DML_wait_bytes(sends[c%2][i]);
+      sends[c%2][i] = DML_isend_bytes(buf + off, len, children[i]);
+      if(!sends[c%2][i])DML_send_bytes(buf + off, len, children[i]);
+    }
   }
-  
-  QMP_broadcast(buf, size);
+
+  for(i = 0; i < nchildren; i++){
+    if(sends[0][i])DML_wait_bytes(sends[0][i]);
+    if(sends[1][i])DML_wait_bytes(sends[1][i]);
+  }
+
+  /* The pooled requests are declared on buf, which may be the
+     caller's stack */
+  DML_free_requests();
 }
 
 int DML_clear_to_send(char *scratch_buf, size_t size, 
@@ -0,0 +1,306 @@
+/* DML_readahead.c */
+/* Read-ahead for the I/O node input buffers */
+
+/* The I/O node queues the reads it will need, each into its own
+   buffer in a ring.  When QIO is built with read-ahead, a separate
+   thread does the queued reads in order while the main thread
+   distributes, reorders and checksums the buffers already read.  A
+   read may start with a seek, so parallel reads of scattered parts of
+   a record are queued the same way.  The main thread waits only for
+   a read that has not finished.  Only the reader thread calls LRL
+   while it runs.  With a ring depth of 1, or without thread support,
+   each read is done as it is queued.
+
+   A file LRL reads through a memory map needs no reader thread.  Each
+   read is done as it is queued by asking the kernel to bring in the
+   pages and noting where they are in the map.  The data are then used
+   in place, and the ring buffers are only a place to reorder them. */
+
+#include <qio_config.h>
+#include <qio.h>
+#include <dml.h>
+#include <lrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef QIO_USE_DML_READ_AHEAD
+#include <pthread.h>
+#endif
+
+typedef struct {
+  DML_SiteRank firstrank;
+  size_t nsites;
+  int doseek;
+  int status;
+} DML_QueuedRead;
+
+struct DML_ReadAhead {
+  LRL_RecordReader *lrl_record_in;
+  size_t size;
+  int this_node;
+
+  int depth;                 /* Buffers in the ring */
+  char **bufs;
+  int mapped;                /* Reads point into a memory map */
+  const char **data;         /* Where the data of each buffer are */
+  DML_QueuedRead *queue;     /* Read for each buffer */
+
+  /* Running counts.  Buffer i % depth holds read i. */
+  size_t submitted;          /* Reads queued */
+  size_t completed;          /* Reads done */
+  size_t waited;             /* Reads handed to the main thread */
+  size_t released;           /* Buffers given back */
+
+  int status;                /* Nonzero after a failed read */
+  double dtdisk;             /* Time spent reading */
+
+#ifdef QIO_USE_DML_READ_AHEAD
+  int threaded;
+  int done;                  /* No more reads will be queued */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t queued;     /* Signals the reader */
+  pthread_cond_t finished;   /* Signals the main thread */
+#endif
+};
+
+static int DML_read_ahead_depth = DML_READ_AHEAD_DEPTH;
+
+/* Set the number of input buffers in the ring.  Returns the old
+   value. */
+int DML_set_read_ahead_depth(int depth){
+  int old = DML_read_ahead_depth;
+  DML_read_ahead_depth = depth < 1 ? 1 : depth;
+  return old;
+}
+
+/* Find the data for buffer i in the map */
+static int DML_read_ahead_map(DML_ReadAhead *ra, size_t i){
+  DML_QueuedRead *r = ra->queue + i % ra->depth;
+  const char **data = ra->data + i % ra->depth;
+  uint64_t nbytes = (uint64_t)r->nsites*ra->size;
+
+  if(r->doseek &&
+     LRL_seek_read_record(ra->lrl_record_in, (off_t)ra->size*r->firstrank)
+     != LRL_SUCCESS)
+    return -1;
+  LRL_advise_read(ra->lrl_record_in, nbytes);
+  *data = LRL_read_bytes_mapped(ra->lrl_record_in, &nbytes);
+  if(*data == NULL || nbytes != (uint64_t)r->nsites*ra->size)return -1;
+  return 0;
+}
+
+/* Do the read for buffer i */
+static int DML_read_ahead_next(DML_ReadAhead *ra, size_t i){
+  DML_QueuedRead *r = ra->queue + i % ra->depth;
+  double dt = QIO_time();
+  int status;
+
+  if(ra->mapped)
+    status = DML_read_ahead_map(ra, i);
+  else
+    status = DML_read_buf(ra->lrl_record_in, ra->bufs[i % ra->depth],
+			  r->firstrank, ra->size, (int)r->nsites, r->doseek);
+  ra->dtdisk += QIO_time() - dt;
+  return status;
+}
+
+#ifdef QIO_USE_DML_READ_AHEAD
+static void *DML_read_ahead_thread(void *arg){
+  DML_ReadAhead *ra = (DML_ReadAhead *)arg;
+  size_t i;
+  int status = 0;
+
+  pthread_mutex_lock(&ra->lock);
+  for(;;){
+    while(ra->completed == ra->submitted && !ra->done)
+      pthread_cond_wait(&ra->queued, &ra->lock);
+    if(ra->completed == ra->submitted)break;
+    i = ra->completed;
+    pthread_mutex_unlock(&ra->lock);
+
+    /* After a failure the rest are not read */
+    if(status == 0)status = DML_read_ahead_next(ra, i);
+
+    pthread_mutex_lock(&ra->lock);
+    ra->queue[i % ra->depth].status = status;
+    ra->completed++;
+    pthread_cond_signal(&ra->finished);
+  }
+  pthread_mutex_unlock(&ra->lock);
+  return NULL;
+}
+#endif
+
+/* Create the ring for reading buffers of up to *max_buf_sites sites
+   of "size" bytes.  *max_buf_sites is reduced if memory is short, and
+   so is the depth. */
+DML_ReadAhead *DML_read_ahead_open(LRL_RecordReader *lrl_record_in,
+				   size_t size, size_t *max_buf_sites,
+				   int this_node){
+  char myname[] = "DML_read_ahead_open";
+  DML_ReadAhead *ra;
+  uint64_t zero = 0;
+  int i;
+
+  ra = (DML_ReadAhead *)calloc(1, sizeof(DML_ReadAhead));
+  if(!ra){
+    printf("%s(%d) can't malloc the read-ahead ring\n",myname,this_node);
+    return NULL;
+  }
+  ra->lrl_record_in = lrl_record_in;
+  ra->size = size;
+  ra->this_node = this_node;
+  ra->depth = DML_read_ahead_depth;
+  /* Asking for no bytes tells whether the file is mapped */
+  ra->mapped = LRL_read_bytes_mapped(lrl_record_in, &zero) != NULL;
+#ifndef QIO_USE_DML_READ_AHEAD
+  if(!ra->mapped) ra->depth = 1;
+#endif
+
+  ra->bufs = (char **)calloc(ra->depth, sizeof(char *));
+  ra->data = (const char **)calloc(ra->depth, sizeof(char *));
+  ra->queue = (DML_QueuedRead *)calloc(ra->depth, sizeof(DML_QueuedRead));
+  if(ra->bufs) ra->bufs[0] = DML_allocate_buf(size, max_buf_sites, 0);
+  if(!ra->bufs || !ra->data || !ra->queue || !ra->bufs[0]){
+    printf("%s(%d) can't malloc inbuf\n",myname,this_node);
+    if(ra->bufs) free(ra->bufs[0]);
+    free(ra->bufs); free(ra->data); free(ra->queue); free(ra);
+    return NULL;
+  }
+  for(i = 1; i < ra->depth; i++){
+    ra->bufs[i] = (char *)malloc(*max_buf_sites*size);
+    if(!ra->bufs[i])break;
+  }
+  ra->depth = i;
+  for(i = 0; i < ra->depth; i++)
+    ra->data[i] = ra->bufs[i];
+
+#ifdef QIO_USE_DML_READ_AHEAD
+  if(ra->depth > 1 && !ra->mapped){
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->queued, NULL);
+    pthread_cond_init(&ra->finished, NULL);
+    ra->threaded =
+      pthread_create(&ra->thread, NULL, DML_read_ahead_thread, ra) == 0;
+    if(!ra->threaded){
+      pthread_mutex_destroy(&ra->lock);
+      pthread_cond_destroy(&ra->queued);
+      pthread_cond_destroy(&ra->finished);
+    }
+  }
+#endif
+
+  return ra;
+}
+
+/* Number of buffers in the ring, which is the most reads that can be
+   queued or held at once */
+int DML_read_ahead_get_depth(DML_ReadAhead *ra){
+  return ra->depth;
+}
+
+/* Queue a read of nsites sites starting at record position firstrank,
+   seeking there first if doseek is set.  A buffer must be free.
+   Returns the buffer number, or -1 if none is free or a read has
+   failed. */
+int DML_read_ahead_submit(DML_ReadAhead *ra, DML_SiteRank firstrank,
+			  size_t nsites, int doseek){
+  DML_QueuedRead *r;
+  size_t i;
+
+  if(ra->status != 0 || ra->submitted - ra->released >= (size_t)ra->depth)
+    return -1;
+
+  i = ra->submitted;
+  r = ra->queue + i % ra->depth;
+  r->firstrank = firstrank;
+  r->nsites = nsites;
+  r->doseek = doseek;
+  r->status = 0;
+
+#ifdef QIO_USE_DML_READ_AHEAD
+  if(ra->threaded){
+    pthread_mutex_lock(&ra->lock);
+    ra->submitted++;
+    pthread_cond_signal(&ra->queued);
+    pthread_mutex_unlock(&ra->lock);
+    return (int)(i % ra->depth);
+  }
+#endif
+
+  r->status = DML_read_ahead_next(ra, i);
+  ra->submitted++;
+  ra->completed++;
+  return (int)(i % ra->depth);
+}
+
+/* Wait for the oldest read not yet handed over and return its data.
+   The data and buffer stay ours until DML_read_ahead_release.  Sets
+   *err to -1 if the read failed. */
+const char *DML_read_ahead_wait(DML_ReadAhead *ra, int *err){
+  size_t i = ra->waited;
+
+  *err = 0;
+  if(i == ra->submitted){
+    *err = -1;
+    return NULL;
+  }
+
+#ifdef QIO_USE_DML_READ_AHEAD
+  if(ra->threaded){
+    pthread_mutex_lock(&ra->lock);
+    while(ra->completed <= i)
+      pthread_cond_wait(&ra->finished, &ra->lock);
+    pthread_mutex_unlock(&ra->lock);
+  }
+#endif
+
+  ra->waited++;
+  if(ra->queue[i % ra->depth].status != 0){
+    ra->status = ra->queue[i % ra->depth].status;
+    *err = -1;
+  }
+  return ra->data[i % ra->depth];
+}
+
+/* The buffer of the data last handed over by DML_read_ahead_wait.  It
+   holds the data, unless the file is mapped, and may be overwritten,
+   so the data can be byte reversed from where they are into it. */
+char *DML_read_ahead_buffer(DML_ReadAhead *ra){
+  if(ra->waited == 0)return NULL;
+  return ra->bufs[(ra->waited - 1) % ra->depth];
+}
+
+/* Give back the oldest buffer handed over by DML_read_ahead_wait */
+void DML_read_ahead_release(DML_ReadAhead *ra){
+  if(ra->released < ra->waited) ra->released++;
+}
+
+/* Stop the reader and free the ring.  Reads still queued are
+   finished first.  Adds the time spent reading to *dtdisk. */
+void DML_read_ahead_close(DML_ReadAhead *ra, double *dtdisk){
+  int i;
+
+  if(!ra)return;
+
+#ifdef QIO_USE_DML_READ_AHEAD
+  if(ra->threaded){
+    pthread_mutex_lock(&ra->lock);
+    ra->done = 1;
+    pthread_cond_signal(&ra->queued);
+    pthread_mutex_unlock(&ra->lock);
+    pthread_join(ra->thread, NULL);
+    pthread_mutex_destroy(&ra->lock);
+    pthread_cond_destroy(&ra->queued);
+    pthread_cond_destroy(&ra->finished);
+  }
+#endif
+
+  if(dtdisk) *dtdisk += ra->dtdisk;
+  for(i = 0; i < ra->depth; i++)
+    free(ra->bufs[i]);
+  free(ra->bufs);
+  free(ra->data);
+  free(ra->queue);
+  free(ra);
+}
@@ -1,29 +1,38 @@
 #include <qmp.h>
 #include <qio_config.h>
+#include <dml.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
 
-#if ( defined(HAVE_QMP_ROUTE) && defined(QIO_USE_QMP_ROUTE) )
-//#warning "Using native QMP_route since it is available and enabled"
-
-/* Use native version of QMP_route since it is available */
-QMP_status_t DML_grid_route(void* buffer, size_t count,
-			    size_t src, size_t dest)
+/* Routing a message between two nodes of a QMP grid machine.  Several
+   engines are kept so they can be compared.  All nodes must use the
+   same engine.
+
+   DML_ROUTE_QMP       native QMP_route, when QMP provides it
+   DML_ROUTE_HOPS      every node shifts the message one hop at a time
+   DML_ROUTE_PATH      only nodes on the path take part, one hop at a time
+   DML_ROUTE_PIPELINE  only nodes on the path take part.  Routes and
+                       message handles are cached and large messages are
+                       cut into chunks that move along all legs of the
+                       path at once.
+*/
+
+#ifdef HAVE_QMP_ROUTE
+/* Use native version of QMP_route */
+static QMP_status_t dml_route_qmp(void* buffer, size_t count,
+				  size_t src, size_t dest)
 {
   return QMP_route(buffer, count, src, dest);
 }
-#else
-
-#ifndef QIO_USE_FAST_ROUTE
-
-//#warning "Using Balints slow DML GRID ROUTE"
+#endif
 
-/* Private implementation of route method */
-QMP_status_t DML_grid_route(void* buffer, size_t count,
-			    size_t src, size_t dest)
+/* Balint's version: every node shifts the message one hop at a time
+   along each axis in turn */
+static QMP_status_t dml_route_hops(void* buffer, size_t count,
+				   size_t src, size_t dest)
 {
   int* l_src_coords;      /* Coordinates of the source */
   int* l_dst_coords;      /* Coordinates of the destination */
@@ -262,8 +271,6 @@ QMP_status_t DML_grid_route(void* buffer, size_t count,
 
   return(QMP_SUCCESS);
 }
-#else
-//#warning "Using faster DML_route from James"
 
 static int
 get_path_dir(int src, int dest, int size)
@@ -279,18 +286,20 @@ get_path_dir(int src, int dest, int size)
   return dir;
 }
 
-/* Private implementation of route method */
-QMP_status_t DML_grid_route(void* buffer, size_t count,
-			    size_t src, size_t dest)
+/* Locate this node on the path from src to dest.  The path runs along
+   axis 0 first, then axis 1 and so on, taking the shorter way around
+   each ring.  For nodes on the path, gives the axis and direction of
+   the hop in and the hop out, with axis -1 if there is none. */
+static QMP_status_t
+get_path_hops(int src, int dest, int *on_path,
+	      int *recv_axis, int *recv_dir, int *send_axis, int *send_dir)
 {
   int *src_coords;      /* Coordinates of the source */
   int *dst_coords;      /* Coordinates of the destination */
   int *my_coords;       /* my coordinates */
   const int *machine_size;    /* size of machine */
   int ndim, me, i;
-  int on_path, path_leg;
-  QMP_mem_t *mem;
-  QMP_msgmem_t msgmem;
+  int path_leg;
   char myname[] = "DML_grid_route";
 
   /* Check to see if the logical topology is declared or not */
@@ -319,18 +328,21 @@ QMP_status_t DML_grid_route(void* buffer, size_t count,
   dst_coords = QMP_get_logical_coordinates_from(dest);
   if( dst_coords == NULL ) { 
     QMP_fprintf(stderr, "%s: QMP_get_logical_coordinates_from failed\n", myname);
+    free(src_coords);
     return QMP_NOMEM_ERR;
   }
 
   my_coords = QMP_get_logical_coordinates_from(me);
   if( my_coords == NULL ) { 
     QMP_fprintf(stderr, "%s: QMP_get_logical_coordinates_from failed\n", myname);
+    free(src_coords);
+    free(dst_coords);
     return QMP_NOMEM_ERR;
   }
 
 
   /* now see if we are on the path */
-  on_path = 1;
+  *on_path = 1;
 
   i = 0;
   while((i<ndim)&&(my_coords[i]==dst_coords[i])) i++;
@@ -338,7 +350,7 @@ QMP_status_t DML_grid_route(void* buffer, size_t count,
 
   i = path_leg + 1;
   while((i<ndim)&&(my_coords[i]==src_coords[i])) i++;
-  if(i<ndim) on_path = 0;
+  if(i<ndim) *on_path = 0;
 
   if(path_leg<ndim) {
     int dir;
@@ -348,45 +360,66 @@ QMP_status_t DML_grid_route(void* buffer, size_t count,
     if(src_coords[path_leg] <= dst_coords[path_leg]) {
       if(dir==1) {
 	if( (my_coords[path_leg]<src_coords[path_leg]) ||
-	    (my_coords[path_leg]>dst_coords[path_leg]) ) on_path = 0;
+	    (my_coords[path_leg]>dst_coords[path_leg]) ) *on_path = 0;
       } else {
 	if( (my_coords[path_leg]>src_coords[path_leg]) &&
-	    (my_coords[path_leg]<dst_coords[path_leg]) ) on_path = 0;
+	    (my_coords[path_leg]<dst_coords[path_leg]) ) *on_path = 0;
       }
     } else {
       if(dir==1) {
 	if( (my_coords[path_leg]<dst_coords[path_leg]) ||
-	    (my_coords[path_leg]>src_coords[path_leg]) ) on_path = 0;
+	    (my_coords[path_leg]>src_coords[path_leg]) ) *on_path = 0;
       } else {
 	if( (my_coords[path_leg]>dst_coords[path_leg]) &&
-	    (my_coords[path_leg]<src_coords[path_leg]) ) on_path = 0;
+	    (my_coords[path_leg]<src_coords[path_leg]) ) *on_path = 0;
       }
     }
   }
 
-  if(on_path) {
-    int recv_axis, recv_dir=0;
-    int send_axis, send_dir=0;
+  *recv_axis = *send_axis = -1;
+  *recv_dir = *send_dir = 0;
 
+  if(*on_path) {
     /* figure out send and recv nodes */
-    if(me==src) {
-      recv_axis = -1;
-    } else {
+    if(me!=src) {
       i = path_leg;
       if(i==ndim) i--;
       while(my_coords[i] == src_coords[i]) i--;
-      recv_dir = -get_path_dir(src_coords[i], dst_coords[i], machine_size[i]);
-      recv_axis = i;
+      *recv_dir = -get_path_dir(src_coords[i], dst_coords[i], machine_size[i]);
+      *recv_axis = i;
     }
 
-    if(me==dest) {
-      send_axis = -1;
-    } else {
+    if(me!=dest) {
       i = path_leg;
-      send_dir = get_path_dir(src_coords[i], dst_coords[i], machine_size[i]);
-      send_axis = i;
+      *send_dir = get_path_dir(src_coords[i], dst_coords[i], machine_size[i]);
+      *send_axis = i;
     }
+  }
+
+  free(src_coords);
+  free(dst_coords);
+  free(my_coords);
+
+  return(QMP_SUCCESS);
+}
+
+/* James Osborn's version: only nodes on the path take part */
+static QMP_status_t dml_route_path(void* buffer, size_t count,
+				   size_t src, size_t dest)
+{
+  int on_path;
+  int recv_axis, recv_dir;
+  int send_axis, send_dir;
+  QMP_mem_t *mem;
+  QMP_msgmem_t msgmem;
+  QMP_status_t err;
+  char myname[] = "DML_grid_route";
+
+  err = get_path_hops((int)src, (int)dest, &on_path, &recv_axis, &recv_dir,
+		      &send_axis, &send_dir);
+  if(err != QMP_SUCCESS) return err;
 
+  if(on_path) {
     if((recv_axis<0)||(send_axis<0)) {
       mem = NULL;
       msgmem = QMP_declare_msgmem(buffer, count);
@@ -398,7 +431,6 @@ QMP_status_t DML_grid_route(void* buffer, size_t count,
     /* do recv if necessary */
     if(recv_axis>=0) {
       QMP_msghandle_t mh;
-      QMP_status_t err;
 
       mh = QMP_declare_receive_relative(msgmem, recv_axis, recv_dir, 0);
       if(mh == NULL) { 
@@ -424,7 +456,6 @@ QMP_status_t DML_grid_route(void* buffer, size_t count,
     /* do send if necessary */
     if(send_axis>=0) {
       QMP_msghandle_t mh;
-      QMP_status_t err;
 
       mh = QMP_declare_send_relative(msgmem, send_axis, send_dir, 0);
       if(mh == NULL) { 
@@ -452,12 +483,260 @@ QMP_status_t DML_grid_route(void* buffer, size_t count,
 
   }
 
-  free(src_coords);
-  free(dst_coords);
-  free(my_coords);
-
   return(QMP_SUCCESS);
 }
+
+/* Pipelined version.  A route, with the relative message handles for
+   its chunks, is kept in a small cache keyed on (src, dest) and is
+   reused as long as the buffer and size are unchanged.  Nodes in the
+   middle of the path relay through one shared buffer that only grows.
+   Every chunk receive is posted before any chunk is forwarded, so a
+   corner node receives along one axis while it sends along the next
+   and the whole path is busy at once. */
+
+/* Smallest piece worth pipelining, and most pieces per message */
+#define DML_ROUTE_CHUNK_BYTES 16384
+#define DML_ROUTE_MAX_CHUNKS  16
+/* Routes remembered by each node */
+#define DML_ROUTE_CACHE       16
+
+typedef struct {
+  int used;
+  size_t src, dest;
+  int on_path;
+  int recv_axis, recv_dir;
+  int send_axis, send_dir;
+  /* Memory the handles describe */
+  char *buf;
+  size_t count;
+  int nchunks;
+  QMP_msgmem_t mm[DML_ROUTE_MAX_CHUNKS];
+  QMP_msghandle_t recv[DML_ROUTE_MAX_CHUNKS];
+  QMP_msghandle_t send[DML_ROUTE_MAX_CHUNKS];
+} DML_RouteEntry;
+
+static DML_RouteEntry dml_route_cache[DML_ROUTE_CACHE];
+static int dml_route_victim = 0;
+static QMP_mem_t *dml_route_relay = NULL;
+static size_t dml_route_relay_size = 0;
+
+static void dml_route_release(DML_RouteEntry *e)
+{
+  int c;
+
+  for(c = 0; c < e->nchunks; c++){
+    if(e->recv[c] != NULL) QMP_free_msghandle(e->recv[c]);
+    if(e->send[c] != NULL) QMP_free_msghandle(e->send[c]);
+    QMP_free_msgmem(e->mm[c]);
+  }
+  e->nchunks = 0;
+  e->buf = NULL;
+  e->count = 0;
+}
+
+static DML_RouteEntry *dml_route_lookup(size_t src, size_t dest)
+{
+  DML_RouteEntry *e;
+  int i;
+
+  for(i = 0; i < DML_ROUTE_CACHE; i++){
+    e = &dml_route_cache[i];
+    if(e->used && e->src == src && e->dest == dest) return e;
+  }
+
+  e = &dml_route_cache[dml_route_victim];
+  dml_route_victim = (dml_route_victim + 1) % DML_ROUTE_CACHE;
+  dml_route_release(e);
+  e->used = 0;
+  if(get_path_hops((int)src, (int)dest, &e->on_path, &e->recv_axis,
+		   &e->recv_dir, &e->send_axis, &e->send_dir) != QMP_SUCCESS)
+    return NULL;
+  e->src = src;
+  e->dest = dest;
+  e->used = 1;
+  return e;
+}
+
+/* Declare the chunk handles of a route on buf */
+static QMP_status_t dml_route_declare(DML_RouteEntry *e, char *buf,
+				      size_t count)
+{
+  size_t chunk, off, len;
+  int c;
+  char myname[] = "DML_grid_route";
+
+  /* Chunks of at least DML_ROUTE_CHUNK_BYTES, 8-byte multiples */
+  chunk = (count + DML_ROUTE_MAX_CHUNKS - 1)/DML_ROUTE_MAX_CHUNKS;
+  if(chunk < DML_ROUTE_CHUNK_BYTES) chunk = DML_ROUTE_CHUNK_BYTES;
+  chunk = (chunk + 7) & ~(size_t)7;
+
+  dml_route_release(e);
+  for(c = 0, off = 0; off < count; c++, off += chunk){
+    len = count - off < chunk ? count - off : chunk;
+    e->mm[c] = QMP_declare_msgmem(buf + off, len);
+    e->recv[c] = e->send[c] = NULL;
+    e->nchunks = c + 1;
+    if(e->recv_axis >= 0){
+      e->recv[c] = QMP_declare_receive_relative(e->mm[c], e->recv_axis,
+						e->recv_dir, 0);
+      if(e->recv[c] == NULL){
+	QMP_fprintf(stderr, "%s: QMP_declare_receive_relative returned NULL\n",myname);
+	dml_route_release(e);
+	return QMP_BAD_MESSAGE;
+      }
+    }
+    if(e->send_axis >= 0){
+      e->send[c] = QMP_declare_send_relative(e->mm[c], e->send_axis,
+					     e->send_dir, 0);
+      if(e->send[c] == NULL){
+	QMP_fprintf(stderr, "%s: QMP_declare_send_relative returned NULL\n",myname);
+	dml_route_release(e);
+	return QMP_BAD_MESSAGE;
+      }
+    }
+  }
+  e->buf = buf;
+  e->count = count;
+  return QMP_SUCCESS;
+}
+
+static QMP_status_t dml_route_pipeline(void* buffer, size_t count,
+				       size_t src, size_t dest)
+{
+  DML_RouteEntry *e;
+  char *buf = (char *)buffer;
+  QMP_status_t err = QMP_SUCCESS;
+  int c;
+  char myname[] = "DML_grid_route";
+
+  if(count == 0 || src == dest) return QMP_SUCCESS;
+
+  e = dml_route_lookup(src, dest);
+  if(e == NULL) return QMP_ERROR;
+  if(!e->on_path) return QMP_SUCCESS;
+
+  /* Middle of the path: relay through the shared buffer */
+  if(e->recv_axis >= 0 && e->send_axis >= 0){
+    if(dml_route_relay_size < count){
+      if(dml_route_relay != NULL) QMP_free_memory(dml_route_relay);
+      dml_route_relay = QMP_allocate_memory(count);
+      if(dml_route_relay == NULL){
+	QMP_fprintf(stderr, "%s: Unable to allocate relay buffer\n",myname);
+	dml_route_relay_size = 0;
+	return QMP_NOMEM_ERR;
+      }
+      dml_route_relay_size = count;
+    }
+    buf = (char *)QMP_get_memory_pointer(dml_route_relay);
+  }
+
+  if(e->buf != buf || e->count != count){
+    err = dml_route_declare(e, buf, count);
+    if(err != QMP_SUCCESS) return err;
+  }
+
+  /* Post all receives, then pass each chunk on as it arrives */
+  if(e->recv_axis >= 0)
+    for(c = 0; c < e->nchunks; c++)
+      if(QMP_start(e->recv[c]) != QMP_SUCCESS){
+	QMP_fprintf(stderr, "%s: QMP_start() failed on receive in DML_route\n",myname); 
+	return QMP_ERROR;
+      }
+
+  for(c = 0; c < e->nchunks; c++){
+    if(e->recv_axis >= 0 && QMP_wait(e->recv[c]) != QMP_SUCCESS){
+      QMP_fprintf(stderr, "%s: QMP_wait() failed on receive in DML_route\n",myname);
+      err = QMP_ERROR;
+    }
+    if(e->send_axis >= 0 && QMP_start(e->send[c]) != QMP_SUCCESS){
+      QMP_fprintf(stderr, "%s: QMP_start() failed on send in DML_route\n",myname); 
+      return QMP_ERROR;
+    }
+  }
+
+  if(e->send_axis >= 0)
+    for(c = 0; c < e->nchunks; c++)
+      if(QMP_wait(e->send[c]) != QMP_SUCCESS){
+	QMP_fprintf(stderr, "%s: QMP_wait() failed on send in DML_route\n",myname);
+	err = QMP_ERROR;
+      }
+
+  return err;
+}
+
+/* Release the cached routes and the relay buffer */
+void DML_grid_route_free(void)
+{
+  int i;
+
+  for(i = 0; i < DML_ROUTE_CACHE; i++){
+    dml_route_release(&dml_route_cache[i]);
+    dml_route_cache[i].used = 0;
+  }
+  if(dml_route_relay != NULL) QMP_free_memory(dml_route_relay);
+  dml_route_relay = NULL;
+  dml_route_relay_size = 0;
+}
+
+static int route_engine_id = DML_ROUTE_AUTO;
+
+int DML_grid_route_select(int engine)
+{
+  if(engine == DML_ROUTE_AUTO){
+#if ( defined(HAVE_QMP_ROUTE) && defined(QIO_USE_QMP_ROUTE) )
+    engine = DML_ROUTE_QMP;
+#elif defined(QIO_USE_FAST_ROUTE)
+    engine = DML_ROUTE_PATH;
+#else
+    engine = DML_ROUTE_PIPELINE;
 #endif
+  }
 
+  switch(engine){
+  case DML_ROUTE_HOPS:
+  case DML_ROUTE_PATH:
+  case DML_ROUTE_PIPELINE:
+#ifdef HAVE_QMP_ROUTE
+  case DML_ROUTE_QMP:
 #endif
+    break;
+  default:
+    return -1;
+  }
+  route_engine_id = engine;
+  return engine;
+}
+
+int DML_grid_route_engine(void)
+{
+  if(route_engine_id == DML_ROUTE_AUTO) DML_grid_route_select(DML_ROUTE_AUTO);
+  return route_engine_id;
+}
+
+const char *DML_grid_route_engine_name(int engine)
+{
+  switch(engine){
+  case DML_ROUTE_AUTO:     return "auto";
+  case DML_ROUTE_QMP:      return "QMP_route";
+  case DML_ROUTE_HOPS:     return "hops";
+  case DML_ROUTE_PATH:     return "path";
+  case DML_ROUTE_PIPELINE: return "pipeline";
+  default:                 return "unknown";
+  }
+}
+
+int DML_grid_route(char *buf, size_t size, int fromnode, int tonode)
+{
+  switch(DML_grid_route_engine()){
+#ifdef HAVE_QMP_ROUTE
+  case DML_ROUTE_QMP:
+    return dml_route_qmp(buf, size, fromnode, tonode);
+#endif
+  case DML_ROUTE_HOPS:
+    return dml_route_hops(buf, size, fromnode, tonode);
+  case DML_ROUTE_PATH:
+    return dml_route_path(buf, size, fromnode, tonode);
+  default:
+    return dml_route_pipeline(buf, size, fromnode, tonode);
+  }
+}
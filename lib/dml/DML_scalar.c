@@ -28,6 +28,41 @@ int DML_get_bytes(char *buf, size_t size, int fromnode){
   return 1;
 }
 
+int DML_exchange_bytes(char *sendbuf, size_t sendsize, int tonode,
+		       char *recvbuf, size_t recvsize, int fromnode){
+  printf("ERROR: called DML_exchange_bytes() in DML_vanilla.c\n");
+  exit(1);
+  return 1;
+}
+
+DML_Request *DML_isend_bytes(char *buf, size_t size, int tonode){
+  printf("ERROR: called DML_isend_bytes() in DML_vanilla.c\n");
+  exit(1);
+  return NULL;
+}
+
+DML_Request *DML_irecv_bytes(char *buf, size_t size, int fromnode){
+  printf("ERROR: called DML_irecv_bytes() in DML_vanilla.c\n");
+  exit(1);
+  return NULL;
+}
+
+int DML_wait_bytes(DML_Request *req){
+  printf("ERROR: called DML_wait_bytes() in DML_vanilla.c\n");
+  exit(1);
+  return 1;
+}
+
+int DML_wait_any(DML_Request *req[], int n){
+  printf("ERROR: called DML_wait_any() in DML_vanilla.c\n");
+  exit(1);
+  return -1;
+}
+
+void DML_free_requests(void){}
+
+void DML_grid_route_free(void){}
+
 void DML_broadcast_bytes(char *buf, size_t size, int this_node, int from_node) {}
 
 int DML_clear_to_send(char *scratch_buf, size_t size, 
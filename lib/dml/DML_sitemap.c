@@ -0,0 +1,472 @@
+/* DML_sitemap.c */
+/* Cache of the site distribution: node and storage index of each
+   site by lexicographic rank */
+
+/* A map covers a range of lexicographic ranks.  It is run compressed
+   when the layout keeps lexicographically consecutive sites in
+   consecutive storage on one node, and otherwise a packed table of
+   node and index for each site.  A map belongs to one DML_Layout, so
+   later records of the file find it ready, and is released with
+   DML_free_site_map when the file is closed.  The total size of the
+   maps is limited by DML_set_site_map_bytes.  A layout whose map
+   would not fit keeps using its callbacks.
+
+   Sitelists held as intervals are kept for the whole run, so opening
+   another file with the same layout doesn't build and sort its
+   sitelist again.  Since the layout functions or their argument may
+   have changed since then, a kept sitelist is checked against them
+   before it is used. */
+
+#include <qio_config.h>
+#include <qio.h>
+#include <dml.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/* Build a map only for a range at most this many times the number of
+   sites that will be looked up, so building costs no more than a few
+   records' worth of layout calls */
+#define DML_SITE_MAP_SPAN 4
+
+struct DML_SiteMap {
+  /* The distribution described */
+  int (*node_number)(const int coords[]);
+  int (*node_index)(const int coords[]);
+  int (*node_number_ext)(const int coords[], void *arg);
+  DML_Index (*node_index_ext)(const int coords[], void *arg);
+  void *arg;
+  int latdim;
+  int *latsize;
+  int number_of_nodes;
+  DML_SiteRank lo, hi;       /* Ranks covered */
+
+  /* Runs start[i] .. start[i+1]-1 with node[i] and first index[i],
+     or node and index per site from lo when packed */
+  size_t nruns;
+  DML_SiteRank *start;
+  int32_t *node;
+  uint32_t *index;
+  int packed;
+  int usable;                /* 0 if it did not fit */
+  size_t cursor;             /* Run found by the last lookup */
+
+  size_t bytes;
+};
+
+/* A sitelist kept for later files */
+typedef struct DML_CachedSitelist {
+  DML_SiteMap desc;          /* Distribution, described as for a map */
+  int (*ionode)(int node);
+  int volfmt, serpar;
+  int this_node;
+  DML_SiteRank first;
+  size_t number_of_io_sites;
+  DML_SiteInterval *intervals;
+  size_t number_of_intervals;
+  struct DML_CachedSitelist *next;
+} DML_CachedSitelist;
+
+static DML_CachedSitelist *DML_cached_sitelists = NULL;
+static size_t DML_site_map_budget = DML_SITE_MAP_BYTES;
+static size_t DML_site_map_used = 0;
+
+/* Set the limit on the total size of the maps.  Returns the old
+   limit.  Zero disables new maps. */
+size_t DML_set_site_map_bytes(size_t bytes){
+  size_t old = DML_site_map_budget;
+  DML_site_map_budget = bytes;
+  return old;
+}
+
+static void DML_destroy_site_map(DML_SiteMap *map){
+  free(map->latsize);
+  free(map->start);
+  free(map->node);
+  free(map->index);
+  free(map);
+}
+
+/* Release the layout's map */
+void DML_free_site_map(DML_Layout *layout){
+  DML_SiteMap *map = layout->site_map;
+
+  if(map == NULL)return;
+  if(map->usable)DML_site_map_used -= map->bytes;
+  DML_destroy_site_map(map);
+  layout->site_map = NULL;
+}
+
+/* Release all kept sitelists */
+void DML_free_site_maps(void){
+  DML_CachedSitelist *c, *cnext;
+
+  for(c = DML_cached_sitelists; c != NULL; c = cnext){
+    cnext = c->next;
+    DML_site_map_used -= c->number_of_intervals*sizeof(DML_SiteInterval);
+    free(c->desc.latsize);
+    free(c->intervals);
+    free(c);
+  }
+  DML_cached_sitelists = NULL;
+}
+
+/* Might the map describe this layout?  Layouts given with the
+   original callbacks are told apart by those, and the others by
+   their extended callbacks and argument. */
+static int DML_site_map_matches(DML_SiteMap *map, DML_Layout *layout){
+  int i;
+
+  if(layout->node_number != NULL){
+    if(map->node_number != layout->node_number ||
+       map->node_index != layout->node_index)return 0;
+  }
+  else if(map->node_number != NULL ||
+	  map->node_number_ext != layout->node_number_ext ||
+	  map->node_index_ext != layout->node_index_ext ||
+	  map->arg != layout->arg)return 0;
+
+  if(map->latdim != layout->latdim ||
+     map->number_of_nodes != layout->number_of_nodes)return 0;
+  for(i = 0; i < map->latdim; i++)
+    if(map->latsize[i] != layout->latsize[i])return 0;
+  return 1;
+}
+
+/* Switch a run map holding the first "filled" sites to a packed
+   table for nsites sites */
+static int DML_pack_site_map(DML_SiteMap *map, size_t filled,
+			     size_t nsites){
+  int32_t *node = (int32_t *)malloc(nsites*sizeof(int32_t));
+  uint32_t *index = (uint32_t *)malloc(nsites*sizeof(uint32_t));
+  size_t r, k, end;
+
+  if(!node || !index){
+    free(node); free(index);
+    return 1;
+  }
+  for(r = 0; r < map->nruns; r++){
+    end = r + 1 < map->nruns ? (size_t)(map->start[r+1] - map->lo) : filled;
+    for(k = (size_t)(map->start[r] - map->lo); k < end; k++){
+      node[k] = map->node[r];
+      index[k] = map->index[r] + (uint32_t)(k - (map->start[r] - map->lo));
+    }
+  }
+  free(map->start); free(map->node); free(map->index);
+  map->start = NULL;
+  map->node = node;
+  map->index = index;
+  map->packed = 1;
+  return 0;
+}
+
+/* Fill the map from the layout callbacks.  Returns 0 for success and
+   1 if the map does not fit. */
+static int DML_fill_site_map(DML_SiteMap *map, DML_Layout *layout,
+			     size_t room){
+  size_t nsites = (size_t)(map->hi - map->lo + 1);
+  size_t run_bytes = sizeof(DML_SiteRank) + sizeof(int32_t) +
+    sizeof(uint32_t);
+  size_t max_runs = room/run_bytes, alloc = 0, k;
+  DML_SiteRank rank;
+  DML_Index index;
+  int *coords, node;
+  void *p;
+
+  coords = DML_allocate_coords(layout->latdim, "DML_fill_site_map",
+			       layout->this_node);
+  if(!coords)return 1;
+
+  for(rank = map->lo; rank <= map->hi; rank++){
+    DML_lex_coords(coords, layout->latdim, layout->latsize, rank);
+    node = layout->node_number_ext(coords, layout->arg);
+    index = layout->node_index_ext(coords, layout->arg);
+    if(node < 0 || index > UINT32_MAX)break;
+    k = (size_t)(rank - map->lo);
+
+    if(map->packed){
+      map->node[k] = node;
+      map->index[k] = (uint32_t)index;
+      continue;
+    }
+
+    /* Extend the last run if the site continues it */
+    if(map->nruns > 0 && node == map->node[map->nruns-1] &&
+       index == map->index[map->nruns-1] +
+       (DML_Index)(rank - map->start[map->nruns-1]))
+      continue;
+
+    /* Too many runs.  Try a packed table instead. */
+    if(map->nruns == max_runs){
+      if(nsites > room/(sizeof(int32_t) + sizeof(uint32_t)) ||
+	 DML_pack_site_map(map, k, nsites))break;
+      map->node[k] = node;
+      map->index[k] = (uint32_t)index;
+      continue;
+    }
+
+    /* Start a new run, growing the arrays as needed */
+    if(map->nruns == alloc){
+      alloc = alloc == 0 ? 64 : 2*alloc;
+      if(alloc > max_runs)alloc = max_runs;
+      p = realloc(map->start, alloc*sizeof(DML_SiteRank));
+      if(!p)break;
+      map->start = (DML_SiteRank *)p;
+      p = realloc(map->node, alloc*sizeof(int32_t));
+      if(!p)break;
+      map->node = (int32_t *)p;
+      p = realloc(map->index, alloc*sizeof(uint32_t));
+      if(!p)break;
+      map->index = (uint32_t *)p;
+    }
+    map->start[map->nruns] = rank;
+    map->node[map->nruns] = node;
+    map->index[map->nruns] = (uint32_t)index;
+    map->nruns++;
+  }
+  free(coords);
+  if(rank <= map->hi)return 1;
+
+  map->bytes = map->packed ? nsites*(sizeof(int32_t) + sizeof(uint32_t)) :
+    map->nruns*run_bytes;
+  return 0;
+}
+
+/* Give the layout a map covering ranks lo through hi, which will be
+   looked up about nsites times per record.  The map is built if it is
+   cheap enough and fits the budget, replacing one for another range.
+   Returns 0 if the layout has a map. */
+int DML_prepare_site_map(DML_Layout *layout, DML_SiteRank lo,
+			 DML_SiteRank hi, size_t nsites){
+  DML_SiteMap *map = layout->site_map;
+  size_t room;
+  int i;
+
+  /* A map that did not fit is kept too, so it is not tried again */
+  if(map != NULL && map->lo <= lo && hi <= map->hi)
+    return map->usable ? 0 : 1;
+  if(layout->latdim == 0 || layout->latsize == NULL || hi < lo)return 1;
+  if((size_t)(hi - lo + 1) > DML_SITE_MAP_SPAN*nsites)return 1;
+
+  DML_free_site_map(layout);
+  if(DML_site_map_used >= DML_site_map_budget)return 1;
+  room = DML_site_map_budget - DML_site_map_used;
+
+  map = (DML_SiteMap *)calloc(1, sizeof(DML_SiteMap));
+  if(!map)return 1;
+  map->latsize = (int *)malloc(layout->latdim*sizeof(int));
+  if(!map->latsize){
+    free(map);
+    return 1;
+  }
+  map->node_number     = layout->node_number;
+  map->node_index      = layout->node_index;
+  map->node_number_ext = layout->node_number_ext;
+  map->node_index_ext  = layout->node_index_ext;
+  map->arg             = layout->arg;
+  map->latdim          = layout->latdim;
+  for(i = 0; i < layout->latdim; i++)
+    map->latsize[i] = layout->latsize[i];
+  map->number_of_nodes = layout->number_of_nodes;
+  map->lo = lo;
+  map->hi = hi;
+
+  map->usable = DML_fill_site_map(map, layout, room) == 0;
+  if(!map->usable){
+    free(map->start); free(map->node); free(map->index);
+    map->start = NULL; map->node = NULL; map->index = NULL;
+    map->nruns = 0;
+  }
+  layout->site_map = map;
+  if(!map->usable)return 1;
+  DML_site_map_used += map->bytes;
+  return 0;
+}
+
+/* Node and storage index of the site with lexicographic rank "rank",
+   from the layout's map if it covers the site, and otherwise from the
+   layout callbacks.  coords is workspace. */
+void DML_layout_site_owner(DML_Layout *layout, DML_SiteRank rank,
+			   int coords[], int *node, DML_Index *index){
+  DML_SiteMap *map = layout->site_map;
+  size_t r, r1, r2;
+
+  if(map != NULL && map->usable && rank >= map->lo && rank <= map->hi){
+    if(map->packed){
+      r = (size_t)(rank - map->lo);
+      *node = map->node[r];
+      *index = map->index[r];
+    }
+    else {
+      /* Lookups usually go forward through the runs */
+      r = map->cursor;
+      if(rank < map->start[r] ||
+	 (r + 1 < map->nruns && rank >= map->start[r+1])){
+	if(rank >= map->start[r] &&
+	   (r + 2 >= map->nruns || rank < map->start[r+2]))
+	  r++;
+	else {
+	  /* Binary search for the last run starting at or before rank */
+	  r1 = 0;
+	  r2 = map->nruns;
+	  while(r2 - r1 > 1){
+	    r = (r1 + r2)/2;
+	    if(map->start[r] <= rank)r1 = r;
+	    else r2 = r;
+	  }
+	  r = r1;
+	}
+	map->cursor = r;
+      }
+      *node = map->node[r];
+      *index = map->index[r] + (DML_Index)(rank - map->start[r]);
+    }
+    layout->site_map_hits++;
+    return;
+  }
+
+  layout->site_map_misses++;
+  DML_lex_coords(coords, layout->latdim, layout->latsize, rank);
+  *node = layout->node_number_ext(coords, layout->arg);
+  *index = layout->node_index_ext(coords, layout->arg);
+}
+
+/* Find a kept sitelist for this layout and file format */
+static DML_CachedSitelist *DML_find_sitelist(DML_SiteList *sites,
+					     DML_Layout *layout,
+					     int volfmt, int serpar){
+  DML_CachedSitelist *c;
+
+  for(c = DML_cached_sitelists; c != NULL; c = c->next)
+    if(c->volfmt == volfmt && c->serpar == serpar &&
+       c->this_node == layout->this_node && c->ionode == layout->ionode &&
+       c->number_of_io_sites == sites->number_of_io_sites &&
+       c->first == sites->first &&
+       DML_site_map_matches(&c->desc, layout))return c;
+  return NULL;
+}
+
+/* Does the kept sitelist hold the sites the layout now gives us?
+   Its sites are distinct, in ascending order, and as many as we
+   have, so it does if each belongs to our partition, and for
+   multifiles is also at its storage index.  Returns 0 if so. */
+static int DML_check_sitelist(DML_CachedSitelist *c, DML_Layout *layout){
+  int my_io_node = layout->ionode(layout->this_node);
+  DML_SiteRank rank, end;
+  size_t i, pos, n = 0;
+  int *coords, node, status = 0;
+
+  coords = DML_allocate_coords(layout->latdim, "DML_check_sitelist",
+			       layout->this_node);
+  if(!coords)return 1;
+
+  for(i = 0; i < c->number_of_intervals && status == 0; i++){
+    rank = c->intervals[i].start_rank;
+    end = rank + (DML_SiteRank)c->intervals[i].length;
+    if(i > 0 && rank < c->intervals[i-1].start_rank +
+       (DML_SiteRank)c->intervals[i-1].length)status = 1;
+    for(pos = c->intervals[i].start_pos; rank < end && status == 0;
+	rank++, pos++, n++){
+      DML_lex_coords(coords, layout->latdim, layout->latsize, rank);
+      node = layout->node_number_ext(coords, layout->arg);
+      if(c->volfmt == DML_MULTIFILE)
+	status = node != layout->this_node ||
+	  layout->node_index_ext(coords, layout->arg) != (DML_Index)pos;
+      else
+	status = layout->ionode(node) != my_io_node;
+    }
+  }
+  if(n != c->number_of_io_sites)status = 1;
+
+  free(coords);
+  return status;
+}
+
+/* Forget a kept sitelist */
+static void DML_drop_sitelist(DML_CachedSitelist *c){
+  DML_CachedSitelist **p;
+
+  for(p = &DML_cached_sitelists; *p != NULL; p = &(*p)->next)
+    if(*p == c){
+      *p = c->next;
+      break;
+    }
+  DML_site_map_used -= c->number_of_intervals*sizeof(DML_SiteInterval);
+  free(c->desc.latsize);
+  free(c->intervals);
+  free(c);
+}
+
+/* Give the sitelist the intervals kept from an earlier file with the
+   same layout.  Returns 0 if there were any. */
+int DML_reuse_sitelist(DML_SiteList *sites, DML_Layout *layout,
+		       int volfmt, int serpar){
+  DML_CachedSitelist *c = DML_find_sitelist(sites, layout, volfmt, serpar);
+  size_t bytes;
+
+  if(c == NULL)return 1;
+
+  /* A stale list would pass the sitelist check, so it is dropped and
+     the list built again */
+  if(DML_check_sitelist(c, layout) != 0){
+    if(QIO_verbosity() >= QIO_VERB_DEBUG)
+      printf("DML_reuse_sitelist(%d): kept sitelist is stale\n",
+	     layout->this_node);
+    DML_drop_sitelist(c);
+    return 1;
+  }
+  bytes = c->number_of_intervals*sizeof(DML_SiteInterval);
+  sites->intervals = (DML_SiteInterval *)malloc(bytes);
+  if(sites->intervals == NULL)return 1;
+  memcpy(sites->intervals, c->intervals, bytes);
+  sites->intervals_by_rank = sites->intervals;
+  sites->number_of_intervals = c->number_of_intervals;
+  sites->current_interval = 0;
+  return 0;
+}
+
+/* Keep a sorted sitelist held as intervals for later files, if it fits
+   the budget shared with the maps */
+void DML_keep_sitelist(DML_SiteList *sites, DML_Layout *layout,
+		       int volfmt, int serpar){
+  DML_CachedSitelist *c;
+  size_t bytes = sites->number_of_intervals*sizeof(DML_SiteInterval);
+  int i;
+
+  if(sites->intervals == NULL ||
+     sites->intervals_by_rank != sites->intervals)return;
+  if(layout->latdim == 0 || layout->latsize == NULL)return;
+  if(DML_site_map_used + bytes > DML_site_map_budget)return;
+  if(DML_find_sitelist(sites, layout, volfmt, serpar) != NULL)return;
+
+  c = (DML_CachedSitelist *)calloc(1, sizeof(DML_CachedSitelist));
+  if(!c)return;
+  c->desc.latsize = (int *)malloc(layout->latdim*sizeof(int));
+  c->intervals = (DML_SiteInterval *)malloc(bytes);
+  if(!c->desc.latsize || !c->intervals){
+    free(c->desc.latsize); free(c->intervals); free(c);
+    return;
+  }
+  c->desc.node_number     = layout->node_number;
+  c->desc.node_index      = layout->node_index;
+  c->desc.node_number_ext = layout->node_number_ext;
+  c->desc.node_index_ext  = layout->node_index_ext;
+  c->desc.arg             = layout->arg;
+  c->desc.latdim          = layout->latdim;
+  for(i = 0; i < layout->latdim; i++)
+    c->desc.latsize[i] = layout->latsize[i];
+  c->desc.number_of_nodes = layout->number_of_nodes;
+  c->ionode = layout->ionode;
+  c->volfmt = volfmt;
+  c->serpar = serpar;
+  c->this_node = layout->this_node;
+  c->first = sites->first;
+  c->number_of_io_sites = sites->number_of_io_sites;
+  memcpy(c->intervals, sites->intervals, bytes);
+  c->number_of_intervals = sites->number_of_intervals;
+
+  c->next = DML_cached_sitelists;
+  DML_cached_sitelists = c;
+  DML_site_map_used += bytes;
+}
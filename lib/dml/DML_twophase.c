@@ -0,0 +1,579 @@
+/* DML_twophase.c */
+/* Two-phase aggregation for the payload of singlefile parallel records */
+
+/* Without MPI-IO, DML_partition_out and DML_partition_in pass every
+   site through the I/O node of its partition, one compute node at a
+   time.  Here the record is instead divided among a set of
+   aggregators, chosen from the I/O nodes, each owning a contiguous
+   range of record positions that starts on a file system stripe
+   boundary.  The record is moved in rounds, and in each round every
+   aggregator handles one buffer-sized window of its range.  In phase
+   one all nodes exchange sites pairwise with the aggregators, so data
+   for different aggregators move at the same time.  In phase two each
+   aggregator writes its window with one contiguous access through its
+   write-behind ring.  Reads run the same pipeline in reverse, reading
+   through the read-ahead ring.  Every node reorders, byte-reverses and
+   checksums its own sites, so the checksums are those of the other
+   paths.  If any node can't set up, the record is moved with
+   DML_partition_out or DML_partition_in. */
+
+#include <qio_config.h>
+#include <qio.h>
+#include <dml.h>
+#include <lrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Set by the application.  Files take the master I/O node's values
+   when they are opened. */
+static int DML_number_aggregators = 0;
+static size_t DML_stripe_bytes = 0;
+
+/* Set the number of two-phase aggregators for singlefile parallel
+   records.  Zero uses the I/O node partitions.  Returns the old
+   value. */
+int DML_set_aggregators(int naggr){
+  int old = DML_number_aggregators;
+  DML_number_aggregators = naggr < 0 ? 0 : naggr;
+  return old;
+}
+
+/* Set the file system stripe size the aggregator ranges are aligned
+   to.  Zero for no alignment.  Returns the old value. */
+size_t DML_set_stripe_bytes(size_t bytes){
+  size_t old = DML_stripe_bytes;
+  DML_stripe_bytes = bytes;
+  return old;
+}
+
+/* Give the layout the master I/O node's aggregator settings, so all
+   nodes take the same path.  Called by all nodes. */
+void DML_agree_aggregators(DML_Layout *layout){
+  uint64_t v[2];
+
+  v[0] = (uint64_t)DML_number_aggregators;
+  v[1] = (uint64_t)DML_stripe_bytes;
+  if(v[0] > (uint64_t)layout->number_of_nodes)
+    v[0] = (uint64_t)layout->number_of_nodes;
+  DML_broadcast_bytes((char *)v, sizeof(v), layout->this_node,
+		      layout->master_io_node);
+  layout->number_aggregators = (int)v[0];
+  layout->stripe_bytes = (size_t)v[1];
+}
+
+typedef struct {
+  int this_node;
+  int number_of_nodes;
+  int naggr;                 /* Number of aggregators */
+  int *aggr_of_node;         /* Aggregator number of each node, or -1 */
+  int my_aggr;               /* Ours, or -1 */
+  DML_SiteRank *domain;      /* Aggregator k owns domain[k] to domain[k+1]-1 */
+  size_t window;             /* Sites per aggregator per round */
+  int rounds;
+
+  size_t nsites;             /* Our sites in the record */
+  DML_SiteRank *pos;         /* Their record positions, in record order */
+  DML_SiteRank *rank;        /* Their ranks */
+  DML_Index *index;          /* Their storage indices */
+  size_t *next;              /* Our next site for each aggregator */
+  char *buf;                 /* Our sites for one aggregator */
+
+  /* Aggregators only */
+  int *owner;                /* Node of each site in the window */
+  size_t *count;             /* Sites of the window on each node */
+  size_t *offset;            /* Their place in stage */
+  char *stage;               /* The window sites grouped by node */
+  int *coords;
+} DML_TwoPhase;
+
+static void DML_two_phase_free(DML_TwoPhase *tp){
+  free(tp->aggr_of_node);
+  free(tp->domain);
+  free(tp->pos);
+  free(tp->rank);
+  free(tp->index);
+  free(tp->next);
+  free(tp->buf);
+  free(tp->owner);
+  free(tp->count);
+  free(tp->offset);
+  free(tp->stage);
+  free(tp->coords);
+}
+
+/* Split the record among the aggregators.  The payload starts at
+   byte "offset" of the file.  Each range begins with the first site
+   at or after a stripe boundary. */
+static void DML_two_phase_domains(DML_TwoPhase *tp, size_t size,
+				  uint64_t offset, DML_Layout *layout){
+  uint64_t volume, total, stripe = layout->stripe_bytes, b;
+  int k, naggr = tp->naggr;
+
+  volume = layout->recordtype == DML_FIELD ? layout->volume :
+    layout->subsetvolume;
+  total = volume*size;
+
+  for(k = 0; k <= naggr; k++){
+    b = total/naggr*k + total%naggr*k/naggr;
+    if(stripe > 0 && k > 0 && k < naggr){
+      b = ((offset + b + stripe - 1)/stripe)*stripe - offset;
+      if(b > total)b = total;
+    }
+    tp->domain[k] = (DML_SiteRank)((b + size - 1)/size);
+  }
+}
+
+/* Record positions handled by aggregator k in round r */
+static size_t DML_two_phase_window(DML_TwoPhase *tp, int k, int r,
+				   DML_SiteRank *first){
+  DML_SiteRank end = tp->domain[k+1];
+
+  *first = tp->domain[k] + (DML_SiteRank)r*tp->window;
+  if(*first >= end)return 0;
+  if((size_t)(end - *first) < tp->window)return (size_t)(end - *first);
+  return tp->window;
+}
+
+/* Our sites in the window of aggregator k in round r.  They start at
+   *first in our list. */
+static size_t DML_two_phase_mine(DML_TwoPhase *tp, int k, int r,
+				 size_t *first){
+  DML_SiteRank wfirst, wend;
+  size_t i, n;
+
+  n = DML_two_phase_window(tp, k, r, &wfirst);
+  wend = wfirst + (DML_SiteRank)n;
+  i = *first = tp->next[k];
+  while(i < tp->nsites && tp->pos[i] < wend)i++;
+  tp->next[k] = i;
+  return i - *first;
+}
+
+/* Find the node of each site in our window and where the sites of
+   each node go in the stage */
+static void DML_two_phase_owners(DML_TwoPhase *tp, DML_SiteRank first,
+				 size_t n, DML_Layout *layout){
+  DML_SiteRank rank;
+  DML_Index index;
+  size_t i, off;
+  int node;
+
+  for(node = 0; node < tp->number_of_nodes; node++)
+    tp->count[node] = 0;
+
+  for(i = 0; i < n; i++){
+    DML_record_coords(tp->coords, first + (DML_SiteRank)i, layout);
+    rank = DML_lex_rank(tp->coords, layout->latdim, layout->latsize);
+    DML_layout_site_owner(layout, rank, tp->coords, &node, &index);
+    tp->owner[i] = node;
+    tp->count[node]++;
+  }
+
+  off = 0;
+  for(node = 0; node < tp->number_of_nodes; node++){
+    tp->offset[node] = off;
+    off += tp->count[node];
+  }
+}
+
+/* Choose the aggregators, split the record and list our sites.
+   Returns 0 for success on this node. */
+static int DML_two_phase_open(DML_TwoPhase *tp, size_t size,
+			      uint64_t offset, DML_Layout *layout){
+  DML_RecordSite *site;
+  DML_SiteRank first, last;
+  int this_node = layout->this_node;
+  int nodes = layout->number_of_nodes;
+  int *io;
+  int nio, k, node;
+  size_t i;
+  char myname[] = "DML_two_phase_open";
+
+  memset(tp, 0, sizeof(DML_TwoPhase));
+  tp->this_node = this_node;
+  tp->number_of_nodes = nodes;
+  tp->my_aggr = -1;
+
+  /* Aggregators are spread evenly over the I/O nodes, since only
+     they have the file open */
+  io = (int *)malloc(nodes*sizeof(int));
+  tp->aggr_of_node = (int *)malloc(nodes*sizeof(int));
+  if(!io || !tp->aggr_of_node){
+    printf("%s(%d) can't malloc node tables\n",myname,this_node);
+    free(io);
+    return 1;
+  }
+  nio = 0;
+  for(node = 0; node < nodes; node++){
+    tp->aggr_of_node[node] = -1;
+    if(layout->ionode(node) == node)io[nio++] = node;
+  }
+  tp->naggr = layout->number_aggregators;
+  if(tp->naggr > nio)tp->naggr = nio;
+  for(k = 0; k < tp->naggr; k++)
+    tp->aggr_of_node[io[(int)((int64_t)k*nio/tp->naggr)]] = k;
+  free(io);
+  if(tp->naggr < 1)return 1;
+  tp->my_aggr = tp->aggr_of_node[this_node];
+
+  tp->domain = (DML_SiteRank *)malloc((tp->naggr+1)*sizeof(DML_SiteRank));
+  tp->next = (size_t *)malloc(tp->naggr*sizeof(size_t));
+  if(!tp->domain || !tp->next){
+    printf("%s(%d) can't malloc aggregator tables\n",myname,this_node);
+    return 1;
+  }
+  DML_two_phase_domains(tp, size, offset, layout);
+
+  /* Every node uses the same window, so all agree on the rounds */
+  tp->window = DML_max_buf_sites(size,1);
+  tp->rounds = 0;
+  for(k = 0; k < tp->naggr; k++){
+    i = (tp->domain[k+1] - tp->domain[k] + tp->window - 1)/tp->window;
+    if((int)i > tp->rounds)tp->rounds = (int)i;
+  }
+
+  /* Our sites in record order */
+  site = DML_list_record_sites(layout, &tp->nsites);
+  if(!site)return 1;
+  tp->pos = (DML_SiteRank *)malloc((tp->nsites+1)*sizeof(DML_SiteRank));
+  tp->rank = (DML_SiteRank *)malloc((tp->nsites+1)*sizeof(DML_SiteRank));
+  tp->index = (DML_Index *)malloc((tp->nsites+1)*sizeof(DML_Index));
+  tp->buf = (char *)malloc(tp->window*size);
+  if(!tp->pos || !tp->rank || !tp->index || !tp->buf){
+    printf("%s(%d) can't malloc site lists\n",myname,this_node);
+    free(site);
+    return 1;
+  }
+  for(i = 0; i < tp->nsites; i++){
+    tp->pos[i] = site[i].pos;
+    tp->rank[i] = site[i].rank;
+    tp->index[i] = site[i].index;
+  }
+  free(site);
+
+  i = 0;
+  for(k = 0; k < tp->naggr; k++){
+    while(i < tp->nsites && tp->pos[i] < tp->domain[k])i++;
+    tp->next[k] = i;
+  }
+
+  if(tp->my_aggr < 0)return 0;
+
+  tp->owner = (int *)malloc(tp->window*sizeof(int));
+  tp->count = (size_t *)malloc(nodes*sizeof(size_t));
+  tp->offset = (size_t *)malloc(nodes*sizeof(size_t));
+  tp->stage = (char *)malloc(tp->window*size);
+  tp->coords = DML_allocate_coords(layout->latdim, myname, this_node);
+  if(!tp->owner || !tp->count || !tp->offset || !tp->stage || !tp->coords){
+    printf("%s(%d) can't malloc stage\n",myname,this_node);
+    return 1;
+  }
+
+  /* Our range of lattice ranks is looked up once per record */
+  first = tp->domain[tp->my_aggr];
+  last = tp->domain[tp->my_aggr+1];
+  if(last > first){
+    DML_record_coords(tp->coords, first, layout);
+    first = DML_lex_rank(tp->coords, layout->latdim, layout->latsize);
+    DML_record_coords(tp->coords, last - 1, layout);
+    last = DML_lex_rank(tp->coords, layout->latdim, layout->latsize);
+    DML_prepare_site_map(layout, first, last,
+			 (size_t)(tp->domain[tp->my_aggr+1] -
+				  tp->domain[tp->my_aggr]));
+  }
+
+  if(QIO_verbosity() >= QIO_VERB_DEBUG)
+    printf("%s(%d): aggregator %d of %d, sites %lu to %lu in %d rounds\n",
+	   myname,this_node,tp->my_aggr,tp->naggr,
+	   (unsigned long)tp->domain[tp->my_aggr],
+	   (unsigned long)tp->domain[tp->my_aggr+1],tp->rounds);
+  return 0;
+}
+
+/* Where the payload starts in the file, as seen by the master I/O
+   node.  Needed only for aligning to stripes. */
+static uint64_t DML_two_phase_offset(off_t offset, int ok,
+				     DML_Layout *layout){
+  int64_t loc = ok ? (int64_t)offset : 0;
+
+  if(layout->stripe_bytes == 0)return 0;
+  DML_broadcast_bytes((char *)&loc, sizeof(loc), layout->this_node,
+		      layout->master_io_node);
+  return (uint64_t)loc;
+}
+
+/*------------------------------------------------------------------*/
+/* Write the sites of a singlefile parallel record through the
+   aggregators.  The master I/O node has written the record header.
+   Returns the checksum and number of bytes written by this node
+   only. */
+
+uint64_t DML_aggregate_out(LRL_RecordWriter *lrl_record_out,
+	   void (*get)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
+	   int count, size_t size, int word_size, void *arg,
+	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	   int serpar, DML_Checksum *checksum)
+{
+  DML_TwoPhase tp;
+  DML_WriteBehind *wb = NULL;
+  DML_SiteRun run;
+  DML_SiteRank first = 0;
+  const char *filename = NULL;
+  off_t offset = 0;
+  char *outbuf, *inbuf;
+  size_t n = 0, mine, nrecv, start, i, max_buf_sites;
+  int this_node = layout->this_node;
+  int nodes = layout->number_of_nodes;
+  int r, s, k, to, from, node, ok, err = 0;
+  double dtall, dtexch = 0, dtdisk = 0, t;
+  uint64_t nbytes = 0;
+  char myname[] = "DML_aggregate_out";
+
+  dtall = QIO_time();
+
+  ok = 1;
+  if(this_node == layout->master_io_node)
+    ok = LRL_get_writer_location(lrl_record_out, &filename, &offset)
+      == LRL_SUCCESS;
+
+  ok = DML_two_phase_open(&tp, size,
+			  DML_two_phase_offset(offset, ok, layout),
+			  layout) == 0;
+  if(ok && tp.my_aggr >= 0){
+    max_buf_sites = tp.window;
+    wb = DML_write_behind_open(lrl_record_out, serpar, size,
+			       &max_buf_sites, this_node);
+    if(!wb || max_buf_sites < tp.window)ok = 0;
+  }
+
+  /* Proceed only if all nodes can */
+  DML_sum_int(&ok);
+  if(ok < nodes){
+    if(wb)DML_write_behind_close(wb, NULL, NULL);
+    DML_two_phase_free(&tp);
+    if(QIO_verbosity() >= QIO_VERB_DEBUG)
+      printf("%s(%d): falling back to DML_partition_out\n",
+	     myname,this_node);
+    return DML_partition_out(lrl_record_out, get, count, size, word_size,
+			     arg, layout, sites, volfmt, serpar, checksum);
+  }
+
+  DML_checksum_init(checksum);
+
+  run.nsites = 0;
+  for(r = 0; r < tp.rounds; r++){
+    t = QIO_time();
+
+    /* The aggregator finds where the sites of its window live */
+    if(tp.my_aggr >= 0){
+      n = DML_two_phase_window(&tp, tp.my_aggr, r, &first);
+      DML_two_phase_owners(&tp, first, n, layout);
+    }
+
+    /* Phase one: each step we send our sites for one aggregator and,
+       if we aggregate, receive those of one node */
+    for(s = 0; s < nodes; s++){
+      to = (this_node + s) % nodes;
+      from = (this_node + nodes - s) % nodes;
+
+      mine = 0;
+      k = tp.aggr_of_node[to];
+      if(k >= 0){
+	mine = DML_two_phase_mine(&tp, k, r, &start);
+	for(i = 0; i < mine; i++)
+	  DML_run_add(&run, tp.buf + i*size, tp.index[start+i], size,
+		      get, count, arg);
+	DML_run_flush(&run, get, count, arg);
+	DML_checksum_byterevn_indexed(checksum, tp.rank + start, tp.buf,
+				      tp.buf, mine, size, word_size,
+				      DML_TO_FILE);
+      }
+
+      nrecv = tp.my_aggr >= 0 ? tp.count[from] : 0;
+      inbuf = nrecv > 0 ? tp.stage + tp.offset[from]*size : NULL;
+      if(s == 0){
+	if(nrecv > 0)memcpy(inbuf, tp.buf, nrecv*size);
+      }
+      else
+	DML_exchange_bytes(tp.buf, mine*size, to, inbuf, nrecv*size, from);
+    }
+
+    /* Phase two: the aggregator writes its window in one piece */
+    if(tp.my_aggr >= 0 && n > 0){
+      outbuf = DML_write_behind_buffer(wb);
+      for(i = 0; i < n; i++){
+	node = tp.owner[i];
+	memcpy(outbuf + i*size, tp.stage + tp.offset[node]*size, size);
+	tp.offset[node]++;
+      }
+      if(DML_write_behind_submit(wb, outbuf, first, n) != 0 && !err){
+	printf("%s(%d) write error\n",myname,this_node);
+	err = 1;
+      }
+    }
+    dtexch += QIO_time() - t;
+  }
+
+  if(wb && DML_write_behind_close(wb, &nbytes, &dtdisk) != 0)err = 1;
+  DML_two_phase_free(&tp);
+  dtall = QIO_time() - dtall;
+
+  if(QIO_verbosity() >= QIO_VERB_LOW && this_node == layout->master_io_node)
+    printf("%s times: exchange %.2f  disk %.2f  total %.2f\n",
+	   myname, dtexch, dtdisk, dtall);
+
+  /* Number of bytes written by this node only */
+  return err ? 0 : nbytes;
+}
+
+/*------------------------------------------------------------------*/
+/* Read the sites of a singlefile parallel record through the
+   aggregators.  The master I/O node has read the record header.
+   Returns the checksum and number of bytes read by this node only. */
+
+uint64_t DML_aggregate_in(LRL_RecordReader *lrl_record_in,
+	  void (*put)(char *buf, size_t first, size_t nsites, int count,
+		      void *arg),
+	  int count, size_t size, int word_size, void *arg,
+	  DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	  int serpar, DML_Checksum *checksum)
+{
+  DML_TwoPhase tp;
+  DML_ReadAhead *ra = NULL;
+  DML_SiteRun run;
+  DML_SiteRank first = 0, wfirst;
+  const char *filename = NULL;
+  off_t offset = 0;
+  const char *rdbuf;
+  char *inbuf;
+  size_t n = 0, mine, nsend, start, i, max_buf_sites;
+  int this_node = layout->this_node;
+  int nodes = layout->number_of_nodes;
+  int r, s, k, to, from, node, ok, status, err = 0;
+  int depth = 0, submitted = 0;
+  double dtall, dtexch = 0, dtdisk = 0, t;
+  uint64_t nbytes = 0;
+  char myname[] = "DML_aggregate_in";
+
+  dtall = QIO_time();
+
+  ok = 1;
+  if(this_node == layout->master_io_node)
+    ok = LRL_get_reader_location(lrl_record_in, &filename, &offset)
+      == LRL_SUCCESS;
+
+  ok = DML_two_phase_open(&tp, size,
+			  DML_two_phase_offset(offset, ok, layout),
+			  layout) == 0;
+  if(ok && tp.my_aggr >= 0){
+    max_buf_sites = tp.window;
+    ra = DML_read_ahead_open(lrl_record_in, size, &max_buf_sites,
+			     this_node);
+    if(!ra || max_buf_sites < tp.window)ok = 0;
+  }
+
+  /* Proceed only if all nodes can */
+  DML_sum_int(&ok);
+  if(ok < nodes){
+    if(ra)DML_read_ahead_close(ra, NULL);
+    DML_two_phase_free(&tp);
+    if(QIO_verbosity() >= QIO_VERB_DEBUG)
+      printf("%s(%d): falling back to DML_partition_in\n",
+	     myname,this_node);
+    return DML_partition_in(lrl_record_in, put, count, size, word_size,
+			    arg, layout, sites, volfmt, serpar, checksum);
+  }
+
+  DML_checksum_init(checksum);
+
+  /* Start reading the first windows */
+  if(ra){
+    depth = DML_read_ahead_get_depth(ra);
+    while(submitted < depth &&
+	  (n = DML_two_phase_window(&tp, tp.my_aggr, submitted, &wfirst)) > 0){
+      DML_read_ahead_submit(ra, wfirst, n, 1);
+      submitted++;
+    }
+  }
+
+  run.nsites = 0;
+  for(r = 0; r < tp.rounds; r++){
+    t = QIO_time();
+
+    /* Phase two first: the aggregator reads its window in one piece
+       and groups the sites by node */
+    if(tp.my_aggr >= 0){
+      n = DML_two_phase_window(&tp, tp.my_aggr, r, &first);
+      DML_two_phase_owners(&tp, first, n, layout);
+      if(n > 0){
+	rdbuf = DML_read_ahead_wait(ra, &status);
+	if(status != 0 || rdbuf == NULL){
+	  if(!err)printf("%s(%d) read error\n",myname,this_node);
+	  err = 1;
+	  rdbuf = NULL;
+	}
+	else nbytes += (uint64_t)n*size;
+	/* After a failure we only keep up with the exchanges */
+	for(i = 0; i < n; i++){
+	  node = tp.owner[i];
+	  if(rdbuf)
+	    memcpy(tp.stage + tp.offset[node]*size, rdbuf + i*size, size);
+	  tp.offset[node]++;
+	}
+	DML_read_ahead_release(ra);
+	if(submitted < tp.rounds &&
+	   (i = DML_two_phase_window(&tp, tp.my_aggr, submitted,
+				     &wfirst)) > 0){
+	  DML_read_ahead_submit(ra, wfirst, i, 1);
+	  submitted++;
+	}
+      }
+    }
+
+    /* Phase one in reverse.  The stage offsets now mark the end of
+       each node's sites. */
+    for(s = 0; s < nodes; s++){
+      to = (this_node + s) % nodes;
+      from = (this_node + nodes - s) % nodes;
+
+      nsend = tp.my_aggr >= 0 ? tp.count[to] : 0;
+      inbuf = nsend > 0 ? tp.stage + (tp.offset[to] - nsend)*size : NULL;
+
+      mine = 0;
+      start = 0;
+      k = tp.aggr_of_node[from];
+      if(k >= 0)mine = DML_two_phase_mine(&tp, k, r, &start);
+
+      if(s == 0){
+	if(mine > 0)memcpy(tp.buf, inbuf, mine*size);
+      }
+      else
+	DML_exchange_bytes(inbuf, nsend*size, to, tp.buf, mine*size, from);
+
+      /* Checksum and reorder our sites and store them */
+      if(mine > 0){
+	DML_checksum_byterevn_indexed(checksum, tp.rank + start, tp.buf,
+				      tp.buf, mine, size, word_size,
+				      DML_FROM_FILE);
+	for(i = 0; i < mine; i++)
+	  DML_run_add(&run, tp.buf + i*size, tp.index[start+i], size,
+		      put, count, arg);
+	DML_run_flush(&run, put, count, arg);
+      }
+    }
+    dtexch += QIO_time() - t;
+  }
+
+  if(ra)DML_read_ahead_close(ra, &dtdisk);
+  DML_two_phase_free(&tp);
+  dtall = QIO_time() - dtall;
+
+  if(QIO_verbosity() >= QIO_VERB_LOW && this_node == layout->master_io_node)
+    printf("%s times: exchange %.2f  disk %.2f  total %.2f\n",
+	   myname, dtexch, dtdisk, dtall);
+
+  /* Number of bytes read by this node only */
+  return err ? 0 : nbytes;
+}
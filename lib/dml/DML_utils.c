@@ -1,10 +1,14 @@
 /* DML_utils.c */
 /* Utilities for DML */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L /* for posix_memalign */
+#endif
 #include <qio_config.h>
 #include <qio.h>
 #include <lrl.h>
 #include <dml.h>
 #include <stdio.h>
+#include <stdlib.h>
 #ifdef HAVE_MALLOC_H
 #include <malloc.h>
 #endif
@@ -117,6 +121,65 @@ int *DML_allocate_coords(int latdim, const char *myname, int this_node){
 }
 
 
+/*------------------------------------------------------------------*/
+/* Block transfers */
+
+/* Adapters presenting per-site get and put as block callbacks */
+void DML_get_sites(char *buf, size_t first, size_t nsites, int count,
+		   void *arg){
+  DML_SiteCallback *cb = (DML_SiteCallback *)arg;
+  size_t i;
+
+  for(i = 0; i < nsites; i++, buf += cb->size)
+    cb->get(buf, first + i, count, cb->arg);
+}
+
+void DML_put_sites(char *buf, size_t first, size_t nsites, int count,
+		   void *arg){
+  DML_SiteCallback *cb = (DML_SiteCallback *)arg;
+  size_t i;
+
+  for(i = 0; i < nsites; i++, buf += cb->size)
+    cb->put(buf, first + i, count, cb->arg);
+}
+
+/* Block get from a field held contiguously in node storage order */
+void DML_get_contiguous(char *buf, size_t first, size_t nsites, int count,
+			void *arg){
+  DML_Contiguous *field = (DML_Contiguous *)arg;
+  _QIO_UNUSED_ARGUMENT(count);
+
+  memcpy(buf, field->base + first*field->size, nsites*field->size);
+}
+
+/* Move the pending run, if any */
+void DML_run_flush(DML_SiteRun *run,
+	  void (*xfer)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
+	  int count, void *arg){
+  if(run->nsites > 0)
+    xfer(run->buf, run->first, run->nsites, count, arg);
+  run->nsites = 0;
+}
+
+/* Append a site to the run.  A site that does not continue the run
+   starts a new one after the pending run is moved. */
+void DML_run_add(DML_SiteRun *run, char *buf, size_t index,
+	  size_t size,
+	  void (*xfer)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
+	  int count, void *arg){
+  if(run->nsites > 0 && index == run->first + run->nsites &&
+     buf == run->buf + size*run->nsites){
+    run->nsites++;
+    return;
+  }
+  DML_run_flush(run, xfer, count, arg);
+  run->buf = buf;
+  run->first = index;
+  run->nsites = 1;
+}
+
 /*------------------------------------------------------------------*/
 /* The message structure holds the site datum and site rank */
 
@@ -224,6 +287,10 @@ DML_SiteList *DML_init_sitelist(int volfmt, int serpar, DML_Layout *layout){
   }
   sites->list               = NULL;
   sites->use_list           = 0;
+  sites->intervals          = NULL;
+  sites->intervals_by_rank  = NULL;
+  sites->number_of_intervals = 0;
+  sites->current_interval   = 0;
   sites->first              = 0;
   sites->current_rank       = 0;
   sites->number_of_io_sites = 0;
@@ -232,6 +299,11 @@ DML_SiteList *DML_init_sitelist(int volfmt, int serpar, DML_Layout *layout){
   sites->use_subset         = 0;
   sites->subset_rank        = NULL;
   sites->subset_io_sites    = 0;
+  sites->runs               = NULL;
+  sites->number_of_runs     = 0;
+  sites->runs_state         = 0;
+  sites->current_run        = 0;
+  sites->run_first          = 0;
 
   /* Initialize number of I/O sites */
 
@@ -290,11 +362,189 @@ int DML_compare_sitelists(DML_SiteRank *lista, DML_SiteRank *listb, size_t n){
   return 0;
 }
 
+/*------------------------------------------------------------------*/
+/* Sitelist intervals.  Partition sitelists are mostly long runs of
+   consecutive ranks, so the list is kept as intervals in list order.
+   Walking the list in order costs O(1) per site and finding a rank
+   O(log intervals).  Lists that aren't sorted, such as multifile
+   lists in storage order, also get a copy of the intervals in rank
+   order for lookups.  A list with so many short runs that the
+   intervals would take more space stays flat. */
+
+static int DML_compare_interval_ranks(const void *a, const void *b){
+  DML_SiteRank ra = ((const DML_SiteInterval *)a)->start_rank;
+  DML_SiteRank rb = ((const DML_SiteInterval *)b)->start_rank;
+  return ra < rb ? -1 : ra > rb;
+}
+
+/* Replace the flat list by intervals if they save space */
+void DML_compress_sitelist(DML_SiteList *sites){
+  DML_SiteRank *list = sites->list;
+  size_t n = sites->number_of_io_sites;
+  size_t pos, m = 0;
+  DML_SiteInterval *iv, *by_rank;
+  int sorted = 1;
+
+  if(list == NULL || n == 0)return;
+
+  for(pos = 0; pos < n; pos++)
+    if(pos == 0 || list[pos] != list[pos-1] + 1)m++;
+  if(m*sizeof(DML_SiteInterval) > n*sizeof(DML_SiteRank))return;
+
+  iv = (DML_SiteInterval *)malloc(m*sizeof(DML_SiteInterval));
+  if(iv == NULL)return;
+  for(pos = 0, m = 0; pos < n; pos++){
+    if(pos > 0 && list[pos] == list[pos-1] + 1){
+      iv[m-1].length++;
+      continue;
+    }
+    if(m > 0 && list[pos] < iv[m-1].start_rank)sorted = 0;
+    iv[m].start_rank = list[pos];
+    iv[m].start_pos = pos;
+    iv[m].length = 1;
+    m++;
+  }
+
+  by_rank = iv;
+  if(!sorted){
+    by_rank = (DML_SiteInterval *)malloc(m*sizeof(DML_SiteInterval));
+    if(by_rank == NULL){
+      free(iv); return;
+    }
+    memcpy(by_rank, iv, m*sizeof(DML_SiteInterval));
+    qsort(by_rank, m, sizeof(DML_SiteInterval), DML_compare_interval_ranks);
+  }
+
+  free(list);
+  sites->list = NULL;
+  sites->intervals = iv;
+  sites->intervals_by_rank = by_rank;
+  sites->number_of_intervals = m;
+  sites->current_interval = 0;
+}
+
+/* Rank of the site at list position pos */
+DML_SiteRank DML_sitelist_rank(DML_SiteList *sites, size_t pos){
+  DML_SiteInterval *iv;
+  size_t lo, hi, mid, m = sites->number_of_intervals;
+
+  if(sites->intervals == NULL)return sites->list[pos];
+
+  iv = sites->intervals + sites->current_interval;
+  if(pos < iv->start_pos || pos >= iv->start_pos + iv->length){
+    /* The site loop moves on to the next interval */
+    if(pos >= iv->start_pos + iv->length && sites->current_interval + 1 < m
+       && pos < iv[1].start_pos + iv[1].length)
+      iv++;
+    else {
+      lo = 0; hi = m;
+      while(hi - lo > 1){
+	mid = (lo + hi)/2;
+	if(sites->intervals[mid].start_pos <= pos)lo = mid;
+	else hi = mid;
+      }
+      iv = sites->intervals + lo;
+    }
+    sites->current_interval = iv - sites->intervals;
+  }
+  return iv->start_rank + (DML_SiteRank)(pos - iv->start_pos);
+}
+
+/* List position of the site with lexicographic rank "rank".  Return
+   -1 if the site isn't in the list. */
+int64_t DML_sitelist_position(DML_SiteList *sites, DML_SiteRank rank){
+  DML_SiteInterval *iv = sites->intervals_by_rank;
+  size_t lo, hi, mid, m = sites->number_of_intervals;
+  size_t n = sites->number_of_io_sites;
+
+  if(!sites->use_list){
+    if(rank < sites->first || rank >= sites->first + (DML_SiteRank)n)
+      return -1;
+    return rank - sites->first;
+  }
+  if(iv == NULL)return DML_table_lookup(sites->list, n, rank);
+
+  /* Try the interval used last */
+  if(iv == sites->intervals){
+    lo = sites->current_interval;
+    if(rank >= iv[lo].start_rank &&
+       rank < iv[lo].start_rank + (DML_SiteRank)iv[lo].length)
+      return iv[lo].start_pos + (rank - iv[lo].start_rank);
+  }
+
+  if(rank < iv[0].start_rank)return -1;
+  lo = 0; hi = m;
+  while(hi - lo > 1){
+    mid = (lo + hi)/2;
+    if(iv[mid].start_rank <= rank)lo = mid;
+    else hi = mid;
+  }
+  if(rank >= iv[lo].start_rank + (DML_SiteRank)iv[lo].length)return -1;
+  return iv[lo].start_pos + (rank - iv[lo].start_rank);
+}
+
+/* Smallest and largest rank in the list */
+void DML_sitelist_bounds(DML_SiteList *sites, DML_SiteRank *lo,
+			 DML_SiteRank *hi){
+  DML_SiteInterval *iv = sites->intervals_by_rank;
+  size_t pos, n = sites->number_of_io_sites;
+  size_t m = sites->number_of_intervals;
+
+  *lo = sites->first;
+  *hi = sites->first + (DML_SiteRank)n - 1;
+  if(!sites->use_list || n == 0)return;
+
+  if(iv != NULL){
+    *lo = iv[0].start_rank;
+    *hi = iv[m-1].start_rank + (DML_SiteRank)iv[m-1].length - 1;
+    return;
+  }
+  *lo = *hi = sites->list[0];
+  for(pos = 1; pos < n; pos++){
+    if(sites->list[pos] < *lo)*lo = sites->list[pos];
+    if(sites->list[pos] > *hi)*hi = sites->list[pos];
+  }
+}
+
+/* Compare n list entries starting at position pos with "list".
+   Return 0 if they all agree and 1 otherwise. */
+int DML_compare_sitelist_part(DML_SiteList *sites, size_t pos,
+			      const DML_SiteRank *list, size_t n){
+  size_t i;
+
+  if(pos + n > sites->number_of_io_sites)return 1;
+  for(i = 0; i < n; i++)
+    if(DML_sitelist_rank(sites, pos + i) != list[i])return 1;
+  return 0;
+}
+
+/* The flat list, made on request and kept with the sitelist */
+DML_SiteRank *DML_sitelist_array(DML_SiteList *sites){
+  size_t k, j, n = sites->number_of_io_sites;
+  DML_SiteInterval *iv;
+
+  if(sites->list != NULL || sites->intervals == NULL)return sites->list;
+
+  sites->list = (DML_SiteRank *)malloc(n*sizeof(DML_SiteRank));
+  if(sites->list == NULL)return NULL;
+  for(k = 0; k < sites->number_of_intervals; k++){
+    iv = sites->intervals + k;
+    for(j = 0; j < iv->length; j++)
+      sites->list[iv->start_pos + j] = iv->start_rank + (DML_SiteRank)j;
+  }
+  return sites->list;
+}
+
 /*------------------------------------------------------------------*/
 /* Free the sitelist structure */
 void DML_free_sitelist(DML_SiteList *sites){
   if(sites == NULL)return;
   if(sites->list != NULL)free(sites->list);
+  if(sites->intervals_by_rank != NULL &&
+     sites->intervals_by_rank != sites->intervals)
+    free(sites->intervals_by_rank);
+  if(sites->intervals != NULL)free(sites->intervals);
+  if(sites->runs != NULL)free(sites->runs);
   free(sites);
 }
 
@@ -416,6 +666,97 @@ void DML_hpsort(DML_SiteRank *array, long n)
   }
 }
 
+/*------------------------------------------------------------------*/
+/* LSD radix sort of nonnegative ranks no larger than max, 11 bits per
+   pass.  Return 0 for success and 1 if there is no room for the work
+   array. */
+
+#define DML_RADIX_BITS 11
+
+static int DML_radix_sort_ranks(DML_SiteRank *array, size_t n,
+				DML_SiteRank max){
+  size_t count[1 << DML_RADIX_BITS];
+  size_t i, sum, c;
+  DML_SiteRank *src = array, *dst, *tmp;
+  int shift, d;
+
+  tmp = (DML_SiteRank *)malloc(n*sizeof(DML_SiteRank));
+  if(tmp == NULL)return 1;
+  dst = tmp;
+
+  for(shift = 0; shift < 63 && (max >> shift) > 0; shift += DML_RADIX_BITS){
+    memset(count, 0, sizeof(count));
+    for(i = 0; i < n; i++)
+      count[(src[i] >> shift) & ((1 << DML_RADIX_BITS) - 1)]++;
+    for(d = 0, sum = 0; d < (1 << DML_RADIX_BITS); d++){
+      c = count[d]; count[d] = sum; sum += c;
+    }
+    for(i = 0; i < n; i++)
+      dst[count[(src[i] >> shift) & ((1 << DML_RADIX_BITS) - 1)]++] = src[i];
+    dst = src; src = src == array ? tmp : array;
+  }
+  if(src != array)memcpy(array, src, n*sizeof(DML_SiteRank));
+  free(tmp);
+  return 0;
+}
+
+/* Put a sitelist filled in storage order in ascending lexicographic
+   rank order.  Storage order on a node mostly runs through consecutive
+   ranks, so if those runs save space the runs are sorted and merged
+   into the sitelist intervals without sorting the sites.  Otherwise
+   the flat list is radix sorted. */
+static void DML_sort_sitelist(DML_SiteList *sites, DML_SiteRank volume){
+  DML_SiteRank *list = sites->list;
+  size_t n = sites->number_of_io_sites;
+  size_t pos, m = 0, k;
+  DML_SiteInterval *iv;
+
+  if(n == 0)return;
+
+  for(pos = 1; pos < n && list[pos] > list[pos-1]; pos++);
+  if(pos == n)return;          /* Already sorted */
+
+  for(pos = 0; pos < n; pos++)
+    if(pos == 0 || list[pos] != list[pos-1] + 1)m++;
+
+  if(m*sizeof(DML_SiteInterval) <= n*sizeof(DML_SiteRank) &&
+     (iv = (DML_SiteInterval *)malloc(m*sizeof(DML_SiteInterval))) != NULL){
+    for(pos = 0, m = 0; pos < n; pos++){
+      if(pos > 0 && list[pos] == list[pos-1] + 1){
+	iv[m-1].length++;
+	continue;
+      }
+      iv[m].start_rank = list[pos];
+      iv[m].length = 1;
+      m++;
+    }
+    qsort(iv, m, sizeof(DML_SiteInterval), DML_compare_interval_ranks);
+
+    /* Merge runs that continue one another and number the positions */
+    for(k = 0, pos = 0; pos < m; pos++){
+      if(k > 0 && iv[pos].start_rank ==
+	 iv[k-1].start_rank + (DML_SiteRank)iv[k-1].length){
+	iv[k-1].length += iv[pos].length;
+	continue;
+      }
+      iv[k] = iv[pos];
+      iv[k].start_pos = k > 0 ? iv[k-1].start_pos + iv[k-1].length : 0;
+      k++;
+    }
+
+    free(list);
+    sites->list = NULL;
+    sites->intervals = iv;
+    sites->intervals_by_rank = iv;
+    sites->number_of_intervals = k;
+    sites->current_interval = 0;
+    return;
+  }
+
+  if(DML_radix_sort_ranks(list, n, volume - 1) != 0)
+    DML_hpsort(list, n);
+}
+
 /*------------------------------------------------------------------*/
 /* Fill the sitelist for partitioned I/O format */
 /* Return code 0 = success; 1 = failure */
@@ -462,7 +803,7 @@ int DML_fill_partition_sitelist(DML_Layout *layout, DML_SiteList *sites){
   }
 
   /* Put the site list in ascending lexicographic rank order */
-  DML_hpsort(list, number_of_io_sites);
+  DML_sort_sitelist(sites, (DML_SiteRank)layout->volume);
   free(coords);
   return 0;
 }
@@ -473,10 +814,14 @@ int DML_fill_partition_sitelist(DML_Layout *layout, DML_SiteList *sites){
 int DML_fill_sitelist(DML_SiteList *sites, int volfmt, int serpar,
 		      DML_Layout *layout){
   int this_node = layout->this_node;
+  int status;
   char myname[] = "DML_fill_sitelist";
 
   if(sites->use_list == 0)return 0;
 
+  /* An earlier file with the same layout may have left the list */
+  if(DML_reuse_sitelist(sites, layout, volfmt, serpar) == 0)return 0;
+
   /* Allocate the list */
 
   sites->list = 
@@ -487,7 +832,7 @@ int DML_fill_sitelist(DML_SiteList *sites, int volfmt, int serpar,
 
   if(volfmt == DML_MULTIFILE){
   /* Multifile format requires a sitelist */
-    return DML_fill_multifile_sitelist(layout,sites);
+    status = DML_fill_multifile_sitelist(layout,sites);
   }
   else if(volfmt == DML_PARTFILE 
           || volfmt == DML_PARTFILE_DIR
@@ -495,7 +840,7 @@ int DML_fill_sitelist(DML_SiteList *sites, int volfmt, int serpar,
     /* Partitioned I/O requires a sitelist on the I/O node */
     /* Singlefile parallel I/O requires the same sitelist as partfile
        to determine which sites to write/read */
-    return DML_fill_partition_sitelist(layout,sites);
+    status = DML_fill_partition_sitelist(layout,sites);
   }
   else {
     /* Bad volfmt */
@@ -503,10 +848,19 @@ int DML_fill_sitelist(DML_SiteList *sites, int volfmt, int serpar,
 	   myname, this_node, volfmt);
     return 1;
   }
+
+  /* Keep the list as intervals, and for later files */
+  if(status == 0){
+    DML_compress_sitelist(sites);
+    DML_keep_sitelist(sites, layout, volfmt, serpar);
+  }
+  return status;
 }
 
 /*------------------------------------------------------------------*/
 /* Read and check the sitelist for input */
+/* The record is read in pieces and each is compared with the expected
+   list as it arrives, so the whole record is never held in memory */
 /* return 0 for success and 1 for failure */
 int DML_read_sitelist(DML_SiteList *sites, LRL_FileReader *lrl_file_in,
 		      int volfmt, DML_Layout *layout,
@@ -518,7 +872,10 @@ int DML_read_sitelist(DML_SiteList *sites, LRL_FileReader *lrl_file_in,
   int this_node = layout->this_node;
   LRL_RecordReader *lrl_record_in;
   DML_SiteRank *inputlist;
-  int not_ok;
+  DML_SiteRank32 *ilist32;
+  size_t n = sites->number_of_io_sites;
+  size_t pos, i, m, max_m, word;
+  int not_ok = 0;
   int status;
   char myname[] = "DML_read_sitelist";
 
@@ -530,8 +887,8 @@ int DML_read_sitelist(DML_SiteList *sites, LRL_FileReader *lrl_file_in,
   if(!lrl_record_in)return 1;
 
   /* Require that the record size matches expectations */
-  check32 = sites->number_of_io_sites * sizeof(DML_SiteRank32);
-  check = sites->number_of_io_sites * sizeof(DML_SiteRank);
+  check32 = n * sizeof(DML_SiteRank32);
+  check = n * sizeof(DML_SiteRank);
   /* Ignore a mismatch if we are trying to discover the lattice dimension */
   if(!layout->discover_dims_mode && announced_rec_size != check && announced_rec_size != check32) {
     printf("%s(%d): sitelist size mismatch: found %lu expected %lu lime type %s\n",
@@ -541,58 +898,65 @@ int DML_read_sitelist(DML_SiteList *sites, LRL_FileReader *lrl_file_in,
     return 1;
   }
 
-  /* Allocate check list according to record size */
-  inputlist = (DML_SiteRank *)malloc(announced_rec_size);
-  if(inputlist == NULL)return 1;
-
-  /* Read the site list and close the record */
-  check = LRL_read_bytes(lrl_record_in, (char *)inputlist, announced_rec_size);
-  LRL_close_read_record(lrl_record_in);
+  /* There is nothing to check against if we are reading in discovery
+     mode */
+  if(layout->discover_dims_mode){
+    LRL_close_read_record(lrl_record_in);
+    return 0;
+  }
 
-#ifdef DML_DEBUG
-  printf("%s(%d) sitelist record was read with %lu bytes\n",myname,
-	 layout->this_node,(unsigned long)check);
-#endif
+  /* Sitelists are 32 bit if they fit */
+  word = announced_rec_size == check32 ? sizeof(DML_SiteRank32) :
+    sizeof(DML_SiteRank);
 
-  /* Check bytes read */
-  if(check != announced_rec_size) {
-    printf("%s(%d): bytes read %lu != expected rec_size %lu\n",
-	   myname, this_node, (unsigned long)check,
-	   (unsigned long)announced_rec_size);
-    free(inputlist); return 1;
+  max_m = DML_BUF_BYTES/sizeof(DML_SiteRank);
+  if(max_m > n)max_m = n;
+  inputlist = (DML_SiteRank *)malloc((max_m > 0 ? max_m : 1)*sizeof(DML_SiteRank));
+  if(inputlist == NULL){
+    LRL_close_read_record(lrl_record_in);
+    return 1;
   }
+  ilist32 = (DML_SiteRank32 *)inputlist;
 
-  if(check == check32) {  // sitelist is 32bit
-    DML_SiteRank32 *ilist32 = (DML_SiteRank32 *)inputlist;
-    if (! DML_big_endian())
-      DML_byterevn(ilist32, announced_rec_size, sizeof(DML_SiteRank32));
-    size_t n = announced_rec_size / sizeof(DML_SiteRank32);
-    inputlist = (DML_SiteRank *)malloc(n*sizeof(DML_SiteRank));
-    for(size_t i=0; i<n; i++) {
-      inputlist[i] = ilist32[i];
+  /* All input sitelists must agree exactly with what we expect */
+  for(pos = 0; pos < n && !not_ok; pos += m){
+    m = n - pos < max_m ? n - pos : max_m;
+    check = LRL_read_bytes(lrl_record_in, (char *)inputlist, m*word);
+
+    /* Check bytes read */
+    if(check != m*word) {
+      printf("%s(%d): bytes read %lu != expected rec_size %lu\n",
+	     myname, this_node, (unsigned long)(pos*word + check),
+	     (unsigned long)announced_rec_size);
+      free(inputlist);
+      LRL_close_read_record(lrl_record_in);
+      return 1;
     }
-    free(ilist32);
-  } else {
-    /* Byte reordering for entire sitelist */
+
+    /* Byte reordering, and widening 32 bit entries in place from the
+       top down */
     if (! DML_big_endian())
-      DML_byterevn(inputlist, announced_rec_size, sizeof(DML_SiteRank));
+      DML_byterevn(inputlist, m*word, word);
+    if(word == sizeof(DML_SiteRank32))
+      for(i = m; i-- > 0; )
+	inputlist[i] = ilist32[i];
+
+    not_ok = DML_compare_sitelist_part(sites, pos, inputlist, m);
   }
+  LRL_close_read_record(lrl_record_in);
+  free(inputlist);
 
-  /* All input sitelists must agree exactly with what we expect */
-  /* Unless we are reading in discovery mode */
-  if(!layout->discover_dims_mode) {
-    not_ok = DML_compare_sitelists(sites->list, inputlist,
-				   sites->number_of_io_sites);
-    if(not_ok)
-      printf("%s(%d): sitelist does not conform to I/O layout.\n",
-	     myname,this_node);
+#ifdef DML_DEBUG
+  printf("%s(%d) sitelist record was read with %lu bytes\n",myname,
+	 layout->this_node,(unsigned long)announced_rec_size);
+#endif
 
-    /* Return 1 if not OK and 0 if OK */
-    free(inputlist);
-    return not_ok;
-  }
-  else
-    return 0;
+  if(not_ok)
+    printf("%s(%d): sitelist does not conform to I/O layout.\n",
+	   myname,this_node);
+
+  /* Return 1 if not OK and 0 if OK */
+  return not_ok;
 }
 
 
@@ -602,7 +966,8 @@ int DML_read_sitelist(DML_SiteList *sites, LRL_FileReader *lrl_file_in,
 DML_SiteRank DML_init_site_loop(DML_SiteList *sites){
   sites->current_index = 0;
   if(sites->use_list){
-    return sites->list[sites->current_index];
+    if(sites->number_of_io_sites == 0)return 0;
+    return DML_sitelist_rank(sites, sites->current_index);
   }
   else{
     sites->current_rank = sites->first;
@@ -618,7 +983,7 @@ int DML_next_site(DML_SiteRank *rank, DML_SiteList *sites)
   sites->current_index++;
   if(sites->current_index >= sites->number_of_io_sites)return 0;
   if(sites->use_list){
-    *rank = sites->list[sites->current_index];
+    *rank = DML_sitelist_rank(sites, sites->current_index);
   }
   else{
     sites->current_rank++;
@@ -627,6 +992,114 @@ int DML_next_site(DML_SiteRank *rank, DML_SiteList *sites)
   return 1;
 }
  
+/*------------------------------------------------------------------*/
+/* Run table.  The sites of the site loop are grouped in runs that
+   are consecutive in the loop, in lexicographic rank and in storage
+   order on one node, so finding the node and storage index of a site
+   costs one layout query per run instead of per site.  The table is
+   built on first use and kept with the sitelist, so every record
+   passing through the sitelist reuses it.  Layouts whose runs are
+   too short to pay for the table, or that need more than
+   DML_RUN_TABLE_BYTES, go without. */
+
+/* Shortest average run worth tabulating */
+#define DML_RUN_MIN_LENGTH 4
+
+/* Return 0 if the table was built and 1 if not */
+int DML_build_run_table(DML_SiteList *sites, DML_Layout *layout){
+  size_t n = sites->number_of_io_sites;
+  size_t max_runs = n/DML_RUN_MIN_LENGTH;
+  size_t pos, nruns = 0;
+  DML_LexRun *runs, *run = NULL;
+  DML_SiteRank rank;
+  DML_Index index;
+  int *coords, node;
+
+  /* Layout queries go through the layout's site map when it has one */
+  if(n > 0){
+    DML_SiteRank lo, hi;
+    DML_sitelist_bounds(sites, &lo, &hi);
+    DML_prepare_site_map(layout, lo, hi, n);
+  }
+
+  sites->runs_state = -1;
+  if(max_runs > DML_RUN_TABLE_BYTES/sizeof(DML_LexRun))
+    max_runs = DML_RUN_TABLE_BYTES/sizeof(DML_LexRun);
+  if(max_runs == 0)return 1;
+
+  runs = (DML_LexRun *)malloc(max_runs*sizeof(DML_LexRun));
+  coords = DML_allocate_coords(layout->latdim, "DML_build_run_table",
+			       layout->this_node);
+  if(!runs || !coords){
+    free(runs); free(coords);
+    return 1;
+  }
+
+  for(pos = 0; pos < n; pos++){
+    rank = sites->use_list ? DML_sitelist_rank(sites, pos) :
+      sites->first + (DML_SiteRank)pos;
+    DML_layout_site_owner(layout, rank, coords, &node, &index);
+    if(run != NULL && node == run->node &&
+       rank == run->start_rank + (DML_SiteRank)run->length &&
+       index == run->start_index + run->length){
+      run->length++;
+      continue;
+    }
+    if(nruns == max_runs){
+      free(runs); free(coords);
+      return 1;
+    }
+    run = runs + nruns++;
+    run->start_rank = rank;
+    run->length = 1;
+    run->node = node;
+    run->start_index = index;
+  }
+  free(coords);
+
+  sites->runs = runs;
+  sites->number_of_runs = nruns;
+  sites->runs_state = 1;
+  sites->current_run = 0;
+  sites->run_first = 0;
+  return 0;
+}
+
+/* Node and storage index of the site with lexicographic rank "rank"
+   at the current position of the site loop.  coords is workspace for
+   the layout query when the table can't answer. */
+void DML_site_owner(DML_SiteList *sites, DML_Layout *layout,
+		    DML_SiteRank rank, int coords[], int *node,
+		    DML_Index *index){
+  size_t pos = sites->current_index;
+  DML_LexRun *run;
+
+  if(sites->runs_state == 0)DML_build_run_table(sites, layout);
+
+  if(sites->runs != NULL && sites->number_of_runs > 0){
+    /* The loop usually moves forward.  Start over if it went back. */
+    if(pos < sites->run_first){
+      sites->current_run = 0;
+      sites->run_first = 0;
+    }
+    run = sites->runs + sites->current_run;
+    while(pos >= sites->run_first + run->length &&
+	  sites->current_run + 1 < sites->number_of_runs){
+      sites->run_first += run->length;
+      sites->current_run++;
+      run++;
+    }
+    pos -= sites->run_first;
+    if(pos < run->length && rank == run->start_rank + (DML_SiteRank)pos){
+      *node = run->node;
+      *index = run->start_index + pos;
+      return;
+    }
+  }
+
+  DML_layout_site_owner(layout, rank, coords, node, index);
+}
+
 /*------------------------------------------------------------------*/
 /* Copy subset data into DML layout structure                       */
 /* return 1 for failure (bad hypercube bounds) and 0 for success */
@@ -732,6 +1205,92 @@ int DML_rank_inside_subset(DML_SiteRank rank, DML_Layout *layout){
 }
 
 
+/*------------------------------------------------------------------*/
+/* Position of the site in a singlefile record, or -1 if the record
+   does not include it.  Hypercube records hold their sites in
+   lexicographic order within the hypercube. */
+DML_SiteRank DML_record_pos(const int coords[], DML_Layout *layout){
+  int latdim = layout->latdim;
+  int *lower = layout->hyperlower;
+  int *upper = layout->hyperupper;
+  DML_SiteRank pos = 0;
+  int d;
+
+  if(layout->recordtype == DML_FIELD)
+    return DML_lex_rank(coords, latdim, layout->latsize);
+
+  for(d = latdim-1; d >= 0; d--){
+    if(coords[d] < lower[d] || coords[d] > upper[d])return -1;
+    pos = pos*(upper[d] - lower[d] + 1) + coords[d] - lower[d];
+  }
+  return pos;
+}
+
+/* Coordinates of the site at position pos in a singlefile record */
+void DML_record_coords(int coords[], DML_SiteRank pos, DML_Layout *layout){
+  int latdim = layout->latdim;
+  int *lower = layout->hyperlower;
+  int *upper = layout->hyperupper;
+  int d, n;
+
+  if(layout->recordtype == DML_FIELD){
+    DML_lex_coords(coords, latdim, layout->latsize, pos);
+    return;
+  }
+
+  for(d = 0; d < latdim; d++){
+    n = upper[d] - lower[d] + 1;
+    coords[d] = lower[d] + (int)(pos % n);
+    pos /= n;
+  }
+}
+
+static int DML_compare_record_sites(const void *a, const void *b){
+  DML_SiteRank pa = ((const DML_RecordSite *)a)->pos;
+  DML_SiteRank pb = ((const DML_RecordSite *)b)->pos;
+  return pa < pb ? -1 : pa > pb;
+}
+
+/* List the sites of this node in a singlefile record, in record order.
+   Returns NULL if memory is short. */
+DML_RecordSite *DML_list_record_sites(DML_Layout *layout, size_t *nsites){
+  DML_RecordSite *site;
+  int *coords;
+  int this_node = layout->this_node;
+  size_t i, n;
+  DML_SiteRank pos;
+  int sorted = 1;
+  char myname[] = "DML_list_record_sites";
+
+  site = (DML_RecordSite *)
+    malloc((layout->sites_on_node+1)*sizeof(DML_RecordSite));
+  coords = DML_allocate_coords(layout->latdim, myname, this_node);
+  if(!site || !coords){
+    printf("%s(%d) can't malloc site table\n",myname,this_node);
+    free(site); free(coords);
+    return NULL;
+  }
+
+  n = 0;
+  for(i = 0; i < layout->sites_on_node; i++){
+    layout->get_coords_ext(coords, this_node, (DML_Index)i, layout->arg);
+    pos = DML_record_pos(coords, layout);
+    if(pos < 0)continue;
+    site[n].pos = pos;
+    site[n].rank = DML_lex_rank(coords, layout->latdim, layout->latsize);
+    site[n].index = (DML_Index)i;
+    if(n > 0 && pos < site[n-1].pos)sorted = 0;
+    n++;
+  }
+  free(coords);
+
+  if(!sorted)
+    qsort(site, n, sizeof(DML_RecordSite), DML_compare_record_sites);
+
+  *nsites = n;
+  return site;
+}
+
 /*------------------------------------------------------------------*/
 /* Table lookup for sorted table.  Return index if found and -1 if not
    found. Binary search for exact match. */
@@ -768,8 +1327,7 @@ int DML_lookup_subset_rank(DML_SiteRank *seek, DML_SiteRank rank,
   DML_SiteRank current_index;
 
   if(sites->use_list) {
-    current_index = DML_table_lookup(sites->list, sites->number_of_io_sites,
-				     rank);
+    current_index = DML_sitelist_position(sites, rank);
     if(current_index < 0)
       return 1;
   } else {
@@ -877,7 +1435,7 @@ int DML_create_subset_rank_parallel(DML_SiteList *sites, DML_Layout *layout){
   int this_node = layout->this_node;
   int *upper = layout->hyperupper;
   int *lower = layout->hyperlower;
-  DML_SiteRank r, *ranklist, s, t;
+  DML_SiteRank r, s, t;
   int *coords,*ubound;
   int d, dim;
   char myname[] = "DML_create_subset_rank_parallel";
@@ -888,26 +1446,16 @@ int DML_create_subset_rank_parallel(DML_SiteList *sites, DML_Layout *layout){
     malloc(sizeof(DML_SiteRank)*sites->number_of_io_sites); /* Could be less */
   if(sites->subset_rank == NULL)return 1;
 
-  ranklist =
-    (DML_SiteRank *)malloc(sizeof(DML_SiteRank)*sites->number_of_io_sites);
-  if(ranklist == NULL)return 1;
-
   /* Allocate lattice coordinate */
   coords = DML_allocate_coords(latdim, myname, this_node);
 
-  /* Tabulate all sites in our I/O partition in lexicographic
-     (processing) order.  */
-  r = DML_init_site_loop(sites);
-  s = 0;
-  do {
-    /* At first flag them as outside the subset. */
+  /* At first flag all sites in our I/O partition as outside the
+     subset.  Their positions in the sitelist are their lexicographic
+     (processing) order. */
+  for(s = 0; s < (DML_SiteRank)sites->number_of_io_sites; s++)
     sites->subset_rank[s] = -1;
-    /* The rank of the site in the whole lattice */
-    ranklist[s] = r;
-    s++;
-  } while(DML_next_site(&r, sites));
 
-  sites->subset_io_sites = s;
+  sites->subset_io_sites = sites->number_of_io_sites;
 
   /* Upper limits for DML_lex_next iteration */
   ubound  = DML_allocate_coords(latdim, myname, this_node);
@@ -924,7 +1472,7 @@ int DML_create_subset_rank_parallel(DML_SiteList *sites, DML_Layout *layout){
     r = DML_lex_rank(coords, latdim, latsize);
     /* Is this site in our I/O partition? If so, get its rank in our
        sitelist */
-    s = DML_lookup_site_rank(ranklist, sites->subset_io_sites, r);
+    s = DML_sitelist_position(sites, r);
     if(s >= 0)
       sites->subset_rank[s] = t;
     t++;
@@ -932,7 +1480,6 @@ int DML_create_subset_rank_parallel(DML_SiteList *sites, DML_Layout *layout){
 
   free(coords);
   free(ubound);
-  free(ranklist);
 
   return 0;
 }
@@ -1043,6 +1590,157 @@ void DML_checksum_accum(DML_Checksum *checksum, DML_SiteRank rank,
   checksum->sumb ^= DML_rank_rotl32(work, rank31);
 }
 
+/* Accumulate checksums for nsites contiguous data with consecutive
+   lexicographic ranks starting at first_rank */
+void DML_checksum_accum_block(DML_Checksum *checksum, DML_SiteRank first_rank,
+			      char *buf, size_t nsites, size_t size){
+
+  uint32_t suma = checksum->suma;
+  uint32_t sumb = checksum->sumb;
+  DML_SiteRank rank29 = first_rank % 29;
+  DML_SiteRank rank31 = first_rank % 31;
+  uint32_t work;
+  size_t i;
+
+  for(i = 0; i < nsites; i++, buf += size){
+    work = DML_crc32(0, (unsigned char*)buf, size);
+    suma ^= DML_rank_rotl32(work, rank29);
+    sumb ^= DML_rank_rotl32(work, rank31);
+    if(++rank29 == 29)rank29 = 0;
+    if(++rank31 == 31)rank31 = 0;
+  }
+
+  checksum->suma = suma;
+  checksum->sumb = sumb;
+}
+
+/* Accumulate checksums for nsites contiguous data with arbitrary
+   lexicographic ranks rank[0..nsites-1] */
+void DML_checksum_accum_indexed(DML_Checksum *checksum,
+				const DML_SiteRank rank[],
+				char *buf, size_t nsites, size_t size){
+
+  uint32_t suma = checksum->suma;
+  uint32_t sumb = checksum->sumb;
+  uint32_t work;
+  size_t i;
+
+  for(i = 0; i < nsites; i++, buf += size){
+    work = DML_crc32(0, (unsigned char*)buf, size);
+    suma ^= DML_rank_rotl32(work, rank[i] % 29);
+    sumb ^= DML_rank_rotl32(work, rank[i] % 31);
+  }
+
+  checksum->suma = suma;
+  checksum->sumb = sumb;
+}
+
+/* Byte reordering and checksumming in one pass.  The data are
+   handled in pieces small enough to stay in the L1 cache between the
+   two steps, so they come from memory only once: small sites a group
+   at a time, large ones a piece at a time.  The checksum is always
+   taken over the file (big-endian) byte order: after the reordering
+   for DML_TO_FILE, before it for DML_FROM_FILE.  The result goes to
+   dst, which may be the same as src. */
+
+#define DML_FUSE_BYTES 4096
+#define DML_FUSE_SITES 64
+
+/* Process the first few of nsites sites, leaving their crc32 values
+   in work[].  Returns the number processed. */
+static size_t DML_byterevn_crc_sites(uint32_t work[], char *dst,
+				     const char *src, size_t nsites,
+				     size_t size, int word_size,
+				     int direction){
+  size_t i, n, off, len;
+  int copy = word_size > 1 || dst != src;
+
+  if(size > DML_FUSE_BYTES){
+    work[0] = 0;
+    for(off = 0; off < size; off += len){
+      len = size - off;
+      if(len > DML_FUSE_BYTES)len = DML_FUSE_BYTES;
+      if(direction == DML_FROM_FILE)
+	work[0] = DML_crc32(work[0], (const unsigned char*)src + off, len);
+      if(copy)DML_copy_byterevn(dst + off, src + off, len, word_size);
+      if(direction == DML_TO_FILE)
+	work[0] = DML_crc32(work[0], (unsigned char*)dst + off, len);
+    }
+    return 1;
+  }
+
+  n = size > 0 ? DML_FUSE_BYTES/size : DML_FUSE_SITES;
+  if(n > DML_FUSE_SITES)n = DML_FUSE_SITES;
+  if(n > nsites)n = nsites;
+
+  if(direction == DML_FROM_FILE)
+    for(i = 0; i < n; i++)
+      work[i] = DML_crc32(0, (const unsigned char*)src + i*size, size);
+  if(copy)DML_copy_byterevn(dst, src, n*size, word_size);
+  if(direction == DML_TO_FILE)
+    for(i = 0; i < n; i++)
+      work[i] = DML_crc32(0, (unsigned char*)dst + i*size, size);
+  return n;
+}
+
+/* Reorder and checksum nsites contiguous data with consecutive
+   lexicographic ranks starting at first_rank */
+void DML_checksum_byterevn_block(DML_Checksum *checksum,
+				 DML_SiteRank first_rank, char *dst,
+				 const char *src, size_t nsites, size_t size,
+				 int word_size, int direction){
+
+  uint32_t suma = checksum->suma;
+  uint32_t sumb = checksum->sumb;
+  DML_SiteRank rank29 = first_rank % 29;
+  DML_SiteRank rank31 = first_rank % 31;
+  uint32_t work[DML_FUSE_SITES];
+  size_t i, j, n;
+
+  if(DML_big_endian())word_size = 1;
+
+  for(i = 0; i < nsites; i += n){
+    n = DML_byterevn_crc_sites(work, dst + i*size, src + i*size,
+			       nsites - i, size, word_size, direction);
+    for(j = 0; j < n; j++){
+      suma ^= DML_rank_rotl32(work[j], rank29);
+      sumb ^= DML_rank_rotl32(work[j], rank31);
+      if(++rank29 == 29)rank29 = 0;
+      if(++rank31 == 31)rank31 = 0;
+    }
+  }
+
+  checksum->suma = suma;
+  checksum->sumb = sumb;
+}
+
+/* Reorder and checksum nsites contiguous data with arbitrary
+   lexicographic ranks rank[0..nsites-1] */
+void DML_checksum_byterevn_indexed(DML_Checksum *checksum,
+				   const DML_SiteRank rank[], char *dst,
+				   const char *src, size_t nsites, size_t size,
+				   int word_size, int direction){
+
+  uint32_t suma = checksum->suma;
+  uint32_t sumb = checksum->sumb;
+  uint32_t work[DML_FUSE_SITES];
+  size_t i, j, n;
+
+  if(DML_big_endian())word_size = 1;
+
+  for(i = 0; i < nsites; i += n){
+    n = DML_byterevn_crc_sites(work, dst + i*size, src + i*size,
+			       nsites - i, size, word_size, direction);
+    for(j = 0; j < n; j++){
+      suma ^= DML_rank_rotl32(work[j], rank[i+j] % 29);
+      sumb ^= DML_rank_rotl32(work[j], rank[i+j] % 31);
+    }
+  }
+
+  checksum->suma = suma;
+  checksum->sumb = sumb;
+}
+
 /* Combine checksums over all nodes */
 void DML_checksum_combine(DML_Checksum *checksum){
   DML_global_xor(&checksum->suma);
@@ -1070,65 +1768,6 @@ int DML_big_endian(void)
 }
 
 
-/* Do byte reversal on n contiguous 32-bit words */
-void DML_byterevn32(uint32_t w[], size_t n)
-{
-  uint32_t old,newv;
-  size_t j;
-
-  assert(sizeof(uint32_t) == 4);
-  
-  for(j=0; j<n; j++)
-    {
-      old = w[j];
-      newv = old >> 24 & 0x000000ff;
-      newv |= old >> 8 & 0x0000ff00;
-      newv |= old << 8 & 0x00ff0000;
-      newv |= old << 24 & 0xff000000;
-      w[j] = newv;
-    }
-}
-
-
-/* Do byte reversal on n contiguous 64-bit words */
-void DML_byterevn64(uint32_t w[], size_t n)
-{
-  uint32_t tmp;
-  size_t j;
-
-  assert(sizeof(uint32_t) == 4);
-  
-  /* First swap pairs of 32-bit words */
-  for(j=0; j<n; j++){
-    tmp = w[2*j];
-    w[2*j] = w[2*j+1];
-    w[2*j+1] = tmp;
-  }
-
-  /* Then swap bytes in 32-bit words */
-  DML_byterevn32(w, 2*n);
-}
-
-/* Do byte reversal on size bytes of contiguous words,
-   each word consisting of word_size bytes 
-   word_size = 1, 4 or 8 are the only choices. */
-
-void DML_byterevn(void *buf, size_t size, int word_size)
-{
-  if(word_size == 1) {
-    /* NOP */
-  }
-  else if(word_size == 4) {
-    DML_byterevn32((uint32_t *)buf, size/word_size);
-  }
-  else if(word_size == 8) {
-    DML_byterevn64((uint32_t *)buf, size/word_size);
-  }
-  else{
-    printf("DML_byterevn: illegal word_size %d\n",word_size);
-  }
-}
-
 /*------------------------------------------------------------------*/
 /* Read and write buffer management */
 
@@ -1139,12 +1778,21 @@ size_t DML_max_buf_sites(size_t size, int factor){
 }
 
 /*------------------------------------------------------------------*/
+/* Allocate a buffer for up to *max_buf_sites sites, fewer if memory
+   is short.  A nonzero align, a power of 2, aligns it for O_DIRECT
+   I/O.  It is freed with free(). */
 char *
-DML_allocate_buf(size_t size, size_t *max_buf_sites)
+DML_allocate_buf(size_t size, size_t *max_buf_sites, size_t align)
 {
   char *lbuf = NULL;
+  void *p;
   while(*max_buf_sites>0) {
-    lbuf = (char*) malloc(*max_buf_sites*size);
+    if(align > sizeof(void *)) {
+      if(posix_memalign(&p, align, *max_buf_sites*size) == 0)
+	lbuf = (char *)p;
+    }
+    else
+      lbuf = (char*) malloc(*max_buf_sites*size);
     if(lbuf!=NULL) break;
     *max_buf_sites /= 2;
   }
@@ -1175,24 +1823,25 @@ int DML_write_buf_current(LRL_RecordWriter *lrl_record_out,
 
 /* If the outbuf contains data for more than one site, we assume the
    sites are in the correct order for writing to the requested point
-   in the file */
+   in the file.  The write is positioned, so it doesn't disturb the
+   current position of the writer. */
 
 int DML_write_buf_seek(LRL_RecordWriter *lrl_record_out,
 		       DML_SiteRank seeksite,
 		       char *lbuf, size_t buf_sites, size_t size,
 		       uint64_t *nbytes, char *myname, int this_node){
 
-  /* Seek to the appropriate position */
-  if(LRL_seek_write_record(lrl_record_out,(off_t)size*seeksite)
-     != LRL_SUCCESS){
-    printf("%s(%d) error while seeking to %lu\n",
-	   myname,this_node,size*seeksite);
+  uint64_t wrote = LRL_write_bytes_at(lrl_record_out, (off_t)size*seeksite,
+				      lbuf, buf_sites*size);
+  if(wrote != buf_sites*size){
+    printf("%s(%d) write error at %lu: wrote %lu bytes but wanted %lu\n",
+	   myname,this_node,(unsigned long)(size*seeksite),
+	   (unsigned long)wrote,(unsigned long)(buf_sites*size));
     return 1;
   }
+  *nbytes += buf_sites*size;
 
-  /* Then write */
-  return DML_write_buf_current(lrl_record_out, lbuf, buf_sites, size,
-			       nbytes, myname, this_node);
+  return 0;
 }
 
 /*------------------------------------------------------------------*/
@@ -1241,17 +1890,13 @@ size_t DML_read_buf_seek(LRL_RecordReader *lrl_record_in,
     new_buf_sites = max_send_sites - isite;
     if(new_buf_sites > max_buf_sites) new_buf_sites = max_buf_sites; 
 
-    /* Seek to the appropriate position in the record */
-    if(LRL_seek_read_record(lrl_record_in,(off_t)size*seeksite)
-       != LRL_SUCCESS){
-      *err = -1;
-      return 0;
-    }
-
-    /* Fill the buffer */
-    if( LRL_read_bytes(lrl_record_in, lbuf, new_buf_sites*size) 
-	!= new_buf_sites*size){
-      printf("%s(%d) read error\n", myname,this_node); 
+    /* Fill the buffer from the appropriate position in the record */
+    uint64_t got = LRL_read_bytes_at(lrl_record_in, (off_t)size*seeksite,
+				     lbuf, new_buf_sites*size);
+    if(got != new_buf_sites*size){
+      printf("%s(%d) read error at %lu: read %lu bytes but wanted %lu\n",
+	     myname,this_node,(unsigned long)(size*seeksite),
+	     (unsigned long)got,(unsigned long)(new_buf_sites*size));
       *err = -1;
       return 0;
     }
@@ -1393,7 +2038,8 @@ DML_RecordWriter *DML_partition_open_out(
     max_buf_sites = 1;
   }
 
-  outbuf = DML_allocate_buf(size, &max_buf_sites);
+  outbuf = DML_allocate_buf(size, &max_buf_sites,
+			    LRL_write_alignment(lrl_record_out));
   if(!outbuf){
     printf("%s(%d) can't malloc outbuf\n",myname,this_node);
     return 0;
@@ -1514,12 +2160,9 @@ int DML_partition_subset_sitedata_out(DML_RecordWriter *dml_record_out,
   /* my_io_node writes the data */
   if(this_node == my_io_node)
     {
-      /* Do byte reordering before checksum */
-      if (! DML_big_endian())
-	DML_byterevn(buf, size, word_size);
-      
-      /* Update checksum */
-      DML_checksum_accum(checksum, snd_coords, buf, size);
+      /* Do byte reordering and update checksum */
+      DML_checksum_byterevn_block(checksum, snd_coords, buf, buf, 1, size,
+				  word_size, DML_TO_FILE);
       
       /* Write the buffer when full */
 
@@ -1609,6 +2252,8 @@ uint64_t DML_partition_close_out(DML_RecordWriter *dml_record_out)
   uint64_t nbytes = dml_record_out->nbytes;
 
   if(dml_record_out == NULL)return 0;
+  /* Cached routes may be declared on the buffers */
+  DML_grid_route_free();
   if(dml_record_out->coords != NULL)
     free(dml_record_out->coords);
   if(dml_record_out->outbuf != NULL)
@@ -1621,10 +2266,10 @@ uint64_t DML_partition_close_out(DML_RecordWriter *dml_record_out)
 
 /*------------------------------------------------------------------*/
 /* Flush the outputbuffer to the file */
-static int DML_flush_outbuf(LRL_RecordWriter *lrl_record_out, int serpar,
-			    DML_SiteRank snd_coords, 
-			    char *outbuf, size_t buf_sites, size_t size,
-			    uint64_t *nbytes,  int this_node)
+int DML_flush_outbuf(LRL_RecordWriter *lrl_record_out, int serpar,
+		     DML_SiteRank snd_coords, 
+		     char *outbuf, size_t buf_sites, size_t size,
+		     uint64_t *nbytes,  int this_node)
 {
   char myname[] = "DML_flush_outbuf";
   int status;
@@ -1642,21 +2287,157 @@ static int DML_flush_outbuf(LRL_RecordWriter *lrl_record_out, int serpar,
   return status;
 }
 
+/*------------------------------------------------------------------*/
+/* Release the output buffer, finishing any writes queued from it */
+static void DML_free_outbuf(DML_WriteBehind *wb, char *outbuf)
+{
+  /* Cached routes may be declared on it */
+  DML_grid_route_free();
+  if(wb) DML_write_behind_close(wb, NULL, NULL);
+  else free(outbuf);
+}
+
+/*------------------------------------------------------------------*/
+/* Number of messages the I/O node keeps receives posted for while
+   collecting output and any node keeps in flight */
+static int DML_send_credits = DML_SEND_CREDITS;
+
+/* Returns the old value */
+int DML_set_send_credits(int credits){
+  int old = DML_send_credits;
+  DML_send_credits = credits < 1 ? 1 : credits;
+  return old;
+}
+
 #if defined(QIO_USE_DML_OUT_BUFFERING)
 /*------------------------------------------------------------------*/
 /* Flush message buffer to IO buffer.  Do byte reordering if needed.
    Accumulate checksums. (tbuf_sites is not reset here)
+   A non-null checksum means the I/O node filled tbuf with its own
+   sites, which are still in host order.  They are then reordered
+   on the way to outbuf and checksummed there, ending with rank
+   last_coords.  Received sites were processed by their sender.
  */
 
-static void DML_flush_tbuf_to_outbuf(size_t size, 
+static void DML_flush_tbuf_to_outbuf(size_t size, int word_size,
 				    char *outbuf, size_t buf_sites, 
-				    char *tbuf, size_t tbuf_sites )
+				    char *tbuf, size_t tbuf_sites,
+				    DML_SiteRank last_coords,
+				    DML_Checksum *checksum)
+{
+  char *dst = outbuf + size*buf_sites;
+
+  if(tbuf_sites == 0)return;
+
+  if(checksum == NULL){
+    /* Copy tbuf to outbuf */
+    memcpy((void *)dst, (void *)tbuf, size*tbuf_sites);
+    return;
+  }
+
+  DML_checksum_byterevn_block(checksum, last_coords + 1 - tbuf_sites,
+			      dst, tbuf, tbuf_sites, size, word_size,
+			      DML_TO_FILE);
+}
+
+/*------------------------------------------------------------------*/
+/* A node sending its message buffer to the I/O node does byte
+   reordering and accumulates the checksum for all of it at once.  The sites have
+   consecutive lexicographic ranks ending with last_coords. */
+
+static void DML_process_tbuf(char *tbuf, size_t tbuf_sites, size_t size,
+			     int word_size, DML_SiteRank last_coords,
+			     DML_Checksum *checksum)
 {
   if(tbuf_sites == 0)return;
 
-  /* Copy tbuf to outbuf */
-  memcpy((void *)(outbuf + size*buf_sites), 
-	 (void *)tbuf, size*tbuf_sites);
+  DML_checksum_byterevn_block(checksum, last_coords + 1 - tbuf_sites,
+			      tbuf, tbuf, tbuf_sites, size, word_size,
+			      DML_TO_FILE);
+}
+
+/*------------------------------------------------------------------*/
+/* Messages to the I/O node.  All nodes of an I/O partition walk the
+   same site loop, so each can tell which node sends each message and
+   when.  A message holds sites consecutive in the loop and in
+   lexicographic rank, all on one node, up to a message buffer. */
+
+typedef struct {
+  int node;                      /* Node holding the sites */
+  int first;                     /* First of a series from the node */
+  size_t nsites;
+  DML_SiteRank last;             /* Rank of the last site */
+  DML_SiteRank seek;             /* Record position of the first site */
+  int adjacent;                  /* The next message continues in rank */
+  char *buf;                     /* Message buffer */
+  DML_Request *recv;             /* Posted receive */
+  DML_Request *credit;           /* Credit sent to the node */
+  DML_Request *send;             /* Send in flight (sending node) */
+} DML_PartitionMsg;
+
+typedef struct {
+  DML_SiteList *sites;
+  DML_Layout *layout;
+  int *coords;
+  int more;                      /* Sites remain in the loop */
+  DML_SiteRank snd_coords;       /* Next site in the loop */
+  int new_node;                  /* Node holding it */
+  DML_Index new_index;           /* Its storage index there */
+  int prev_node;                 /* Node of the previous message */
+  size_t max_sites;              /* Sites per message */
+} DML_PartitionPlan;
+
+/* Start the site loop.  Returns 0 if there are no sites. */
+static int DML_plan_init(DML_PartitionPlan *p, DML_SiteList *sites,
+			 DML_Layout *layout, int *coords, int my_io_node,
+			 size_t max_sites){
+  p->sites = sites;
+  p->layout = layout;
+  p->coords = coords;
+  p->prev_node = my_io_node;
+  p->max_sites = max_sites;
+  p->more = DML_init_subset_site_loop(&p->snd_coords, sites);
+  if(p->more)
+    DML_site_owner(sites, layout, p->snd_coords, coords, &p->new_node,
+		   &p->new_index);
+  return p->more;
+}
+
+/* Collect the next message.  The node holding the sites fetches them
+   to buf.  Returns 0 when the loop is done. */
+static int DML_plan_next(DML_PartitionPlan *p, DML_PartitionMsg *m,
+			 char *buf, size_t size,
+			 void (*get)(char *buf, size_t first, size_t nsites,
+				     int count, void *arg),
+			 int count, void *arg){
+  int this_node = p->layout->this_node;
+  DML_SiteRun run;
+
+  if(!p->more)return 0;
+
+  m->node = p->new_node;
+  m->first = m->node != p->prev_node;
+  m->nsites = 0;
+  m->seek = DML_subset_rank(p->snd_coords, p->sites);
+  run.nsites = 0;
+  do {
+    if(this_node == m->node)
+      DML_run_add(&run, buf + size*m->nsites, p->new_index, size,
+		  get, count, arg);
+    m->nsites++;
+    m->last = p->snd_coords;
+    p->more = DML_next_subset_site(&p->snd_coords, p->sites);
+    if(p->more)
+      DML_site_owner(p->sites, p->layout, p->snd_coords, p->coords,
+		     &p->new_node, &p->new_index);
+  } while(p->more && p->new_node == m->node &&
+	  m->nsites < p->max_sites && p->snd_coords == m->last + 1);
+  m->adjacent = p->more && p->snd_coords == m->last + 1;
+  p->prev_node = m->node;
+
+  if(this_node == m->node)
+    DML_run_flush(&run, get, count, arg);
+  return 1;
 }
 
 /*------------------------------------------------------------------*/
@@ -1670,27 +2451,49 @@ static void DML_flush_tbuf_to_outbuf(size_t size,
    algorithm is intended for SINGLEFILE/SERIAL, MULTIFILE, and
    PARTFILE/PARTFILE_DIR modes. */
 
+/* Flow control is by credits.  The I/O node keeps receives posted for
+   the next messages in the site loop, as many as it has credits.  As
+   a series of messages from a node enters this window it sends the
+   node a credit.  The node waits for the credit before sending the
+   first message of the series and sends the rest without waiting.
+   Credits go out well ahead of the data, so nodes rarely wait a round
+   trip, and no more than the credit count of nodes are sending.
+
+   A sending node has as many message buffers as credits.  It packs
+   the next one while the earlier ones are still on their way. */
+
 uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out,
-	   void (*get)(char *buf, size_t index, int count, void *arg),
+	   void (*get)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
 	   int count, size_t size, int word_size, void *arg,
 	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
 	   int serpar, DML_Checksum *checksum)
 {
   double dtall=0, dtall2=0, dtwrite2=0, dtsend2=0, dtproc2=0, dtcalc2=0;
-  char *buf,*outbuf = NULL,*tbuf = NULL, *scratch_buf;
-  int current_node, new_node;
+  char *outbuf = NULL, *tbuf = NULL, *scratch_buf;
   int *coords;
   int this_node = layout->this_node;
   int my_io_node;
   int latdim = layout->latdim;
-  int *latsize = layout->latsize;
-  size_t isite,buf_sites,tbuf_sites,max_buf_sites=0,max_tbuf_sites;
-  int status;
-  DML_SiteRank subset_rank;
-  DML_SiteRank snd_coords,prev_coords,outbuf_coords;
+  size_t buf_sites,max_buf_sites=0,max_tbuf_sites;
+  size_t credits = 1, planned, processed, i;
+  int status, err = 0;
+  DML_SiteRank outbuf_seek = 0;
+  DML_PartitionPlan plan;
+  DML_PartitionMsg msg, *msgs = NULL, *m;
+  DML_WriteBehind *wb = NULL;
+  double dtdisk = 0;
   uint64_t nbytes = 0;
+  int nthreads;
   char myname[] = "DML_partition_out";
 
+  /* A file of our own sites alone is shared by I/O threads */
+  nthreads = DML_local_io_threads(layout, sites, volfmt, size,
+				  LRL_write_concurrent(lrl_record_out));
+  if(nthreads > 1)
+    return DML_threaded_out(lrl_record_out, get, count, size, word_size,
+			    arg, layout, sites, volfmt, nthreads, checksum);
+
   timestart(dtall);
   timestart2(dtall2);
 
@@ -1712,37 +2515,36 @@ uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out,
     if(max_tbuf_sites > max_buf_sites)max_buf_sites = max_tbuf_sites;
   }
 
-#if 0
-  /* For parallel I/O we don't try to buffer for messaging.  When each
-     node can do I/O the data being written is local.  If we start
-     doing PARTFILE/PARTFILE_DIR parallel I/O we may want to buffer. */
-  if(serpar == DML_PARALLEL){
-    max_buf_sites = 1;
-    max_tbuf_sites = 1;
-  }
-#endif
-
-  /* Only the I/O node has an output buffer */
+  /* Only the I/O node has output buffers.  Full ones are written
+     behind while the next is filled. */
   if(this_node == my_io_node){
-    outbuf = DML_allocate_buf(size, &max_buf_sites);
-    if(!outbuf){
-      printf("%s(%d) can't malloc outbuf\n",myname,this_node);
-      return 0;
-    }
-  }
-
-  tbuf = DML_allocate_buf(size, &max_tbuf_sites);
-  if(!tbuf){
+    wb = DML_write_behind_open(lrl_record_out, serpar, size,
+			       &max_buf_sites, this_node);
+    if(!wb)return 0;
+    outbuf = DML_write_behind_buffer(wb);
+  }
+
+  /* Every node has a message buffer for each credit, fewer if memory
+     is short.  Every node must split messages alike, so no smaller
+     buffers. */
+  credits = (size_t)DML_send_credits;
+  while(!(tbuf = (char *)malloc(credits*max_tbuf_sites*size)) &&
+	credits > 1)
+    credits /= 2;
+  msgs = (DML_PartitionMsg *)calloc(credits, sizeof(DML_PartitionMsg));
+  if(!tbuf || !msgs){
     printf("%s(%d) can't malloc tbuf\n",myname,this_node);
-    free(outbuf);
+    DML_write_behind_close(wb, NULL, NULL); free(tbuf); free(msgs);
     return 0;
   }
+  for(i = 0; i < credits; i++)
+    msgs[i].buf = tbuf + i*max_tbuf_sites*size;
 
-  /* Scratch for clear-to-send signal */
-  { size_t one=1; scratch_buf = DML_allocate_buf(4, &one); }
+  /* Scratch for the credit signal */
+  { size_t one=1; scratch_buf = DML_allocate_buf(4, &one, 0); }
   if(!scratch_buf){
     printf("%s(%d) can't malloc scratch_buf\n",myname,this_node);
-    free(outbuf); free(tbuf);
+    DML_write_behind_close(wb, NULL, NULL); free(tbuf); free(msgs);
     return 0;
   }
   memset(scratch_buf,0,4);
@@ -1751,7 +2553,8 @@ uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out,
   coords = DML_allocate_coords(latdim, myname, this_node);
   if(!coords){
     printf("%s(%d) can't allocate coords\n",myname,this_node);
-    free(outbuf);free(tbuf);free(scratch_buf);
+    DML_write_behind_close(wb, NULL, NULL);
+    free(tbuf); free(msgs); free(scratch_buf);
     return 0;
   }
 
@@ -1763,152 +2566,147 @@ uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out,
     printf("%s(%d): byte reversing %d\n",myname,this_node,word_size);
 #endif
 
-  /* Maximum number of sites to be processed */
-  //max_dest_sites = sites->subset_io_sites;
-  isite = 0;  /* Running count of all sites */
-
-  current_node = my_io_node;
-
-  /* Loop over the sending coordinates */
-  buf = outbuf;
-  buf_sites = 0;   /* Count of sites in the output buffer */
-  tbuf_sites = 0;  /* Count of sites in the message tbuf */
-
-  if(DML_init_subset_site_loop(&snd_coords, sites) == 0){
+  if(DML_plan_init(&plan, sites, layout, coords, my_io_node,
+		   max_tbuf_sites) == 0){
     printf("%s(%d): DML_init_subset_site_loop returned 0\n",myname,this_node);
-    free(outbuf); free(tbuf); free(scratch_buf); free(coords);
+    DML_write_behind_close(wb, NULL, NULL);
+    free(tbuf); free(msgs); free(scratch_buf); free(coords);
     return 0;
   }
 
-  /* To track lexicographic order */
-  prev_coords = snd_coords-1;
-  /* Remember coordinate of first site in outbuf so we know where to
-     seek */
-  outbuf_coords = snd_coords;
-  /* The subset_rank locates the datum for outbuf_coords in the
-     record our I/O partition is writing */
-  subset_rank = DML_subset_rank(outbuf_coords, sites);
-  if(subset_rank<0) {
-    printf("%s(%d): Output rank %lu unexpectedly missing from subset list\n",
-	   myname,this_node,outbuf_coords);
-    return 0;
-  }
-
-  do {
-    timestart2(dtcalc2);
-    /* Convert lexicographic rank to coordinates */
-    DML_lex_coords(coords, latdim, latsize, snd_coords);
-
-    /* Node that sends data */
-    new_node = layout->node_number_ext(coords, layout->arg);
-    timestop2(dtcalc2);
-
-    /* A node sends its message buffer to the io_node when changing
-       nodes or when its message buffer is full or when the
-       lexicographic order is broken */
-    if(new_node != current_node ||
-       tbuf_sites >= max_tbuf_sites ||
-       snd_coords != prev_coords + 1){
-      if(tbuf_sites > 0){
-	/* Node with data sends its message buffer to the I/O node's tbuf */
-	if(current_node != my_io_node) {
-	  timestart2(dtsend2);
-	  DML_route_bytes(tbuf,size*tbuf_sites,current_node,my_io_node);
-	  timestop2(dtsend2);
-	}
-	/* The I/O node flushes its tbuf and accumulates the checksum */
-	if(this_node == my_io_node){
-	  DML_flush_tbuf_to_outbuf(size, outbuf, buf_sites, tbuf, tbuf_sites);
-	  buf_sites += tbuf_sites;
-	  /* The I/O node writes the I/O buffer when full or when the
-	     lexicographic order is broken */
-	  if(buf_sites > max_buf_sites - max_tbuf_sites ||
-	     snd_coords != prev_coords + 1){
-	    timestart2(dtwrite2);
-	    status = DML_flush_outbuf(lrl_record_out, serpar, subset_rank,
-			     outbuf, buf_sites, size, &nbytes, this_node);
-	    if(status != 0) {
-	      printf("%s(%d): DML_flush_outbuf returned status %i\n",
-		     myname,this_node,status);
-	      free(outbuf); free(tbuf); free(scratch_buf); free(coords);
-	      return 0;
-	    }
-	    timestop2(dtwrite2);
-	    timestart2(dtcalc2);
-	    buf_sites = 0;
-	    outbuf_coords = snd_coords;
-	    subset_rank = DML_subset_rank(outbuf_coords, sites);
-	    if(subset_rank<0) {
-	      printf("%s(%d): Output rank %lu unexpectedly missing from subset list\n",
-		     myname,this_node,outbuf_coords);
-	      free(outbuf); free(tbuf); free(scratch_buf); free(coords);
-	      return 0;
-	    }
-	    timestop2(dtcalc2);
-	  }
-	}
-	tbuf_sites = 0;
+  if(this_node != my_io_node){
+    /* Send our messages as the site loop comes to them */
+    planned = 0;
+    for(;;){
+      /* The buffer for our next message must be free before the plan
+	 fills it */
+      m = msgs + planned % credits;
+      if(m->send){
+	timestart2(dtsend2);
+	DML_wait_bytes(m->send);
+	m->send = NULL;
+	timestop2(dtsend2);
       }
 
-      /* Send nodes must wait for a ready signal from the I/O node
-	 to prevent message pileups on the I/O node */
+      timestart2(dtcalc2);
+      status = DML_plan_next(&plan, &msg, m->buf, size, get, count, arg);
+      timestop2(dtcalc2);
+      if(!status)break;
+      if(msg.node != this_node)continue;
 
-      /* CTS only if changing data source node */
-      timestart2(dtsend2);
-      if(new_node != current_node){
-	DML_clear_to_send(scratch_buf,4,my_io_node,new_node);
-	current_node = new_node;
-      }
-      timestop2(dtsend2);
-    } /* current_node != newnode || tbuf_sites >= max_tbuf_sites */
-
-    /* The node with the data just appends it to its message buffer */
-    if(this_node == current_node){
+      /* Node with data finishes its message buffer */
       timestart2(dtproc2);
-      /* Fetch to the message buffer */
-      buf = tbuf + size*tbuf_sites;
-      DML_Index ni = layout->node_index_ext(coords,layout->arg);
-      get(buf,ni,count,arg);
-
-      /* Do byte reordering and update checksum */
-      if (! DML_big_endian()) DML_byterevn(buf, size, word_size);
-      DML_checksum_accum(checksum, snd_coords, buf, size);
+      DML_process_tbuf(m->buf, msg.nsites, size, word_size, msg.last,
+		       checksum);
       timestop2(dtproc2);
-    }
-
-    /* The I/O node and current node count sites together */
-    if(this_node == current_node || this_node == my_io_node)tbuf_sites++;
-
-    isite++;
-    prev_coords = snd_coords;
-  } while(DML_next_subset_site(&snd_coords, sites));
 
-  /* Purge any remaining data */
-
-  if(tbuf_sites > 0){
-    if(current_node != my_io_node) {
       timestart2(dtsend2);
-      DML_route_bytes(tbuf,size*tbuf_sites,current_node,my_io_node);
+      if(msg.first)
+	DML_get_bytes(scratch_buf,4,my_io_node);
+      m->send = DML_isend_bytes(m->buf,size*msg.nsites,my_io_node);
+      if(!m->send)
+	DML_send_bytes(m->buf,size*msg.nsites,my_io_node);
       timestop2(dtsend2);
+      planned++;
     }
+
+    timestart2(dtsend2);
+    for(i = 0; i < credits; i++)
+      if(msgs[i].send)DML_wait_bytes(msgs[i].send);
+    timestop2(dtsend2);
   }
+  else {
+    buf_sites = 0;   /* Count of sites in the output buffer */
+    planned = processed = 0;
+    for(;;){
+      /* Post receives and send credits for the window of upcoming
+	 messages */
+      while(plan.more && planned - processed < credits){
+	m = msgs + planned % credits;
+	timestart2(dtcalc2);
+	DML_plan_next(&plan, m, m->buf, size, get, count, arg);
+	timestop2(dtcalc2);
+	if(m->node != my_io_node){
+	  timestart2(dtsend2);
+	  m->recv = DML_irecv_bytes(m->buf, size*m->nsites, m->node);
+	  if(m->recv && m->first){
+	    m->credit = DML_isend_bytes(scratch_buf, 4, m->node);
+	    /* The node won't send without its credit, so if the credit
+	       couldn't be posted send it now */
+	    if(!m->credit)DML_send_bytes(scratch_buf, 4, m->node);
+	  }
+	  timestop2(dtsend2);
+	}
+	planned++;
+      }
+      if(processed == planned)break;
 
-  if(this_node == my_io_node){
+      /* Take the next message in loop order */
+      m = msgs + processed % credits;
+      processed++;
+      if(m->node != my_io_node){
+	timestart2(dtsend2);
+	if(m->recv){
+	  DML_wait_bytes(m->recv);
+	  if(m->credit)DML_wait_bytes(m->credit);
+	}
+	else {
+	  /* Couldn't post it.  Do it the slow way. */
+	  if(m->first)DML_send_bytes(scratch_buf,4,m->node);
+	  DML_get_bytes(m->buf,size*m->nsites,m->node);
+	}
+	m->recv = m->credit = NULL;
+	timestop2(dtsend2);
+      }
+      if(err)continue;
+
+      /* The I/O node flushes the message to outbuf and accumulates the
+	 checksum for its own sites */
+      if(buf_sites == 0){
+	outbuf_seek = m->seek;
+	if(outbuf_seek<0) {
+	  printf("%s(%d): Output rank %lu unexpectedly missing from subset list\n",
+		 myname,this_node,(unsigned long)(m->last + 1 - m->nsites));
+	  err = 1;
+	  continue;
+	}
+      }
+      timestart2(dtproc2);
+      DML_flush_tbuf_to_outbuf(size, word_size, outbuf, buf_sites,
+			       m->buf, m->nsites, m->last,
+			       m->node == my_io_node ? checksum : NULL);
+      timestop2(dtproc2);
+      buf_sites += m->nsites;
+
+      /* The I/O node writes the I/O buffer when full or when the
+	 lexicographic order is broken */
+      if(buf_sites > max_buf_sites - max_tbuf_sites || !m->adjacent){
+	timestart2(dtwrite2);
+	status = DML_write_behind_submit(wb, outbuf, outbuf_seek, buf_sites);
+	if(status != 0) {
+	  printf("%s(%d): DML_write_behind_submit returned status %i\n",
+		 myname,this_node,status);
+	  err = 1;
+	}
+	outbuf = DML_write_behind_buffer(wb);
+	buf_sites = 0;
+	timestop2(dtwrite2);
+      }
+    }
+
+    /* Messages already posted were drained above even after an
+       error */
     timestart2(dtwrite2);
-    DML_flush_tbuf_to_outbuf(size, outbuf, buf_sites, tbuf, tbuf_sites);
-    buf_sites += tbuf_sites;
-    tbuf_sites = 0;
-    status = DML_flush_outbuf(lrl_record_out, serpar, subset_rank,
-			      outbuf, buf_sites, size, &nbytes, this_node);
-    buf_sites = 0;
-    if(status !=  0) nbytes = 0;
+    status = DML_write_behind_close(wb, &nbytes, &dtdisk);
+    if(status != 0 || err) nbytes = 0;
     timestop2(dtwrite2);
   }
 
+  DML_free_requests();
   free(coords);
   free(scratch_buf);
-  free(outbuf);
   free(tbuf);
+  free(msgs);
   timestop(dtall);
   timestop2(dtall2);
 
@@ -1918,14 +2716,17 @@ uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out,
     dtwrite2 *= s;
     dtsend2 *= s;
     dtproc2 *= s;
+    /* "write" is the time spent waiting for a free output buffer and
+       "disk" the time the writes took.  Any difference was overlapped
+       with the other work. */
 #if 1
     if(this_node==layout->master_io_node) {
-      printf("%s times: calc %.2f  write %.2f  send %.2f  process %.2f  total %.2f\n",
-	     myname, dtcalc2, dtwrite2, dtsend2, dtproc2, dtall);
+      printf("%s times: calc %.2f  write %.2f  send %.2f  process %.2f  total %.2f  disk %.2f\n",
+	     myname, dtcalc2, dtwrite2, dtsend2, dtproc2, dtall, dtdisk);
     }
 #else
-    printf("%i: %s times: calc %.2f  write %.2f  send %.2f  process %.2f  total %.2f\n",
-           this_node, myname, dtcalc2, dtwrite2, dtsend2, dtproc2, dtall);
+    printf("%i: %s times: calc %.2f  write %.2f  send %.2f  process %.2f  total %.2f  disk %.2f\n",
+           this_node, myname, dtcalc2, dtwrite2, dtsend2, dtproc2, dtall, dtdisk);
 #endif
   }
   /* Number of bytes written by this node only */
@@ -1948,24 +2749,36 @@ uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out,
 /* This is the old algorithm that sent only one site's worth at a time */
 
 uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out, 
-	   void (*get)(char *buf, size_t index, int count, void *arg),
+	   void (*get)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
 	   int count, size_t size, int word_size, void *arg, 
 	   DML_Layout *layout, DML_SiteList *sites, int volfmt, 
 	   int serpar, DML_Checksum *checksum)
 {
   char *buf,*outbuf,*scratch_buf;
+  DML_SiteRank *ranks;
   int current_node, new_node;
+  DML_Index new_index;
   int *coords;
   int this_node = layout->this_node;
   int my_io_node;
   int latdim = layout->latdim;
-  int *latsize = layout->latsize;
   size_t isite,buf_sites,max_buf_sites,max_dest_sites;
   int status;
   DML_SiteRank snd_coords, subset_rank;
+  DML_SiteRun run;
+  DML_WriteBehind *wb = NULL;
   uint64_t nbytes = 0;
+  int nthreads;
   char myname[] = "DML_partition_out";
 
+  /* A file of our own sites alone is shared by I/O threads */
+  nthreads = DML_local_io_threads(layout, sites, volfmt, size,
+				  LRL_write_concurrent(lrl_record_out));
+  if(nthreads > 1)
+    return DML_threaded_out(lrl_record_out, get, count, size, word_size,
+			    arg, layout, sites, volfmt, nthreads, checksum);
+
   /* Get my I/O node */
   my_io_node = DML_my_ionode(volfmt, serpar, layout);
 
@@ -1979,23 +2792,40 @@ uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out,
   if(serpar == DML_PARALLEL)
     max_buf_sites = 1;
 
-  outbuf = DML_allocate_buf(size, &max_buf_sites);
-  if(!outbuf){
-    printf("%s(%d) can't malloc outbuf\n",myname,this_node);
+  /* The I/O node writes full buffers behind while filling the next */
+  if(this_node == my_io_node){
+    wb = DML_write_behind_open(lrl_record_out, serpar, size,
+			       &max_buf_sites, this_node);
+    if(!wb)return 0;
+    outbuf = DML_write_behind_buffer(wb);
+  }
+  else {
+    outbuf = DML_allocate_buf(size, &max_buf_sites, 0);
+    if(!outbuf){
+      printf("%s(%d) can't malloc outbuf\n",myname,this_node);
+      return 0;
+    }
+  }
+
+  /* Ranks of the sites in the write buffer for the checksum */
+  ranks = (DML_SiteRank *)malloc(max_buf_sites*sizeof(DML_SiteRank));
+  if(!ranks){
+    printf("%s(%d) can't malloc ranks\n",myname,this_node);
+    DML_free_outbuf(wb, outbuf);
     return 0;
   }
 
-  { size_t one=1; scratch_buf = DML_allocate_buf(4, &one); }
+  { size_t one=1; scratch_buf = DML_allocate_buf(4, &one, 0); }
   if(!scratch_buf){
     printf("%s(%d) can't malloc scratch_buf\n",myname,this_node);
-    free(outbuf);
+    DML_free_outbuf(wb, outbuf); free(ranks);
     return 0;
   }
   memset(scratch_buf,0,4);
 
   /* Allocate lattice coordinate */
   coords = DML_allocate_coords(latdim, myname, this_node);
-  if(!coords){free(outbuf);return 0;}
+  if(!coords){DML_free_outbuf(wb, outbuf); free(ranks); free(scratch_buf); return 0;}
   
   /* Initialize checksum */
   DML_checksum_init(checksum);
@@ -2014,17 +2844,15 @@ uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out,
   /* Loop over the sending coordinates */
   buf = outbuf;
   buf_sites = 0;   /* Count of sites in the output buffer */
+  run.nsites = 0;  /* Sites waiting to be fetched to the buffer */
   if(DML_init_subset_site_loop(&snd_coords, sites) == 0){
-    free(outbuf); free(coords); free(scratch_buf);
+    DML_free_outbuf(wb, outbuf); free(ranks); free(coords); free(scratch_buf);
     return 0;
   }
 
   do {
-    /* Convert lexicographic rank to coordinates */
-    DML_lex_coords(coords, latdim, latsize, snd_coords);
-
-    /* Node that sends data */
-    new_node = layout->node_number_ext(coords, layout->arg);
+    /* Node that sends data and where it keeps it */
+    DML_site_owner(sites, layout, snd_coords, coords, &new_node, &new_index);
 
     /* Send nodes must wait for a ready signal from the I/O node
        to prevent message pileups on the I/O node */
@@ -2037,15 +2865,16 @@ uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out,
 
     /* Copy to the write buffer */
     if(this_node == current_node){
-      /* Fetch directly to the buffer */
+      /* Fetch directly to the buffer, a run at a time */
       buf = outbuf + size*buf_sites;
-      get(buf,layout->node_index_ext(coords,layout->arg),count,arg);
+      DML_run_add(&run, buf, new_index, size, get, count, arg);
       buf_sites++;
     }
 
     /* Send result to my I/O node. Avoid I/O node sending to itself. */
     if (current_node != my_io_node) 
     {
+      if(this_node == current_node)DML_run_flush(&run, get, count, arg);
 #if 1
       /* Data from any other node is received in the I/O node write buffer */
       if(this_node == my_io_node){
@@ -2072,50 +2901,192 @@ uint64_t DML_partition_out(LRL_RecordWriter *lrl_record_out,
 
     /* Now write data */
     if(this_node == my_io_node) {
-      /* Do byte reordering before checksum */
-      if (! DML_big_endian())
-	DML_byterevn(buf, size, word_size);
-
-      /* Update checksum */
-      DML_checksum_accum(checksum, snd_coords, buf, size);
+      /* Remember the rank of the new datum for the checksum */
+      ranks[buf_sites-1] = snd_coords;
 
       /* Write the buffer when full */
       if( (buf_sites >= max_buf_sites) || (isite == max_dest_sites-1) ) {
+	/* Fetch the sites still pending */
+	DML_run_flush(&run, get, count, arg);
+
+	/* Do byte reordering and update checksum for the whole buffer */
+	DML_checksum_byterevn_indexed(checksum, ranks, outbuf, outbuf,
+				      buf_sites, size, word_size,
+				      DML_TO_FILE);
+
 	/* The subset_rank locates the datum for snd_coords in the
 	   record that our I/O partition is writing */
 	subset_rank = DML_subset_rank(snd_coords, sites);
 	if(subset_rank<0) {
 	  printf("%s(%d): Output rank %ld unexpectedly missing from subset list\n",
 		 myname,this_node,snd_coords);
-	  free(outbuf); free(coords);
+	  DML_free_outbuf(wb, outbuf); free(ranks); free(coords); free(scratch_buf);
 	  return 0;
 	}
-	status = DML_flush_outbuf(lrl_record_out, serpar, subset_rank,
-				  outbuf, buf_sites, size, &nbytes,
-				  this_node);
+	status = DML_write_behind_submit(wb, outbuf, subset_rank, buf_sites);
+	outbuf = DML_write_behind_buffer(wb);
 	buf_sites = 0;
-	if(status != 0) {free(outbuf); free(coords); return 0;}
+	if(status != 0) {
+	  DML_free_outbuf(wb, outbuf); free(ranks); free(coords); free(scratch_buf);
+	  return 0;
+	}
       }
     }
     isite++;
   } while(DML_next_subset_site(&snd_coords, sites));
 
+  /* Cached routes are declared on outbuf */
+  DML_grid_route_free();
   free(coords);
   free(scratch_buf);
-  free(outbuf);
+  free(ranks);
+  if(wb){
+    if(DML_write_behind_close(wb, &nbytes, NULL) != 0) nbytes = 0;
+  }
+  else
+    free(outbuf);
 
   /* Number of bytes written by this node only */
   return nbytes;
 }
 #endif  /* if defined(QIO_USE_DML_OUT_BUFFERING) */
 
+/*------------------------------------------------------------------*/
+/* Write a field held contiguously in node storage order directly
+   from the application's array.  This needs every site written by
+   this node's I/O partition to live on this node: multifile format, a
+   single node, or partfile and singlefile parallel output with one
+   node per partition.  Other cases go through DML_partition_out.
+
+   Sites consecutive in the file are taken a buffer at a time.  Those
+   also consecutive in storage are reordered and checksummed with one
+   call on the way to the buffer.  When no reordering is needed and
+   the whole buffer is one storage run, it is written straight from
+   the array, which is left unchanged until the queued writes finish. */
+
+/* Returns the number of bytes written by this node */
+
+uint64_t DML_contiguous_out(LRL_RecordWriter *lrl_record_out,
+	   int count, int word_size, DML_Contiguous *field,
+	   DML_Layout *layout, DML_SiteList *sites, int volfmt,
+	   int serpar, DML_Checksum *checksum)
+{
+  const char *base = field->base;
+  size_t size = field->size;
+  const char *src;
+  char *outbuf, *lbuf;
+  DML_SiteRank *ranks, snd_coords, subset_rank, first_rank = 0;
+  DML_Index *index;
+  int *coords, node;
+  int this_node = layout->this_node;
+  int latdim = layout->latdim;
+  int in_place = DML_big_endian() || word_size == 1;
+  size_t i, n, buf_sites, max_buf_sites;
+  int notdone, status, nthreads;
+  DML_WriteBehind *wb;
+  uint64_t nbytes = 0;
+  char myname[] = "DML_contiguous_out";
+
+  /* Other nodes contribute to our record.  Take the usual route. */
+  if(!(volfmt == DML_MULTIFILE || layout->number_of_nodes == 1 ||
+       ((volfmt != DML_SINGLEFILE || serpar == DML_PARALLEL) &&
+	layout->ionode(this_node) == this_node &&
+	sites->number_of_my_ionodes == 1)))
+    return DML_partition_out(lrl_record_out, DML_get_contiguous, count,
+			     size, word_size, (void *)field, layout, sites,
+			     volfmt, serpar, checksum);
+
+  /* A file of our own sites alone is shared by I/O threads */
+  nthreads = DML_local_io_threads(layout, sites, volfmt, size,
+				  LRL_write_concurrent(lrl_record_out));
+  if(nthreads > 1)
+    return DML_threaded_out(lrl_record_out, DML_get_contiguous, count, size,
+			    word_size, (void *)field, layout, sites, volfmt,
+			    nthreads, checksum);
+
+  /* Full buffers are written behind while the next is filled */
+  max_buf_sites = DML_max_buf_sites(size,1);
+  wb = DML_write_behind_open(lrl_record_out, serpar, size, &max_buf_sites,
+			     this_node);
+  if(!wb)return 0;
+
+  /* Storage index and rank of each site in the buffer */
+  ranks = (DML_SiteRank *)malloc(max_buf_sites*sizeof(DML_SiteRank));
+  index = (DML_Index *)malloc(max_buf_sites*sizeof(DML_Index));
+  coords = DML_allocate_coords(latdim, myname, this_node);
+  if(!ranks || !index || !coords){
+    printf("%s(%d) can't malloc site tables\n",myname,this_node);
+    DML_free_outbuf(wb, NULL); free(ranks); free(index); free(coords);
+    return 0;
+  }
+
+  /* Initialize checksum */
+  DML_checksum_init(checksum);
+
+  notdone = DML_init_subset_site_loop(&snd_coords, sites);
+  while(notdone){
+    /* Collect sites that are consecutive in the file */
+    buf_sites = 0;
+    do {
+      /* In parallel mode the subset_rank locates the datum in the
+	 record.  In serial mode we write consecutively. */
+      if(serpar == DML_PARALLEL){
+	subset_rank = DML_subset_rank(snd_coords, sites);
+	if(subset_rank<0){
+	  printf("%s(%d): Output rank %ld unexpectedly missing from subset list\n",
+		 myname,this_node,snd_coords);
+	  DML_free_outbuf(wb, NULL); free(ranks); free(index); free(coords);
+	  return 0;
+	}
+	if(buf_sites == 0) first_rank = subset_rank;
+	else if(subset_rank != first_rank + (DML_SiteRank)buf_sites) break;
+      }
+      DML_site_owner(sites, layout, snd_coords, coords, &node,
+		     &index[buf_sites]);
+      ranks[buf_sites] = snd_coords;
+      buf_sites++;
+      notdone = DML_next_subset_site(&snd_coords, sites);
+    } while(notdone && buf_sites < max_buf_sites);
+
+    /* Reorder and checksum a storage run at a time */
+    outbuf = DML_write_behind_buffer(wb);
+    lbuf = outbuf;
+    for(i = 0; i < buf_sites; i += n){
+      for(n = 1; i + n < buf_sites && index[i+n] == index[i] + n; n++);
+      src = base + index[i]*size;
+      if(in_place && n == buf_sites){
+	lbuf = (char *)src;
+	DML_checksum_accum_indexed(checksum, ranks, lbuf, n, size);
+      }
+      else
+	DML_checksum_byterevn_indexed(checksum, ranks + i, outbuf + i*size,
+				      src, n, size, word_size, DML_TO_FILE);
+    }
+
+    status = DML_write_behind_submit(wb, lbuf, first_rank, buf_sites);
+    if(status != 0){
+      DML_free_outbuf(wb, NULL); free(ranks); free(index); free(coords);
+      return 0;
+    }
+  }
+
+  free(ranks);
+  free(index);
+  free(coords);
+  if(DML_write_behind_close(wb, &nbytes, NULL) != 0) nbytes = 0;
+
+  /* Number of bytes written by this node only */
+  return nbytes;
+}
+
 
 /*------------------------------------------------------------------*/
 /* The master node fetches the global data in one call to "get"  and writes */
 /* Returns the number of bytes written */
 
 size_t DML_global_out(LRL_RecordWriter *lrl_record_out, 
-	   void (*get)(char *buf, size_t index, int count, void *arg),
+	   void (*get)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
 	   int count, size_t size, int word_size, void *arg, 
            DML_Layout *layout, int volfmt, 
 	   DML_Checksum *checksum)
@@ -2145,14 +3116,11 @@ size_t DML_global_out(LRL_RecordWriter *lrl_record_out,
   /* Master node writes all the data */
   if(this_node == layout->master_io_node){
     /* Get all the data.  0 for the unused site index */
-    get(buf,0,count,arg);
-    
-    /* Do byte reordering before checksum */
-    if (! DML_big_endian())
-      DML_byterevn(buf, size, word_size);
+    get(buf,0,1,count,arg);
     
-    /* Do checksum.  Straight crc32. */
-    DML_checksum_accum(checksum, 0, buf, size);
+    /* Do byte reordering and checksum.  Straight crc32. */
+    DML_checksum_byterevn_block(checksum, 0, buf, buf, 1, size,
+				word_size, DML_TO_FILE);
     
     /* Write all the data */
     nbytes = LRL_write_bytes(lrl_record_out,(char *)buf,size);
@@ -2173,75 +3141,85 @@ size_t DML_global_out(LRL_RecordWriter *lrl_record_out,
 /* Returns the number of bytes written by this node alone */
 
 uint64_t DML_multifile_out(LRL_RecordWriter *lrl_record_out, 
-	      void (*get)(char *buf, size_t index, int count, void *arg),
+	      void (*get)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
 	      int count, size_t size, int word_size, void *arg, 
 	      DML_Layout *layout, DML_Checksum *checksum)
 {
   
   size_t max_buf_sites, buf_sites;
-  size_t isite, max_dest_sites;
+  size_t isite, max_dest_sites, j;
   uint64_t nbytes = 0;
-  DML_SiteRank rank;
+  DML_SiteRank *ranks;
   int this_node = layout->this_node;
   char myname[] = "DML_multifile_out";
-  char *lbuf, *buf=NULL;
+  char *lbuf;
   int *coords;
-  int status;
+  int status, nthreads;
+
+  /* The file is shared by I/O threads if it can be */
+  nthreads = DML_local_io_threads(layout, NULL, DML_MULTIFILE, size,
+				  LRL_write_concurrent(lrl_record_out));
+  if(nthreads > 1)
+    return DML_threaded_out(lrl_record_out, get, count, size, word_size,
+			    arg, layout, NULL, DML_MULTIFILE, nthreads,
+			    checksum);
 
   /* Allocate buffer for writing */
   max_buf_sites = DML_max_buf_sites(size,1);
-  lbuf = DML_allocate_buf(size, &max_buf_sites);
+  lbuf = DML_allocate_buf(size, &max_buf_sites,
+			  LRL_write_alignment(lrl_record_out));
   if(!lbuf){
     printf("%s(%d): Can't malloc lbuf\n",myname,this_node);
     return 0;
   }
 
+  /* Ranks of the sites in the buffer for the checksum */
+  ranks = (DML_SiteRank *)malloc(max_buf_sites*sizeof(DML_SiteRank));
+  if(!ranks){
+    printf("%s(%d): Can't malloc ranks\n",myname,this_node);
+    free(lbuf);
+    return 0;
+  }
+
   /* Allocate coordinate */
   coords = DML_allocate_coords(layout->latdim,myname,this_node);
-  if(!coords){free(buf); return 0;}
+  if(!coords){free(lbuf); free(ranks); return 0;}
 
   /* Initialize checksum */
   DML_checksum_init(checksum);
 
-  buf_sites = 0;
-
   max_dest_sites = layout->sites_on_node;
 
-  /** TODO: VECTORIZE THE TRANSFER - CD **/
-  /* Loop over the storage order index of sites on the local node */
-  for(isite = 0; isite < max_dest_sites; isite++){
+  /* Loop over the storage order index of sites on the local node a
+     buffer at a time */
+  for(isite = 0; isite < max_dest_sites; isite += buf_sites){
 
-    /* The coordinates of this site */
-    layout->get_coords_ext(coords, this_node, isite, layout->arg);
+    buf_sites = max_dest_sites - isite;
+    if(buf_sites > max_buf_sites) buf_sites = max_buf_sites;
 
-    /* The lexicographic rank of this site */
-    rank = DML_lex_rank(coords, layout->latdim, layout->latsize);
+    for(j = 0; j < buf_sites; j++){
+      /* The lexicographic rank of each site */
+      layout->get_coords_ext(coords, this_node, isite + j, layout->arg);
+      ranks[j] = DML_lex_rank(coords, layout->latdim, layout->latsize);
+    }
 
-    /* Fetch directly to the buffer */
-    buf = lbuf + size*buf_sites;
-    get(buf, isite, count, arg);
-    buf_sites++;
+    /* Fetch the sites isite ... isite+buf_sites-1 directly to the
+       buffer */
+    get(lbuf, isite, buf_sites, count, arg);
 
-    /* Accumulate checksums as the values are inserted into the buffer */
-    
-    /* Do byte reversal if needed */
-    if (! DML_big_endian())
-      DML_byterevn(buf, size, word_size);
-    
-    DML_checksum_accum(checksum, rank, buf, size);
-    
-    /* Write buffer when full or last site processed */
-    if( (buf_sites >= max_buf_sites) || (isite == max_dest_sites - 1))
-      {
-	status = DML_write_buf_current(lrl_record_out, 
-				       lbuf, buf_sites, size, &nbytes,
-				       myname, this_node);
-	buf_sites = 0;
-	if(status != 0) {free(lbuf); free(coords); return 0;}
-      }
+    /* Do byte reversal if needed and accumulate checksums for the
+       whole buffer */
+    DML_checksum_byterevn_indexed(checksum, ranks, lbuf, lbuf,
+				  buf_sites, size, word_size, DML_TO_FILE);
+
+    status = DML_write_buf_current(lrl_record_out, 
+				   lbuf, buf_sites, size, &nbytes,
+				   myname, this_node);
+    if(status != 0) {free(lbuf); free(ranks); free(coords); return 0;}
   } /* isite */
 
-  free(lbuf);   free(coords);
+  free(lbuf);   free(ranks);   free(coords);
   
   /* Return the number of bytes written by this node only */
   return nbytes;
@@ -2257,71 +3235,94 @@ uint64_t DML_multifile_out(LRL_RecordWriter *lrl_record_out,
 
 uint64_t DML_multifile_in(LRL_RecordReader *lrl_record_in, 
 	     DML_SiteRank sitelist[],
-	     void (*put)(char *buf, size_t index, int count, void *arg),
+	     void (*put)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
 	     int count, size_t size, int word_size, void *arg, 
 	     DML_Layout *layout, DML_Checksum *checksum)
 {
   _QIO_UNUSED_ARGUMENT(sitelist);
 
-  size_t buf_sites, buf_extract, max_buf_sites;
-  size_t isite, max_send_sites;
+  size_t buf_sites, max_buf_sites;
+  size_t isite, queued, max_send_sites, j;
   uint64_t nbytes = 0;
-  DML_SiteRank rank;
+  DML_SiteRank *ranks;
+  DML_ReadAhead *ra;
   int this_node = layout->this_node;
   char myname[] = "DML_multifile_in";
-  char *lbuf, *buf;
+  const char *lbuf;
+  char *obuf;
   int *coords;
-  int err;
+  int err, nthreads;
 
-  /* Allocate buffer for reading */
+  /* The file is shared by I/O threads if it can be */
+  nthreads = DML_local_io_threads(layout, NULL, DML_MULTIFILE, size,
+				  LRL_read_concurrent(lrl_record_in));
+  if(nthreads > 1)
+    return DML_threaded_in(lrl_record_in, put, count, size, word_size,
+			   arg, layout, NULL, DML_MULTIFILE, nthreads,
+			   checksum);
+
+  /* Allocate buffers for reading ahead */
   max_buf_sites = DML_max_buf_sites(size,1);
-  lbuf = DML_allocate_buf(size, &max_buf_sites);
-  if(!lbuf)return 0;
+  ra = DML_read_ahead_open(lrl_record_in, size, &max_buf_sites, this_node);
+  if(!ra)return 0;
+
+  /* Ranks of the sites in the buffer for the checksum */
+  ranks = (DML_SiteRank *)malloc(max_buf_sites*sizeof(DML_SiteRank));
+  if(!ranks){DML_read_ahead_close(ra, NULL);return 0;}
 
   /* Allocate coordinate */
   coords = DML_allocate_coords(layout->latdim, myname, this_node);
-  if(!coords){free(lbuf);return 0;}
+  if(!coords){DML_read_ahead_close(ra, NULL);free(ranks);return 0;}
 
   /* Initialize checksum */
   DML_checksum_init(checksum);
 
-  buf_sites = 0;      /* Length of current read buffer */
-  buf_extract = 0;    /* Counter for current site in read buffer */
   max_send_sites = layout->sites_on_node;
+  queued = 0;         /* Sites whose reads are queued */
+
+  /* Loop over the storage order site index for this node a buffer
+     at a time */
+  for(isite = 0; isite < max_send_sites; isite += buf_sites){
+
+    /* Keep the reads of the following buffers going */
+    while(queued < max_send_sites){
+      buf_sites = max_send_sites - queued;
+      if(buf_sites > max_buf_sites) buf_sites = max_buf_sites;
+      if(DML_read_ahead_submit(ra, 0, buf_sites, 0) < 0)break;
+      queued += buf_sites;
+    }
 
-  /** TODO: VECTORIZE THE TRANSFER - CD **/
-  /* Loop over the storage order site index for this node */
-  for(isite = 0; isite < max_send_sites; isite++){
+    /* The buffer holds the sites isite ... isite+buf_sites-1 */
+    buf_sites = max_send_sites - isite;
+    if(buf_sites > max_buf_sites) buf_sites = max_buf_sites;
+    lbuf = DML_read_ahead_wait(ra, &err);
+    if(err < 0){
+      printf("%s(%d) read error\n", myname,this_node); 
+      DML_read_ahead_close(ra, NULL);free(ranks);free(coords);return 0;
+    }
+    nbytes += buf_sites*size;
 
-    /* The coordinates of this site */
-    layout->get_coords_ext(coords, this_node, isite, layout->arg);
+    for(j = 0; j < buf_sites; j++){
+      /* The lexicographic rank of each site */
+      layout->get_coords_ext(coords, this_node, isite + j, layout->arg);
+      ranks[j] = DML_lex_rank(coords, layout->latdim, layout->latsize);
+    }
 
-    /* The lexicographic rank of this site */
-    rank = DML_lex_rank(coords, layout->latdim, layout->latsize);
+    /* Accumulate checksums for the whole buffer and do byte
+       reversal after checksum if needed.  Data read in place from a
+       mapped file go to the buffer on the way. */
+    obuf = DML_read_ahead_buffer(ra);
+    DML_checksum_byterevn_indexed(checksum, ranks, obuf, lbuf,
+				  buf_sites, size, word_size,
+				  DML_FROM_FILE);
 
-    /* Refill buffer if necessary */
-    buf_sites = DML_read_buf_next(lrl_record_in, size, lbuf, 
-				  &buf_extract, buf_sites, max_buf_sites, 
-				  isite, max_send_sites, &nbytes, 
-				  myname, this_node, &err);
-    if(err < 0){free(lbuf);free(coords);return 0;}
-    
     /* Copy data directly from the buffer */
-    buf = lbuf + size*buf_extract;
-
-    /* Accumulate checksums as the values are inserted into the buffer */
-    DML_checksum_accum(checksum, rank, buf, size);
-    
-    /* Do byte reversal after checksum if needed */
-    if (! DML_big_endian())
-      DML_byterevn(buf, size, word_size);
-
-    put(buf, isite, count, arg);
-    
-    buf_extract++;
+    put(obuf, isite, buf_sites, count, arg);
+    DML_read_ahead_release(ra);
   } /* isite */
 
-  free(lbuf);   free(coords);
+  DML_read_ahead_close(ra, NULL);   free(ranks);   free(coords);
   
   /* Return the number of bytes read by this node only */
   return nbytes;
@@ -2396,7 +3397,7 @@ DML_RecordReader *DML_partition_open_in(LRL_RecordReader *lrl_record_in,
   else
     max_buf_sites = 1;
 
-  inbuf = DML_allocate_buf(size, &max_buf_sites);
+  inbuf = DML_allocate_buf(size, &max_buf_sites, 0);
   if(!inbuf){
     printf("%s(%d) can't malloc inbuf\n",myname,this_node);
     return 0;
@@ -2508,12 +3509,9 @@ int DML_partition_subset_sitedata_in(DML_RecordReader *dml_record_in,
   /* Process data before inserting */
   if(this_node == dest_node){
     
-    /* Accumulate checksum */
-    DML_checksum_accum(checksum, rcv_coords, buf, size);
-    
-    /* Do byte reversal if necessary */
-    if (! DML_big_endian())
-      DML_byterevn(buf, size, word_size);
+    /* Accumulate checksum and do byte reversal if necessary */
+    DML_checksum_byterevn_block(checksum, rcv_coords, buf, buf, 1, size,
+				word_size, DML_FROM_FILE);
     
     /* Store the data */
     put(buf,layout->node_index_ext(coords,layout->arg),count,arg);
@@ -2592,6 +3590,8 @@ uint64_t DML_partition_close_in(DML_RecordReader *dml_record_in)
   uint64_t nbytes = dml_record_in->nbytes;
 
   if(dml_record_in == NULL)return 0;
+  /* Cached routes may be declared on the buffers */
+  DML_grid_route_free();
   if(dml_record_in->coords != NULL)
     free(dml_record_in->coords);
   if(dml_record_in->inbuf != NULL)
@@ -2602,6 +3602,64 @@ uint64_t DML_partition_close_in(DML_RecordReader *dml_record_in)
   return nbytes;
 }
 
+/*------------------------------------------------------------------*/
+/* Messages from the I/O node.  Every node walks the same site loop.
+   A message holds sites consecutive in the loop, all for one node, up
+   to a message buffer, whatever the I/O node's read buffers.  The I/O
+   node copies the sites into a message buffer as it comes to them and
+   sends it when it is complete.  The receiving node posts a receive
+   for it then and keeps the ranks and storage indices of its sites
+   for when it arrives. */
+
+typedef struct {
+  int node;                      /* Node getting the sites */
+  size_t nsites;
+  char *buf;
+  DML_SiteRank *rank;            /* Receiving node only */
+  DML_Index *index;              /* Receiving node only */
+} DML_InputMsg;
+
+/* Store the sites of a message that arrived */
+static void DML_put_input_msg(DML_InputMsg *m, size_t size, int word_size,
+	      void (*put)(char *buf, size_t first, size_t nsites, int count,
+			  void *arg),
+	      int count, void *arg, DML_Checksum *checksum){
+  DML_SiteRun run;
+  size_t j;
+
+  DML_checksum_byterevn_indexed(checksum, m->rank, m->buf, m->buf,
+				m->nsites, size, word_size, DML_FROM_FILE);
+  run.nsites = 0;
+  for(j = 0; j < m->nsites; j++)
+    DML_run_add(&run, m->buf + j*size, (size_t)m->index[j], size,
+		put, count, arg);
+  DML_run_flush(&run, put, count, arg);
+}
+
+/* The I/O node sends a finished message and the node getting it posts
+   the receive.  If that can't be done without waiting, it is done the
+   slow way and the request is NULL. */
+static DML_Request *DML_start_input_msg(DML_InputMsg *m, int this_node,
+	      int my_io_node, size_t size, int word_size,
+	      void (*put)(char *buf, size_t first, size_t nsites, int count,
+			  void *arg),
+	      int count, void *arg, DML_Checksum *checksum){
+  DML_Request *req;
+
+  if(this_node == my_io_node){
+    req = DML_isend_bytes(m->buf, size*m->nsites, m->node);
+    if(!req) DML_send_bytes(m->buf, size*m->nsites, m->node);
+  }
+  else {
+    req = DML_irecv_bytes(m->buf, size*m->nsites, my_io_node);
+    if(!req) {
+      DML_get_bytes(m->buf, size*m->nsites, my_io_node);
+      DML_put_input_msg(m, size, word_size, put, count, arg, checksum);
+    }
+  }
+  return req;
+}
+
 /*------------------------------------------------------------------*/
 /* Each I/O node (or the master I/O node) reads data from its file and
    distributes it to its nodes.
@@ -2612,44 +3670,112 @@ uint64_t DML_partition_close_in(DML_RecordReader *dml_record_in)
    disjoint from the corresponding set for any other I/O node.  This
    algorithm is intended for SINGLEFILE/SERIAL, MULTIFILE, and
    PARTFILE/PARTFILE_DIR modes. */
+
+/* Every node keeps as many messages in flight as there are send
+   credits.  The I/O node fills the next message buffer while earlier
+   ones are being sent and takes whichever send finishes first.  The
+   other nodes post receives ahead and store the data in order. */
 uint64_t
 DML_partition_in(LRL_RecordReader *lrl_record_in,
-		 void (*put)(char *buf, size_t index, int count, void *arg),
+		 void (*put)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
 		 int count, size_t size, int word_size, void *arg,
 		 DML_Layout *layout, DML_SiteList *sites, int volfmt,
 		 int serpar, DML_Checksum *checksum)
 {
   double dtall=0, dtall2=0, dtread2=0, dtsend2=0, dtproc2=0, dtcalc2=0;
-  char *buf, *inbuf;
+  double dtdisk=0;
+  char *buf, *obuf = NULL, *tbuf = NULL;
+  const char *inbuf = NULL;
   int my_io_node;
-  int *coords;
+  int *coords = NULL;
   int this_node = layout->this_node;
   int latdim = layout->latdim;
-  int *latsize = layout->latsize;
   size_t nbytes=0;
-  size_t max_buf_sites=1;
+  size_t max_buf_sites=1, max_tbuf_sites, nmsgs, posted = 0;
+  DML_ReadAhead *ra = NULL;
+  DML_InputMsg *msgs = NULL, *m = NULL;
+  DML_Request **reqs = NULL;
+  DML_SiteRank *mrank = NULL;
+  DML_Index *mindex = NULL;
+  DML_SiteRank rcv_coords, firstrank = 0, nextrank = 0;
+  DML_SiteRank *rcoords = NULL;
+  int *dest_node = NULL;
+  DML_Index *node_index = NULL;
+  size_t *nsites = NULL;
+  size_t nplan, planned = 0, done = 0;
+  DML_SiteRun run;
+  int notdone = 1, err = 0;
+  int depth = 1, nthreads;
   char myname[] = "DML_partition_in";
 
+  /* A file of our own sites alone is shared by I/O threads */
+  nthreads = DML_local_io_threads(layout, sites, volfmt, size,
+				  LRL_read_concurrent(lrl_record_in));
+  if(nthreads > 1)
+    return DML_threaded_in(lrl_record_in, put, count, size, word_size,
+			   arg, layout, sites, volfmt, nthreads, checksum);
+
   timestart(dtall);
   timestart2(dtall2);
 
   /* Get my I/O node */
   my_io_node = DML_my_ionode(volfmt, serpar, layout);
 
-  /* Allocate buffer for reading or receiving data */
-  /* I/O node needs a large buffer.  Others only enough for one site */
-  if(this_node == my_io_node) max_buf_sites = DML_max_buf_sites(size,1);
-  if(max_buf_sites<1) max_buf_sites = 1;
+  /* Every node must split messages alike */
+  max_tbuf_sites = DML_TBUF_BYTES/size;
+  if(max_tbuf_sites<1) max_tbuf_sites = 1;
 
-  inbuf = DML_allocate_buf(size, &max_buf_sites);
-  if(!inbuf){
-    printf("%s(%d) can't malloc inbuf\n",__func__,this_node);
-    return 0;
+  /* Allocate buffers for reading data */
+  /* I/O node needs large buffers, read ahead while earlier ones are
+     used.  Others only plan the site loop a message buffer at a
+     time */
+  if(this_node == my_io_node){
+    max_buf_sites = DML_max_buf_sites(size,1);
+    if(max_buf_sites<1) max_buf_sites = 1;
+    ra = DML_read_ahead_open(lrl_record_in, size, &max_buf_sites, this_node);
+    if(!ra) return 0;
+    depth = DML_read_ahead_get_depth(ra);
+  }
+  else
+    max_buf_sites = max_tbuf_sites;
+
+  /* Message buffers, one for each send credit, fewer if memory is
+     short */
+  nmsgs = (size_t)DML_send_credits;
+  while(!(tbuf = (char *)malloc(nmsgs*max_tbuf_sites*size)) && nmsgs > 1)
+    nmsgs /= 2;
+  msgs = (DML_InputMsg *)calloc(nmsgs, sizeof(DML_InputMsg));
+  reqs = (DML_Request **)calloc(nmsgs, sizeof(DML_Request *));
+  if(this_node != my_io_node){
+    mrank = (DML_SiteRank *)malloc(nmsgs*max_tbuf_sites*sizeof(*mrank));
+    mindex = (DML_Index *)malloc(nmsgs*max_tbuf_sites*sizeof(*mindex));
+  }
+  /* Where the sites of each buffer in the ring go */
+  nplan = (size_t)depth*max_buf_sites;
+  rcoords = (DML_SiteRank *)malloc(nplan*sizeof(*rcoords));
+  dest_node = (int *)malloc(nplan*sizeof(*dest_node));
+  node_index = (DML_Index *)malloc(nplan*sizeof(*node_index));
+  nsites = (size_t *)malloc(depth*sizeof(*nsites));
+  if(!tbuf || !msgs || !reqs ||
+     (this_node != my_io_node && (!mrank || !mindex)) ||
+     !rcoords || !dest_node || !node_index || !nsites){
+    printf("%s(%d) can't malloc tbuf\n",__func__,this_node);
+    err = 1;
+    goto cleanup;
+  }
+  for(size_t j=0; j<nmsgs; j++) {
+    msgs[j].buf = tbuf + j*max_tbuf_sites*size;
+    if(mrank) msgs[j].rank = mrank + j*max_tbuf_sites;
+    if(mindex) msgs[j].index = mindex + j*max_tbuf_sites;
   }
 
   /* Allocate coordinate counter */
   coords = DML_allocate_coords(latdim, __func__, this_node);
-  if(!coords) { free(inbuf); return 0; }
+  if(!coords) {
+    err = 1;
+    goto cleanup;
+  }
 
   /* Initialize checksum */
   DML_checksum_init(checksum);
@@ -2660,88 +3786,192 @@ DML_partition_in(LRL_RecordReader *lrl_record_in,
 #endif
 
   /* Loop over the receiving sites */
-  DML_SiteRank rcv_coords;
   if(DML_init_subset_site_loop(&rcv_coords, sites) == 0) {
-    free(inbuf); free(coords);
-    return 0;
-  }
-
-  DML_SiteRank *rcoords =
-    (DML_SiteRank*)DML_allocate_buf(sizeof(*rcoords),&max_buf_sites);
-  DML_SiteRank firstrank=0, nextrank=0;
-  int *dest_node = (int*)DML_allocate_buf(sizeof(*dest_node),&max_buf_sites);
-  int *node_index = (int*)DML_allocate_buf(sizeof(*node_index),&max_buf_sites);
-  int notdone = 1;
-  while(notdone) {
-    timestart2(dtcalc2);
-    size_t k = 0;
-    do { // get list of file contiguous sites
-      /* The subset_rank locates the datum for rcv_coords in the
-	 record our I/O partition is reading */
-      DML_SiteRank subset_rank = nextrank;
-      if(serpar == DML_PARALLEL) {
-	subset_rank = (DML_SiteRank) DML_subset_rank(rcv_coords, sites);
-	if(subset_rank<0){
-	  printf("%s(%d): Input rank %ld unexpectedly missing from subset list\n",
-		 myname,this_node,rcv_coords);
-	  return 0;
+    err = 1;
+    goto cleanup;
+  }
+
+  run.nsites = 0;
+  while(notdone || done < planned) {
+    /* Plan the next buffers and queue their reads */
+    while(notdone && planned - done < (size_t)depth) {
+      timestart2(dtcalc2);
+      size_t slot = (planned % depth)*max_buf_sites;
+      size_t k = 0;
+      do { // get list of file contiguous sites
+	/* The subset_rank locates the datum for rcv_coords in the
+	   record our I/O partition is reading */
+	DML_SiteRank subset_rank = nextrank + (DML_SiteRank)k;
+	if(serpar == DML_PARALLEL) {
+	  subset_rank = (DML_SiteRank) DML_subset_rank(rcv_coords, sites);
+	  if(subset_rank<0){
+	    printf("%s(%d): Input rank %ld unexpectedly missing from subset list\n",
+		   myname,this_node,rcv_coords);
+	    err = 1;
+	    goto cleanup;
+	  }
 	}
+	if(k==0) firstrank = subset_rank;
+	else if(subset_rank!=firstrank+(DML_SiteRank)k) break;
+	rcoords[slot+k] = rcv_coords;
+	/* The node that gets the next datum and where it keeps it */
+	DML_site_owner(sites, layout, rcv_coords, coords, &dest_node[slot+k],
+		       &node_index[slot+k]);
+	k++;
+	notdone = DML_next_subset_site(&rcv_coords, sites);
+      } while(k<max_buf_sites && notdone);
+      nsites[planned % depth] = k;
+      timestop2(dtcalc2);
+
+      /* I/O node queues the read, seeking if not contiguous */
+      if(this_node == my_io_node) {
+	int doseek = (nextrank != firstrank);
+	timestart2(dtread2);
+	DML_read_ahead_submit(ra, firstrank, k, doseek);
+	timestop2(dtread2);
+	nbytes += k*size;
       }
-      if(k==0) firstrank = subset_rank;
-      else if(subset_rank!=firstrank+(DML_SiteRank)k) break;
-      /* Convert lexicographic rank to coordinates */
-      DML_lex_coords(coords, latdim, latsize, rcv_coords);
-      rcoords[k] = rcv_coords;
-      /* The node that gets the next datum */
-      dest_node[k] = layout->node_number_ext(coords, layout->arg);
-      node_index[k] = layout->node_index_ext(coords, layout->arg);
-      k++;
-      notdone = DML_next_subset_site(&rcv_coords, sites);
-    } while(k<max_buf_sites && notdone);
-    timestop2(dtcalc2);
+      nextrank = firstrank + k;
+      planned++;
+    }
 
-    /* I/O node reads the next value */
+    /* The oldest buffer */
+    size_t slot = (done % depth)*max_buf_sites;
+    size_t k = nsites[done % depth];
     if(this_node == my_io_node) {
-      int doseek = (nextrank != firstrank);
+      int rerr;
       timestart2(dtread2);
-      int err = DML_read_buf(lrl_record_in, inbuf, firstrank, size, k, doseek);
+      inbuf = DML_read_ahead_wait(ra, &rerr);
+      obuf = DML_read_ahead_buffer(ra);
       timestop2(dtread2);
-      nbytes += k*size;
 
-      if(err < 0) {
+      if(rerr < 0) {
         printf("%s(%d) DML_read_buf returns error\n", __func__, this_node);
-        free(inbuf); free(coords);
-        return 0;
+        err = 1;
+        goto cleanup;
       }
     }
-    nextrank = firstrank + k;
 
+    /* Build the messages for other nodes.  Avoid I/O node sending to
+       itself. */
     for(size_t i=0; i<k; i++) {
-      buf = inbuf + i*size;
-      /* Send result to destination node. Avoid I/O node sending to itself. */
-      if (dest_node[i] != my_io_node) {
+      int d = dest_node[slot+i];
+      if(m && (d != m->node || m->nsites == max_tbuf_sites)) {
+	/* Send or post the receive for the finished message */
 	timestart2(dtsend2);
-	DML_route_bytes(buf, size, my_io_node, dest_node[i]);
+	reqs[m - msgs] = DML_start_input_msg(m, this_node, my_io_node, size,
+					     word_size, put, count, arg,
+					     checksum);
+	posted++;
+	m = NULL;
 	timestop2(dtsend2);
       }
-      /* Process data before inserting */
-      if(this_node == dest_node[i]) {
-	timestart2(dtproc2);
-	/* Accumulate checksum */
-	DML_checksum_accum(checksum, rcoords[i], buf, size);
-	/* Do byte reversal if necessary */
-	if (! DML_big_endian()) DML_byterevn(buf, size, word_size);
-	/* Store the data */
-	put(buf, node_index[i], count, arg);
-	timestop2(dtproc2);
+      if(!m && d != my_io_node && (this_node == my_io_node || d == this_node)) {
+	/* Take a free message buffer.  The I/O node takes the first
+	   whose send is done, the others store the oldest message. */
+	size_t j;
+	if(this_node == my_io_node) {
+	  for(j=0; j<nmsgs && reqs[j]; j++);
+	  if(j == nmsgs) {
+	    timestart2(dtsend2);
+	    j = (size_t)DML_wait_any(reqs, (int)nmsgs);
+	    timestop2(dtsend2);
+	  }
+	} else {
+	  j = posted % nmsgs;
+	  if(reqs[j]) {
+	    timestart2(dtsend2);
+	    DML_wait_bytes(reqs[j]);
+	    reqs[j] = NULL;
+	    timestop2(dtsend2);
+	    timestart2(dtproc2);
+	    DML_put_input_msg(msgs+j, size, word_size, put, count, arg,
+			      checksum);
+	    timestop2(dtproc2);
+	  }
+	}
+	m = msgs + j;
+	m->node = d;
+	m->nsites = 0;
+      }
+      if(m) {
+	if(this_node == my_io_node)
+	  memcpy(m->buf + m->nsites*size, inbuf + i*size, size);
+	else {
+	  m->rank[m->nsites] = rcoords[slot+i];
+	  m->index[m->nsites] = node_index[slot+i];
+	}
+	m->nsites++;
       }
     }
+
+    /* Process data before inserting.  Sites for this node that are
+       adjacent in the buffer are checksummed and byte reversed
+       together, into the buffer if they were read in place from a
+       mapped file. */
+    timestart2(dtproc2);
+    for(size_t i=0; i<k && this_node == my_io_node; ) {
+      size_t n = 0;
+      while(i+n<k && dest_node[slot+i+n] == this_node) n++;
+      if(n == 0) { i++; continue; }
+      buf = obuf + i*size;
+      /* Accumulate checksum and do byte reversal if necessary */
+      DML_checksum_byterevn_indexed(checksum, rcoords+slot+i, buf,
+				    inbuf + i*size, n, size, word_size,
+				    DML_FROM_FILE);
+      /* Store the data, a run at a time */
+      for(size_t j=0; j<n; j++)
+	DML_run_add(&run, buf + j*size, (size_t)node_index[slot+i+j], size,
+		    put, count, arg);
+      i += n;
+    }
+    DML_run_flush(&run, put, count, arg);
+    timestop2(dtproc2);
+
+    if(this_node == my_io_node) DML_read_ahead_release(ra);
+    done++;
+  }
+
+  /* Send or receive the last message and finish the ones in flight */
+  if(m) {
+    timestart2(dtsend2);
+    reqs[m - msgs] = DML_start_input_msg(m, this_node, my_io_node, size,
+					 word_size, put, count, arg, checksum);
+    posted++;
+    timestop2(dtsend2);
+  }
+
+ cleanup:
+  /* Finish the messages in flight, oldest first, even after an error,
+     since their buffers are freed below.  Messages that arrived are
+     stored only if all went well. */
+  for(size_t i=0; reqs && i<nmsgs; i++) {
+    size_t j = (posted + i) % nmsgs;
+    if(!reqs[j]) continue;
+    timestart2(dtsend2);
+    DML_wait_bytes(reqs[j]);
+    reqs[j] = NULL;
+    timestop2(dtsend2);
+    if(this_node != my_io_node && !err) {
+      timestart2(dtproc2);
+      DML_put_input_msg(msgs+j, size, word_size, put, count, arg, checksum);
+      timestop2(dtproc2);
+    }
   }
+
+  DML_free_requests();
+  free(nsites);
   free(dest_node);
   free(node_index);
   free(rcoords);
   free(coords);
-  free(inbuf);
+  free(tbuf);
+  free(msgs);
+  free(reqs);
+  free(mrank);
+  free(mindex);
+  DML_read_ahead_close(ra, &dtdisk);
+  if(err) return 0;
 
   timestop(dtall);
   timestop2(dtall2);
@@ -2751,9 +3981,11 @@ DML_partition_in(LRL_RecordReader *lrl_record_in,
     dtread2 *= s;
     dtsend2 *= s;
     dtproc2 *= s;
+    /* "read" is the time spent waiting for data and "disk" the time
+       the reads took */
     if(this_node==layout->master_io_node) {
-      printf("%s times: calc %.2f  read %.2f  send %.2f  process %.2f  total %.2f\n",
-	     __func__, dtcalc2, dtread2, dtsend2, dtproc2, dtall);
+      printf("%s times: calc %.2f  read %.2f  send %.2f  process %.2f  total %.2f  disk %.2f\n",
+	     __func__, dtcalc2, dtread2, dtsend2, dtproc2, dtall, dtdisk);
     }
   }
   /* return the number of bytes read by this node only */
@@ -2767,7 +3999,8 @@ DML_partition_in(LRL_RecordReader *lrl_record_in,
 /* Returns the number of bytes read */
 
 size_t DML_global_in(LRL_RecordReader *lrl_record_in, 
-	  void (*put)(char *buf, size_t index, int count, void *arg),
+	  void (*put)(char *buf, size_t first, size_t nsites, int count,
+		       void *arg),
 	  int count, size_t size, int word_size, void *arg, 
           DML_Layout* layout, int volfmt, int broadcast_globaldata,
 	  DML_Checksum *checksum)
@@ -2795,12 +4028,9 @@ size_t DML_global_in(LRL_RecordReader *lrl_record_in,
       free(buf); return 0;
     }
     
-    /* Do checksum.  Straight crc32. */
-    DML_checksum_accum(checksum, 0, buf, size);
-
-    /* Do byte reordering if needed */
-    if (! DML_big_endian())
-      DML_byterevn(buf, size, word_size);
+    /* Do checksum.  Straight crc32.  Then byte reordering if needed */
+    DML_checksum_byterevn_block(checksum, 0, buf, buf, 1, size,
+				word_size, DML_FROM_FILE);
     
   }
 
@@ -2810,12 +4040,12 @@ size_t DML_global_in(LRL_RecordReader *lrl_record_in,
     /* Broadcast the result to node bufs */
     DML_broadcast_bytes(buf, size, this_node, layout->master_io_node);
     /* All nodes store their data. Unused site index is 0. */
-    put(buf,0,count,arg);
+    put(buf,0,1,count,arg);
   }
   else{
     /* Only the master I/O node stores its data */
     if(this_node == layout->master_io_node)
-      put(buf,0,count,arg);
+      put(buf,0,1,count,arg);
   }
 
   free(buf);
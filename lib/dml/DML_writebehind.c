@@ -0,0 +1,254 @@
+/* DML_writebehind.c */
+/* Write-behind for the I/O node output buffers */
+
+/* The I/O node fills a ring of output buffers.  A full buffer is
+   queued and, when QIO is built with write-behind, written by a
+   separate thread while the main thread goes on receiving, reordering
+   and checksumming sites into the next buffer.  The main thread waits
+   only when every buffer in the ring is still queued.  Buffers are
+   written in the order queued, and only the writer thread calls LRL
+   while it runs.  With a ring depth of 1, or without thread support,
+   each buffer is written as it is queued. */
+
+#include <qio_config.h>
+#include <qio.h>
+#include <dml.h>
+#include <lrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef QIO_USE_DML_WRITE_BEHIND
+#include <pthread.h>
+#endif
+
+typedef struct {
+  char *buf;
+  DML_SiteRank rank;
+  size_t nsites;
+} DML_QueuedWrite;
+
+struct DML_WriteBehind {
+  LRL_RecordWriter *lrl_record_out;
+  int serpar;
+  size_t size;
+  int this_node;
+
+  int depth;                 /* Buffers in the ring */
+  char **bufs;
+  int fill;                  /* Buffer the main thread fills next */
+  DML_QueuedWrite *queue;    /* Writes not yet finished, oldest at head */
+  int head, count;
+
+  int status;                /* Nonzero after a failed write */
+  uint64_t nbytes;
+  double dtdisk;             /* Time spent writing */
+
+#ifdef QIO_USE_DML_WRITE_BEHIND
+  int threaded;
+  int done;                  /* No more writes will be queued */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t queued;     /* Signals the writer */
+  pthread_cond_t written;    /* Signals the main thread */
+#endif
+};
+
+static int DML_write_behind_depth = DML_WRITE_BEHIND_DEPTH;
+
+/* Set the number of output buffers in the ring.  Returns the old
+   value. */
+int DML_set_write_behind_depth(int depth){
+  int old = DML_write_behind_depth;
+  DML_write_behind_depth = depth < 1 ? 1 : depth;
+  return old;
+}
+
+/* Write the oldest queued buffer */
+static int DML_write_behind_next(DML_WriteBehind *wb, uint64_t *nbytes){
+  DML_QueuedWrite *w = wb->queue + wb->head;
+  double dt = QIO_time();
+  int status;
+
+  status = DML_flush_outbuf(wb->lrl_record_out, wb->serpar, w->rank,
+			    w->buf, w->nsites, wb->size, nbytes,
+			    wb->this_node);
+  wb->dtdisk += QIO_time() - dt;
+  return status;
+}
+
+#ifdef QIO_USE_DML_WRITE_BEHIND
+static void *DML_write_behind_thread(void *arg){
+  DML_WriteBehind *wb = (DML_WriteBehind *)arg;
+  uint64_t nbytes = 0;
+  int status = 0;
+
+  pthread_mutex_lock(&wb->lock);
+  for(;;){
+    while(wb->count == 0 && !wb->done)
+      pthread_cond_wait(&wb->queued, &wb->lock);
+    if(wb->count == 0)break;
+    pthread_mutex_unlock(&wb->lock);
+
+    /* After a failure the rest are dropped */
+    if(status == 0)status = DML_write_behind_next(wb, &nbytes);
+
+    pthread_mutex_lock(&wb->lock);
+    wb->status = status;
+    wb->head = (wb->head + 1) % wb->depth;
+    wb->count--;
+    pthread_cond_signal(&wb->written);
+  }
+  wb->nbytes = nbytes;
+  pthread_mutex_unlock(&wb->lock);
+  return NULL;
+}
+#endif
+
+/* Create the ring for writing buffers of up to *max_buf_sites sites
+   of "size" bytes.  *max_buf_sites is reduced if memory is short, and
+   so is the depth. */
+DML_WriteBehind *DML_write_behind_open(LRL_RecordWriter *lrl_record_out,
+				       int serpar, size_t size,
+				       size_t *max_buf_sites, int this_node){
+  char myname[] = "DML_write_behind_open";
+  DML_WriteBehind *wb;
+  size_t align = LRL_write_alignment(lrl_record_out), n;
+  int i;
+
+  wb = (DML_WriteBehind *)calloc(1, sizeof(DML_WriteBehind));
+  if(!wb){
+    printf("%s(%d) can't malloc the write-behind ring\n",myname,this_node);
+    return NULL;
+  }
+  wb->lrl_record_out = lrl_record_out;
+  wb->serpar = serpar;
+  wb->size = size;
+  wb->this_node = this_node;
+  wb->depth = DML_write_behind_depth;
+#ifndef QIO_USE_DML_WRITE_BEHIND
+  wb->depth = 1;
+#endif
+
+  wb->bufs = (char **)calloc(wb->depth, sizeof(char *));
+  wb->queue = (DML_QueuedWrite *)calloc(wb->depth, sizeof(DML_QueuedWrite));
+  if(wb->bufs) wb->bufs[0] = DML_allocate_buf(size, max_buf_sites, align);
+  if(!wb->bufs || !wb->queue || !wb->bufs[0]){
+    printf("%s(%d) can't malloc outbuf\n",myname,this_node);
+    if(wb->bufs) free(wb->bufs[0]);
+    free(wb->bufs); free(wb->queue); free(wb);
+    return NULL;
+  }
+  for(i = 1; i < wb->depth; i++){
+    n = *max_buf_sites;
+    wb->bufs[i] = DML_allocate_buf(size, &n, align);
+    if(wb->bufs[i] && n < *max_buf_sites){
+      free(wb->bufs[i]);
+      wb->bufs[i] = NULL;
+    }
+    if(!wb->bufs[i])break;
+  }
+  wb->depth = i;
+
+#ifdef QIO_USE_DML_WRITE_BEHIND
+  if(wb->depth > 1){
+    pthread_mutex_init(&wb->lock, NULL);
+    pthread_cond_init(&wb->queued, NULL);
+    pthread_cond_init(&wb->written, NULL);
+    wb->threaded =
+      pthread_create(&wb->thread, NULL, DML_write_behind_thread, wb) == 0;
+    if(!wb->threaded){
+      pthread_mutex_destroy(&wb->lock);
+      pthread_cond_destroy(&wb->queued);
+      pthread_cond_destroy(&wb->written);
+    }
+  }
+#endif
+
+  return wb;
+}
+
+/* The buffer to fill next.  Waits for it to be written if it is still
+   queued. */
+char *DML_write_behind_buffer(DML_WriteBehind *wb){
+#ifdef QIO_USE_DML_WRITE_BEHIND
+  if(wb->threaded){
+    pthread_mutex_lock(&wb->lock);
+    while(wb->count == wb->depth)
+      pthread_cond_wait(&wb->written, &wb->lock);
+    pthread_mutex_unlock(&wb->lock);
+  }
+#endif
+  return wb->bufs[wb->fill];
+}
+
+/* Queue nsites sites from buf for writing at record position "rank"
+   (used only for parallel writes).  buf is normally the one from
+   DML_write_behind_buffer, but may be other memory that stays
+   unchanged until DML_write_behind_close.  Returns nonzero if a write
+   has failed. */
+int DML_write_behind_submit(DML_WriteBehind *wb, char *buf,
+			    DML_SiteRank rank, size_t nsites){
+  DML_QueuedWrite *w;
+  int status;
+
+  if(nsites == 0)return wb->status;
+
+#ifdef QIO_USE_DML_WRITE_BEHIND
+  if(wb->threaded){
+    pthread_mutex_lock(&wb->lock);
+    while(wb->count == wb->depth)
+      pthread_cond_wait(&wb->written, &wb->lock);
+    w = wb->queue + (wb->head + wb->count) % wb->depth;
+    w->buf = buf;
+    w->rank = rank;
+    w->nsites = nsites;
+    wb->count++;
+    wb->fill = (wb->fill + 1) % wb->depth;
+    status = wb->status;
+    pthread_cond_signal(&wb->queued);
+    pthread_mutex_unlock(&wb->lock);
+    return status;
+  }
+#endif
+
+  w = wb->queue + wb->head;
+  w->buf = buf;
+  w->rank = rank;
+  w->nsites = nsites;
+  if(wb->status == 0)
+    wb->status = DML_write_behind_next(wb, &wb->nbytes);
+  status = wb->status;
+  return status;
+}
+
+/* Finish the queued writes and free the ring.  Returns the number of
+   bytes written and the time spent writing.  Returns nonzero if a
+   write failed. */
+int DML_write_behind_close(DML_WriteBehind *wb, uint64_t *nbytes,
+			   double *dtdisk){
+  int i, status;
+
+  if(!wb)return 1;
+
+#ifdef QIO_USE_DML_WRITE_BEHIND
+  if(wb->threaded){
+    pthread_mutex_lock(&wb->lock);
+    wb->done = 1;
+    pthread_cond_signal(&wb->queued);
+    pthread_mutex_unlock(&wb->lock);
+    pthread_join(wb->thread, NULL);
+    pthread_mutex_destroy(&wb->lock);
+    pthread_cond_destroy(&wb->queued);
+    pthread_cond_destroy(&wb->written);
+  }
+#endif
+
+  status = wb->status;
+  if(nbytes) *nbytes += wb->nbytes;
+  if(dtdisk) *dtdisk += wb->dtdisk;
+  for(i = 0; i < wb->depth; i++)
+    free(wb->bufs[i]);
+  free(wb->bufs);
+  free(wb->queue);
+  free(wb);
+  return status;
+}
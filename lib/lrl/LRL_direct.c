@@ -0,0 +1,253 @@
+/* LRL_direct.c */
+/* The LRL backend writing a file with O_DIRECT */
+
+/* Output written through stdio is copied into the page cache, where
+   it takes memory from the application on the same node.  Here the
+   file is opened twice, with and without O_DIRECT.  Output collects in
+   a block-aligned bounce buffer, or stays in the caller's buffer if
+   that is aligned the same as the file, and whole blocks are written
+   with O_DIRECT.  The odd bytes at either end of a stretch of output,
+   such as a LIME header or the bytes after a seek, are written exactly
+   through the page cache, so a block shared with another node writing
+   the same file is never overwritten.  If the file system refuses
+   O_DIRECT when opening, LRL_open_write_file uses posix instead, and
+   if it refuses a write, everything after goes through the page
+   cache.  Output is written before a write somewhere else, so any
+   offset can be written. */
+
+#define _GNU_SOURCE 1 /* for O_DIRECT */
+#include <qio_config.h>
+#include <lrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Bytes in the bounce buffer.  A multiple of any block size we use. */
+#define LRL_DIRECT_BUF_BYTES 4194304
+/* Smallest block size we align to */
+#define LRL_DIRECT_MIN_ALIGN 4096
+
+typedef struct {
+  int fd;                   /* Opened with O_DIRECT, -1 if refused */
+  int bfd;                  /* Opened without it */
+  size_t align;             /* Block size for O_DIRECT transfers */
+  size_t cap;               /* Bytes in the bounce buffer */
+  char *bounce;             /* Bytes not yet written */
+  uint64_t stage_off;       /* Offset of the first of them */
+  uint64_t stage_len;       /* How many */
+  uint64_t pos;             /* Where the next byte goes */
+} LRL_DirectWriter;
+
+/* Write all nbytes at offset.  Returns 0 or -1. */
+static int LRL_direct_pwrite(int fd, const char *buf, size_t nbytes,
+			     uint64_t offset){
+  ssize_t k;
+
+  while(nbytes > 0){
+    k = pwrite(fd, buf, nbytes, (off_t)offset);
+    if(k < 0 && errno == EINTR)continue;
+    if(k <= 0)return -1;
+    buf += k;
+    nbytes -= (size_t)k;
+    offset += (uint64_t)k;
+  }
+  return 0;
+}
+
+/* Write whole aligned blocks with O_DIRECT.  If that is refused,
+   write them and everything after through the page cache. */
+static int LRL_direct_blocks(LRL_DirectWriter *dw, const char *buf,
+			     size_t nbytes, uint64_t offset){
+  if(dw->fd >= 0){
+    if(LRL_direct_pwrite(dw->fd, buf, nbytes, offset) == 0)return 0;
+    if(errno != EINVAL)return -1;
+    close(dw->fd);
+    dw->fd = -1;
+  }
+  return LRL_direct_pwrite(dw->bfd, buf, nbytes, offset);
+}
+
+/* Write what is in the bounce buffer.  The whole blocks go with
+   O_DIRECT and the bytes before the first block boundary exactly.
+   The bytes after the last boundary are written exactly if final is
+   set, and otherwise kept to complete the block. */
+static int LRL_direct_drain(LRL_DirectWriter *dw, int final){
+  size_t head = (size_t)(dw->stage_off % dw->align);
+  size_t lo = head, hi = head + (size_t)dw->stage_len, b;
+  uint64_t base = dw->stage_off - head;    /* File offset of bounce[0] */
+
+  if(dw->stage_len == 0)return 0;
+
+  if(head > 0){
+    lo = hi < dw->align ? hi : dw->align;
+    if(LRL_direct_pwrite(dw->bfd, dw->bounce + head, lo - head,
+			 base + head) != 0)return -1;
+  }
+
+  b = hi - hi % dw->align;
+  if(b > lo){
+    if(LRL_direct_blocks(dw, dw->bounce + lo, b - lo, base + lo) != 0)
+      return -1;
+    lo = b;
+  }
+
+  if(final && hi > lo){
+    if(LRL_direct_pwrite(dw->bfd, dw->bounce + lo, hi - lo, base + lo) != 0)
+      return -1;
+    lo = hi;
+  }
+
+  /* What is left starts on a block boundary */
+  if(hi > lo)memmove(dw->bounce, dw->bounce + lo, hi - lo);
+  dw->stage_off = base + lo;
+  dw->stage_len = hi - lo;
+  return 0;
+}
+
+/* Write nbytes at the current position.  Returns the number
+   accepted, or 0 after a write error. */
+static uint64_t LRL_direct_put(LRL_DirectWriter *dw, const char *buf,
+			       uint64_t nbytes){
+  uint64_t done = 0, k;
+  size_t head;
+
+  while(done < nbytes){
+    /* Whole blocks aligned in memory as in the file go straight out,
+       after the bytes collected before them */
+    k = nbytes - done;
+    k -= k % dw->align;
+    if(k > 0 && dw->fd >= 0 && dw->pos % dw->align == 0 &&
+       (uintptr_t)(buf + done) % dw->align == 0){
+      if(LRL_direct_drain(dw, 0) != 0 ||
+	 LRL_direct_blocks(dw, buf + done, (size_t)k, dw->pos) != 0)
+	return 0;
+      dw->pos += k;
+      done += k;
+      dw->stage_off = dw->pos;
+      continue;
+    }
+    if(dw->stage_len == 0)dw->stage_off = dw->pos;
+    head = (size_t)(dw->stage_off % dw->align);
+    k = dw->cap - head - dw->stage_len;
+    if(k > nbytes - done)k = nbytes - done;
+    memcpy(dw->bounce + head + dw->stage_len, buf + done, (size_t)k);
+    dw->stage_len += k;
+    dw->pos += k;
+    done += k;
+    if(head + dw->stage_len == dw->cap && LRL_direct_drain(dw, 0) != 0)
+      return 0;
+  }
+  return done;
+}
+
+/* Open a file for O_DIRECT writing with one of the LRL modes.
+   Returns null if the file can't be opened that way. */
+static void *LRL_direct_open(const char *filename, int mode){
+#ifdef O_DIRECT
+  LRL_DirectWriter *dw;
+  struct stat st;
+  void *bounce;
+  int flags = O_WRONLY;
+
+  if(mode == LRL_READ)return NULL;
+  if(mode == LRL_APPEND)flags |= O_CREAT;
+  else if(mode != LRL_NOTRUNC)flags |= O_CREAT | O_TRUNC;
+
+  dw = (LRL_DirectWriter *)calloc(1, sizeof(LRL_DirectWriter));
+  if(dw == NULL)return NULL;
+  dw->bfd = open(filename, flags, 0666);
+  if(dw->bfd < 0){
+    free(dw);
+    return NULL;
+  }
+  dw->fd = open(filename, O_WRONLY | O_DIRECT);
+  if(dw->fd < 0){
+    close(dw->bfd);
+    free(dw);
+    return NULL;
+  }
+
+  /* Align to the preferred block size if it is reasonable */
+  dw->align = LRL_DIRECT_MIN_ALIGN;
+  if(fstat(dw->bfd, &st) == 0 && st.st_blksize > LRL_DIRECT_MIN_ALIGN &&
+     st.st_blksize <= LRL_DIRECT_BUF_BYTES &&
+     (st.st_blksize & (st.st_blksize - 1)) == 0)
+    dw->align = (size_t)st.st_blksize;
+  dw->cap = LRL_DIRECT_BUF_BYTES;
+
+  if(posix_memalign(&bounce, dw->align, dw->cap) != 0){
+    close(dw->fd);
+    close(dw->bfd);
+    free(dw);
+    return NULL;
+  }
+  dw->bounce = (char *)bounce;
+  return dw;
+#else
+  (void)filename;
+  (void)mode;
+  return NULL;
+#endif
+}
+
+/* Write nbytes at offset.  Output collected for elsewhere is written
+   first.  Returns the number written. */
+static uint64_t LRL_direct_write_at(void *h, const char *buf,
+				    uint64_t nbytes, uint64_t offset){
+  LRL_DirectWriter *dw = (LRL_DirectWriter *)h;
+
+  if(offset != dw->pos){
+    if(LRL_direct_drain(dw, 1) != 0)return 0;
+    dw->pos = offset;
+  }
+  return LRL_direct_put(dw, buf, nbytes);
+}
+
+static uint64_t LRL_direct_size(void *h){
+  LRL_DirectWriter *dw = (LRL_DirectWriter *)h;
+  struct stat st;
+  uint64_t end = dw->stage_off + dw->stage_len;
+
+  if(fstat(dw->bfd, &st) != 0)return end;
+  return (uint64_t)st.st_size > end ? (uint64_t)st.st_size : end;
+}
+
+static size_t LRL_direct_alignment(void *h){
+  return ((LRL_DirectWriter *)h)->align;
+}
+
+/* Write everything collected so far */
+static int LRL_direct_flush(void *h){
+  if(LRL_direct_drain((LRL_DirectWriter *)h, 1) != 0)return LRL_ERR_WRITE;
+  return LRL_SUCCESS;
+}
+
+static int LRL_direct_close(void *h){
+  LRL_DirectWriter *dw = (LRL_DirectWriter *)h;
+  int status = LRL_SUCCESS;
+
+  if(LRL_direct_drain(dw, 1) != 0)status = LRL_ERR_WRITE;
+  if(dw->fd >= 0 && close(dw->fd) != 0)status = LRL_ERR_CLOSE;
+  if(close(dw->bfd) != 0)status = LRL_ERR_CLOSE;
+  free(dw->bounce);
+  free(dw);
+  return status;
+}
+
+const LRL_Backend LRL_direct_backend = {
+  "direct", 1, 0,
+  LRL_direct_open,
+  NULL,
+  LRL_direct_write_at,
+  NULL,
+  NULL,
+  LRL_direct_size,
+  LRL_direct_alignment,
+  LRL_direct_flush,
+  LRL_direct_close
+};
@@ -1,12 +1,10 @@
-#ifndef _POSIX_SOURCE
-#define _POSIX_SOURCE 1 // for fdopen in stdio
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L /* for strnlen */
 #endif
 #include <qio_config.h>
 #include <lrl.h>
 #include <stdio.h>
 #include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <string.h>
 #ifdef HAVE_MALLOC_H
 #include <malloc.h>
@@ -14,6 +12,167 @@
 #include <stdlib.h>
 //#include <qmp.h>
 
+/* LRL writes and parses the LIME framing itself and leaves moving the
+   bytes to a backend, so the record position is kept here in the
+   LRL_RecordState of the file reader or writer. */
+
+/* Keep the file name, for LRL_get_writer_location and
+   LRL_get_reader_location */
+static char *LRL_copy_filename(const char *filename)
+{
+  char *copy = (char *)malloc(strlen(filename)+1);
+  if(copy != NULL) strcpy(copy, filename);
+  return copy;
+}
+
+static uint64_t LRL_get_big_endian(const unsigned char *p, int n)
+{
+  uint64_t x = 0;
+  int i;
+  for(i = 0; i < n; i++) x = (x << 8) | p[i];
+  return x;
+}
+
+static void LRL_put_big_endian(unsigned char *p, int n, uint64_t x)
+{
+  int i;
+  for(i = n-1; i >= 0; i--, x >>= 8) p[i] = (unsigned char)(x & 0xff);
+}
+
+/* Bytes padding a payload to a multiple of 8 */
+static uint64_t LRL_pad_bytes(uint64_t nbytes)
+{
+  return (8 - nbytes % 8) % 8;
+}
+
+/**
+ * Look up a backend by its code
+ *
+ * \param code   one of the LRL_BACKEND codes
+ *
+ * \return the backend, or null for LRL_BACKEND_DEFAULT or anything
+ * else that is not one of the tagged codes
+ */
+const LRL_Backend *LRL_get_backend(int code)
+{
+  switch(code) {
+  case LRL_BACKEND_POSIX:  return &LRL_posix_backend;
+  case LRL_BACKEND_STDIO:  return &LRL_stdio_backend;
+  case LRL_BACKEND_MMAP:   return &LRL_mmap_backend;
+  case LRL_BACKEND_DIRECT: return &LRL_direct_backend;
+  case LRL_BACKEND_MEMORY: return &LRL_memory_backend;
+  default:                 return NULL;
+  }
+}
+
+/**
+ * Look up a backend by name
+ *
+ * \param name   "posix", "stdio", "mmap", "direct" or "memory"
+ *
+ * \return the backend, or null if there is none by that name
+ */
+const LRL_Backend *LRL_find_backend(const char *name)
+{
+  static const int codes[] = { LRL_BACKEND_POSIX, LRL_BACKEND_STDIO,
+			       LRL_BACKEND_MMAP, LRL_BACKEND_DIRECT,
+			       LRL_BACKEND_MEMORY };
+  const LRL_Backend *backend;
+  size_t i;
+
+  if(name == NULL) return NULL;
+  for(i = 0; i < sizeof(codes)/sizeof(codes[0]); i++) {
+    backend = LRL_get_backend(codes[i]);
+    if(strcmp(name, backend->name) == 0) return backend;
+  }
+  return NULL;
+}
+
+/* The backends set by LRL_set_read_backend and LRL_set_write_backend */
+static const LRL_Backend *LRL_read_default = NULL;
+static const LRL_Backend *LRL_write_default = NULL;
+
+/* The backend for a file opened without choosing one: the one set,
+   else the one named by the QIO_BACKEND environment variable, else
+   pread and pwrite */
+static const LRL_Backend *LRL_default_backend(const LRL_Backend *set)
+{
+  const LRL_Backend *backend;
+
+  if(set != NULL) return set;
+  backend = LRL_find_backend(getenv("QIO_BACKEND"));
+  if(backend != NULL) return backend;
+  return &LRL_posix_backend;
+}
+
+/**
+ * Choose the backend for files opened for reading without choosing
+ * one.  Must be set the same on all nodes.
+ *
+ * \param backend   the backend, or null for the QIO_BACKEND environment
+ *                  variable or posix
+ *
+ * \return the old setting
+ */
+const LRL_Backend *LRL_set_read_backend(const LRL_Backend *backend)
+{
+  const LRL_Backend *old = LRL_read_default;
+  LRL_read_default = backend;
+  return old;
+}
+
+/**
+ * Choose the backend for files opened for writing without choosing
+ * one
+ *
+ * \param backend   the backend, or null for the QIO_BACKEND environment
+ *                  variable or posix
+ *
+ * \return the old setting
+ */
+const LRL_Backend *LRL_set_write_backend(const LRL_Backend *backend)
+{
+  const LRL_Backend *old = LRL_write_default;
+  LRL_write_default = backend;
+  return old;
+}
+
+/**
+ * Choose whether files are read through a memory map.  Files that
+ * can't be mapped are still read.
+ *
+ * \param flag   1 to map, 0 for the default
+ *
+ * \return the old setting
+ */
+int LRL_set_read_mapped(int flag)
+{
+  int old = LRL_default_backend(LRL_read_default) == &LRL_mmap_backend;
+  LRL_read_default = flag ? &LRL_mmap_backend : NULL;
+  return old;
+}
+
+/* Open a reader with exactly this backend */
+static LRL_FileReader *LRL_open_reader(const char *filename,
+				       const LRL_Backend *backend)
+{
+  LRL_FileReader *fr;
+
+  fr = (LRL_FileReader *) calloc(1, sizeof(LRL_FileReader));
+  if(fr == NULL) return NULL;
+  fr->backend = backend;
+  fr->handle = backend->open(filename, LRL_READ);
+  fr->filename = LRL_copy_filename(filename);
+  if(fr->handle == NULL || fr->filename == NULL) {
+    if(fr->handle) backend->close(fr->handle);
+    free(fr->filename);
+    free(fr);
+    return NULL;
+  }
+  fr->length = backend->size(fr->handle);
+  return fr;
+}
+
 /** 
  * Open a file for reading 
  *
@@ -23,27 +182,47 @@
  */
 LRL_FileReader *LRL_open_read_file(const char *filename)
 {
-  LRL_FileReader *fr = NULL;
-  /* Open and check for a readable file */
-  FILE *fpt = DCAPL(fopen)(filename,"r");
-  if(fpt != NULL) {
-    /* Set up LRL_FileReader structure */
-    fr = (LRL_FileReader *) malloc(sizeof(LRL_FileReader));
-    if(fr != NULL) {
-      fr->file = fpt;
-      fr->dr = limeCreateReader(fr->file);
-      if(fr->dr == NULL) {
-	free(fr);
-	fr = NULL;
-      }
-    }
-    if(fr == NULL) {
-      DCAP(fclose)(fpt);
-    }
-  }
+  return LRL_open_read_file_backend(filename, NULL);
+}
+
+/** 
+ * Open a file for reading with a given backend.  If a backend for
+ * files on disk can't open it, pread and pwrite and then stdio are
+ * tried.
+ *
+ * \param filename   file for reading  ( Read )
+ * \param backend    the backend, or null for the default ( Read )
+ *
+ * \return null if failure
+ */
+LRL_FileReader *LRL_open_read_file_backend(const char *filename,
+					   const LRL_Backend *backend)
+{
+  LRL_FileReader *fr;
+
+  if(backend == NULL) backend = LRL_default_backend(LRL_read_default);
+  fr = LRL_open_reader(filename, backend);
+  if(fr == NULL && backend->on_disk && backend != &LRL_posix_backend &&
+     backend != &LRL_stdio_backend)
+    fr = LRL_open_reader(filename, &LRL_posix_backend);
+  /* stdio also reaches dCache */
+  if(fr == NULL && backend->on_disk && backend != &LRL_stdio_backend)
+    fr = LRL_open_reader(filename, &LRL_stdio_backend);
   return fr;
 }
 
+/** 
+ * Open a file for reading through a memory map
+ *
+ * \param filename   file for reading  ( Read )
+ *
+ * \return null if the file can't be opened or mapped
+ */
+LRL_FileReader *LRL_open_read_file_mapped(const char *filename)
+{
+  return LRL_open_reader(filename, &LRL_mmap_backend);
+}
+
 /**
  * Seek to a new file pointer position
  *
@@ -52,11 +231,13 @@ LRL_FileReader *LRL_open_read_file(const char *filename)
  */
 
 int LRL_set_reader_pointer(LRL_FileReader *fr, off_t offset){
-  int status;
+  if(offset < 0)return LRL_ERR_SEEK;
 
-  /* Position file as requested */
-  status = limeSetReaderPointer(fr->dr, offset);
-  if(status != LIME_SUCCESS)return LRL_ERR_SEEK;
+  /* The next record starts here */
+  fr->rs.next = (uint64_t)offset;
+  fr->rs.rec_start = (uint64_t)offset;
+  fr->rs.rec_ptr = 0;
+  fr->rs.bytes_total = 0;
   return LRL_SUCCESS;
 }
 
@@ -67,7 +248,45 @@ int LRL_set_reader_pointer(LRL_FileReader *fr, off_t offset){
  */
 
 off_t LRL_get_reader_pointer(LRL_FileReader *fr){
-  return limeGetReaderPointer(fr->dr);  
+  return (off_t)fr->rs.next;
+}
+
+/**
+ * Choose whether files are written with O_DIRECT.  Files that can't
+ * be opened that way are still written.
+ *
+ * \param flag   1 for O_DIRECT, 0 for the default
+ *
+ * \return the old setting
+ */
+int LRL_set_write_direct(int flag)
+{
+  int old = LRL_default_backend(LRL_write_default) == &LRL_direct_backend;
+  LRL_write_default = flag ? &LRL_direct_backend : NULL;
+  return old;
+}
+
+/* Open a writer with exactly this backend */
+static LRL_FileWriter *LRL_open_writer(const char *filename, int mode,
+				       const LRL_Backend *backend)
+{
+  LRL_FileWriter *fw;
+
+  fw = (LRL_FileWriter *) calloc(1, sizeof(LRL_FileWriter));
+  if(fw == NULL) return NULL;
+  fw->backend = backend;
+  fw->handle = backend->open(filename, mode);
+  fw->filename = LRL_copy_filename(filename);
+  if(fw->handle == NULL || fw->filename == NULL) {
+    if(fw->handle) backend->close(fw->handle);
+    free(fw->filename);
+    free(fw);
+    return NULL;
+  }
+  /* The first header goes at the end of a file appended to */
+  if(mode == LRL_APPEND) fw->rs.next = backend->size(fw->handle);
+  fw->rs.me_flag = 1;
+  return fw;
 }
 
 /** 
@@ -79,34 +298,132 @@ off_t LRL_get_reader_pointer(LRL_FileReader *fr){
  */
 LRL_FileWriter *LRL_open_write_file(const char *filename, int mode)
 {
-  LRL_FileWriter *fw = (LRL_FileWriter *) malloc(sizeof(LRL_FileWriter));
-  if(fw != NULL) {
-    /* Open according to requested mode */
-    if(mode == LRL_APPEND) {
-      fw->file = DCAPL(fopen)(filename,"a");
-    } else if(mode == LRL_NOTRUNC) {
-      int fd = DCAP(open)(filename, O_WRONLY, 0666);
-      fw->file = fdopen(fd, "w");
-    } else {
-      fw->file = DCAPL(fopen)(filename,"w");
-    }
-    if(fw->file == NULL) {
-      printf("%s: failed to open %s for writing\n", __func__, filename);
-      free(fw);
-      fw = NULL;
-    } else {
-      fw->dg = limeCreateWriter(fw->file);
-      if(fw->dg == NULL) {
-	printf("%s: limeCreateWriter failed\n", __func__);
-	DCAP(fclose)(fw->file);
-	free(fw);
-	fw = NULL;
-      }
-    }
-  }
+  return LRL_open_write_file_backend(filename, mode, NULL);
+}
+
+/** 
+ * Open a file for writing with a given backend.  If a backend for
+ * files on disk can't open it, pread and pwrite and then stdio are
+ * tried.
+ *
+ * \param filename   file for writing  ( Read )
+ * \param mode       LRL write mode ( Read )
+ * \param backend    the backend, or null for the default ( Read )
+ *
+ * \return null if failure
+ */
+LRL_FileWriter *LRL_open_write_file_backend(const char *filename, int mode,
+					    const LRL_Backend *backend)
+{
+  LRL_FileWriter *fw;
+
+  if(backend == NULL) backend = LRL_default_backend(LRL_write_default);
+  fw = LRL_open_writer(filename, mode, backend);
+  if(fw == NULL && backend->on_disk && backend != &LRL_posix_backend &&
+     backend != &LRL_stdio_backend)
+    fw = LRL_open_writer(filename, mode, &LRL_posix_backend);
+  if(fw == NULL && backend->on_disk && backend != &LRL_stdio_backend)
+    fw = LRL_open_writer(filename, mode, &LRL_stdio_backend);
+  if(fw == NULL)
+    printf("%s: failed to open %s for writing\n", __func__, filename);
   return fw;
 }
 
+/** 
+ * Open a file for writing with O_DIRECT
+ *
+ * \param filename   file for writing  ( Read )
+ * \param mode       LRL write mode ( Read )
+ *
+ * \return null if the file can't be opened that way
+ */
+LRL_FileWriter *LRL_open_write_file_direct(const char *filename, int mode)
+{
+  return LRL_open_writer(filename, mode, &LRL_direct_backend);
+}
+
+/**
+ * The block size output buffers should be aligned to, or 0 if it
+ * doesn't matter
+ *
+ * \param rw         LRL record writer  ( Read )
+ */
+size_t LRL_write_alignment(LRL_RecordWriter *rw)
+{
+  if(rw == NULL || rw->fw == NULL || rw->fw->backend->alignment == NULL)
+    return 0;
+  return rw->fw->backend->alignment(rw->fw->handle);
+}
+
+/**
+ * Whether LRL_write_bytes_at may be called from several threads at
+ * once
+ *
+ * \param rw         LRL record writer  ( Read )
+ */
+int LRL_write_concurrent(LRL_RecordWriter *rw)
+{
+  if(rw == NULL || rw->fw == NULL)
+    return 0;
+  return rw->fw->backend->concurrent;
+}
+
+/**
+ * Whether LRL_read_bytes_at may be called from several threads at
+ * once
+ *
+ * \param rr         LRL record reader  ( Read )
+ */
+int LRL_read_concurrent(LRL_RecordReader *rr)
+{
+  if(rr == NULL || rr->fr == NULL)
+    return 0;
+  return rr->fr->backend->concurrent;
+}
+
+/* Read the record header at the start of the next record.  Returns
+   LRL_EOF if there are no more records. */
+static int LRL_read_header(LRL_FileReader *fr)
+{
+  LRL_RecordState *rs = &fr->rs;
+  unsigned char h[LRL_LIME_HDR_BYTES];
+  uint64_t k;
+  char myname[] = "LRL_read_header";
+
+  k = fr->backend->read_at(fr->handle, (char *)h, sizeof(h), rs->next);
+  if(k == 0) return LRL_EOF;
+  if(k < sizeof(h)) {
+    printf("%s: truncated LIME header at byte %lu\n",myname,
+	   (unsigned long)rs->next);
+    return LRL_ERR_READ;
+  }
+  if(LRL_get_big_endian(h, 4) != LRL_LIME_MAGIC) {
+    printf("%s: no LIME header at byte %lu\n",myname,
+	   (unsigned long)rs->next);
+    return LRL_ERR_READ;
+  }
+
+  rs->mb_flag = (h[6] & LRL_LIME_MB_MASK) != 0;
+  rs->me_flag = (h[6] & LRL_LIME_ME_MASK) != 0;
+  rs->bytes_total = LRL_get_big_endian(h + LRL_LIME_LEN_OFFSET, 8);
+  memcpy(rs->type, h + LRL_LIME_TYPE_OFFSET, LRL_LIME_TYPE_LEN);
+  rs->type[LRL_LIME_TYPE_LEN] = '\0';
+  rs->rec_start = rs->next + LRL_LIME_HDR_BYTES;
+  rs->rec_ptr = 0;
+
+  if(fr->length >= rs->rec_start &&
+     rs->bytes_total > fr->length - rs->rec_start) {
+    printf("%s: record of %lu bytes at byte %lu is truncated\n",myname,
+	   (unsigned long)rs->bytes_total, (unsigned long)rs->rec_start);
+    rs->bytes_total = 0;
+    return LRL_ERR_READ;
+  }
+
+  rs->next = rs->rec_start + rs->bytes_total +
+    LRL_pad_bytes(rs->bytes_total);
+  return LRL_SUCCESS;
+}
+
 /** 
  * Open a record for reading
  *
@@ -121,7 +438,6 @@ LRL_RecordReader *LRL_open_read_record(LRL_FileReader *fr,
 				       LIME_type *lime_type, int *status)
 {
   LRL_RecordReader *rr;
-  int lime_status;
   char myname[] = "LRL_open_read_record";
 
   if (fr == NULL)
@@ -133,25 +449,20 @@ LRL_RecordReader *LRL_open_read_record(LRL_FileReader *fr,
     return NULL;
   }
   rr->fr = fr;
-  
+
   /* Get next record header */
-  lime_status = limeReaderNextRecord(rr->fr->dr);
-  if (lime_status != LIME_SUCCESS){
-    if(lime_status == LIME_EOF)*status = LRL_EOF;
-    else{
-      printf("%s lime error %d getting next record header\n",myname,
-	     lime_status);
-      *status = LRL_ERR_READ;
-    }
+  *status = LRL_read_header(fr);
+  if (*status != LRL_SUCCESS){
+    if(*status != LRL_EOF)
+      printf("%s: error %d getting next record header\n",myname,*status);
     free(rr);
     return NULL;
   }
 
   /* Extract record information */
-  *rec_size = limeReaderBytes(rr->fr->dr);
-  *lime_type = limeReaderType(rr->fr->dr);
+  *rec_size = fr->rs.bytes_total;
+  *lime_type = fr->rs.type;
 
-  *status = LRL_SUCCESS;
   return rr;
 }
 
@@ -241,21 +552,38 @@ int LRL_write_record_header(LRL_RecordWriter *rw,
 			    uint64_t rec_size, 
 			    LIME_type lime_type)
 {
-  LimeRecordHeader *h;
-  int status;
+  LRL_FileWriter *fw = rw->fw;
+  LRL_RecordState *rs = &fw->rs;
+  unsigned char h[LRL_LIME_HDR_BYTES];
   char myname[] = "LRL_write_record_header";
 
   /* Create and write record header */
-  h = limeCreateHeader(msg_begin, msg_end, lime_type, rec_size);
-  status = limeWriteRecordHeader(h, rw->fw->dg);
-
-  if (status < 0)
+  memset(h, 0, sizeof(h));
+  LRL_put_big_endian(h, 4, LRL_LIME_MAGIC);
+  LRL_put_big_endian(h + 4, 2, LRL_LIME_VERSION);
+  if(msg_begin) h[6] |= LRL_LIME_MB_MASK;
+  if(msg_end) h[6] |= LRL_LIME_ME_MASK;
+  LRL_put_big_endian(h + LRL_LIME_LEN_OFFSET, 8, rec_size);
+  /* The header is zeroed, so a shorter type stays null-terminated */
+  if(lime_type != NULL)
+    memcpy(h + LRL_LIME_TYPE_OFFSET, lime_type,
+	   strnlen(lime_type, LRL_LIME_TYPE_LEN));
+
+  if (fw->backend->write_at(fw->handle, (const char *)h, sizeof(h), rs->next)
+      != sizeof(h))
   { 
-    printf("%s: fatal error. LIME status is: %d\n", myname, status);
+    printf("%s: fatal error writing the header\n", myname);
     return LRL_ERR_WRITE;
   }
 
-  limeDestroyHeader(h);
+  rs->mb_flag = msg_begin;
+  rs->me_flag = msg_end;
+  rs->bytes_total = rec_size;
+  memcpy(rs->type, h + LRL_LIME_TYPE_OFFSET, LRL_LIME_TYPE_LEN);
+  rs->type[LRL_LIME_TYPE_LEN] = '\0';
+  rs->rec_start = rs->next + LRL_LIME_HDR_BYTES;
+  rs->rec_ptr = 0;
+  rs->next = rs->rec_start + rec_size + LRL_pad_bytes(rec_size);
 
   return LRL_SUCCESS;
 }
@@ -305,22 +633,22 @@ LRL_RecordWriter *LRL_open_write_record(LRL_FileWriter *fw,
 void LRL_get_reader_state(LRL_RecordReader *rr,
 			  void **state_ptr, size_t *state_size)
 {
-  LimeReader *spt;
+  LRL_RecordState *spt;
   char myname[] = "LRL_get_reader_state";
 
-  /* For now the LIME reader structure defines the state.  It would be
-     cleaner to define a new state structure and copy just the reader
-     components we need */
-  spt = (LimeReader *)malloc(sizeof(LimeReader));
+  /* The record state is the same for every backend, so nodes reading
+     differently, or not at all, agree on it */
+  spt = (LRL_RecordState *)calloc(1, sizeof(LRL_RecordState));
   if (spt == NULL){
     printf("%s: Can't malloc reader state\n",myname);
     *state_ptr = NULL;
     *state_size = 0;
   }
   else{
-    if(rr) *spt = *(rr->fr->dr);
+    if(rr != NULL)
+      *spt = rr->fr->rs;
     *state_ptr = (void *)spt;
-    *state_size = sizeof(LimeReader);
+    *state_size = sizeof(LRL_RecordState);
   }
 }
 
@@ -338,13 +666,10 @@ void LRL_get_reader_state(LRL_RecordReader *rr,
 void LRL_get_writer_state(LRL_RecordWriter *rw,
 			  void **state_ptr, size_t *state_size)
 {
-  LimeWriter *spt;
+  LRL_RecordState *spt;
   char myname[] = "LRL_get_writer_state";
 
-  /* For now the LIME writer structure defines the state.  It would be
-     cleaner to define a new state structure and copy just the reader
-     components we need */
-  spt = (LimeWriter *)malloc(sizeof(LimeWriter));
+  spt = (LRL_RecordState *)calloc(1, sizeof(LRL_RecordState));
   if (spt == NULL){
     printf("%s: Can't malloc writer state\n",myname);
     *state_ptr = NULL;
@@ -352,9 +677,9 @@ void LRL_get_writer_state(LRL_RecordWriter *rw,
   }
   else{
     if(rw != NULL)
-      *spt = *(rw->fw->dg);
+      *spt = rw->fw->rs;
     *state_ptr = (void *)spt;
-    *state_size = sizeof(LimeWriter);
+    *state_size = sizeof(LRL_RecordState);
   }
 }
 
@@ -367,16 +692,10 @@ void LRL_get_writer_state(LRL_RecordWriter *rw,
  * \return LRL status
  */
 int LRL_set_reader_state(LRL_RecordReader *rr, void *state_ptr){
-  LimeReader *rsrc = (LimeReader *)state_ptr;
-  int status;
-
   if(rr) {
-    /* Set the LIME reader state to the state specified by state_ptr */
-    status = limeReaderSetState(rr->fr->dr, rsrc);
-    if(status != LIME_SUCCESS)return LRL_ERR_SETSTATE;
-
-    status = limeReaderSeek(rr->fr->dr, 0, SEEK_SET);
-    if(status != LIME_SUCCESS)return LRL_ERR_SEEK;
+    /* Take the record and go to the start of its payload */
+    rr->fr->rs = *(LRL_RecordState *)state_ptr;
+    rr->fr->rs.rec_ptr = 0;
   }
 
   return LRL_SUCCESS;
@@ -391,16 +710,9 @@ int LRL_set_reader_state(LRL_RecordReader *rr, void *state_ptr){
  * \return LRL status
  */
 int LRL_set_writer_state(LRL_RecordWriter *rw, void *state_ptr){
-  LimeWriter *wsrc = (LimeWriter *)state_ptr;
-  int status;
-
   if(rw) {
-    /* Set the LIME writer state to the state specified by state_ptr */
-    status = limeWriterSetState(rw->fw->dg, wsrc);
-    if(status != LIME_SUCCESS)return LRL_ERR_SETSTATE;
-
-    status = limeWriterSeek(rw->fw->dg, 0, SEEK_SET);
-    if(status != LIME_SUCCESS)return LRL_ERR_SEEK;
+    rw->fw->rs = *(LRL_RecordState *)state_ptr;
+    rw->fw->rs.rec_ptr = 0;
   }
 
   return LRL_SUCCESS;
@@ -418,25 +730,124 @@ int LRL_set_writer_state(LRL_RecordWriter *rw, void *state_ptr){
 uint64_t LRL_read_bytes(LRL_RecordReader *rr, char *buf, 
 		      uint64_t nbytes)
 {
-  int status;
-  uint64_t nbyt = nbytes;
+  LRL_FileReader *fr;
+  uint64_t nbyt;
   char myname[] = "LRL_read_bytes";
 
   if (rr == NULL)
     return 0;
+  fr = rr->fr;
+
+  /* Not past the end of the record */
+  if (nbytes > fr->rs.bytes_total - fr->rs.rec_ptr)
+    nbytes = fr->rs.bytes_total - fr->rs.rec_ptr;
 
-  //printf("node %i pos %i reading %i bytes\n", QMP_get_node_number(), rr->fr->dr->rec_ptr, nbytes);
-  status = limeReaderReadData((void *)buf, &nbyt, rr->fr->dr);
-  if( status != LIME_SUCCESS ) 
+  nbyt = fr->backend->read_at(fr->handle, buf, nbytes,
+			      fr->rs.rec_start + fr->rs.rec_ptr);
+  if( nbyt != nbytes ) 
   { 
-    printf("%s: LIME error %d has occurred\n", myname, status);
+    printf("%s: read %lu of %lu bytes\n", myname,
+	   (unsigned long)nbyt, (unsigned long)nbytes);
     exit(EXIT_FAILURE);
   }
+  fr->rs.rec_ptr += nbyt;
+
+  return nbyt;
+}
+
+/** 
+ * Read bytes at a given place in the record payload.  The read
+ * position is neither used nor moved, so threads can read different
+ * parts of a record at once if the backend is concurrent.
+ *
+ * \param rr         LRL record reader  ( Read )
+ * \param offset     bytes from the start of the payload ( Read )
+ * \param buf        buffer for reading ( Write )
+ * \param nbytes     number of bytes to read ( Read )
+ *
+ * \return number of bytes read, fewer at the end of the record or
+ * if the read fails.  The caller reports a failure, since this may run
+ * on a thread of its own.
+ */
+uint64_t LRL_read_bytes_at(LRL_RecordReader *rr, off_t offset,
+			   char *buf, uint64_t nbytes)
+{
+  LRL_FileReader *fr;
+  uint64_t nbyt;
+  char myname[] = "LRL_read_bytes_at";
+
+  if (rr == NULL)
+    return 0;
+  fr = rr->fr;
+  if (offset < 0 || (uint64_t)offset > fr->rs.bytes_total) {
+    printf("%s: offset %lu is beyond the record\n", myname,
+	   (unsigned long)offset);
+    return 0;
+  }
+
+  if (nbytes > fr->rs.bytes_total - (uint64_t)offset)
+    nbytes = fr->rs.bytes_total - (uint64_t)offset;
+
+  nbyt = fr->backend->read_at(fr->handle, buf, nbytes,
+			      fr->rs.rec_start + (uint64_t)offset);
 
   return nbyt;
 }
 
 
+/** 
+ * Read bytes without copying them, from a backend that can point to
+ * them, such as a mapped file
+ *
+ * \param rr         LRL record reader  ( Read )
+ * \param nbytes     number of bytes wanted, reduced to the number
+ *                   left in the record ( Modify )
+ *
+ * \return pointer to the bytes, or null if the backend can't point to
+ * them.  It is valid until the file is closed.
+ */
+const char *LRL_read_bytes_mapped(LRL_RecordReader *rr, uint64_t *nbytes)
+{
+  LRL_FileReader *fr;
+  const char *p;
+
+  if (rr == NULL || rr->fr->backend->map_at == NULL)
+    return NULL;
+  fr = rr->fr;
+
+  if (*nbytes > fr->rs.bytes_total - fr->rs.rec_ptr)
+    *nbytes = fr->rs.bytes_total - fr->rs.rec_ptr;
+  p = fr->backend->map_at(fr->handle, fr->rs.rec_start + fr->rs.rec_ptr,
+			  *nbytes);
+  if (p != NULL)
+    fr->rs.rec_ptr += *nbytes;
+  return p;
+}
+
+/** 
+ * Say that the next nbytes of the record payload will be read soon,
+ * so a mapped file can be brought in ahead of time.  Does nothing for
+ * a backend that can't use the advice.
+ *
+ * \param rr         LRL record reader  ( Read )
+ * \param nbytes     number of bytes ( Read )
+ *
+ * \return LRL status
+ */
+int LRL_advise_read(LRL_RecordReader *rr, uint64_t nbytes)
+{
+  LRL_FileReader *fr;
+
+  if (rr == NULL || rr->fr->backend->advise == NULL)
+    return LRL_SUCCESS;
+  fr = rr->fr;
+
+  if (nbytes > fr->rs.bytes_total - fr->rs.rec_ptr)
+    nbytes = fr->rs.bytes_total - fr->rs.rec_ptr;
+  return fr->backend->advise(fr->handle, fr->rs.rec_start + fr->rs.rec_ptr,
+			     nbytes);
+}
+
 /** 
  * Write bytes
  *
@@ -449,19 +860,65 @@ uint64_t LRL_read_bytes(LRL_RecordReader *rr, char *buf,
 uint64_t LRL_write_bytes(LRL_RecordWriter *rw, char *buf, 
 		       uint64_t nbytes)
 {
-  int status;
-  uint64_t nbyt = nbytes;
+  LRL_FileWriter *fw;
+  uint64_t nbyt;
 
   if (rw == NULL)
     return 0;
+  fw = rw->fw;
 
-  status = limeWriteRecordData(buf, &nbyt, rw->fw->dg);
+  /* Not past the end of the record */
+  if (nbytes > fw->rs.bytes_total - fw->rs.rec_ptr)
+    nbytes = fw->rs.bytes_total - fw->rs.rec_ptr;
 
-  if( status != LIME_SUCCESS ) 
+  nbyt = fw->backend->write_at(fw->handle, buf, nbytes,
+			       fw->rs.rec_start + fw->rs.rec_ptr);
+  if( nbyt != nbytes ) 
   { 
-    printf("LRL_write_bytes: some error has occurred. status is: %d\n", status);
+    printf("LRL_write_bytes: wrote %lu of %lu bytes\n",
+	   (unsigned long)nbyt, (unsigned long)nbytes);
     exit(EXIT_FAILURE);
   }
+  fw->rs.rec_ptr += nbyt;
+
+  return nbyt;
+}
+
+/** 
+ * Write bytes at a given place in the record payload.  The write
+ * position is neither used nor moved, so threads can write different
+ * parts of a record at once if the backend is concurrent.
+ *
+ * \param rw         LRL record writer  ( Read )
+ * \param offset     bytes from the start of the payload ( Read )
+ * \param buf        buffer for writing ( Read )
+ * \param nbytes     number of bytes to write ( Read )
+ *
+ * \return number of bytes written, fewer at the end of the record or
+ * if the write fails.  The caller reports a failure, since this may
+ * run on a thread of its own.
+ */
+uint64_t LRL_write_bytes_at(LRL_RecordWriter *rw, off_t offset,
+			    char *buf, uint64_t nbytes)
+{
+  LRL_FileWriter *fw;
+  uint64_t nbyt;
+  char myname[] = "LRL_write_bytes_at";
+
+  if (rw == NULL)
+    return 0;
+  fw = rw->fw;
+  if (offset < 0 || (uint64_t)offset > fw->rs.bytes_total) {
+    printf("%s: offset %lu is beyond the record\n", myname,
+	   (unsigned long)offset);
+    return 0;
+  }
+
+  if (nbytes > fw->rs.bytes_total - (uint64_t)offset)
+    nbytes = fw->rs.bytes_total - (uint64_t)offset;
+
+  nbyt = fw->backend->write_at(fw->handle, buf, nbytes,
+			       fw->rs.rec_start + (uint64_t)offset);
 
   return nbyt;
 }
@@ -473,16 +930,13 @@ uint64_t LRL_write_bytes(LRL_RecordWriter *rw, char *buf,
 
 int LRL_seek_read_record(LRL_RecordReader *rr, off_t offset)
 {
-  int status;
-
   if (rr == NULL || rr->fr == NULL)return LRL_ERR_SEEK;
-  status = limeReaderSeek(rr->fr->dr, offset, SEEK_SET);
-
-  if( status != LIME_SUCCESS ) 
-  { 
-    printf("LRL_seek_read_record: some error has occurred. status is: %d\n", status);
+  if (offset < 0 || (uint64_t)offset > rr->fr->rs.bytes_total) {
+    printf("LRL_seek_read_record: offset %lu is beyond the record\n",
+	   (unsigned long)offset);
     return LRL_ERR_SEEK;
   }
+  rr->fr->rs.rec_ptr = (uint64_t)offset;
   return LRL_SUCCESS;
 }
 
@@ -492,7 +946,6 @@ int LRL_seek_read_record(LRL_RecordReader *rr, off_t offset)
 
 int LRL_seek_write_record(LRL_RecordWriter *rw, off_t offset)
 {
-  int status;
   char myname[] = "LRL_seek_write_record";
 
   if (rw == NULL){
@@ -503,14 +956,55 @@ int LRL_seek_write_record(LRL_RecordWriter *rw, off_t offset)
     printf("%s: null file writer\n",myname);
     return LRL_ERR_SEEK;
   }
-
-  status = limeWriterSeek(rw->fw->dg, offset, SEEK_SET);
-
-  if( status != LIME_SUCCESS ) 
-  { 
-    printf("%s: LIME error %d\n", myname,status);
+  if (offset < 0 || (uint64_t)offset > rw->fw->rs.bytes_total) {
+    printf("%s: offset %lu is beyond the record\n", myname,
+	   (unsigned long)offset);
     return LRL_ERR_SEEK;
   }
+
+  rw->fw->rs.rec_ptr = (uint64_t)offset;
+  return LRL_SUCCESS;
+}
+
+/**
+ * Locate the record payload in the file, so that it can be written by
+ * other means.  Output already buffered is flushed first.
+ *
+ * \param rw         LRL record writer  ( Read )
+ * \param filename   name of the file ( Write )
+ * \param offset     file offset of the start of the payload ( Write )
+ *
+ * \return LRL status
+ */
+int LRL_get_writer_location(LRL_RecordWriter *rw, const char **filename,
+			    off_t *offset)
+{
+  if (rw == NULL || rw->fw == NULL)return LRL_ERR_SEEK;
+  if (!rw->fw->backend->on_disk)return LRL_ERR_SEEK;
+  *filename = rw->fw->filename;
+  if (rw->fw->backend->flush(rw->fw->handle) != LRL_SUCCESS)
+    return LRL_ERR_WRITE;
+  *offset = (off_t)rw->fw->rs.rec_start;
+  return LRL_SUCCESS;
+}
+
+/**
+ * Locate the record payload in the file, so that it can be read by
+ * other means
+ *
+ * \param rr         LRL record reader  ( Read )
+ * \param filename   name of the file ( Write )
+ * \param offset     file offset of the start of the payload ( Write )
+ *
+ * \return LRL status
+ */
+int LRL_get_reader_location(LRL_RecordReader *rr, const char **filename,
+			    off_t *offset)
+{
+  if (rr == NULL || rr->fr == NULL)return LRL_ERR_SEEK;
+  if (!rr->fr->backend->on_disk)return LRL_ERR_SEEK;
+  *filename = rr->fr->filename;
+  *offset = (off_t)rr->fr->rs.rec_start;
   return LRL_SUCCESS;
 }
 
@@ -524,13 +1018,13 @@ int LRL_next_message(LRL_FileReader *fr)
 
   if(fr == NULL)return LRL_ERR_SKIP;
   while(msg_end == 0){
-    status = limeReaderNextRecord(fr->dr);
-    msg_end = limeReaderMEFlag(fr->dr);
-    if( status != LIME_SUCCESS ) 
+    status = LRL_read_header(fr);
+    if( status != LRL_SUCCESS ) 
       { 
-	printf("%s: LIME error %d\n", myname,status);
+	printf("%s: error %d\n", myname,status);
 	return LRL_ERR_SKIP;
       }
+    msg_end = fr->rs.me_flag;
   }
   return LRL_SUCCESS;
 }
@@ -540,16 +1034,13 @@ int LRL_next_message(LRL_FileReader *fr)
 int LRL_next_record(LRL_RecordReader *rr)
 {
   int status;
-  LRL_FileReader *fr;
 
-  if(rr == NULL)return LRL_ERR_SKIP;
-  fr = rr->fr;
-  if(fr == NULL)return LRL_ERR_SKIP;
-  status = limeReaderNextRecord(fr->dr);
+  if(rr == NULL || rr->fr == NULL)return LRL_ERR_SKIP;
+  status = LRL_read_header(rr->fr);
 
-  if( status != LIME_SUCCESS ) 
+  if( status != LRL_SUCCESS ) 
   { 
-    printf("LRL_next_record: LIME error %d\n", status);
+    printf("LRL_next_record: error %d\n", status);
     return LRL_ERR_SKIP;
   }
   return LRL_SUCCESS;
@@ -589,8 +1080,8 @@ LRL_close_read_record(LRL_RecordReader *rr)
   if(rr == NULL) {
     status = LRL_ERR_CLOSE;
   } else {
-    if(limeReaderCloseRecord(rr->fr->dr) != LIME_SUCCESS)
-      status = LRL_ERR_CLOSE;
+    /* A record needs no closing.  The next header is found from the
+       record length. */
     free(rr);
   }
   return status;
@@ -604,11 +1095,19 @@ LRL_close_read_record(LRL_RecordReader *rr)
 int
 LRL_close_write_record(LRL_RecordWriter *rw)
 {
+  static const char zeros[8] = {0};
+  LRL_FileWriter *fw;
+  uint64_t pad;
   int status = LRL_SUCCESS;
   if(rw == NULL) {
     status = LRL_ERR_CLOSE;
   } else {
-    if(limeWriterCloseRecord(rw->fw->dg) != LIME_SUCCESS)
+    /* Pad the payload */
+    fw = rw->fw;
+    pad = LRL_pad_bytes(fw->rs.bytes_total);
+    if(pad > 0 &&
+       fw->backend->write_at(fw->handle, zeros, pad,
+			     fw->rs.rec_start + fw->rs.bytes_total) != pad)
       status = LRL_ERR_CLOSE;
     free(rw);
   }
@@ -627,8 +1126,8 @@ LRL_close_read_file(LRL_FileReader *fr)
 {
   int status = LRL_SUCCESS;
   if(fr != NULL) {
-    limeDestroyReader(fr->dr);
-    if(DCAP(fclose)(fr->file)!=0) status = LRL_ERR_CLOSE;
+    status = fr->backend->close(fr->handle);
+    free(fr->filename);
     free(fr);
   }
   return status;
@@ -646,14 +1145,11 @@ LRL_close_write_file(LRL_FileWriter *fw)
 {
   int status = LRL_SUCCESS;
   if(fw != NULL) {
-    limeDestroyWriter(fw->dg);
-    int fstatus = DCAP(fclose)(fw->file);
-    if(fstatus!=0) {
-      status = LRL_ERR_CLOSE;
-    }
+    status = fw->backend->close(fw->handle);
 #ifdef JCO_DEBUG
-    fprintf(stderr, "%s: fclose return: %i\n", __func__, fstatus);
+    fprintf(stderr, "%s: close return: %i\n", __func__, status);
 #endif
+    free(fw->filename);
     free(fw);
   }
   return status;
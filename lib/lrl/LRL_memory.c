@@ -0,0 +1,149 @@
+/* LRL_memory.c */
+/* The LRL backend keeping files in memory */
+
+/* Files are named buffers in this process, kept after they are closed
+   so they can be read back.  Nothing touches the file system, which
+   makes this the backend for tests and for timing QIO without the
+   disk.  Other processes don't see the files, and the buffers are not
+   protected against threads opening or removing them at once.
+   LRL_memory_remove frees them. */
+
+#include <qio_config.h>
+#include <lrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct LRL_MemFile {
+  char *name;
+  char *data;
+  uint64_t length;          /* Bytes in the file */
+  uint64_t cap;             /* Bytes allocated */
+  struct LRL_MemFile *next;
+} LRL_MemFile;
+
+static LRL_MemFile *LRL_mem_files = NULL;
+
+static LRL_MemFile *LRL_mem_find(const char *filename){
+  LRL_MemFile *mf;
+
+  for(mf = LRL_mem_files; mf != NULL; mf = mf->next)
+    if(strcmp(mf->name, filename) == 0)return mf;
+  return NULL;
+}
+
+static void *LRL_mem_open(const char *filename, int mode){
+  LRL_MemFile *mf = LRL_mem_find(filename);
+
+  if(mode == LRL_READ || mode == LRL_NOTRUNC)return mf;
+  if(mf == NULL){
+    mf = (LRL_MemFile *)calloc(1, sizeof(LRL_MemFile));
+    if(mf == NULL)return NULL;
+    mf->name = (char *)malloc(strlen(filename)+1);
+    if(mf->name == NULL){
+      free(mf);
+      return NULL;
+    }
+    strcpy(mf->name, filename);
+    mf->next = LRL_mem_files;
+    LRL_mem_files = mf;
+  }
+  if(mode != LRL_APPEND)mf->length = 0;
+  return mf;
+}
+
+static uint64_t LRL_mem_read_at(void *h, char *buf, uint64_t nbytes,
+				uint64_t offset){
+  LRL_MemFile *mf = (LRL_MemFile *)h;
+
+  if(offset >= mf->length)return 0;
+  if(nbytes > mf->length - offset)nbytes = mf->length - offset;
+  memcpy(buf, mf->data + offset, (size_t)nbytes);
+  return nbytes;
+}
+
+/* Grow the file as needed.  A gap left by writing past the end reads
+   as zeros. */
+static uint64_t LRL_mem_write_at(void *h, const char *buf, uint64_t nbytes,
+				 uint64_t offset){
+  LRL_MemFile *mf = (LRL_MemFile *)h;
+  uint64_t end = offset + nbytes, cap;
+  char *data;
+
+  if(end > mf->cap){
+    cap = mf->cap > 0 ? mf->cap : 4096;
+    while(cap < end)cap *= 2;
+    if(cap != (uint64_t)(size_t)cap)return 0;
+    data = (char *)realloc(mf->data, (size_t)cap);
+    if(data == NULL)return 0;
+    mf->data = data;
+    mf->cap = cap;
+  }
+  if(offset > mf->length)
+    memset(mf->data + mf->length, 0, (size_t)(offset - mf->length));
+  memcpy(mf->data + offset, buf, (size_t)nbytes);
+  if(end > mf->length)mf->length = end;
+  return nbytes;
+}
+
+static const char *LRL_mem_map_at(void *h, uint64_t offset, uint64_t nbytes){
+  LRL_MemFile *mf = (LRL_MemFile *)h;
+
+  if(mf->data == NULL || offset > mf->length ||
+     nbytes > mf->length - offset)return NULL;
+  return mf->data + offset;
+}
+
+static uint64_t LRL_mem_size(void *h){
+  return ((LRL_MemFile *)h)->length;
+}
+
+static int LRL_mem_flush(void *h){
+  (void)h;
+  return LRL_SUCCESS;
+}
+
+/* The file stays until it is removed */
+static int LRL_mem_close(void *h){
+  (void)h;
+  return LRL_SUCCESS;
+}
+
+const LRL_Backend LRL_memory_backend = {
+  "memory", 0, 0,
+  LRL_mem_open,
+  LRL_mem_read_at,
+  LRL_mem_write_at,
+  LRL_mem_map_at,
+  NULL,
+  LRL_mem_size,
+  NULL,
+  LRL_mem_flush,
+  LRL_mem_close
+};
+
+/**
+ * Free a file kept by the memory backend.  It must not be open.
+ *
+ * \param filename   the file, or null for all of them
+ *
+ * \return LRL_SUCCESS, or LRL_ERR_CLOSE if there is no such file
+ */
+int LRL_memory_remove(const char *filename)
+{
+  LRL_MemFile **link = &LRL_mem_files, *mf;
+  int status = filename == NULL ? LRL_SUCCESS : LRL_ERR_CLOSE;
+
+  while((mf = *link) != NULL){
+    if(filename != NULL && strcmp(mf->name, filename) != 0){
+      link = &mf->next;
+      continue;
+    }
+    *link = mf->next;
+    free(mf->name);
+    free(mf->data);
+    free(mf);
+    status = LRL_SUCCESS;
+  }
+  return status;
+}
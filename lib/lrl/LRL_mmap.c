@@ -0,0 +1,119 @@
+/* LRL_mmap.c */
+/* The LRL backend reading a file through a memory map */
+
+/* The whole file is mapped read-only.  Payload bytes are either
+   copied out or handed to the caller as pointers into the map, so
+   nothing passes through a stdio buffer.  The pages come from the page
+   cache, so a file that is read again is not read from disk again. */
+
+#define _POSIX_C_SOURCE 200112L
+#include <qio_config.h>
+#include <lrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef struct {
+  char *base;               /* The map */
+  uint64_t length;          /* Bytes mapped, the whole file */
+} LRL_MapFile;
+
+/* Map a file.  Returns null if it can't be mapped, in which case
+   LRL_open_read_file can still read it with stdio. */
+static void *LRL_map_open(const char *filename, int mode){
+  LRL_MapFile *map;
+  struct stat st;
+  void *base;
+  int fd;
+
+  if(mode != LRL_READ)return NULL;
+  fd = open(filename, O_RDONLY);
+  if(fd < 0)return NULL;
+  if(fstat(fd, &st) != 0 || st.st_size <= 0 ||
+     (uint64_t)st.st_size > (uint64_t)(size_t)-1){
+    close(fd);
+    return NULL;
+  }
+  base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED)return NULL;
+
+  map = (LRL_MapFile *)malloc(sizeof(LRL_MapFile));
+  if(map == NULL){
+    munmap(base, (size_t)st.st_size);
+    return NULL;
+  }
+  map->base = (char *)base;
+  map->length = (uint64_t)st.st_size;
+  return map;
+}
+
+/* Point to nbytes at offset */
+static const char *LRL_map_at(void *h, uint64_t offset, uint64_t nbytes){
+  LRL_MapFile *map = (LRL_MapFile *)h;
+
+  if(offset > map->length || nbytes > map->length - offset)return NULL;
+  return map->base + offset;
+}
+
+/* Copy up to nbytes at offset */
+static uint64_t LRL_map_read_at(void *h, char *buf, uint64_t nbytes,
+				uint64_t offset){
+  LRL_MapFile *map = (LRL_MapFile *)h;
+
+  if(offset >= map->length)return 0;
+  if(nbytes > map->length - offset)nbytes = map->length - offset;
+  memcpy(buf, map->base + offset, (size_t)nbytes);
+  return nbytes;
+}
+
+/* Tell the kernel that nbytes at offset will be read soon, so it can
+   start bringing them in */
+static int LRL_map_advise(void *h, uint64_t offset, uint64_t nbytes){
+  LRL_MapFile *map = (LRL_MapFile *)h;
+  uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+  uint64_t start, end;
+
+  if(offset >= map->length || nbytes == 0)return LRL_SUCCESS;
+  if(nbytes > map->length - offset)nbytes = map->length - offset;
+  start = offset - offset % page;
+  end = offset + nbytes;
+  if(posix_madvise(map->base + start, (size_t)(end - start),
+		   POSIX_MADV_WILLNEED) != 0)return LRL_ERR_READ;
+  return LRL_SUCCESS;
+}
+
+static uint64_t LRL_map_size(void *h){
+  return ((LRL_MapFile *)h)->length;
+}
+
+static int LRL_map_flush(void *h){
+  (void)h;
+  return LRL_SUCCESS;
+}
+
+static int LRL_map_close(void *h){
+  LRL_MapFile *map = (LRL_MapFile *)h;
+
+  munmap(map->base, (size_t)map->length);
+  free(map);
+  return LRL_SUCCESS;
+}
+
+const LRL_Backend LRL_mmap_backend = {
+  "mmap", 1, 1,
+  LRL_map_open,
+  LRL_map_read_at,
+  NULL,
+  LRL_map_at,
+  LRL_map_advise,
+  LRL_map_size,
+  NULL,
+  LRL_map_flush,
+  LRL_map_close
+};
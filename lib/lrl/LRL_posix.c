@@ -0,0 +1,121 @@
+/* LRL_posix.c */
+/* The LRL backend reading and writing with pread and pwrite */
+
+/* Every transfer names its own offset, so there is no file position
+   to share and several threads can read or write different parts of
+   a file through one handle at the same time.  Nothing is buffered in
+   the process, so a write is visible to other handles as soon as it
+   returns.  Files that open can't reach, such as dCache URLs, are
+   left to the stdio backend. */
+
+#define _POSIX_C_SOURCE 200809L /* for pread, pwrite and posix_fadvise */
+#include <qio_config.h>
+#include <lrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef struct {
+  int fd;
+} LRL_PosixFile;
+
+static void *LRL_posix_open(const char *filename, int mode){
+  LRL_PosixFile *pf;
+  int flags, fd;
+
+  if(mode == LRL_READ)flags = O_RDONLY;
+  else if(mode == LRL_APPEND)flags = O_WRONLY | O_CREAT;
+  else if(mode == LRL_NOTRUNC)flags = O_WRONLY;
+  else flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+  fd = open(filename, flags, 0666);
+  if(fd < 0)return NULL;
+  pf = (LRL_PosixFile *)malloc(sizeof(LRL_PosixFile));
+  if(pf == NULL){
+    close(fd);
+    return NULL;
+  }
+  pf->fd = fd;
+  return pf;
+}
+
+static uint64_t LRL_posix_read_at(void *h, char *buf, uint64_t nbytes,
+				  uint64_t offset){
+  LRL_PosixFile *pf = (LRL_PosixFile *)h;
+  uint64_t done = 0;
+  ssize_t k;
+
+  while(done < nbytes){
+    k = pread(pf->fd, buf + done, (size_t)(nbytes - done),
+	      (off_t)(offset + done));
+    if(k < 0 && errno == EINTR)continue;
+    if(k <= 0)break;
+    done += (uint64_t)k;
+  }
+  return done;
+}
+
+static uint64_t LRL_posix_write_at(void *h, const char *buf, uint64_t nbytes,
+				   uint64_t offset){
+  LRL_PosixFile *pf = (LRL_PosixFile *)h;
+  uint64_t done = 0;
+  ssize_t k;
+
+  while(done < nbytes){
+    k = pwrite(pf->fd, buf + done, (size_t)(nbytes - done),
+	       (off_t)(offset + done));
+    if(k < 0 && errno == EINTR)continue;
+    if(k <= 0)break;
+    done += (uint64_t)k;
+  }
+  return done;
+}
+
+/* Ask the kernel to start reading nbytes at offset */
+static int LRL_posix_advise(void *h, uint64_t offset, uint64_t nbytes){
+  LRL_PosixFile *pf = (LRL_PosixFile *)h;
+
+  if(posix_fadvise(pf->fd, (off_t)offset, (off_t)nbytes,
+		   POSIX_FADV_WILLNEED) != 0)return LRL_ERR_READ;
+  return LRL_SUCCESS;
+}
+
+static uint64_t LRL_posix_size(void *h){
+  LRL_PosixFile *pf = (LRL_PosixFile *)h;
+  struct stat st;
+
+  if(fstat(pf->fd, &st) != 0)return 0;
+  return (uint64_t)st.st_size;
+}
+
+/* Writes are already with the kernel */
+static int LRL_posix_flush(void *h){
+  (void)h;
+  return LRL_SUCCESS;
+}
+
+static int LRL_posix_close(void *h){
+  LRL_PosixFile *pf = (LRL_PosixFile *)h;
+  int status = LRL_SUCCESS;
+
+  if(close(pf->fd) != 0)status = LRL_ERR_CLOSE;
+  free(pf);
+  return status;
+}
+
+const LRL_Backend LRL_posix_backend = {
+  "posix", 1, 1,
+  LRL_posix_open,
+  LRL_posix_read_at,
+  LRL_posix_write_at,
+  NULL,
+  LRL_posix_advise,
+  LRL_posix_size,
+  NULL,
+  LRL_posix_flush,
+  LRL_posix_close
+};
@@ -0,0 +1,121 @@
+/* LRL_stdio.c */
+/* The default LRL backend, reading and writing through stdio */
+
+/* The stream remembers where it is, so reading or writing straight on
+   from the last transfer doesn't seek and keeps the stdio buffer. */
+
+#define _POSIX_C_SOURCE 200112L /* for fdopen, fseeko and ftello */
+#include <qio_config.h>
+#include <lrl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+typedef struct {
+  FILE *file;
+  uint64_t pos;             /* Stream position */
+  int pos_known;            /* Whether pos is right */
+} LRL_StdioFile;
+
+static void *LRL_stdio_open(const char *filename, int mode){
+  LRL_StdioFile *sf;
+  FILE *fpt;
+
+  /* Open according to requested mode.  Not with "a" for appending,
+     which would send every write to the end. */
+  if(mode == LRL_READ) {
+    fpt = DCAPL(fopen)(filename,"r");
+  } else if(mode == LRL_APPEND || mode == LRL_NOTRUNC) {
+    int fd = DCAP(open)(filename,
+			mode == LRL_APPEND ? O_WRONLY | O_CREAT : O_WRONLY, 0666);
+    fpt = fd < 0 ? NULL : fdopen(fd, "w");
+  } else {
+    fpt = DCAPL(fopen)(filename,"w");
+  }
+  if(fpt == NULL) return NULL;
+
+  sf = (LRL_StdioFile *)malloc(sizeof(LRL_StdioFile));
+  if(sf == NULL) {
+    DCAP(fclose)(fpt);
+    return NULL;
+  }
+  sf->file = fpt;
+  sf->pos = 0;
+  sf->pos_known = 1;
+  return sf;
+}
+
+static int LRL_stdio_seek(LRL_StdioFile *sf, uint64_t offset){
+  if(sf->pos_known && sf->pos == offset) return 0;
+  if(DCAPL(fseeko)(sf->file, (off_t)offset, SEEK_SET) != 0) {
+    sf->pos_known = 0;
+    return -1;
+  }
+  sf->pos = offset;
+  sf->pos_known = 1;
+  return 0;
+}
+
+static uint64_t LRL_stdio_read_at(void *h, char *buf, uint64_t nbytes,
+				  uint64_t offset){
+  LRL_StdioFile *sf = (LRL_StdioFile *)h;
+  size_t k;
+
+  if(LRL_stdio_seek(sf, offset) != 0) return 0;
+  k = DCAP(fread)(buf, 1, (size_t)nbytes, sf->file);
+  sf->pos += k;
+  return k;
+}
+
+static uint64_t LRL_stdio_write_at(void *h, const char *buf, uint64_t nbytes,
+				   uint64_t offset){
+  LRL_StdioFile *sf = (LRL_StdioFile *)h;
+  size_t k;
+
+  if(LRL_stdio_seek(sf, offset) != 0) return 0;
+  k = DCAP(fwrite)(buf, 1, (size_t)nbytes, sf->file);
+  sf->pos += k;
+  return k;
+}
+
+static uint64_t LRL_stdio_size(void *h){
+  LRL_StdioFile *sf = (LRL_StdioFile *)h;
+  off_t end;
+
+  sf->pos_known = 0;
+  if(DCAPL(fseeko)(sf->file, 0, SEEK_END) != 0) return 0;
+  end = DCAPL(ftello)(sf->file);
+  if(end < 0) return 0;
+  sf->pos = (uint64_t)end;
+  sf->pos_known = 1;
+  return (uint64_t)end;
+}
+
+static int LRL_stdio_flush(void *h){
+  LRL_StdioFile *sf = (LRL_StdioFile *)h;
+  return DCAP(fflush)(sf->file) == 0 ? LRL_SUCCESS : LRL_ERR_WRITE;
+}
+
+static int LRL_stdio_close(void *h){
+  LRL_StdioFile *sf = (LRL_StdioFile *)h;
+  int status = LRL_SUCCESS;
+
+  if(DCAP(fclose)(sf->file) != 0) status = LRL_ERR_CLOSE;
+  free(sf);
+  return status;
+}
+
+const LRL_Backend LRL_stdio_backend = {
+  "stdio", 1, 0,
+  LRL_stdio_open,
+  LRL_stdio_read_at,
+  LRL_stdio_write_at,
+  NULL,
+  NULL,
+  LRL_stdio_size,
+  NULL,
+  LRL_stdio_flush,
+  LRL_stdio_close
+};
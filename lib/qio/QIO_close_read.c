@@ -4,6 +4,7 @@
 #include <qio.h>
 #include <qio_string.h>
 #include <lrl.h>
+#include <stdio.h>
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
@@ -12,12 +13,27 @@
 #endif
 
 int QIO_close_read(QIO_Reader *in){
+  char myname[] = "QIO_close_read";
   int status;
+  uint64_t hits, misses;
 
   if(!in)return QIO_SUCCESS;
   status = LRL_close_read_file(in->lrl_file_in);
   if(status != QIO_SUCCESS)return QIO_ERR_CLOSE;
   if(in->layout){
+    /* Totals over all nodes, reported by the master */
+    if(QIO_verbosity() >= QIO_VERB_LOW){
+      hits = in->layout->site_map_hits;
+      misses = in->layout->site_map_misses;
+      DML_sum_uint64_t(&hits);
+      DML_sum_uint64_t(&misses);
+      if(in->layout->this_node == in->layout->master_io_node &&
+	 hits + misses > 0)
+	printf("%s(%d): site map hits %llu misses %llu\n",myname,
+	       in->layout->this_node,(unsigned long long)hits,
+	       (unsigned long long)misses);
+    }
+    DML_free_site_map(in->layout);
     free(in->layout->latsize);
     if(in->layout->hyperupper)free(in->layout->hyperupper);
     if(in->layout->hyperlower)free(in->layout->hyperlower);
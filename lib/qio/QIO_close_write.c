@@ -3,12 +3,16 @@
 #include <qio_config.h>
 #include <qio.h>
 #include <lrl.h>
+#include <stdio.h>
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
 
 int QIO_close_write(QIO_Writer *out)
 {
+  char myname[] = "QIO_close_write";
+  uint64_t hits, misses;
+
   /* Prevent premature file truncation in parallel writes */
   /* Note, the test will cause a hang if the oflag->serpar value is
      not the same for all nodes */
@@ -16,6 +20,19 @@ int QIO_close_write(QIO_Writer *out)
 
   int status = LRL_close_write_file(out->lrl_file_out);
   if(out->layout) {
+    /* Totals over all nodes, reported by the master */
+    if(QIO_verbosity() >= QIO_VERB_LOW){
+      hits = out->layout->site_map_hits;
+      misses = out->layout->site_map_misses;
+      DML_sum_uint64_t(&hits);
+      DML_sum_uint64_t(&misses);
+      if(out->layout->this_node == out->layout->master_io_node &&
+	 hits + misses > 0)
+	printf("%s(%d): site map hits %llu misses %llu\n",myname,
+	       out->layout->this_node,(unsigned long long)hits,
+	       (unsigned long long)misses);
+    }
+    DML_free_site_map(out->layout);
     free(out->layout->latsize);
     if(out->layout->hyperupper) free(out->layout->hyperupper);
     if(out->layout->hyperlower) free(out->layout->hyperlower);
@@ -434,7 +434,7 @@ int QIO_single_to_part( const char filename[], QIO_Filesystem *fs,
   DML_Checksum checksum, checksum_out, checksum_in;
   uint64_t nbytes_out, totnbytes_out, nbytes_in, totnbytes_in;
   int *msg_begin, *msg_end;
-  int i,status,master_io_node_rank;
+  int i,status,master_io_node_rank,io_threads;
   int number_io_nodes = fs->number_io_nodes;
   int master_io_node = fs->master_io_node();
   uint64_t total_bytes;
@@ -457,6 +457,7 @@ int QIO_single_to_part( const char filename[], QIO_Filesystem *fs,
   oflag.serpar = QIO_SERIAL;
   oflag.ildgstyle = QIO_ILDGNO;
   oflag.ildgLFN = NULL;
+  QIO_set_oflag_backend(&oflag, QIO_BACKEND_DEFAULT);
   
   if(number_io_nodes <= 1){
    printf("%s: No conversion since number_io_nodes %d <= 1\n",
@@ -697,12 +698,15 @@ int QIO_single_to_part( const char filename[], QIO_Filesystem *fs,
 	  if(status != QIO_SUCCESS)return status;
 	  
 	  /* Write the data.  The factory function QIO_scalar_get
-	     seeks and reads from the input file */
+	     seeks and reads from the input file through the one
+	     scratch site of field_in, so it takes a single thread */
+	  io_threads = QIO_set_io_threads(1);
 	  status = 
 	    QIO_write_record_data(outfile, &rec_info, QIO_scalar_get, 
 				  datum_size, word_size, &arg_seek, 
 				  &checksum, &nbytes_out, 
 				  &msg_begin[i], &msg_end[i]);
+	  QIO_set_io_threads(io_threads);
 	  if(status != QIO_SUCCESS)return status;
 	  
 	  /* Add partial byte count to total output bytes */
@@ -832,7 +836,7 @@ int QIO_part_to_single( const char filename[], int ildgstyle,
   uint64_t nbytes_in, nbytes_out, totnbytes_out, totnbytes_in,
     total_bytes;
   int msg_begin, msg_end;
-  int i,status,master_io_node_rank;
+  int i,status,master_io_node_rank,io_threads;
   int number_io_nodes = fs->number_io_nodes;
   int master_io_node = fs->master_io_node();
   size_t datum_size;
@@ -853,11 +857,13 @@ int QIO_part_to_single( const char filename[], int ildgstyle,
   /* Default values */
   iflag.serpar = QIO_SERIAL;
   iflag.volfmt = QIO_PARTFILE;
+  QIO_set_iflag_backend(&iflag, QIO_BACKEND_DEFAULT);
 
   oflag.serpar = QIO_SERIAL;
   oflag.mode = QIO_TRUNC;
   oflag.ildgstyle = ildgstyle;
   oflag.ildgLFN = NULL;
+  QIO_set_oflag_backend(&oflag, QIO_BACKEND_DEFAULT);
 
   /* Sanity checks */
 
@@ -1158,11 +1164,15 @@ int QIO_part_to_single( const char filename[], int ildgstyle,
 				    master_io_node);
 	    
 	    /* Read the record data, writing it to the host single
-	       file via the factory function QIO_part_put */
+	       file via the factory function QIO_part_put.  It goes
+	       through the one scratch site of field_in, so it takes a
+	       single thread */
+	    io_threads = QIO_set_io_threads(1);
 	    status = 
 	      QIO_generic_read_record_data(infile,QIO_part_put,datum_size,
 					   word_size,&arg_seek,
 					   &checksum, &nbytes_in);
+	    QIO_set_io_threads(io_threads);
 	    if(status != QIO_SUCCESS)return status;
 
 	    /* Add partial checksum to total */
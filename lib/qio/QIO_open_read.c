@@ -33,9 +33,11 @@ QIO_create_reader(const char *filename,
   char myname[] = "QIO_create_reader";
 
   int serpar=QIO_SERIAL, volfmt=QIO_UNKNOWN;
+  const LRL_Backend *backend = NULL;
   if(iflag != NULL) {
     serpar = iflag->serpar;
     volfmt = iflag->volfmt;
+    backend = LRL_get_backend(iflag->backend);
   }
 
   /* First, only the global master node opens the file, regardless of
@@ -52,7 +54,7 @@ QIO_create_reader(const char *filename,
       if(QIO_verbosity() >= QIO_VERB_DEBUG)
 	printf("%s(%d): Calling LRL_open_read_file %s\n",
 	       myname,this_node,filename);
-      lrl_file_in = LRL_open_read_file(filename);
+      lrl_file_in = LRL_open_read_file_backend(filename, backend);
       /* If the open succeeded with just "filename" the format
 	 must be SINGLEFILE */
       if(lrl_file_in != NULL) volfmt = QIO_SINGLEFILE;
@@ -70,7 +72,7 @@ QIO_create_reader(const char *filename,
       if(QIO_verbosity() >= QIO_VERB_DEBUG)
 	printf("%s(%d): Calling LRL_open_read_file %s\n",
 	       myname,this_node,newfilename);
-      lrl_file_in = LRL_open_read_file(newfilename);
+      lrl_file_in = LRL_open_read_file_backend(newfilename, backend);
       if(lrl_file_in == NULL) {
 	if (this_node == master_ionode)
           printf("%s(%d): cannot open %s as PARTFILE; trying PARTFILE_DIR\n",
@@ -98,7 +100,7 @@ QIO_create_reader(const char *filename,
        printf("%s(%d): Calling LRL_open_read_file %s\n",
               myname, this_node, newfilename);
 
-      lrl_file_in = LRL_open_read_file(newfilename);
+      lrl_file_in = LRL_open_read_file_backend(newfilename, backend);
       if (lrl_file_in == NULL){
         if (this_node == master_ionode)
           printf("%s(%d): cannot open %s as PARTFILE_DIR; QIO_create_reader FAILED\n",
@@ -113,9 +115,7 @@ QIO_create_reader(const char *filename,
       free(newfilename);
     }
   }
-  int success = (lrl_file_in != NULL);
-  DML_broadcast_bytes((char *)&success, sizeof(int), this_node, master_ionode);
-  if(!success) return NULL;
+  /* The caller tells the other nodes whether the master succeeded */
 
   /* Make a local copy of lattice size */
   if(latdim != 0){
@@ -164,6 +164,15 @@ QIO_create_reader(const char *filename,
 
   dml_layout->ionode               = io_node;
   dml_layout->master_io_node       = master_ionode;
+  dml_layout->number_aggregators   = 0;
+  dml_layout->stripe_bytes         = 0;
+
+  /* Site map cache, keyed on the application's own callbacks */
+  dml_layout->node_number          = QIO_user_layout(layout)->node_number;
+  dml_layout->node_index           = QIO_user_layout(layout)->node_index;
+  dml_layout->site_map             = NULL;
+  dml_layout->site_map_hits        = 0;
+  dml_layout->site_map_misses      = 0;
 
   /* Construct the reader handle */
   qio_in = (QIO_Reader *)malloc(sizeof(QIO_Reader));
@@ -468,28 +477,38 @@ int QIO_check_file_info(DML_Layout *dml_layout, QIO_FileInfo *file_info_found)
 /************************************************************************/
 /* Other nodes just create the reader */
 
-QIO_Reader *
-QIO_open_read_master(const char *filename, 
+/* The work of QIO_open_read_master without telling the other nodes
+   how it went.  The master's status is returned in *status.  The
+   reader is returned on all nodes, even if the master failed. */
+
+static QIO_Reader *
+QIO_open_read_master_status(const char *filename, 
 		     QIO_Layout *layout, QIO_Iflag *iflag,
-		     int (*io_node)(int), int (*master_io_node)())
+		     int (*io_node)(int), int (*master_io_node)(),
+		     int *status)
 {
   QIO_Reader *qio_in;
   DML_Layout *dml_layout;
   QIO_FileInfo *file_info_found;
   int this_node = layout->this_node;
-  int status;
   char myname[] = "QIO_open_read_master";
 
   /* First, only the global master node opens the file, regardless of
      whether it will be read by all nodes */
 
+  *status = QIO_SUCCESS;
   qio_in = QIO_create_reader(filename, layout, iflag, io_node, master_io_node);
-  if(!qio_in)return NULL;
+  if(!qio_in){
+    *status = QIO_ERR_ALLOC;
+    return NULL;
+  }
 
   dml_layout = qio_in->layout;
 
-  if(this_node == dml_layout->master_io_node && !qio_in->lrl_file_in)
-    return NULL;
+  if(this_node == dml_layout->master_io_node && !qio_in->lrl_file_in){
+    *status = QIO_ERR_OPEN_READ;
+    return qio_in;
+  }
 
   /* Master node reads and decodes the private file XML record */
   /* For parallel input the other nodes pretend to read */
@@ -498,15 +517,21 @@ QIO_open_read_master(const char *filename,
 
     /* Read the private file info from the master file */
     file_info_found = QIO_read_private_file_info(qio_in);
-    if(file_info_found == NULL)return NULL;
+    if(file_info_found == NULL){
+      *status = QIO_ERR_PRIVATE_FILE_INFO;
+      return qio_in;
+    }
 
     /* Compare what we found with what we expected */
     /* If we read in discovery mode, accept whatever the file gives
        us */
 
     if(!qio_in->layout->discover_dims_mode){
-      status = QIO_check_file_info(dml_layout, file_info_found);
-      if(status != QIO_SUCCESS)return NULL;
+      *status = QIO_check_file_info(dml_layout, file_info_found);
+      if(*status != QIO_SUCCESS){
+	QIO_destroy_file_info(file_info_found);
+	return qio_in;
+      }
     }
 
     /* Get the volume format from the file info */
@@ -517,9 +542,12 @@ QIO_open_read_master(const char *filename,
     /* Get lattice dimensions from the file info
        if we are in discovery mode */
     if(qio_in->layout->discover_dims_mode){
-      status = QIO_set_latdim(qio_in, QIO_get_spacetime(file_info_found),
-			      QIO_get_dims(file_info_found));
-      if(status != QIO_SUCCESS)return NULL;
+      *status = QIO_set_latdim(qio_in, QIO_get_spacetime(file_info_found),
+			       QIO_get_dims(file_info_found));
+      if(*status != QIO_SUCCESS){
+	QIO_destroy_file_info(file_info_found);
+	return qio_in;
+      }
     }
 
    QIO_destroy_file_info(file_info_found);
@@ -529,33 +557,86 @@ QIO_open_read_master(const char *filename,
   return qio_in;
 }
 
-int QIO_broadcast_file_reader_info(QIO_Reader *qio_in, int discover_dims)
+QIO_Reader *
+QIO_open_read_master(const char *filename, 
+		     QIO_Layout *layout, QIO_Iflag *iflag,
+		     int (*io_node)(int), int (*master_io_node)())
+{
+  QIO_Reader *qio_in;
+  int status;
+
+  qio_in = QIO_open_read_master_status(filename, layout, iflag, io_node,
+				       master_io_node, &status);
+  if(!qio_in)return NULL;
+
+  /* All nodes fail if the master did */
+  DML_broadcast_bytes((char *)&status, sizeof(int), layout->this_node,
+		      qio_in->layout->master_io_node);
+  if(status != QIO_SUCCESS){
+    QIO_close_read(qio_in);
+    return NULL;
+  }
+
+  return qio_in;
+}
+
+/* What the master I/O node tells the others after opening the file.
+   Lattice dimensions from the file info never exceed
+   QIO_MAXINTARRAY. */
+typedef struct {
+  int status;                    /* The master's status */
+  int volfmt;
+  int discover;
+  int latdim;
+  int latsize[QIO_MAXINTARRAY];
+} QIO_FileReaderInfo;
+
+/* Master I/O node broadcasts its status and the volume format to all
+   the nodes, inserting the value in the qio_in structure.  In discover
+   dimensions mode the lattice dimensions in its reader structure go
+   along.  It all goes in one message.  Returns the master's status. */
+
+int QIO_broadcast_file_reader_info(QIO_Reader *qio_in, int discover_dims,
+				   int status)
 {
   DML_Layout *dml_layout = qio_in->layout;
   int this_node = dml_layout->this_node;
-  int discover = discover_dims;
+  QIO_FileReaderInfo info;
+  int i;
   char myname[] = "QIO_broadcast_file_reader_info";
 
-  /* Master I/O node broadcasts the volume format to all the nodes, */
-  /* inserting the value in the qio_in structure */
-  DML_broadcast_bytes((char *)(&qio_in->volfmt), sizeof(int),
-		      this_node, DML_master_io_node());
+  memset(&info, 0, sizeof(info));
+  if(this_node == dml_layout->master_io_node){
+    info.status   = status;
+    info.volfmt   = qio_in->volfmt;
+    info.discover = discover_dims;
+    if(discover_dims && status == QIO_SUCCESS){
+      if(dml_layout->latdim > QIO_MAXINTARRAY){
+	printf("%s(%d): Too many lattice dimensions %d\n",
+	       myname,this_node,dml_layout->latdim);
+	info.status = QIO_ERR_FILE_INFO;
+      }
+      else {
+	info.latdim = dml_layout->latdim;
+	for(i = 0; i < info.latdim; i++)
+	  info.latsize[i] = dml_layout->latsize[i];
+      }
+    }
+  }
+
+  status = QIO_broadcast_packed(dml_layout, &info, sizeof(info), NULL, 0);
+  if(status != QIO_SUCCESS)return status;
+  if(info.status != QIO_SUCCESS)return info.status;
+
+  qio_in->volfmt = info.volfmt;
   if(QIO_verbosity() >= QIO_VERB_DEBUG){
     printf("%s(%d): volume format info was broadcast\n",
 	   myname,this_node);fflush(stdout);
   }
 
-  /* In discover dimensions mode the master broadcasts the lattice
-     dimensions in its reader structure to all the nodes */
-
-  /* Master node calls for discovery */
-  DML_broadcast_bytes((char *)(&discover), sizeof(int),
-		      this_node, DML_master_io_node());
-
-  if(discover){
+  if(info.discover && this_node != dml_layout->master_io_node){
     /* Set the lattice dimension from the master */
-    DML_broadcast_bytes((char *)(&dml_layout->latdim),
-			sizeof(int), this_node, DML_master_io_node());
+    dml_layout->latdim = info.latdim;
     /* Adjust space for the lattice dimensions */
     dml_layout->latsize = (int *)realloc(dml_layout->latsize,
 					 sizeof(int)*dml_layout->latdim);
@@ -563,10 +644,8 @@ int QIO_broadcast_file_reader_info(QIO_Reader *qio_in, int discover_dims)
       printf("%s(%d): Can't realloc latsize\n",myname,this_node);
       return QIO_ERR_ALLOC;
     }
-    /* Broadcast the lattice dimensions */
-    DML_broadcast_bytes((char *)(dml_layout->latsize),
-			sizeof(int)*dml_layout->latdim, 
-			this_node, DML_master_io_node());
+    for(i = 0; i < info.latdim; i++)
+      dml_layout->latsize[i] = info.latsize[i];
     if(QIO_verbosity() >= QIO_VERB_DEBUG){
       printf("%s(%d): lattice dimension info was broadcast\n",
 	     myname,this_node);fflush(stdout);
@@ -586,13 +665,16 @@ int
 QIO_open_read_nonmaster(QIO_Reader *qio_in, const char *filename,
 			QIO_Iflag *iflag)
 {
-  _QIO_UNUSED_ARGUMENT(iflag);
   DML_Layout *dml_layout = qio_in->layout;
   int this_node = dml_layout->this_node;
   LRL_FileReader *lrl_file_in = NULL;
+  const LRL_Backend *backend = NULL;
   char *newfilename;
   char myname[] = "QIO_open_read_nonmaster";
 
+  if(iflag != NULL)
+    backend = LRL_get_backend(iflag->backend);
+
   /* Open any additional file handles as needed */
   /* Read the sitelist if needed */
 
@@ -612,7 +694,7 @@ QIO_open_read_nonmaster(QIO_Reader *qio_in, const char *filename,
     if( qio_in->serpar == QIO_PARALLEL &&
 	this_node != dml_layout->master_io_node &&
 	this_node == dml_layout->ionode(this_node) ) {
-      lrl_file_in = LRL_open_read_file(filename);
+      lrl_file_in = LRL_open_read_file_backend(filename, backend);
       if(lrl_file_in == NULL){
 	printf("%s(%d): Can't open %s\n",myname,this_node,filename);
 	return QIO_ERR_OPEN_READ;
@@ -645,7 +727,7 @@ QIO_open_read_nonmaster(QIO_Reader *qio_in, const char *filename,
 	if(QIO_verbosity() >= QIO_VERB_DEBUG)
 	  printf("%s(%d): Calling LRL_open_read_file %s\n",
 		 myname,this_node,newfilename);
-	lrl_file_in = LRL_open_read_file(newfilename);
+	lrl_file_in = LRL_open_read_file_backend(newfilename, backend);
 	if(QIO_verbosity() >= QIO_VERB_DEBUG)
 	  printf("%s(%d): LRL_open_read_file returns %p\n",myname,this_node,
 		 (void *)lrl_file_in);
@@ -674,7 +756,7 @@ QIO_open_read_nonmaster(QIO_Reader *qio_in, const char *filename,
       if(QIO_verbosity() >= QIO_VERB_DEBUG)
 	printf("%s(%d): Calling LRL_open_read_file %s\n",
 	       myname,this_node,newfilename);
-      lrl_file_in = LRL_open_read_file(newfilename);
+      lrl_file_in = LRL_open_read_file_backend(newfilename, backend);
       if(lrl_file_in == NULL){
 	printf("%s(%d): Can't open %s for reading\n",myname,this_node,
 	       newfilename);
@@ -783,7 +865,7 @@ QIO_open_read(QIO_String *xml_file, const char *filename,
   char myname[] = "QIO_open_read";
   int this_node = layout->this_node;
   int status;
-  int length;
+  QIO_String *xml_strings[1];
   DML_io_node_t my_io_node;
   DML_master_io_node_t master_io_node;
 
@@ -808,17 +890,26 @@ QIO_open_read(QIO_String *xml_file, const char *filename,
 
   /* On the compute nodes, we use DML calls to specify the I/O nodes
      and the master I/O node */
-  qio_in = QIO_open_read_master(filename, layout, iflag,
-				my_io_node, master_io_node);
+  qio_in = QIO_open_read_master_status(filename, layout, iflag,
+				       my_io_node, master_io_node, &status);
   if(layout!=layout_in) free(layout);
   if(qio_in == NULL) return NULL;
 
-  /* Master I/O node broadcasts the volume format to all the nodes, */
-  /* inserting the value in the qio_in structure */
+  /* Master I/O node broadcasts how the open went and the volume
+     format to all the nodes, inserting the value in the qio_in
+     structure */
   /* In discovery mode the master also broadcasts the lattice
      dimensions to all the nodes */
   status = QIO_broadcast_file_reader_info(qio_in, 
-					  qio_in->layout->discover_dims_mode);
+					  qio_in->layout->discover_dims_mode,
+					  status);
+  if(status != QIO_SUCCESS){
+    QIO_close_read(qio_in);
+    return NULL;
+  }
+
+  /* Two-phase aggregation for parallel reads */
+  DML_agree_aggregators(qio_in->layout);
 
   /* Read the rest of the header */
   status = QIO_open_read_nonmaster(qio_in, filename, iflag);
@@ -828,26 +919,16 @@ QIO_open_read(QIO_String *xml_file, const char *filename,
   if(status != QIO_SUCCESS)return NULL;
 
   status = QIO_read_user_file_xml(xml_file, qio_in);
-  if(status != QIO_SUCCESS)return NULL;
 
-  /* Broadcast the user file XML to all nodes */
+  /* Broadcast the master's status and the user file XML to all nodes
+     in one message.  Receiving nodes resize their strings. */
 
   dml_layout = qio_in->layout;
-  if(this_node == dml_layout->master_io_node)
-    length = QIO_string_length(xml_file);
-
-  /* First broadcast length */
-  DML_broadcast_bytes((char *)&length,sizeof(int),
-		      this_node, dml_layout->master_io_node);
-  
-  /* Receiving nodes resize their strings */
-  if(this_node != dml_layout->master_io_node){
-    QIO_string_realloc(xml_file,length);
-  }
-
-  /* Then broadcast the string itself */
-  DML_broadcast_bytes(QIO_string_ptr(xml_file),length,
-		      this_node, dml_layout->master_io_node);
+  xml_strings[0] = xml_file;
+  if(QIO_broadcast_packed(dml_layout, &status, sizeof(int),
+			  xml_strings, 1) != QIO_SUCCESS ||
+     status != QIO_SUCCESS)
+    return NULL;
   
   if(QIO_verbosity() >= QIO_VERB_DEBUG){
     printf("%s(%d): Done with user file XML\n",myname,this_node);
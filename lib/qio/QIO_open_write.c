@@ -43,6 +43,7 @@ QIO_Writer *QIO_generic_open_write(const char *filename,
 {
   QIO_Writer *qio_out = NULL;
   LRL_FileWriter *lrl_file_out = NULL;
+  const LRL_Backend *backend = NULL;
   DML_Layout *dml_layout;
   int *latsize, *upper, *lower;
   int latdim = layout->latdim;
@@ -99,6 +100,15 @@ QIO_Writer *QIO_generic_open_write(const char *filename,
 
   dml_layout->ionode               = io_node;
   dml_layout->master_io_node       = master_io_node();
+  dml_layout->number_aggregators   = 0;
+  dml_layout->stripe_bytes         = 0;
+
+  /* Site map cache, keyed on the application's own callbacks */
+  dml_layout->node_number          = QIO_user_layout(layout)->node_number;
+  dml_layout->node_index           = QIO_user_layout(layout)->node_index;
+  dml_layout->site_map             = NULL;
+  dml_layout->site_map_hits        = 0;
+  dml_layout->site_map_misses      = 0;
 
   /* Construct the writer handle */
   qio_out = (QIO_Writer *)malloc(sizeof(QIO_Writer));
@@ -122,6 +132,7 @@ QIO_Writer *QIO_generic_open_write(const char *filename,
   }
   else {
     mode = oflag->mode;
+    backend = LRL_get_backend(oflag->backend);
     qio_out->serpar = oflag->serpar;
     qio_out->ildgstyle = oflag->ildgstyle;
     /* This should be a deep rather than pointer copy I think */
@@ -203,7 +214,7 @@ QIO_Writer *QIO_generic_open_write(const char *filename,
     if(qio_out->volfmt==QIO_SINGLEFILE) {
       if(this_node == dml_layout->master_io_node) {
 	// optimization: one node creates file (if necessary) and closes
-	lrl_file_out = LRL_open_write_file(newfilename, mode);
+	lrl_file_out = LRL_open_write_file_backend(newfilename, mode, backend);
 	LRL_close_write_file(lrl_file_out);
       }
       // the initial open will create or truncate the file if needed
@@ -211,7 +222,7 @@ QIO_Writer *QIO_generic_open_write(const char *filename,
       mode = LRL_NOTRUNC;
     }
     DML_sync();
-    lrl_file_out = LRL_open_write_file(newfilename, mode);
+    lrl_file_out = LRL_open_write_file_backend(newfilename, mode, backend);
     if(lrl_file_out == NULL) {
       printf("%s(%d): failed to open file for writing\n",myname,this_node);
       return NULL;
@@ -413,6 +424,7 @@ QIO_Writer *QIO_open_write(QIO_String *xml_file, const char *filename,
   if(layout!=layout_in) free(layout);
   if (NULL == qio_out)
     return NULL;
+
 #if 0
   /* Prevent premature file truncation in parallel writes */
   /* Note, the test will cause a hang if the oflag->serpar value is
@@ -430,6 +442,9 @@ QIO_Writer *QIO_open_write(QIO_String *xml_file, const char *filename,
     return NULL;
   }
 
+  /* Two-phase aggregation for parallel writes */
+  DML_agree_aggregators(qio_out->layout);
+
   status = QIO_write_file_header(qio_out, xml_file);
   fail = (status != QIO_SUCCESS);
   DML_sum_int(&fail);
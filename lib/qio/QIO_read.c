@@ -14,11 +14,14 @@
 /* Calls QIO_read_record_info and QIO_read_record_data */
 /* Caller must allocate *record_info and *xml_record.
    Caller must signal abort to all nodes upon failure. */
+/* The put_block callback stores a run of sites that are consecutive
+   in node storage order in one call */
 int
-QIO_read(QIO_Reader *in, QIO_RecordInfo *record_info,
-	 QIO_String *xml_record, 
-	 void (*put)(char *buf, size_t index, int count, void *arg),
-	 size_t datum_size, int word_size, void *arg)
+QIO_read_block(QIO_Reader *in, QIO_RecordInfo *record_info,
+	       QIO_String *xml_record, 
+	       void (*put_block)(char *buf, size_t first, size_t nsites,
+				 int count, void *arg),
+	       size_t datum_size, int word_size, void *arg)
 {
   int status;
   int this_node = in->layout->this_node;
@@ -36,7 +39,8 @@ QIO_read(QIO_Reader *in, QIO_RecordInfo *record_info,
   if(status!=QIO_SUCCESS) return status;
 
   /* Read data */
-  status = QIO_read_record_data(in, put, datum_size, word_size, arg);
+  status = QIO_read_record_data_block(in, put_block, datum_size, word_size,
+				      arg);
 
   if(QIO_verbosity() >= QIO_VERB_DEBUG) {
     printf("%s(%d): QIO_read_record_data returned %d\n",
@@ -45,3 +49,16 @@ QIO_read(QIO_Reader *in, QIO_RecordInfo *record_info,
 
   return status;
 }
+
+/* Same with a per-site put callback */
+int
+QIO_read(QIO_Reader *in, QIO_RecordInfo *record_info,
+	 QIO_String *xml_record, 
+	 void (*put)(char *buf, size_t index, int count, void *arg),
+	 size_t datum_size, int word_size, void *arg)
+{
+  DML_SiteCallback cb = { NULL, put, datum_size, arg };
+
+  return QIO_read_block(in, record_info, xml_record, DML_put_sites,
+			datum_size, word_size, (void *)&cb);
+}
@@ -46,8 +46,9 @@ void QIO_print_record_info(QIO_RecordInfo *record_info){
 
 /* On failure calling program must signal abort to all nodes. */
 
-int QIO_generic_read_record_data(QIO_Reader *in, 
-	     void (*put)(char *buf, size_t index, int count, void *arg),
+int QIO_generic_read_record_data_block(QIO_Reader *in, 
+	     void (*put_block)(char *buf, size_t first, size_t nsites,
+			       int count, void *arg),
 	     size_t datum_size, int word_size, void *arg,
   	     DML_Checksum *checksum, uint64_t *nbytes)
 {
@@ -126,8 +127,8 @@ int QIO_generic_read_record_data(QIO_Reader *in,
   }
 
   /* Then read the data and close the record */
-  status = QIO_read_field_data(in, lrl_record_in, 
-			       put, count, datum_size, word_size, 
+  status = QIO_read_field_data_block(in, lrl_record_in, 
+			       put_block, count, datum_size, word_size, 
 			       arg, checksum, nbytes);
   if(status != QIO_SUCCESS){
     printf("%s(%d): Error reading field data\n",myname,this_node);
@@ -152,6 +153,19 @@ int QIO_generic_read_record_data(QIO_Reader *in,
   return QIO_SUCCESS;
 }
 
+/* Same with a per-site put callback */
+int QIO_generic_read_record_data(QIO_Reader *in, 
+	     void (*put)(char *buf, size_t index, int count, void *arg),
+	     size_t datum_size, int word_size, void *arg,
+  	     DML_Checksum *checksum, uint64_t *nbytes)
+{
+  DML_SiteCallback cb = { NULL, put, datum_size, arg };
+
+  return QIO_generic_read_record_data_block(in, DML_put_sites, datum_size,
+					    word_size, (void *)&cb,
+					    checksum, nbytes);
+}
+
 QIO_ChecksumInfo *QIO_read_checksum(QIO_Reader *in)
 {
   char myname[] = "QIO_read_checksum";
@@ -216,8 +230,11 @@ int QIO_compare_checksum(int this_node,
   return status;
 }
 
-int QIO_read_record_data(QIO_Reader *in, 
-	     void (*put)(char *buf, size_t index, int count, void *arg),
+/* The put_block callback stores a run of sites that are consecutive
+   in node storage order in one call */
+int QIO_read_record_data_block(QIO_Reader *in, 
+	     void (*put_block)(char *buf, size_t first, size_t nsites,
+			       int count, void *arg),
 	     size_t datum_size, int word_size, void *arg){
 
 
@@ -236,8 +253,9 @@ int QIO_read_record_data(QIO_Reader *in,
 	   myname,this_node);fflush(stdout);
   }
 
-  status = QIO_generic_read_record_data(in, put, datum_size, word_size, arg,
-					&checksum, &nbytes);
+  status = QIO_generic_read_record_data_block(in, put_block, datum_size,
+					      word_size, arg,
+					      &checksum, &nbytes);
   if(status != QIO_SUCCESS)return status;
 
   /* Total number of sites in this record */
@@ -294,3 +312,13 @@ int QIO_read_record_data(QIO_Reader *in,
   return QIO_SUCCESS;
 }
 
+/* Same with a per-site put callback */
+int QIO_read_record_data(QIO_Reader *in, 
+	     void (*put)(char *buf, size_t index, int count, void *arg),
+	     size_t datum_size, int word_size, void *arg){
+
+  DML_SiteCallback cb = { NULL, put, datum_size, arg };
+
+  return QIO_read_record_data_block(in, DML_put_sites, datum_size,
+				    word_size, (void *)&cb);
+}
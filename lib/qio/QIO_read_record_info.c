@@ -12,6 +12,12 @@
 #include <malloc.h>
 #endif
 
+/* What the master node tells the others about a record */
+typedef struct {
+  int status;                    /* The master's status */
+  QIO_RecordInfo record_info;
+} QIO_RecordHeader;
+
 /* Update the record type and hypercube information */
 int QIO_reader_insert_hypercube_data(QIO_Reader *in, 
 				     QIO_RecordInfo *record_info)
@@ -32,14 +38,11 @@ int QIO_reader_insert_hypercube_data(QIO_Reader *in,
   return QIO_SUCCESS;
 }
 
-/* Read user record XML */
-/* Can be called separately from QIO_read for discovering the record
-   contents without reading the field itself */
+/* Master node reads the private record XML into the reader.  The
+   other nodes only update the reader state. */
 
-int QIO_read_private_record_info(QIO_Reader *in, QIO_RecordInfo *record_info)
+static int QIO_read_private_record_info_master(QIO_Reader *in)
 {
-  /* Caller must allocate *record_info */
-
   QIO_String *xml_record_private;
   int this_node = in->layout->this_node;
   int status;
@@ -107,6 +110,23 @@ int QIO_read_private_record_info(QIO_Reader *in, QIO_RecordInfo *record_info)
     in->read_state = QIO_RECORD_INFO_USER_NEXT;
   }
 
+  return QIO_SUCCESS;
+}
+
+/* Read private record XML */
+/* Can be called separately from QIO_read for discovering the record
+   contents without reading the field itself */
+
+int QIO_read_private_record_info(QIO_Reader *in, QIO_RecordInfo *record_info)
+{
+  /* Caller must allocate *record_info */
+
+  int this_node = in->layout->this_node;
+  int status;
+
+  status = QIO_read_private_record_info_master(in);
+  if(status != QIO_SUCCESS)return status;
+
   // broadcast just so everyone has it (possibly not needed)
   DML_broadcast_bytes((char *)&(in->record_info), sizeof(QIO_RecordInfo),
 		      this_node, in->layout->master_io_node);
@@ -268,20 +288,34 @@ int QIO_read_record_info(QIO_Reader *in, QIO_RecordInfo *record_info,
   /* Caller must allocate *xml_record and *record_info */
 
   int this_node = in->layout->this_node;
-  int length;
   int status;
+  QIO_RecordHeader header;
+  QIO_String *strings[2];
   char myname[] = "QIO_read_record_info";
   
-  /* Read private record XML if not already done */
-
-  status = QIO_read_private_record_info(in, record_info);
+  /* The master node reads the private record XML, the user record
+     XML and the ILDG LFN if present and not already done */
+
+  status = QIO_read_private_record_info_master(in);
+  if(status == QIO_SUCCESS)
+    status = QIO_read_user_record_info(in, xml_record);
+  if(status == QIO_SUCCESS)
+    status = QIO_read_ILDG_LFN(in);
+
+  /* Broadcast the master's status, the private record data, the user
+     xml record and the ILDG LFN to all nodes in one message.
+     Receiving nodes resize their strings. */
+  memset(&header, 0, sizeof(header));
+  header.status = status;
+  memcpy(&header.record_info, &(in->record_info), sizeof(QIO_RecordInfo));
+  strings[0] = in->xml_record;
+  strings[1] = in->ildgLFN;
+  status = QIO_broadcast_packed(in->layout, &header, sizeof(header),
+				strings, 2);
   if(status != QIO_SUCCESS)return status;
+  if(header.status != QIO_SUCCESS)return header.status;
+  memcpy(&(in->record_info), &header.record_info, sizeof(QIO_RecordInfo));
 
-  /* Broadcast the private record data to all nodes */
-  DML_broadcast_bytes((char *)&(in->record_info), 
-		      sizeof(QIO_RecordInfo), this_node, 
-		      in->layout->master_io_node);
-  
   /* Return the record info to caller */
   memcpy(record_info, &(in->record_info), sizeof(QIO_RecordInfo));
 
@@ -289,70 +323,10 @@ int QIO_read_record_info(QIO_Reader *in, QIO_RecordInfo *record_info,
   QIO_reader_insert_hypercube_data(in, record_info);
 
   if(QIO_verbosity() >= QIO_VERB_DEBUG){
-    printf("%s(%d): Done broadcasting private record info\n",
-	   myname,this_node);
-  }
-
-  /* Read user record XML if not already done */
-
-  status = QIO_read_user_record_info(in, xml_record);
-  if(status != QIO_SUCCESS)return status;
-  
-  /* Broadcast the user xml record to all nodes */
-  /* First broadcast length */
-
-  length = QIO_string_length(in->xml_record);
-  DML_broadcast_bytes((char *)&length, sizeof(int), this_node, 
-		      in->layout->master_io_node);
-
-  /* Receiving nodes resize their strings */
-  /* if(this_node != in->layout->master_io_node){ */
-
-  /* QIO_string_realloc is supposedly non-destructive. Can do it on
-     all nodes */
-  QIO_string_realloc(in->xml_record,length);
-
-  DML_broadcast_bytes(QIO_string_ptr(in->xml_record),length,
-		      this_node, in->layout->master_io_node);
-
-  if(QIO_verbosity() >= QIO_VERB_DEBUG){
-    printf("%s(%d): Done broadcasting user record info \"%s\"\n",
+    printf("%s(%d): Done broadcasting record info \"%s\"\n",
 	   myname,this_node,QIO_string_ptr(in->xml_record));
   }
 
-  /* Read the ILDG LFN if present and not already done */
-
-  status = QIO_read_ILDG_LFN(in);
-  if(status != QIO_SUCCESS)
-    return status;
-
-  /* Broadcast the ILDG LFN to all nodes */
-  if(in->ildgLFN != NULL){
-    /* First broadcast length */
-
-    length = QIO_string_length(in->ildgLFN);
-    DML_broadcast_bytes((char *)&length, sizeof(int), this_node, 
-			in->layout->master_io_node);
-    if(length > 0){
-      /* Receiving nodes resize their strings */
-      /* QIO_string_realloc is supposedly non-destructive. Can do it on
-	 all nodes */
-      QIO_string_realloc(in->ildgLFN,length);
-
-      DML_broadcast_bytes(QIO_string_ptr(in->ildgLFN),length,
-			  this_node, in->layout->master_io_node);
-      
-      if(QIO_verbosity() >= QIO_VERB_DEBUG){
-	 printf("%s(%d): Done broadcasting ILDG LFN \"%s\"\n",
-		myname,this_node,QIO_string_ptr(in->ildgLFN));
-	 }
-    }
-  }
-
-  if(QIO_verbosity() >= QIO_VERB_DEBUG){
-    printf("%s(%d): Finished\n",myname,this_node);
-  }
-
   /* Copy user record info and ILDG LFN (for all nodes)*/
   if(xml_record != NULL)
     QIO_string_copy(xml_record,in->xml_record);
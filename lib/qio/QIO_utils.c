@@ -44,6 +44,83 @@ int QIO_verbosity(){
   return QIO_verbosity_level;
 }
 
+/* Set the memory limit for the cached site maps.  Returns the old
+   limit. */
+size_t QIO_set_site_map_bytes(size_t bytes){
+  return DML_set_site_map_bytes(bytes);
+}
+
+/* Release the kept sitelists.  No file may be open. */
+void QIO_free_site_maps(void){
+  DML_free_site_maps();
+}
+
+/* Set the number of I/O node output buffers.  Returns the old
+   value. */
+int QIO_set_write_behind_depth(int depth){
+  return DML_set_write_behind_depth(depth);
+}
+
+/* Set the number of I/O node input buffers.  Returns the old value. */
+int QIO_set_read_ahead_depth(int depth){
+  return DML_set_read_ahead_depth(depth);
+}
+
+/* Set the number of messages an I/O node receives ahead.  Returns
+   the old value. */
+int QIO_set_send_credits(int credits){
+  return DML_set_send_credits(credits);
+}
+
+/* Set the number of threads sharing the I/O of a node's own file.
+   Returns the old value. */
+int QIO_set_io_threads(int nthreads){
+  return DML_set_io_threads(nthreads);
+}
+
+/* Set the number of two-phase aggregators.  Returns the old value. */
+int QIO_set_aggregators(int naggr){
+  return DML_set_aggregators(naggr);
+}
+
+/* Set the stripe size for aligning the aggregators.  Returns the old
+   value. */
+size_t QIO_set_stripe_bytes(size_t bytes){
+  return DML_set_stripe_bytes(bytes);
+}
+
+/* Choose the backend of files opened with the flag.  Returns
+   QIO_BAD_ARG, leaving the default, for an unknown code. */
+int QIO_set_iflag_backend(QIO_Iflag *iflag, int backend){
+  if(backend != QIO_BACKEND_DEFAULT && LRL_get_backend(backend) == NULL){
+    iflag->backend = QIO_BACKEND_DEFAULT;
+    return QIO_BAD_ARG;
+  }
+  iflag->backend = backend;
+  return QIO_SUCCESS;
+}
+
+int QIO_set_oflag_backend(QIO_Oflag *oflag, int backend){
+  if(backend != QIO_BACKEND_DEFAULT && LRL_get_backend(backend) == NULL){
+    oflag->backend = QIO_BACKEND_DEFAULT;
+    return QIO_BAD_ARG;
+  }
+  oflag->backend = backend;
+  return QIO_SUCCESS;
+}
+
+/* Choose whether files are read through a memory map.  Returns the
+   old setting. */
+int QIO_set_read_mapped(int flag){
+  return LRL_set_read_mapped(flag);
+}
+
+/* Choose whether files are written with O_DIRECT.  Returns the old
+   setting. */
+int QIO_set_write_direct(int flag){
+  return LRL_set_write_direct(flag);
+}
+
 /*------------------------------------------------------------------*/
 
 /* In case of multifile format we use a common file name stem and add
@@ -192,12 +269,9 @@ int QIO_write_sitelist(QIO_Writer *out, int msg_begin, int msg_end,
   // check if we can fit each site index in 32 bits
   int use32 = 1;
   int64_t max32 = UINT32_MAX;
-  for(size_t i=0; i<sites->number_of_io_sites; i++) {
-    if(sites->list[i] > max32) {
-      use32 = 0;
-      break;
-    }
-  }
+  DML_SiteRank lo, hi;
+  DML_sitelist_bounds(sites, &lo, &hi);
+  if(sites->number_of_io_sites > 0 && hi > max32) use32 = 0;
 
   /* Make a copy in case we have to byte reverse */
   if(use32) {
@@ -220,12 +294,14 @@ int QIO_write_sitelist(QIO_Writer *out, int msg_begin, int msg_end,
   if(use32) {
     DML_SiteRank32 *ol32 = (DML_SiteRank32 *)outputlist;
     for(size_t i=0; i<sites->number_of_io_sites; i++) {
-      ol32[i] = sites->list[i];
+      ol32[i] = DML_sitelist_rank(sites, i);
     }
     if (! DML_big_endian())
       DML_byterevn(ol32, rec_size, sizeof(DML_SiteRank32));
   } else {
-    memcpy(outputlist, sites->list, rec_size);
+    for(size_t i=0; i<sites->number_of_io_sites; i++) {
+      outputlist[i] = DML_sitelist_rank(sites, i);
+    }
     /* Byte reordering for entire sitelist */
     if (! DML_big_endian())
       DML_byterevn(outputlist, rec_size, sizeof(DML_SiteRank));
@@ -482,10 +558,14 @@ int QIO_close_write_field(QIO_Writer *out, uint64_t *nbytes)
 }
 
 /*------------------------------------------------------------------*/
-/* Write the whole binary lattice field or global data at once */
-
-int QIO_write_field_data(QIO_Writer *out, LRL_RecordWriter *lrl_record_out,
-	    void (*get)(char *buf, size_t index, int count, void *arg),
+/* Write the whole binary lattice field or global data at once.  The
+   get callback fetches a run of sites that are consecutive in node
+   storage order in one call. */
+
+int QIO_write_field_data_block(QIO_Writer *out,
+	    LRL_RecordWriter *lrl_record_out,
+	    void (*get)(char *buf, size_t first, size_t nsites, int count,
+	          void *arg),
 	    int count, size_t datum_size, int word_size, void *arg, 
 	    DML_Checksum *checksum, uint64_t *nbytes)
 {
@@ -508,6 +588,34 @@ int QIO_write_field_data(QIO_Writer *out, LRL_RecordWriter *lrl_record_out,
 			     arg, out->layout, out->volfmt, checksum);
   }
 
+#ifdef QIO_USE_MPI_IO
+  /* Singlefile parallel field data with collective MPI-IO */
+  else if(out->volfmt == QIO_SINGLEFILE && out->serpar == QIO_PARALLEL) {
+    *nbytes = DML_collective_out(lrl_record_out, get, count, datum_size,
+				 word_size, arg, out->layout, out->sites,
+				 out->volfmt, out->serpar, checksum);
+    DML_sync();
+  }
+#endif
+
+  /* Singlefile parallel field data through two-phase aggregators */
+  else if(out->volfmt == QIO_SINGLEFILE && out->serpar == QIO_PARALLEL &&
+	  out->layout->number_aggregators > 0) {
+    *nbytes = DML_aggregate_out(lrl_record_out, get, count, datum_size,
+				word_size, arg, out->layout, out->sites,
+				out->volfmt, out->serpar, checksum);
+    DML_sync();
+  }
+
+  /* Lattice field data held contiguously in storage order */
+  else if(get == DML_get_contiguous) {
+    *nbytes = DML_contiguous_out(lrl_record_out, count, word_size,
+				 (DML_Contiguous *)arg, out->layout,
+				 out->sites, out->volfmt, out->serpar,
+				 checksum);
+    if(out->serpar==QIO_PARALLEL) DML_sync();
+  }
+
   /* Lattice field data type */
   else {
     *nbytes = DML_partition_out(lrl_record_out, get, count, datum_size, 
@@ -524,12 +632,27 @@ int QIO_write_field_data(QIO_Writer *out, LRL_RecordWriter *lrl_record_out,
   return QIO_SUCCESS;
 }
 
+/* Same with a per-site get callback */
+int QIO_write_field_data(QIO_Writer *out, LRL_RecordWriter *lrl_record_out,
+	    void (*get)(char *buf, size_t index, int count, void *arg),
+	    int count, size_t datum_size, int word_size, void *arg, 
+	    DML_Checksum *checksum, uint64_t *nbytes)
+{
+  DML_SiteCallback cb = { get, NULL, datum_size, arg };
+
+  return QIO_write_field_data_block(out, lrl_record_out, DML_get_sites,
+				    count, datum_size, word_size,
+				    (void *)&cb, checksum, nbytes);
+}
+
 
 /*------------------------------------------------------------------*/
-/* Write the whole binary lattice field or global data at once */
+/* Write the whole binary lattice field or global data at once.  The
+   get callback fetches a run of sites in one call. */
 
-int QIO_write_field(QIO_Writer *out, int msg_begin, int msg_end,
-	    void (*get)(char *buf, size_t index, int count, void *arg),
+int QIO_write_field_block(QIO_Writer *out, int msg_begin, int msg_end,
+	    void (*get)(char *buf, size_t first, size_t nsites, int count,
+	          void *arg),
 	    int count, size_t datum_size, int word_size, void *arg, 
 	    DML_Checksum *checksum, uint64_t *nbytes,
 	    const LIME_type lime_type){
@@ -552,7 +675,7 @@ int QIO_write_field(QIO_Writer *out, int msg_begin, int msg_end,
 
   /* Write data and close LRL record writer */
   if(do_output)
-    status = QIO_write_field_data(out, lrl_record_out, 
+    status = QIO_write_field_data_block(out, lrl_record_out, 
 			 get, count, datum_size, word_size, arg,
 			 checksum, nbytes);
 
@@ -563,6 +686,20 @@ int QIO_write_field(QIO_Writer *out, int msg_begin, int msg_end,
   return status;
 }
 
+/* Same with a per-site get callback */
+int QIO_write_field(QIO_Writer *out, int msg_begin, int msg_end,
+	    void (*get)(char *buf, size_t index, int count, void *arg),
+	    int count, size_t datum_size, int word_size, void *arg, 
+	    DML_Checksum *checksum, uint64_t *nbytes,
+	    const LIME_type lime_type){
+
+  DML_SiteCallback cb = { get, NULL, datum_size, arg };
+
+  return QIO_write_field_block(out, msg_begin, msg_end, DML_get_sites,
+			       count, datum_size, word_size, (void *)&cb,
+			       checksum, nbytes, lime_type);
+}
+
 
 /*------------------------------------------------------------------*/
 /* Open a record and get the LIME type and expected record size */
@@ -688,6 +825,113 @@ int QIO_close_read_record(LRL_RecordReader *lrl_record_in){
   else return QIO_ERR_SKIP;
 }
 
+/*------------------------------------------------------------------*/
+/* The master I/O node broadcasts a header of fixed size followed by
+   some strings, all in one message when the strings fit in
+   QIO_BCAST_INLINE_BYTES.  Otherwise the strings follow in a second
+   message.  The other nodes get the header and their strings are
+   resized to match.  NULL strings are skipped.  The first message
+   goes through a fixed buffer and carries the master's failure flag,
+   so the common case costs a single broadcast.  Only the long path
+   allocates on every node and agrees on the outcome with a sum. */
+
+#define QIO_BCAST_INLINE_BYTES 4096
+/* The largest header is the status and record info broadcast by
+   QIO_read_record_info */
+#define QIO_BCAST_HEADER_BYTES (sizeof(QIO_RecordInfo) + 64)
+#define QIO_BCAST_MAX_STRINGS 8
+
+static char qio_bcast_msg[sizeof(int) + QIO_BCAST_HEADER_BYTES +
+			  QIO_BCAST_MAX_STRINGS*sizeof(size_t) +
+			  QIO_BCAST_INLINE_BYTES];
+
+int QIO_broadcast_packed(DML_Layout *layout, void *header, size_t hsize,
+			 QIO_String *str[], int nstr)
+{
+  int this_node = layout->this_node;
+  int master = layout->master_io_node;
+  size_t lsize = nstr*sizeof(size_t);
+  size_t msgsize = sizeof(int) + hsize + lsize + QIO_BCAST_INLINE_BYTES;
+  size_t length[QIO_BCAST_MAX_STRINGS], total = 0, off;
+  char *msg = qio_bcast_msg;
+  char *inline_data = msg + sizeof(int) + hsize + lsize;
+  char *payload = NULL;
+  int i, fail = 0;
+  char myname[] = "QIO_broadcast_packed";
+
+  /* The sizes are the same on all nodes, so they all fail here */
+  if(hsize > QIO_BCAST_HEADER_BYTES || nstr > QIO_BCAST_MAX_STRINGS){
+    printf("%s(%d): Header of %lu bytes and %d strings is too large\n",
+	   myname,this_node,(unsigned long)hsize,nstr);
+    return QIO_ERR_ALLOC;
+  }
+
+  if(this_node == master){
+    for(i = 0; i < nstr; i++){
+      length[i] = str[i] ? QIO_string_length(str[i]) : 0;
+      total += length[i];
+    }
+    if(total <= QIO_BCAST_INLINE_BYTES)
+      payload = inline_data;
+    else {
+      payload = (char *)malloc(total);
+      if(!payload){
+	printf("%s(%d): Can't malloc %lu bytes\n",myname,this_node,
+	       (unsigned long)total);
+	fail = 1;
+      }
+    }
+    if(!fail)
+      for(i = 0, off = 0; i < nstr; off += length[i++])
+	if(length[i] > 0)
+	  memcpy(payload + off, QIO_string_ptr(str[i]), length[i]);
+    memcpy(msg, &fail, sizeof(int));
+    memcpy(msg + sizeof(int), header, hsize);
+    memcpy(msg + sizeof(int) + hsize, length, lsize);
+  }
+
+  DML_broadcast_bytes(msg, msgsize, this_node, master);
+
+  memcpy(&fail, msg, sizeof(int));
+  if(fail)return QIO_ERR_ALLOC;
+
+  if(this_node != master){
+    memcpy(header, msg + sizeof(int), hsize);
+    memcpy(length, msg + sizeof(int) + hsize, lsize);
+    for(i = 0; i < nstr; i++){
+      total += length[i];
+      if(str[i])QIO_string_realloc(str[i], length[i]);
+    }
+  }
+
+  if(total > QIO_BCAST_INLINE_BYTES){
+    /* Too long for the first message */
+    if(this_node != master){
+      payload = (char *)malloc(total);
+      fail = !payload;
+      if(fail)
+	printf("%s(%d): Can't malloc %lu bytes\n",myname,this_node,
+	       (unsigned long)total);
+    }
+    DML_sum_int(&fail);
+    if(fail){
+      free(payload);
+      return QIO_ERR_ALLOC;
+    }
+    DML_broadcast_bytes(payload, total, this_node, master);
+  }
+  else
+    payload = inline_data;
+
+  if(this_node != master)
+    for(i = 0, off = 0; i < nstr; off += length[i++])
+      if(str[i] && length[i] > 0)
+	memcpy(QIO_string_ptr(str[i]), payload + off, length[i]);
+
+  if(payload != inline_data)free(payload);
+  return QIO_SUCCESS;
+}
+
 /*------------------------------------------------------------------*/
 /* Read site list */
 
@@ -979,10 +1223,13 @@ int QIO_close_read_field(QIO_Reader *in, uint64_t *nbytes)
 
 /*------------------------------------------------------------------*/
 /* Read binary data for a previously opened lattice field.  
-   Close record when done. */
+   Close record when done.  The put callback stores a run of sites
+   that are consecutive in node storage order in one call. */
 
-int QIO_read_field_data(QIO_Reader *in, LRL_RecordReader *lrl_record_in,
-	   void (*put)(char *buf, size_t index, int count, void *arg),
+int QIO_read_field_data_block(QIO_Reader *in,
+	   LRL_RecordReader *lrl_record_in,
+	   void (*put)(char *buf, size_t first, size_t nsites, int count,
+	         void *arg),
 	   int count, size_t datum_size, int word_size, void *arg, 
  	   DML_Checksum *checksum, uint64_t* nbytes){
 
@@ -1008,6 +1255,29 @@ int QIO_read_field_data(QIO_Reader *in, LRL_RecordReader *lrl_record_in,
     }
   }
 
+#ifdef QIO_USE_MPI_IO
+  /* Singlefile parallel field data with collective MPI-IO */
+  else if(in->volfmt == QIO_SINGLEFILE && in->serpar == QIO_PARALLEL){
+    *nbytes = DML_collective_in(lrl_record_in,
+		       put, count, datum_size, word_size, arg, in->layout,
+		       in->sites, in->volfmt, in->serpar, checksum);
+    if(QIO_verbosity() >= QIO_VERB_DEBUG){
+      printf("%s(%d): done with DML_collective_in\n", myname,this_node);
+    }
+  }
+#endif
+
+  /* Singlefile parallel field data through two-phase aggregators */
+  else if(in->volfmt == QIO_SINGLEFILE && in->serpar == QIO_PARALLEL &&
+	  in->layout->number_aggregators > 0){
+    *nbytes = DML_aggregate_in(lrl_record_in,
+		       put, count, datum_size, word_size, arg, in->layout,
+		       in->sites, in->volfmt, in->serpar, checksum);
+    if(QIO_verbosity() >= QIO_VERB_DEBUG){
+      printf("%s(%d): done with DML_aggregate_in\n", myname,this_node);
+    }
+  }
+
   /* Field data */
   else{
     /* Partition I/O only.  Nodes are assigned to disjoint I/O partitions */
@@ -1034,11 +1304,26 @@ int QIO_read_field_data(QIO_Reader *in, LRL_RecordReader *lrl_record_in,
   return QIO_SUCCESS;
 }
 
+/* Same with a per-site put callback */
+int QIO_read_field_data(QIO_Reader *in, LRL_RecordReader *lrl_record_in,
+	   void (*put)(char *buf, size_t index, int count, void *arg),
+	   int count, size_t datum_size, int word_size, void *arg, 
+ 	   DML_Checksum *checksum, uint64_t* nbytes){
+
+  DML_SiteCallback cb = { NULL, put, datum_size, arg };
+
+  return QIO_read_field_data_block(in, lrl_record_in, DML_put_sites,
+				   count, datum_size, word_size,
+				   (void *)&cb, checksum, nbytes);
+}
+
 /*------------------------------------------------------------------*/
-/* Read binary data for a lattice field */
+/* Read binary data for a lattice field.  The put callback stores a
+   run of sites in one call. */
 
-int QIO_read_field(QIO_Reader *in, 
-	   void (*put)(char *buf, size_t index, int count, void *arg),
+int QIO_read_field_block(QIO_Reader *in, 
+	   void (*put)(char *buf, size_t first, size_t nsites, int count,
+	         void *arg),
 	   int count, size_t datum_size, int word_size, void *arg, 
 	   DML_Checksum *checksum, uint64_t* nbytes,
 	   LIME_type *lime_type){
@@ -1049,12 +1334,26 @@ int QIO_read_field(QIO_Reader *in,
   lrl_record_in = QIO_open_read_field(in, datum_size, NULL, 0, 
 				      lime_type, &status);
 
-  status = QIO_read_field_data(in, lrl_record_in, 
+  status = QIO_read_field_data_block(in, lrl_record_in, 
 			       put, count, datum_size, word_size, arg,
 			       checksum, nbytes);
   return status;
 }
 
+/* Same with a per-site put callback */
+int QIO_read_field(QIO_Reader *in, 
+	   void (*put)(char *buf, size_t index, int count, void *arg),
+	   int count, size_t datum_size, int word_size, void *arg, 
+	   DML_Checksum *checksum, uint64_t* nbytes,
+	   LIME_type *lime_type){
+
+  DML_SiteCallback cb = { NULL, put, datum_size, arg };
+
+  return QIO_read_field_block(in, DML_put_sites, count, datum_size,
+			      word_size, (void *)&cb, checksum, nbytes,
+			      lime_type);
+}
+
 int
 QIO_node_number_ext(const int coords[], void *arg)
 {
@@ -1132,6 +1431,15 @@ QIO_check_layout_ext(QIO_Layout *layout)
   return layout;
 }
 
+/* The layout the application gave, before QIO_check_layout_ext */
+QIO_Layout *
+QIO_user_layout(QIO_Layout *layout)
+{
+  if(layout->node_number_ext == QIO_node_number_ext)
+    return (QIO_Layout *)layout->arg;
+  return layout;
+}
+
 void
 QIO_free_layout_ext(DML_Layout *layout)
 {
@@ -193,8 +193,10 @@ int QIO_write_record_info(QIO_Writer *out, QIO_RecordInfo *record_info,
 /* Write the binary payload for a lattice field, but not the checksum */
 
 /* Handles the write operation on the compute nodes as well as the host */
-int QIO_write_record_data(QIO_Writer *out, QIO_RecordInfo *record_info, 
-	      void (*get)(char *buf, size_t index, int count, void *arg),
+int QIO_write_record_data_block(QIO_Writer *out,
+	      QIO_RecordInfo *record_info, 
+	      void (*get_block)(char *buf, size_t first, size_t nsites,
+				int count, void *arg),
 	      size_t datum_size, int word_size, void *arg,
 	      DML_Checksum *checksum, uint64_t *nbytes,
 	      int *msg_begin, int *msg_end){
@@ -220,8 +222,8 @@ int QIO_write_record_data(QIO_Writer *out, QIO_RecordInfo *record_info,
   else lime_type = scidac_type;
 
   status = 
-    QIO_write_field(out, *msg_begin, *msg_end, 
-		    get, count, datum_size, word_size, arg, 
+    QIO_write_field_block(out, *msg_begin, *msg_end, 
+		    get_block, count, datum_size, word_size, arg, 
 		    checksum, nbytes, lime_type);
   if(status != QIO_SUCCESS){
     printf("%s(%d): Error writing field data\n",myname,this_node);
@@ -237,6 +239,20 @@ int QIO_write_record_data(QIO_Writer *out, QIO_RecordInfo *record_info,
   return QIO_SUCCESS;
 }
 
+/* Same with a per-site get callback */
+int QIO_write_record_data(QIO_Writer *out, QIO_RecordInfo *record_info, 
+	      void (*get)(char *buf, size_t index, int count, void *arg),
+	      size_t datum_size, int word_size, void *arg,
+	      DML_Checksum *checksum, uint64_t *nbytes,
+	      int *msg_begin, int *msg_end){
+
+  DML_SiteCallback cb = { get, NULL, datum_size, arg };
+
+  return QIO_write_record_data_block(out, record_info, DML_get_sites,
+				     datum_size, word_size, (void *)&cb,
+				     checksum, nbytes, msg_begin, msg_end);
+}
+
 
 
 /* Write records for a lattice field.  Writes metadata, binary payload,
@@ -244,9 +260,10 @@ int QIO_write_record_data(QIO_Writer *out, QIO_RecordInfo *record_info,
 
 /* Handles the write operation on the compute nodes or the host in
    case of file conversion */
-int QIO_generic_write(QIO_Writer *out, QIO_RecordInfo *record_info, 
+int QIO_generic_write_block(QIO_Writer *out, QIO_RecordInfo *record_info, 
 	      QIO_String *xml_record, 
-	      void (*get)(char *buf, size_t index, int count, void *arg),
+	      void (*get_block)(char *buf, size_t first, size_t nsites,
+				int count, void *arg),
 	      size_t datum_size, int word_size, void *arg,
 	      DML_Checksum *checksum, uint64_t *nbytes,
 	      int *msg_begin, int *msg_end){
@@ -258,12 +275,28 @@ int QIO_generic_write(QIO_Writer *out, QIO_RecordInfo *record_info,
   if(status != QIO_SUCCESS)
     return status;
 
-  status = QIO_write_record_data(out, record_info, get, datum_size, 
-				     word_size, arg, checksum, nbytes, 
-				     msg_begin, msg_end);
+  status = QIO_write_record_data_block(out, record_info, get_block,
+				       datum_size, word_size, arg, checksum,
+				       nbytes, msg_begin, msg_end);
   return status;
 }
 
+/* Same with a per-site get callback */
+int QIO_generic_write(QIO_Writer *out, QIO_RecordInfo *record_info, 
+	      QIO_String *xml_record, 
+	      void (*get)(char *buf, size_t index, int count, void *arg),
+	      size_t datum_size, int word_size, void *arg,
+	      DML_Checksum *checksum, uint64_t *nbytes,
+	      int *msg_begin, int *msg_end){
+
+  DML_SiteCallback cb = { get, NULL, datum_size, arg };
+
+  return QIO_generic_write_block(out, record_info, xml_record,
+				 DML_get_sites, datum_size, word_size,
+				 (void *)&cb, checksum, nbytes,
+				 msg_begin, msg_end);
+}
+
 /* Write the checksum record */
 
 int QIO_write_checksum(QIO_Writer *out, DML_Checksum *checksum)
@@ -298,11 +331,13 @@ int QIO_write_checksum(QIO_Writer *out, DML_Checksum *checksum)
 }
 
 /* Write a lattice field on the compute nodes. Includes checksum
-   record */
+   record.  The get_block callback fetches a run of sites that are
+   consecutive in node storage order in one call. */
 
-int QIO_write(QIO_Writer *out, QIO_RecordInfo *record_info, 
+int QIO_write_block(QIO_Writer *out, QIO_RecordInfo *record_info, 
 	      QIO_String *xml_record, 
-	      void (*get)(char *buf, size_t index, int count, void *arg),
+	      void (*get_block)(char *buf, size_t first, size_t nsites,
+				int count, void *arg),
 	      size_t datum_size, int word_size, void *arg){
 
   DML_Checksum checksum;
@@ -315,9 +350,9 @@ int QIO_write(QIO_Writer *out, QIO_RecordInfo *record_info,
   size_t volume;
   char myname[] = "QIO_write";
 
-  status = QIO_generic_write(out, record_info, xml_record, get, datum_size, 
-			     word_size, arg, &checksum, &nbytes, 
-			     &msg_begin, &msg_end);
+  status = QIO_generic_write_block(out, record_info, xml_record, get_block,
+				   datum_size, word_size, arg, &checksum,
+				   &nbytes, &msg_begin, &msg_end);
   
  if(status != QIO_SUCCESS)return status;
 
@@ -376,3 +411,32 @@ int QIO_write(QIO_Writer *out, QIO_RecordInfo *record_info,
 
   return status;
 }
+
+/* Write a lattice field on the compute nodes with a per-site get
+   callback. Includes checksum record */
+
+int QIO_write(QIO_Writer *out, QIO_RecordInfo *record_info, 
+	      QIO_String *xml_record, 
+	      void (*get)(char *buf, size_t index, int count, void *arg),
+	      size_t datum_size, int word_size, void *arg){
+
+  DML_SiteCallback cb = { get, NULL, datum_size, arg };
+
+  return QIO_write_block(out, record_info, xml_record, DML_get_sites,
+			 datum_size, word_size, (void *)&cb);
+}
+
+/* Write a lattice field held in one array in node storage order,
+   datum_size bytes per site, or global data from one array.
+   Includes checksum record.  When each node writes its own sites the
+   data go to the file without staging copies. */
+
+int QIO_write_contiguous(QIO_Writer *out, QIO_RecordInfo *record_info, 
+	      QIO_String *xml_record, const void *base,
+	      size_t datum_size, int word_size){
+
+  DML_Contiguous field = { (const char *)base, datum_size };
+
+  return QIO_write_block(out, record_info, xml_record, DML_get_contiguous,
+			 datum_size, word_size, (void *)&field);
+}